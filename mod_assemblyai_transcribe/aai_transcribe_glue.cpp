@@ -17,6 +17,7 @@
 #include "simple_buffer.h"
 #include "parser.hpp"
 #include "audio_pipe.hpp"
+#include "teardown_executor.hpp"
 
 #define RTP_PACKETIZATION_PERIOD 20
 #define FRAME_SIZE_8000  320 /*which means each 20ms frame as 320 bytes at 8 khz (1 channel only)*/
@@ -27,6 +28,10 @@ namespace {
   static const char *requestedBufferSecs = std::getenv("MOD_AUDIO_FORK_BUFFER_SECS");
   static int nAudioBufferSecs = std::max(1, std::min(requestedBufferSecs ? ::atoi(requestedBufferSecs) : 2, 5));
   static const char *requestedNumServiceThreads = std::getenv("MOD_AUDIO_FORK_SERVICE_THREADS");
+  static const char *requestedTeardownMaxPending = std::getenv("MOD_TRANSCRIBE_TEARDOWN_MAX_PENDING");
+  static unsigned int nTeardownMaxPending = std::max(1, requestedTeardownMaxPending ? ::atoi(requestedTeardownMaxPending) : 1000);
+  static const char *requestedTeardownTimeoutMs = std::getenv("MOD_TRANSCRIBE_TEARDOWN_TIMEOUT_MS");
+  static unsigned int nTeardownTimeoutMs = std::max(100, requestedTeardownTimeoutMs ? ::atoi(requestedTeardownTimeoutMs) : 5000);
   static unsigned int idxCallCount = 0;
   static uint32_t playCount = 0;
 
@@ -35,12 +40,12 @@ namespace {
     pAp.reset((assemblyai::AudioPipe *)tech_pvt->pAudioPipe);
     tech_pvt->pAudioPipe = nullptr;
 
-    std::thread t([pAp, tech_pvt]{
-      pAp->finish();
-      pAp->waitForClose();
-      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "%s (%u) got remote close\n", tech_pvt->sessionId, tech_pvt->id);
-    });
-    t.detach();
+    // ask for final results; the teardown executor frees the pipe once the far end has closed the socket
+    pAp->finish();
+    std::string tag = std::string(tech_pvt->sessionId) + " (" + std::to_string(tech_pvt->id) + ")";
+    assemblyai::TeardownExecutor::submit(tag, pAp,
+      [pAp] { return pAp->isClosed(); },
+      [pAp] { pAp->close(); });
   }
 
   static void destroy_tech_pvt(private_t *tech_pvt) {
@@ -257,6 +262,7 @@ extern "C" {
     //| LLL_INFO | LLL_PARSER | LLL_HEADER | LLL_EXT | LLL_CLIENT  | LLL_LATENCY | LLL_DEBUG ;
     
     assemblyai::AudioPipe::initialize(logs, lws_logger);
+    assemblyai::TeardownExecutor::initialize(nTeardownMaxPending, nTeardownTimeoutMs);
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "AudioPipe::initialize completed\n");
 
 		const char* apiKey = std::getenv("DEEPGRAM_API_KEY");
@@ -274,11 +280,31 @@ extern "C" {
   switch_status_t aai_transcribe_cleanup() {
     bool cleanup = false;
     cleanup = assemblyai::AudioPipe::deinitialize();
+    assemblyai::TeardownExecutor::deinitialize();
     if (cleanup == true) {
         return SWITCH_STATUS_SUCCESS;
     }
     return SWITCH_STATUS_FALSE;
   }
+
+  // reports the counters of the connections being drained after a stop, as json
+  char* aai_transcribe_stats() {
+    assemblyai::TeardownExecutor::Stats teardowns;
+    assemblyai::TeardownExecutor::getStats(teardowns);
+
+    cJSON* jStats = cJSON_CreateObject();
+    cJSON* jTeardowns = cJSON_CreateObject();
+    cJSON_AddNumberToObject(jTeardowns, "pending", teardowns.pending);
+    cJSON_AddNumberToObject(jTeardowns, "submitted", (double) teardowns.submitted);
+    cJSON_AddNumberToObject(jTeardowns, "completed", (double) teardowns.completed);
+    cJSON_AddNumberToObject(jTeardowns, "timedOut", (double) teardowns.timedOut);
+    cJSON_AddNumberToObject(jTeardowns, "overflowed", (double) teardowns.overflowed);
+    cJSON_AddNumberToObject(jTeardowns, "abandoned", (double) teardowns.abandoned);
+    cJSON_AddItemToObject(jStats, "teardowns", jTeardowns);
+    char* json = cJSON_PrintUnformatted(jStats);
+    cJSON_Delete(jStats);
+    return json;
+  }
 	
   switch_status_t aai_transcribe_session_init(switch_core_session_t *session, 
     responseHandler_t responseHandler, uint32_t samples_per_second, uint32_t channels, 
@@ -340,6 +366,29 @@ extern "C" {
     return SWITCH_STATUS_SUCCESS;
   }
 	
+  switch_status_t aai_transcribe_session_finalize(switch_core_session_t *session, char* bugname) {
+    switch_channel_t *channel = switch_core_session_get_channel(session);
+    switch_media_bug_t *bug = (switch_media_bug_t*) switch_channel_get_private(channel, bugname);
+    if (!bug) {
+      switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "aai_transcribe_session_finalize: no bug %s\n", bugname);
+      return SWITCH_STATUS_FALSE;
+    }
+    private_t* tech_pvt = (private_t*) switch_core_media_bug_get_user_data(bug);
+    if (!tech_pvt) return SWITCH_STATUS_FALSE;
+
+    // get final results for the current utterance but keep streaming on the same connection
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    switch_mutex_lock(tech_pvt->mutex);
+    assemblyai::AudioPipe *pAudioPipe = static_cast<assemblyai::AudioPipe *>(tech_pvt->pAudioPipe);
+    if (pAudioPipe) {
+      switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%u) aai_transcribe_session_finalize\n", tech_pvt->id);
+      pAudioPipe->flush();
+      status = SWITCH_STATUS_SUCCESS;
+    }
+    switch_mutex_unlock(tech_pvt->mutex);
+    return status;
+  }
+
 	switch_bool_t aai_transcribe_frame(switch_core_session_t *session, switch_media_bug_t *bug) {
     private_t* tech_pvt = (private_t*) switch_core_media_bug_get_user_data(bug);
     size_t inuse = 0;
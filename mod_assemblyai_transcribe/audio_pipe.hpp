@@ -76,7 +76,9 @@ public:
 
   void close() ;
   void finish();
+  void flush();
   void waitForClose();
+  bool isClosed();
   void setClosed() { m_promise.set_value(); }
   bool isFinished() { return m_finished;}
 
@@ -138,6 +140,7 @@ private:
   bool m_finished;
   std::string m_bugname;
   std::promise<void> m_promise;
+  std::shared_future<void> m_closed;
 };
 
 } // namespace assemblyai
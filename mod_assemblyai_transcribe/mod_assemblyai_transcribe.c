@@ -116,7 +116,7 @@ static switch_status_t do_stop(switch_core_session_t *session,  char* bugname)
 	return status;
 }
 
-#define TRANSCRIBE_API_SYNTAX "<uuid> [start|stop] lang-code [interim] [stereo|mono]"
+#define TRANSCRIBE_API_SYNTAX "<uuid> [start|stop|finalize] lang-code [interim] [stereo|mono]"
 SWITCH_STANDARD_API(aai_transcribe_function)
 {
 	char *mycmd = NULL, *argv[6] = { 0 };
@@ -143,6 +143,10 @@ SWITCH_STANDARD_API(aai_transcribe_function)
 				char *bugname = argc > 2 ? argv[2] : MY_BUG_NAME;
     		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "stop transcribing\n");
 				status = do_stop(lsession, bugname);
+			} else if (!strcasecmp(argv[1], "finalize")) {
+				char *bugname = argc > 2 ? argv[2] : MY_BUG_NAME;
+    		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "finalize transcription %s\n", bugname);
+				status = aai_transcribe_session_finalize(lsession, bugname);
 			} else if (!strcasecmp(argv[1], "start")) {
         char* lang = argv[2];
         int interim = argc > 3 && !strcmp(argv[3], "interim");
@@ -171,6 +175,19 @@ SWITCH_STANDARD_API(aai_transcribe_function)
 }
 
 
+SWITCH_STANDARD_API(stats_function)
+{
+	char *json = aai_transcribe_stats();
+	if (json) {
+		stream->write_function(stream, "%s\n", json);
+		free(json);
+	}
+	else {
+		stream->write_function(stream, "-ERR Operation Failed\n");
+	}
+	return SWITCH_STATUS_SUCCESS;
+}
+
 SWITCH_MODULE_LOAD_FUNCTION(mod_assemblyai_transcribe_load)
 {
 	switch_api_interface_t *api_interface;
@@ -195,6 +212,9 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_assemblyai_transcribe_load)
 	SWITCH_ADD_API(api_interface, "uuid_assemblyai_transcribe", "Deepgram Speech Transcription API", aai_transcribe_function, TRANSCRIBE_API_SYNTAX);
 	switch_console_set_complete("add uuid_assemblyai_transcribe start lang-code [interim|final] [stereo|mono]");
 	switch_console_set_complete("add uuid_assemblyai_transcribe stop ");
+	switch_console_set_complete("add uuid_assemblyai_transcribe finalize ");
+
+	SWITCH_ADD_API(api_interface, "assemblyai_transcribe_stats", "Show AssemblyAI transcribe teardown counters", stats_function, "");
 
 	/* indicate that the module should continue to be loaded */
 	return SWITCH_STATUS_SUCCESS;
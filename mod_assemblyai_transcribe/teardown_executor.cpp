@@ -0,0 +1,161 @@
+#include "teardown_executor.hpp"
+
+#include <switch.h>
+#include <vector>
+#include <algorithm>
+#include <cinttypes>
+
+using namespace assemblyai;
+
+std::thread TeardownExecutor::workerThread;
+std::mutex TeardownExecutor::mutex;
+std::condition_variable TeardownExecutor::cv;
+std::list<TeardownExecutor::Job> TeardownExecutor::jobs;
+std::list<std::shared_ptr<void> > TeardownExecutor::abandoned;
+TeardownExecutor::Stats TeardownExecutor::stats;
+unsigned int TeardownExecutor::maxPending;
+unsigned int TeardownExecutor::timeoutMs;
+bool TeardownExecutor::stopFlag;
+bool TeardownExecutor::notified;
+
+void TeardownExecutor::initialize(unsigned int maxPendingTeardowns, unsigned int closeTimeoutMs) {
+  std::lock_guard<std::mutex> lk(mutex);
+  maxPending = maxPendingTeardowns;
+  timeoutMs = closeTimeoutMs;
+  stopFlag = false;
+  notified = false;
+  stats = Stats();
+  workerThread = std::thread(&TeardownExecutor::worker);
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "TeardownExecutor::initialize max pending %u, close timeout %u ms\n",
+    maxPending, timeoutMs);
+}
+
+void TeardownExecutor::deinitialize() {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    stopFlag = true;
+  }
+  cv.notify_all();
+  if (workerThread.joinable()) workerThread.join();
+
+  std::list<Job> remaining;
+  std::list<std::shared_ptr<void> > parked;
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE,
+      "TeardownExecutor::deinitialize pending %u, submitted %" PRIu64 ", completed %" PRIu64 ", timed out %" PRIu64 ", overflowed %" PRIu64 ", abandoned %" PRIu64 "\n",
+      (unsigned int) jobs.size(), stats.submitted, stats.completed, stats.timedOut, stats.overflowed, stats.abandoned);
+    remaining.swap(jobs);
+    parked.swap(abandoned);
+    stats.pending = 0;
+  }
+}
+
+void TeardownExecutor::submit(const std::string& tag, std::shared_ptr<void> holder,
+  std::function<bool()> isClosed, std::function<void()> forceClose) {
+  std::lock_guard<std::mutex> lk(mutex);
+  Job job;
+  job.tag = tag;
+  job.holder = holder;
+  job.isClosed = isClosed;
+  job.forceClose = forceClose;
+  job.deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+  job.forced = false;
+  job.overflowed = false;
+
+  stats.submitted++;
+  if (jobs.size() >= maxPending) {
+    // too many connections already draining: give up on final results for this one and close it right away
+    job.deadline = Clock::now();
+    job.overflowed = true;
+    stats.overflowed++;
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "TeardownExecutor::submit %s: %u teardowns pending, closing immediately\n",
+      tag.c_str(), (unsigned int) jobs.size());
+  }
+  jobs.push_back(job);
+  stats.pending = jobs.size();
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "TeardownExecutor::submit %s, %u teardowns pending\n",
+    tag.c_str(), stats.pending);
+  notified = true;
+  cv.notify_one();
+}
+
+void TeardownExecutor::notify() {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    notified = true;
+  }
+  cv.notify_one();
+}
+
+void TeardownExecutor::getStats(Stats& out) {
+  std::lock_guard<std::mutex> lk(mutex);
+  out = stats;
+}
+
+void TeardownExecutor::worker() {
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "TeardownExecutor::worker starting\n");
+  std::unique_lock<std::mutex> lk(mutex);
+  while (!stopFlag) {
+    if (jobs.empty()) {
+      cv.wait(lk, [] { return stopFlag || notified; });
+      notified = false;
+      continue;
+    }
+
+    // cleared before checking, so that a connection closing after its check wakes the wait below
+    notified = false;
+    auto now = Clock::now();
+    std::list<Job> done;
+    std::vector<std::function<void()> > toClose;
+
+    for (auto it = jobs.begin(); it != jobs.end();) {
+      Job& job = *it;
+      if (job.isClosed()) {
+        stats.completed++;
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "%s got remote close\n", job.tag.c_str());
+        done.splice(done.end(), jobs, it++);
+        continue;
+      }
+      if (job.deadline <= now) {
+        if (!job.forced) {
+          job.forced = true;
+          job.deadline = now + std::chrono::milliseconds(timeoutMs);
+          if (!job.overflowed) {
+            stats.timedOut++;
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "%s no close after %u ms, forcing close\n",
+              job.tag.c_str(), timeoutMs);
+          }
+          if (job.forceClose) toClose.push_back(job.forceClose);
+        }
+        else {
+          // never safe to free while the transport may still refer to it: keep it until the module unloads
+          stats.abandoned++;
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "%s did not close after forced close, abandoning\n",
+            job.tag.c_str());
+          abandoned.push_back(job.holder);
+          it = jobs.erase(it);
+          continue;
+        }
+      }
+      ++it;
+    }
+    stats.pending = jobs.size();
+
+    if (!done.empty() || !toClose.empty()) {
+      // closing and releasing connections can block (and can take locks of their own), so do it unlocked
+      lk.unlock();
+      for (auto& forceClose : toClose) forceClose();
+      done.clear();
+      lk.lock();
+      if (stopFlag) break;
+    }
+    if (jobs.empty()) continue;
+
+    // nothing changes until a connection closes, a teardown is submitted, or a deadline passes
+    Clock::time_point next = jobs.front().deadline;
+    for (auto& job : jobs) next = std::min(next, job.deadline);
+    cv.wait_until(lk, next, [] { return stopFlag || notified; });
+  }
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "TeardownExecutor::worker ending\n");
+}
@@ -0,0 +1,447 @@
+/*
+ * Standalone load generator for the AudioPipe websocket transport.
+ *
+ * Opens N AudioPipe connections to a bundled local sink and pushes a 20 ms L16 frame
+ * on each of them every 20 ms, the way the media bug does in FreeSWITCH.  Sessions are
+ * spread evenly across the 20 ms period.  At the end it reports client cpu per stream,
+ * send latency percentiles (frame written into the pipe until it is received by the sink),
+ * context switches per second, memory per pipe and dropped frames.
+ *
+ * usage: audio_pipe_bench [options]; see usage() below
+ */
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "../audio_pipe.hpp"
+#include "ws_sink.hpp"
+
+#define RTP_PACKETIZATION_PERIOD 20
+#define SLOT_MS 1
+#define NUM_SLOTS (RTP_PACKETIZATION_PERIOD / SLOT_MS)
+/* a generator tick this late means the generator itself is saturated and the results are not trustworthy */
+#define LATE_TICK_MS 5
+
+using namespace bench;
+
+namespace {
+  enum SessionState_t {
+    SESSION_IDLE,
+    SESSION_CONNECTED,
+    SESSION_FAILED,
+    SESSION_CLOSED
+  };
+
+  struct Session {
+    drachtio::AudioPipe* pipe;
+    std::atomic<int> state;
+    uint32_t seq;
+  };
+
+  struct GeneratorStats {
+    std::atomic<uint64_t> sent;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> lateTicks;
+  };
+
+  struct Options {
+    unsigned int sessions = 100;
+    unsigned int duration = 30;
+    unsigned int sampleRate = 8000;
+    unsigned int port = 9001;
+    unsigned int threads = 1;
+    unsigned int rampPerSec = 500;
+    unsigned int bufferSecs = 2;
+    unsigned int reportSecs = 5;
+    unsigned int maxP99Usecs = 0;
+    uint64_t maxDrops = UINT64_MAX;
+    std::string protocol = "audio.drachtio.org";
+    bool verbose = false;
+  };
+
+  struct Usage {
+    double cpuSecs;
+    double ctxSwitches;
+  };
+
+  static Options opts;
+  static std::unique_ptr<Session[]> sessions;
+  static std::unique_ptr<GeneratorStats[]> genStats;
+  static std::atomic<bool> stopGenerators(false);
+  static std::atomic<unsigned int> nConnected(0);
+  static std::atomic<unsigned int> nFailed(0);
+  static std::atomic<unsigned int> nClosed(0);
+  static char bugname[] = "audio_pipe_bench";
+
+  static void usage(const char* prog) {
+    fprintf(stderr,
+      "usage: %s [options]\n"
+      "  -n, --sessions N       number of concurrent sessions (default 100)\n"
+      "  -d, --duration SECS    measurement time once all sessions are up (default 30)\n"
+      "  -r, --rate HZ          8000 or 16000 (default 8000)\n"
+      "  -p, --port PORT        local port for the bundled sink (default 9001)\n"
+      "  -t, --threads N        generator threads, standing in for media threads (default 1)\n"
+      "  -R, --ramp N           new connections per second (default 500)\n"
+      "  -b, --buffer-secs N    per pipe audio buffer, as MOD_AUDIO_FORK_BUFFER_SECS (default 2)\n"
+      "  -i, --report SECS      interval between progress lines, 0 for none (default 5)\n"
+      "  -P, --protocol NAME    websocket subprotocol (default audio.drachtio.org)\n"
+      "      --max-p99-us N     exit non-zero if p99 send latency exceeds N usecs\n"
+      "      --max-drops N      exit non-zero if more than N frames were dropped or lost\n"
+      "  -v, --verbose          libwebsockets notice logging\n",
+      prog);
+  }
+
+  static bool parseArgs(int argc, char** argv) {
+    static const struct option longOpts[] = {
+      {"sessions", required_argument, nullptr, 'n'},
+      {"duration", required_argument, nullptr, 'd'},
+      {"rate", required_argument, nullptr, 'r'},
+      {"port", required_argument, nullptr, 'p'},
+      {"threads", required_argument, nullptr, 't'},
+      {"ramp", required_argument, nullptr, 'R'},
+      {"buffer-secs", required_argument, nullptr, 'b'},
+      {"report", required_argument, nullptr, 'i'},
+      {"protocol", required_argument, nullptr, 'P'},
+      {"max-p99-us", required_argument, nullptr, 1},
+      {"max-drops", required_argument, nullptr, 2},
+      {"verbose", no_argument, nullptr, 'v'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0}
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "n:d:r:p:t:R:b:i:P:vh", longOpts, nullptr)) != -1) {
+      switch (c) {
+        case 'n': opts.sessions = ::atoi(optarg); break;
+        case 'd': opts.duration = ::atoi(optarg); break;
+        case 'r': opts.sampleRate = ::atoi(optarg); break;
+        case 'p': opts.port = ::atoi(optarg); break;
+        case 't': opts.threads = ::atoi(optarg); break;
+        case 'R': opts.rampPerSec = ::atoi(optarg); break;
+        case 'b': opts.bufferSecs = ::atoi(optarg); break;
+        case 'i': opts.reportSecs = ::atoi(optarg); break;
+        case 'P': opts.protocol = optarg; break;
+        case 1: opts.maxP99Usecs = ::atoi(optarg); break;
+        case 2: opts.maxDrops = ::strtoull(optarg, nullptr, 10); break;
+        case 'v': opts.verbose = true; break;
+        default: return false;
+      }
+    }
+    if (opts.sessions < 1 || opts.threads < 1 || opts.rampPerSec < 1 || opts.bufferSecs < 1 ||
+      (opts.sampleRate != 8000 && opts.sampleRate != 16000)) {
+      return false;
+    }
+    return true;
+  }
+
+  static void eventCallback(const char *sessionId, const char* bugname, drachtio::AudioPipe::NotifyEvent_t event, const char* message) {
+    // session ids are "bench-<index>"
+    unsigned int idx = ::atoi(sessionId + 6);
+    if (idx >= opts.sessions) return;
+    Session& s = sessions[idx];
+
+    switch (event) {
+      case drachtio::AudioPipe::CONNECT_SUCCESS:
+        s.state.store(SESSION_CONNECTED, std::memory_order_release);
+        nConnected++;
+        break;
+      case drachtio::AudioPipe::CONNECT_FAIL:
+        s.state.store(SESSION_FAILED, std::memory_order_release);
+        nFailed++;
+        break;
+      case drachtio::AudioPipe::CONNECTION_DROPPED:
+      case drachtio::AudioPipe::CONNECTION_CLOSED_GRACEFULLY:
+        // the pipe deletes itself after this event
+        s.state.store(SESSION_CLOSED, std::memory_order_release);
+        nClosed++;
+        break;
+      default:
+        break;
+    }
+  }
+
+  static void generator(unsigned int idx, size_t frameBytes) {
+    GeneratorStats& stats = genStats[idx];
+    std::vector<uint8_t> payload(frameBytes);
+
+    // a quiet 400 Hz tone, so the payload is not trivially compressible
+    int16_t* samples = (int16_t *) payload.data();
+    for (size_t i = 0; i < frameBytes / 2; i++) {
+      samples[i] = (int16_t) (1000 * std::sin(2 * 3.14159265 * 400 * i / opts.sampleRate));
+    }
+
+    // sessions owned by this thread, grouped by the 1 ms slot they write in
+    std::vector<std::vector<unsigned int> > slots(NUM_SLOTS);
+    for (unsigned int i = idx; i < opts.sessions; i += opts.threads) {
+      slots[(i / opts.threads) % NUM_SLOTS].push_back(i);
+    }
+
+    auto next = std::chrono::steady_clock::now();
+    unsigned int tick = 0;
+    while (!stopGenerators.load(std::memory_order_relaxed)) {
+      std::this_thread::sleep_until(next);
+      if (std::chrono::steady_clock::now() - next > std::chrono::milliseconds(LATE_TICK_MS)) {
+        stats.lateTicks.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      for (unsigned int i : slots[tick % NUM_SLOTS]) {
+        Session& s = sessions[i];
+        if (s.state.load(std::memory_order_acquire) != SESSION_CONNECTED) continue;
+        drachtio::AudioPipe* ap = s.pipe;
+
+        ap->lockAudioBuffer();
+        if (ap->binarySpaceAvailable() < frameBytes) {
+          // the service thread has fallen behind by more than the buffer: this frame is lost, as in the media bug
+          ap->unlockAudioBuffer();
+          stats.dropped.fetch_add(1, std::memory_order_relaxed);
+          continue;
+        }
+        FrameHeader hdr;
+        hdr.session = i;
+        hdr.seq = s.seq++;
+        hdr.sentAtNs = nowNs();
+        char* p = ap->binaryWritePtr();
+        memcpy(p, payload.data(), frameBytes);
+        memcpy(p, &hdr, sizeof(hdr));
+        ap->binaryWritePtrAdd(frameBytes);
+        ap->unlockAudioBuffer();
+        stats.sent.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      tick++;
+      next += std::chrono::milliseconds(SLOT_MS);
+    }
+  }
+
+  static double threadCpuSecs(pid_t tid) {
+    char path[64];
+    unsigned long utime = 0, stime = 0;
+    snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+    FILE* fp = fopen(path, "r");
+    if (!fp) return 0;
+    // skip past the command name, which may contain spaces
+    char buf[1024];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = '\0';
+    char* p = strrchr(buf, ')');
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) return 0;
+    return (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+  }
+
+  static double threadCtxSwitches(pid_t tid) {
+    char path[64], line[256];
+    double total = 0;
+    snprintf(path, sizeof(path), "/proc/self/task/%d/status", tid);
+    FILE* fp = fopen(path, "r");
+    if (!fp) return 0;
+    while (fgets(line, sizeof(line), fp)) {
+      unsigned long v;
+      if (sscanf(line, "voluntary_ctxt_switches: %lu", &v) == 1) total += v;
+      else if (sscanf(line, "nonvoluntary_ctxt_switches: %lu", &v) == 1) total += v;
+    }
+    fclose(fp);
+    return total;
+  }
+
+  // process-wide usage less that of the sink thread, i.e. what the transport and generators cost
+  static Usage clientUsage() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    Usage u;
+    u.cpuSecs = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    u.ctxSwitches = ru.ru_nvcsw + ru.ru_nivcsw;
+    pid_t sinkTid = WsSink::threadId();
+    if (sinkTid) {
+      u.cpuSecs -= threadCpuSecs(sinkTid);
+      u.ctxSwitches -= threadCtxSwitches(sinkTid);
+    }
+    return u;
+  }
+
+  static long rssKb() {
+    long pages = 0, resident = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (!fp) return 0;
+    if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(fp);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+  }
+
+  static void totals(uint64_t& sent, uint64_t& dropped, uint64_t& lateTicks) {
+    sent = dropped = lateTicks = 0;
+    for (unsigned int i = 0; i < opts.threads; i++) {
+      sent += genStats[i].sent.load(std::memory_order_relaxed);
+      dropped += genStats[i].dropped.load(std::memory_order_relaxed);
+      lateTicks += genStats[i].lateTicks.load(std::memory_order_relaxed);
+    }
+  }
+
+  static void raiseFdLimit(unsigned int needed) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) return;
+    if (rl.rlim_cur < rl.rlim_max) {
+      rl.rlim_cur = rl.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (rl.rlim_cur < needed) {
+      fprintf(stderr, "warning: open file limit %lu is below the %u needed for %u sessions\n",
+        (unsigned long) rl.rlim_cur, needed, opts.sessions);
+    }
+  }
+
+  static void logger(int level, const char *line) {
+    fprintf(stderr, "%s", line);
+  }
+}
+
+int main(int argc, char** argv) {
+  if (!parseArgs(argc, argv)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  // same sizing as the media bug: a 20 ms mono frame, and a buffer holding bufferSecs of audio
+  size_t frameBytes = 320 * opts.sampleRate / 8000;
+  size_t buflen = LWS_PRE + (frameBytes * 1000 / RTP_PACKETIZATION_PERIOD * opts.bufferSecs);
+
+  // each session uses a socket at both ends
+  raiseFdLimit(2 * opts.sessions + 64);
+  lws_set_log_level(opts.verbose ? (LLL_ERR | LLL_WARN | LLL_NOTICE) : (LLL_ERR | LLL_WARN), logger);
+
+  if (!WsSink::start(opts.protocol.c_str(), opts.port, frameBytes)) return 1;
+  drachtio::AudioPipe::initialize(opts.protocol.c_str(), 0, logger);
+  // the service thread creates the lws context asynchronously
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  sessions.reset(new Session[opts.sessions]());
+  genStats.reset(new GeneratorStats[opts.threads]());
+
+  long rssBefore = rssKb();
+  printf("audio_pipe_bench: %u sessions at %u Hz, %u generator threads, %zu byte frames, %zu byte buffers\n",
+    opts.sessions, opts.sampleRate, opts.threads, frameBytes, buflen);
+
+  std::vector<std::thread> generators;
+  for (unsigned int i = 0; i < opts.threads; i++) generators.push_back(std::thread(generator, i, frameBytes));
+
+  // ramp up
+  auto rampStart = std::chrono::steady_clock::now();
+  for (unsigned int i = 0; i < opts.sessions; i++) {
+    std::string uuid = "bench-" + std::to_string(i);
+    Session& s = sessions[i];
+    s.pipe = new drachtio::AudioPipe(uuid.c_str(), "127.0.0.1", opts.port, "/", 0,
+      buflen, frameBytes, nullptr, nullptr, bugname, eventCallback);
+    s.pipe->connect();
+    std::this_thread::sleep_until(rampStart + std::chrono::microseconds((uint64_t) (i + 1) * 1000000 / opts.rampPerSec));
+  }
+  auto rampDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (nConnected + nFailed < opts.sessions && std::chrono::steady_clock::now() < rampDeadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  unsigned int connected = nConnected;
+  printf("ramp: %u connected, %u failed, %u pending after %.1f secs\n", connected, nFailed.load(),
+    opts.sessions - connected - nFailed.load(),
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - rampStart).count());
+  if (0 == connected) {
+    fprintf(stderr, "no sessions connected\n");
+    return 1;
+  }
+
+  // let the pipes settle after the connection storm before measuring
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+  long rssAfter = rssKb();
+
+  uint64_t sent0, dropped0, late0;
+  totals(sent0, dropped0, late0);
+  uint64_t received0 = WsSink::framesReceived();
+  uint64_t lost0 = WsSink::framesLost();
+  Usage usage0 = clientUsage();
+  WsSink::setMeasuring(true);
+  auto measureStart = std::chrono::steady_clock::now();
+
+  for (unsigned int elapsed = 0; elapsed < opts.duration; elapsed++) {
+    std::this_thread::sleep_until(measureStart + std::chrono::seconds(elapsed + 1));
+    if (opts.reportSecs && (elapsed + 1) % opts.reportSecs == 0) {
+      uint64_t sent, dropped, late;
+      totals(sent, dropped, late);
+      const LatencyHistogram& h = WsSink::latency();
+      printf("%4us  connected %u  sent %" PRIu64 "  received %" PRIu64 "  dropped %" PRIu64 "  lost %" PRIu64 "  p50 %" PRIu64 "us  p99 %" PRIu64 "us\n",
+        elapsed + 1, nConnected - nClosed, sent - sent0, WsSink::framesReceived() - received0,
+        dropped - dropped0, WsSink::framesLost() - lost0, h.percentile(50), h.percentile(99));
+      fflush(stdout);
+    }
+  }
+
+  WsSink::setMeasuring(false);
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - measureStart).count();
+  Usage usage1 = clientUsage();
+  uint64_t sent1, dropped1, late1;
+  totals(sent1, dropped1, late1);
+  uint64_t received = WsSink::framesReceived() - received0;
+  uint64_t lost = WsSink::framesLost() - lost0;
+  uint64_t sent = sent1 - sent0;
+  uint64_t dropped = dropped1 - dropped0;
+  const LatencyHistogram& h = WsSink::latency();
+
+  stopGenerators = true;
+  for (auto& t : generators) t.join();
+
+  double cpu = usage1.cpuSecs - usage0.cpuSecs;
+  double ctx = usage1.ctxSwitches - usage0.ctxSwitches;
+  printf("\nresults over %.1f secs with %u streams\n", secs, connected);
+  printf("  client cpu:        %.2f%% of a core total, %.4f%% per stream\n", 100 * cpu / secs, 100 * cpu / secs / connected);
+  printf("  context switches:  %.0f/s total, %.2f/s per stream\n", ctx / secs, ctx / secs / connected);
+  printf("  send latency:      p50 %" PRIu64 "us  p90 %" PRIu64 "us  p99 %" PRIu64 "us  p99.9 %" PRIu64 "us  max %" PRIu64 "us (%" PRIu64 " samples)\n",
+    h.percentile(50), h.percentile(90), h.percentile(99), h.percentile(99.9), h.max(), h.count());
+  printf("  memory:            %.1f KB per pipe (rss %ld -> %ld KB, includes the sink side)\n",
+    (double) (rssAfter - rssBefore) / connected, rssBefore, rssAfter);
+  printf("  frames:            %" PRIu64 " sent, %" PRIu64 " received, %" PRIu64 " dropped on full buffer, %" PRIu64 " lost in transit\n",
+    sent, received, dropped, lost);
+  if (late1 - late0 > 0) {
+    printf("  warning:           %" PRIu64 " generator ticks were more than %d ms late; add --threads\n", late1 - late0, LATE_TICK_MS);
+  }
+
+  // tear down: close every pipe that is still up and wait for the sockets to go away
+  unsigned int toClose = 0, closedBefore = nClosed;
+  for (unsigned int i = 0; i < opts.sessions; i++) {
+    Session& s = sessions[i];
+    if (s.state.load() == SESSION_CONNECTED) {
+      s.pipe->close();
+      toClose++;
+    }
+  }
+  auto closeDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (nClosed - closedBefore < toClose && std::chrono::steady_clock::now() < closeDeadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  drachtio::AudioPipe::deinitialize();
+  for (unsigned int i = 0; i < opts.sessions; i++) {
+    // pipes that never connected are not deleted by the service thread
+    if (sessions[i].state.load() != SESSION_CLOSED && sessions[i].state.load() != SESSION_CONNECTED) delete sessions[i].pipe;
+  }
+  WsSink::stop();
+
+  int rc = 0;
+  if (opts.maxP99Usecs && h.percentile(99) > opts.maxP99Usecs) {
+    printf("FAIL: p99 send latency %" PRIu64 "us exceeds %u us\n", h.percentile(99), opts.maxP99Usecs);
+    rc = 1;
+  }
+  if (dropped + lost > opts.maxDrops) {
+    printf("FAIL: %" PRIu64 " frames dropped or lost exceeds %" PRIu64 "\n", dropped + lost, opts.maxDrops);
+    rc = 1;
+  }
+  return rc;
+}
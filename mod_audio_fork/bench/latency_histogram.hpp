@@ -0,0 +1,75 @@
+#ifndef __LATENCY_HISTOGRAM_HPP__
+#define __LATENCY_HISTOGRAM_HPP__
+
+#include <atomic>
+#include <cstdint>
+
+namespace bench {
+
+  /*
+   * Log-linear histogram of microsecond values: exact below 32us, then 32 buckets
+   * per power of two (about 3% precision).  A single thread records while others
+   * may read; counts are relaxed atomics so readers see a close-enough snapshot.
+   */
+  class LatencyHistogram {
+  public:
+    LatencyHistogram() { reset(); }
+
+    void reset() {
+      for (int i = 0; i < NUM_BUCKETS; i++) m_counts[i].store(0, std::memory_order_relaxed);
+      m_total.store(0, std::memory_order_relaxed);
+      m_max.store(0, std::memory_order_relaxed);
+    }
+
+    void record(uint64_t usecs) {
+      m_counts[bucketFor(usecs)].fetch_add(1, std::memory_order_relaxed);
+      m_total.fetch_add(1, std::memory_order_relaxed);
+      if (usecs > m_max.load(std::memory_order_relaxed)) m_max.store(usecs, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return m_total.load(std::memory_order_relaxed); }
+    uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+
+    // lower bound of the bucket holding the given percentile (0-100)
+    uint64_t percentile(double pct) const {
+      uint64_t total = count();
+      if (0 == total) return 0;
+      uint64_t target = (uint64_t) (pct / 100.0 * total);
+      if (target < 1) target = 1;
+      uint64_t seen = 0;
+      for (int i = 0; i < NUM_BUCKETS; i++) {
+        seen += m_counts[i].load(std::memory_order_relaxed);
+        if (seen >= target) return valueFor(i);
+      }
+      return max();
+    }
+
+  private:
+    static const int SUB_BITS = 5;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int NUM_MAJORS = 40;
+    static const int NUM_BUCKETS = NUM_MAJORS * SUB_BUCKETS;
+
+    static int bucketFor(uint64_t v) {
+      if (v < (uint64_t) SUB_BUCKETS) return (int) v;
+      int msb = 63 - __builtin_clzll(v);
+      int shift = msb - SUB_BITS;
+      int idx = (msb - SUB_BITS + 1) * SUB_BUCKETS + (int) ((v >> shift) & (SUB_BUCKETS - 1));
+      return idx < NUM_BUCKETS ? idx : NUM_BUCKETS - 1;
+    }
+
+    static uint64_t valueFor(int idx) {
+      int major = idx / SUB_BUCKETS;
+      int sub = idx % SUB_BUCKETS;
+      if (0 == major) return sub;
+      return ((uint64_t) (SUB_BUCKETS + sub)) << (major - 1);
+    }
+
+    std::atomic<uint64_t> m_counts[NUM_BUCKETS];
+    std::atomic<uint64_t> m_total;
+    std::atomic<uint64_t> m_max;
+  };
+
+} // namespace bench
+
+#endif
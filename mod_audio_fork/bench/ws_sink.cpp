@@ -0,0 +1,133 @@
+#include "ws_sink.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+using namespace bench;
+
+std::thread WsSink::serviceThread;
+struct lws_context *WsSink::context = nullptr;
+std::string WsSink::protocol;
+size_t WsSink::frameLen;
+std::atomic<bool> WsSink::stopFlag(false);
+std::atomic<bool> WsSink::measuringFlag(false);
+std::atomic<pid_t> WsSink::tid(0);
+std::atomic<uint64_t> WsSink::nFrames(0);
+std::atomic<uint64_t> WsSink::nLost(0);
+std::atomic<unsigned int> WsSink::nConnections(0);
+LatencyHistogram WsSink::histogram;
+
+int WsSink::lws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len) {
+  per_session_data* pss = (per_session_data *) user;
+
+  switch (reason) {
+    case LWS_CALLBACK_ESTABLISHED:
+      pss->nextSeq = 0;
+      pss->seen = false;
+      pss->partialLen = 0;
+      nConnections++;
+      break;
+
+    case LWS_CALLBACK_CLOSED:
+      nConnections--;
+      break;
+
+    case LWS_CALLBACK_RECEIVE:
+      {
+        // text frames carry metadata; only audio is of interest here
+        if (!lws_frame_is_binary(wsi)) break;
+
+        // the client may coalesce several frames into one message, and lws may split a message across callbacks
+        const uint8_t* p = (const uint8_t *) in;
+        size_t remaining = len;
+        while (remaining > 0) {
+          size_t n = std::min(remaining, frameLen - pss->partialLen);
+          memcpy(pss->partial + pss->partialLen, p, n);
+          pss->partialLen += n;
+          p += n;
+          remaining -= n;
+          if (pss->partialLen == frameLen) {
+            onFrame(pss);
+            pss->partialLen = 0;
+          }
+        }
+      }
+      break;
+
+    default:
+      break;
+  }
+  return lws_callback_http_dummy(wsi, reason, user, in, len);
+}
+
+void WsSink::onFrame(per_session_data* pss) {
+  FrameHeader hdr;
+  memcpy(&hdr, pss->partial, sizeof(hdr));
+  uint64_t now = nowNs();
+
+  nFrames.fetch_add(1, std::memory_order_relaxed);
+  if (measuringFlag.load(std::memory_order_relaxed) && now > hdr.sentAtNs) {
+    histogram.record((now - hdr.sentAtNs) / 1000);
+  }
+
+  // the generator never skips a sequence number, so any gap was lost in transit
+  if (pss->seen && hdr.seq > pss->nextSeq) {
+    nLost.fetch_add(hdr.seq - pss->nextSeq, std::memory_order_relaxed);
+  }
+  pss->seen = true;
+  pss->nextSeq = hdr.seq + 1;
+}
+
+void WsSink::service() {
+  tid.store((pid_t) syscall(SYS_gettid));
+  while (!stopFlag.load()) {
+    if (lws_service(context, 0) < 0) break;
+  }
+}
+
+bool WsSink::start(const char* protocolName, unsigned int port, size_t frameBytes) {
+  static struct lws_protocols protocols[3];
+  struct lws_context_creation_info info;
+
+  if (frameBytes < sizeof(FrameHeader) || frameBytes > MAX_FRAME_BYTES) {
+    lwsl_err("WsSink::start frame size %lu is not supported\n", (unsigned long) frameBytes);
+    return false;
+  }
+  protocol = protocolName;
+  frameLen = frameBytes;
+
+  memset(protocols, 0, sizeof(protocols));
+  protocols[0].name = "http";
+  protocols[0].callback = lws_callback_http_dummy;
+  protocols[1].name = protocol.c_str();
+  protocols[1].callback = WsSink::lws_callback;
+  protocols[1].per_session_data_size = sizeof(per_session_data);
+  protocols[1].rx_buffer_size = 4096;
+
+  memset(&info, 0, sizeof info);
+  info.port = port;
+  info.iface = "127.0.0.1";
+  info.protocols = protocols;
+  info.count_threads = 1;
+
+  context = lws_create_context(&info);
+  if (!context) {
+    lwsl_err("WsSink::start failed creating context on port %u\n", port);
+    return false;
+  }
+
+  stopFlag = false;
+  serviceThread = std::thread(&WsSink::service);
+  return true;
+}
+
+void WsSink::stop() {
+  if (!context) return;
+  stopFlag = true;
+  lws_cancel_service(context);
+  if (serviceThread.joinable()) serviceThread.join();
+  lws_context_destroy(context);
+  context = nullptr;
+}
@@ -0,0 +1,79 @@
+#ifndef __WS_SINK_HPP__
+#define __WS_SINK_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include <sys/types.h>
+#include <libwebsockets.h>
+
+#include "latency_histogram.hpp"
+
+namespace bench {
+
+  // written by the load generator at the start of every audio frame (host byte order, since both ends share a process)
+  struct FrameHeader {
+    uint32_t session;
+    uint32_t seq;
+    uint64_t sentAtNs;
+  };
+
+  inline uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  /*
+   * Local websocket server that accepts the AudioPipe subprotocol, splits the binary
+   * stream back into fixed size frames and records how long each frame took to arrive.
+   * Runs its own lws context on a dedicated thread so its cost can be separated out.
+   */
+  class WsSink {
+  public:
+    static bool start(const char* protocolName, unsigned int port, size_t frameBytes);
+    static void stop();
+
+    // latency is only recorded while measuring, so that ramp-up is excluded
+    static void setMeasuring(bool measuring) { measuringFlag.store(measuring); }
+
+    static const LatencyHistogram& latency() { return histogram; }
+    static uint64_t framesReceived() { return nFrames.load(std::memory_order_relaxed); }
+    static uint64_t framesLost() { return nLost.load(std::memory_order_relaxed); }
+    static unsigned int connections() { return nConnections.load(std::memory_order_relaxed); }
+
+    // kernel thread id of the service thread, for per-thread cpu and context switch accounting
+    static pid_t threadId() { return tid.load(); }
+
+  private:
+    static const size_t MAX_FRAME_BYTES = 2048;
+
+    struct per_session_data {
+      uint32_t nextSeq;
+      bool seen;
+      size_t partialLen;
+      uint8_t partial[MAX_FRAME_BYTES];
+    };
+
+    static int lws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len);
+    static void service();
+    static void onFrame(per_session_data* pss);
+
+    static std::thread serviceThread;
+    static struct lws_context *context;
+    static std::string protocol;
+    static size_t frameLen;
+    static std::atomic<bool> stopFlag;
+    static std::atomic<bool> measuringFlag;
+    static std::atomic<pid_t> tid;
+    static std::atomic<uint64_t> nFrames;
+    static std::atomic<uint64_t> nLost;
+    static std::atomic<unsigned int> nConnections;
+    static LatencyHistogram histogram;
+  };
+
+} // namespace bench
+
+#endif
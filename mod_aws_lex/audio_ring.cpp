@@ -0,0 +1,64 @@
+#include "audio_ring.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+using namespace aws_lex;
+
+AudioRing::AudioRing(size_t chunkBytes, size_t numChunks) : m_chunks(std::max((size_t) 2, numChunks)),
+  m_chunkBytes(chunkBytes), m_head(0), m_used(0), m_bytes(0) {
+  for (auto& chunk : m_chunks) {
+    chunk.data.reset(new unsigned char[m_chunkBytes]);
+    chunk.len = 0;
+  }
+}
+
+bool AudioRing::write(const void* data, size_t len, size_t& dropped) {
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  while (len > 0) {
+    if (0 == m_used || m_chunks[(m_head + m_used - 1) % m_chunks.size()].len == m_chunkBytes) {
+      if (m_used == m_chunks.size()) {
+        dropped += m_chunks[m_head].len;
+        m_bytes -= m_chunks[m_head].len;
+        m_head = (m_head + 1) % m_chunks.size();
+        m_used--;
+      }
+      Chunk& next = m_chunks[(m_head + m_used) % m_chunks.size()];
+      next.len = 0;
+      next.started = Clock::now();
+      m_used++;
+    }
+    Chunk& chunk = m_chunks[(m_head + m_used - 1) % m_chunks.size()];
+    size_t n = std::min(len, m_chunkBytes - chunk.len);
+    memcpy(chunk.data.get() + chunk.len, p, n);
+    chunk.len += n;
+    m_bytes += n;
+    p += n;
+    len -= n;
+  }
+  return m_used > 1 || (1 == m_used && m_chunks[m_head].len == m_chunkBytes);
+}
+
+bool AudioRing::read(Aws::Vector<unsigned char>& out, std::chrono::milliseconds maxAge) {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  if (0 == m_used) return false;
+
+  // only the newest chunk can be partly filled, and it is the head only when it is the sole chunk
+  Chunk& chunk = m_chunks[m_head];
+  if (0 == chunk.len) return false;
+  if (chunk.len < m_chunkBytes && Clock::now() - chunk.started < maxAge) return false;
+
+  out.assign(chunk.data.get(), chunk.data.get() + chunk.len);
+  m_bytes -= chunk.len;
+  chunk.len = 0;
+  m_head = (m_head + 1) % m_chunks.size();
+  m_used--;
+  return true;
+}
+
+size_t AudioRing::size() {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  return m_bytes;
+}
@@ -0,0 +1,133 @@
+#include "audio_store.hpp"
+
+#include <switch.h>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+
+using namespace aws_lex;
+
+std::mutex AudioStore::mutex;
+std::map<std::string, std::shared_ptr<AudioStore::Clip> > AudioStore::clips;
+std::map<std::string, AudioStore::SessionClips> AudioStore::sessions;
+uint64_t AudioStore::nextId = 0;
+size_t AudioStore::nMaxSessionBytes = 0;
+
+void AudioStore::initialize(size_t maxSessionBytes) {
+  std::lock_guard<std::mutex> lk(mutex);
+  nMaxSessionBytes = maxSessionBytes;
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "AudioStore::initialize max %u KB of agent audio per session\n",
+    (unsigned int) (nMaxSessionBytes / 1024));
+}
+
+void AudioStore::deinitialize() {
+  std::lock_guard<std::mutex> lk(mutex);
+  for (const auto& clip : clips) drop(*clip.second);
+  clips.clear();
+  sessions.clear();
+}
+
+std::string AudioStore::add(const std::string& sessionId, uint32_t sampleRate, const char* data, size_t len, bool complete) {
+  std::shared_ptr<Clip> clip = std::make_shared<Clip>();
+  clip->pcm.assign(data, std::min(len, nMaxSessionBytes));
+  clip->sampleRate = sampleRate;
+  clip->complete = complete;
+
+  std::lock_guard<std::mutex> lk(mutex);
+  std::string id = sessionId + "_" + std::to_string(++nextId);
+  clips.insert(std::make_pair(id, clip));
+
+  SessionClips& session = sessions[sessionId];
+  session.ids.push_back(id);
+  session.bytes += clip->pcm.size();
+  trim(session);
+  return id;
+}
+
+bool AudioStore::append(const std::string& id, const char* data, size_t len) {
+  std::lock_guard<std::mutex> lk(mutex);
+  auto it = clips.find(id);
+  if (it == clips.end()) return false;
+  {
+    std::lock_guard<std::mutex> clk(it->second->mutex);
+
+    // a single clip may not grow past the bound
+    if (it->second->pcm.size() + len > nMaxSessionBytes) return false;
+    it->second->pcm.append(data, len);
+  }
+
+  std::string sessionId = id.substr(0, id.rfind('_'));
+  SessionClips& session = sessions[sessionId];
+  session.bytes += len;
+  trim(session);
+  return true;
+}
+
+void AudioStore::complete(const std::string& id) {
+  std::lock_guard<std::mutex> lk(mutex);
+  auto it = clips.find(id);
+  if (it == clips.end()) return;
+  std::lock_guard<std::mutex> clk(it->second->mutex);
+  it->second->complete = true;
+}
+
+std::shared_ptr<AudioStore::Clip> AudioStore::open(const std::string& id) {
+  std::lock_guard<std::mutex> lk(mutex);
+  auto it = clips.find(id);
+  if (it == clips.end()) return nullptr;
+  return it->second;
+}
+
+size_t AudioStore::read(const std::shared_ptr<Clip>& clip, size_t offset, char* buf, size_t len) {
+  std::lock_guard<std::mutex> lk(clip->mutex);
+  if (offset >= clip->pcm.size()) return 0;
+  size_t n = std::min(len, clip->pcm.size() - offset);
+  memcpy(buf, clip->pcm.data() + offset, n);
+  return n;
+}
+
+size_t AudioStore::size(const std::shared_ptr<Clip>& clip) {
+  std::lock_guard<std::mutex> lk(clip->mutex);
+  return clip->pcm.size();
+}
+
+void AudioStore::removeSession(const std::string& sessionId) {
+  std::lock_guard<std::mutex> lk(mutex);
+  auto it = sessions.find(sessionId);
+  if (it == sessions.end()) return;
+  for (const auto& id : it->second.ids) {
+    auto clip = clips.find(id);
+    if (clip == clips.end()) continue;
+    drop(*clip->second);
+    clips.erase(clip);
+  }
+  sessions.erase(it);
+}
+
+// a clip still being played when dropped is marked complete, so that its playback ends rather than waiting for more audio
+void AudioStore::drop(Clip& clip) {
+  std::lock_guard<std::mutex> lk(clip.mutex);
+  clip.complete = true;
+}
+
+// called with the mutex held; drops the oldest complete clips, but never the newest, until the session is within bounds
+void AudioStore::trim(SessionClips& session) {
+  auto id = session.ids.begin();
+  while (session.bytes > nMaxSessionBytes && id != session.ids.end() && std::next(id) != session.ids.end()) {
+    auto it = clips.find(*id);
+    if (it != clips.end()) {
+      size_t bytes;
+      {
+        std::lock_guard<std::mutex> clk(it->second->mutex);
+        if (!it->second->complete) {
+          ++id;
+          continue;
+        }
+        bytes = it->second->pcm.size();
+      }
+      session.bytes -= bytes;
+      clips.erase(it);
+    }
+    id = session.ids.erase(id);
+  }
+}
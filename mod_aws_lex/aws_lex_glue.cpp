@@ -12,19 +12,35 @@
 #include <string>
 #include <sstream>
 #include <map>
+#include <algorithm>
 
 #include <float.h>
 
 #include <aws/core/Aws.h>
 #include <aws/core/auth/AWSCredentialsProvider.h>
 #include <aws/core/client/ClientConfiguration.h>
-#include <aws/core/utils/logging/DefaultLogSystem.h>
+#include <aws/core/utils/logging/LogSystemInterface.h>
 #include <aws/core/utils/logging/AWSLogging.h>
 #include <aws/lexv2-runtime/LexRuntimeV2Client.h>
 #include <aws/lexv2-runtime/model/StartConversationRequest.h>
 
 #include "mod_aws_lex.h"
 #include "parser.h"
+#include "audio_store.hpp"
+#include "client_registry.hpp"
+#include "audio_ring.hpp"
+#include "log_ring.hpp"
+
+/* audio is sent in AudioInputEvents of this duration, and up to AUDIO_RING_MS of it is held until it can be sent */
+#define MIN_AUDIO_EVENT_MS (20)
+#define MAX_AUDIO_EVENT_MS (200)
+#define AUDIO_RING_MS (5000)
+#define AUDIO_BYTES_PER_MS (16)
+#define AUDIO_CONTENT_TYPE "audio/lpcm; sample-rate=8000; sample-size-bits=16; channel-count=1; is-big-endian=false"
+
+/* sending a window of audio that takes longer than this counts as a stall; dropped audio is reported at most every DROP_REPORT_SECS */
+#define SEND_STALL_MS (100)
+#define DROP_REPORT_SECS (5)
 
 using namespace Aws;
 using namespace Aws::Utils;
@@ -36,11 +52,72 @@ using namespace Aws::LexRuntimeV2::Model;
 const char ALLOC_TAG[] = "drachtio";
 
 static uint64_t playCount = 0;
+static std::mutex audioFilesMutex;
 static std::multimap<std::string, std::string> audioFiles;
 static bool hasDefaultCredentials = false;
-static bool awsLoggingEnabled = false;
 static const char *endpointOverride = std::getenv("AWS_LEX_ENDPOINT_OVERRIDE");
 static std::vector<Aws::String> locales{"en_AU", "en_GB", "en_US", "fr_CA", "fr_FR", "es_ES", "es_US", "it_IT"};
+static const char* requestedMaxSessionAudioKB = std::getenv("LEX_MAX_SESSION_AUDIO_KB");
+static unsigned int nMaxSessionAudioKB = std::max(64, requestedMaxSessionAudioKB ? ::atoi(requestedMaxSessionAudioKB) : 2048);
+static const char* requestedSdkThreads = std::getenv("AWS_LEX_SDK_THREADS");
+static unsigned int nSdkThreads = std::max(1, requestedSdkThreads ? ::atoi(requestedSdkThreads) : 64);
+static const char* requestedAudioEventMs = std::getenv("AWS_LEX_AUDIO_EVENT_MS");
+static unsigned int nAudioEventMs = std::min(MAX_AUDIO_EVENT_MS, std::max(MIN_AUDIO_EVENT_MS, requestedAudioEventMs ? ::atoi(requestedAudioEventMs) : 100));
+static const char* requestedSdkLogLevel = std::getenv("AWS_LEX_SDK_LOG_LEVEL");
+static const char* requestedSdkLogSlots = std::getenv("AWS_LEX_SDK_LOG_SLOTS");
+static unsigned int nSdkLogSlots = std::max(16, requestedSdkLogSlots ? ::atoi(requestedSdkLogSlots) : 1024);
+
+using aws_lex::AudioStore;
+using aws_lex::ClientRegistry;
+using aws_lex::AudioRing;
+using aws_lex::LogRing;
+
+// hands the sdk's log output to the LogRing, which writes it to the freeswitch log from its own thread
+class SdkLogSystem : public Aws::Utils::Logging::LogSystemInterface {
+public:
+	Aws::Utils::Logging::LogLevel GetLogLevel(void) const {
+		switch (LogRing::getLevel()) {
+			case LogRing::LEVEL_ERROR: return Aws::Utils::Logging::LogLevel::Error;
+			case LogRing::LEVEL_WARNING: return Aws::Utils::Logging::LogLevel::Warn;
+			case LogRing::LEVEL_INFO: return Aws::Utils::Logging::LogLevel::Info;
+			case LogRing::LEVEL_DEBUG: return Aws::Utils::Logging::LogLevel::Debug;
+			case LogRing::LEVEL_TRACE: return Aws::Utils::Logging::LogLevel::Trace;
+			default: return Aws::Utils::Logging::LogLevel::Off;
+		}
+	}
+	void Log(Aws::Utils::Logging::LogLevel logLevel, const char* tag, const char* formatStr, ...) {
+		va_list args;
+		va_start(args, formatStr);
+		LogRing::vpush(ringLevel(logLevel), tag, formatStr, args);
+		va_end(args);
+	}
+	void vaLog(Aws::Utils::Logging::LogLevel logLevel, const char* tag, const char* formatStr, va_list args) {
+		LogRing::vpush(ringLevel(logLevel), tag, formatStr, args);
+	}
+	void LogStream(Aws::Utils::Logging::LogLevel logLevel, const char* tag, const Aws::OStringStream &messageStream) {
+		LogRing::push(ringLevel(logLevel), tag, messageStream.str().c_str());
+	}
+	void Flush() {}
+
+private:
+	static LogRing::Level ringLevel(Aws::Utils::Logging::LogLevel logLevel) {
+		switch (logLevel) {
+			case Aws::Utils::Logging::LogLevel::Fatal:
+			case Aws::Utils::Logging::LogLevel::Error: return LogRing::LEVEL_ERROR;
+			case Aws::Utils::Logging::LogLevel::Warn: return LogRing::LEVEL_WARNING;
+			case Aws::Utils::Logging::LogLevel::Info: return LogRing::LEVEL_INFO;
+			case Aws::Utils::Logging::LogLevel::Debug: return LogRing::LEVEL_DEBUG;
+			case Aws::Utils::Logging::LogLevel::Trace: return LogRing::LEVEL_TRACE;
+			default: return LogRing::LEVEL_OFF;
+		}
+	}
+};
+
+// an open playback of agent audio held in memory
+struct audio_reader {
+	std::shared_ptr<AudioStore::Clip> clip;
+	size_t offset;
+};
 
 static switch_status_t hanguphook(switch_core_session_t *session) {
 	switch_channel_t *channel = switch_core_session_get_channel(session);
@@ -48,14 +125,18 @@ static switch_status_t hanguphook(switch_core_session_t *session) {
 
 	if (state == CS_HANGUP || state == CS_ROUTING) {
 		char * sessionId = switch_core_session_get_uuid(session);
-		auto range = audioFiles.equal_range(sessionId);
-		for (auto it = range.first; it != range.second; it++) {
-			std::string filename = it->second;
-			std::remove(filename.c_str());
-			switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, 
-				"aws_lex_session_cleanup: removed audio file %s\n", filename.c_str());
-		}
-		audioFiles.erase(sessionId);
+		{
+			std::lock_guard<std::mutex> lk(audioFilesMutex);
+			auto range = audioFiles.equal_range(sessionId);
+			for (auto it = range.first; it != range.second; it++) {
+				std::string filename = it->second;
+				std::remove(filename.c_str());
+				switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, 
+					"aws_lex_session_cleanup: removed audio file %s\n", filename.c_str());
+			}
+			audioFiles.erase(sessionId);
+		}
+		AudioStore::removeSession(sessionId);
 		switch_core_event_hook_remove_state_change(session, hanguphook);
 	}
 	return SWITCH_STATUS_SUCCESS;
@@ -176,14 +257,10 @@ public:
 		responseHandler_t responseHandler,
 		errorHandler_t  errorHandler) : 
 	m_bot(bot), m_alias(alias), m_region(region), m_sessionId(sessionId), m_finished(false), m_finishing(false), m_packets(0),
-	m_pStream(nullptr), m_bPlayDone(false), m_bDiscardAudio(false)
+	m_pStream(nullptr), m_bPlayDone(false), m_bDiscardAudio(false), m_bInMemoryAudio(false), m_bStreamReady(false), m_bAudioReady(false),
+	m_droppedBytes(0), m_reportedDroppedBytes(0), m_stalls(0), m_audio(AUDIO_BYTES_PER_MS * nAudioEventMs, AUDIO_RING_MS / nAudioEventMs)
 	{
-		Aws::String key(awsAccessKeyId);
-		Aws::String secret(awsSecretAccessKey);
 		Aws::String awsLocale(locale);
-		Aws::Client::ClientConfiguration config;
-		config.region = region;
-		if (endpointOverride) config.endpointOverride = endpointOverride;
 		char keySnippet[20];
 
 		strncpy(keySnippet, awsAccessKeyId, 4);
@@ -193,11 +270,20 @@ public:
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p ACCESS_KEY_ID %s\n", this, keySnippet);		
 		if (*awsAccessKeyId && *awsSecretAccessKey) {
 			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "using AWS creds %s %s\n", awsAccessKeyId, awsSecretAccessKey);	
-			m_client = Aws::MakeUnique<LexRuntimeV2Client>(ALLOC_TAG, AWSCredentials(awsAccessKeyId, awsSecretAccessKey), config);
 		}
 		else {
 			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "No AWS credentials so using default credentials\n");	
-			m_client = Aws::MakeUnique<LexRuntimeV2Client>(ALLOC_TAG, config);
+		}
+		m_client = ClientRegistry::getClient(region, endpointOverride ? endpointOverride : "", awsAccessKeyId, awsSecretAccessKey);
+		if (!m_client) {
+			// only before the registry is initialized: report it now rather than start a conversation that could never run
+			switch_core_session_t* psession = switch_core_session_locate(m_sessionId.c_str());
+			if (psession) {
+				errorHandler(psession, "{\"message\":\"no aws client available for the conversation\"}");
+				switch_core_session_rwunlock(psession);
+			}
+			m_finished = true;
+			return;
 		}
 	
     m_handler.SetHeartbeatEventCallback([this](const HeartbeatEvent&)
@@ -257,7 +343,30 @@ public:
 			auto contentType = ev.GetContentType();
 			auto eventId = ev.GetEventId();
 			switch_core_session_t* psession = switch_core_session_locate(m_sessionId.c_str());
-			if (psession) {
+			if (psession && m_bInMemoryAudio) {
+				// pcm chunks are collected in memory and played through our file interface
+				if (m_audioId.empty()) {
+					if (bytes > 0) {
+						m_audioId = AudioStore::add(m_sessionId, 8000, (const char*) audio.GetUnderlyingData(), bytes, false);
+						switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG, "GStreamer %p: receiving audio into %s\n", this, m_audioId.c_str());
+					}
+				}
+				else if (0 == bytes) {
+					AudioStore::complete(m_audioId);
+
+					std::ostringstream s;
+					s << "{\"path\": \"" << AWS_LEX_AUDIO_PREFIX << "://" << m_audioId << "\"}";
+					m_audioId.clear();
+
+					responseHandler(psession, AWS_LEX_EVENT_AUDIO_PROVIDED, const_cast<char *>(s.str().c_str()));
+				}
+				else if (!AudioStore::append(m_audioId, (const char*) audio.GetUnderlyingData(), bytes)) {
+					switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_WARNING, "GStreamer %p: audio for %s exceeds LEX_MAX_SESSION_AUDIO_KB, truncating\n",
+						this, m_audioId.c_str());
+				}
+				switch_core_session_rwunlock(psession);
+			}
+			else if (psession) {
 				if (!m_f.is_open()) {
 					if (0 == bytes) return;
 						m_ostrCurrentPath.str("");
@@ -267,6 +376,7 @@ public:
 						m_f.write((const char*) audio.GetUnderlyingData(), bytes);
 
 						// add the file to the list of files played for this session, we'll delete when session closes
+						std::lock_guard<std::mutex> lk(audioFilesMutex);
 						audioFiles.insert(std::pair<std::string, std::string>(m_sessionId, m_ostrCurrentPath.str().c_str()));
 				}
 				else if (0 == bytes) {
@@ -347,6 +457,10 @@ public:
 					switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "GStreamer %p using tts so audio packets will be discarded\n", this);
 					m_bDiscardAudio = true;
 				}
+				else if (switch_channel_var_true(channel, "LEX_AUDIO_IN_MEMORY")) {
+					switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p playing audio from memory\n", this);
+					m_bInMemoryAudio = true;
+				}
 				if (var = switch_channel_get_variable(channel, "x-amz-lex:audio:start-timeout-ms")) {
 					sessionAttributes.insert({"x-amz-lex:audio:start-timeout-ms:*:*", var});
 				}
@@ -358,7 +472,8 @@ public:
 				sessionState.SetSessionAttributes(sessionAttributes);
 
 				ConfigurationEvent configurationEvent;
-				configurationEvent.SetResponseContentType("audio/mpeg");
+				configurationEvent.SetResponseContentType(m_bInMemoryAudio ?
+					"audio/lpcm; sample-rate=8000; sample-size-bits=16; channel-count=1; is-big-endian=false" : "audio/mpeg");
 
 				Intent intent;
 				if (intentName && strlen(intentName) > 0) {
@@ -400,6 +515,13 @@ public:
 				stream.WritePlaybackCompletionEvent(playbackCompletionEvent);
 				stream.flush();
 
+				// audio may only follow the configuration event
+				{
+					std::lock_guard<std::mutex> lk(m_mutex);
+					m_bStreamReady = true;
+				}
+				m_cond.notify_one();
+
 				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p got stream ready\n", this);		
 				switch_core_session_rwunlock(psession);
 			}
@@ -427,7 +549,7 @@ public:
 	}
 
 	~GStreamer() {
-		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::~GStreamer wrote %d packets %p\n", m_packets, this);		
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::~GStreamer wrote %d packets, dropped %u bytes, %u stalled sends %p\n", m_packets, m_droppedBytes, m_stalls, this);
 	}
 
 	void dtmf(char* dtmf) {
@@ -454,12 +576,18 @@ public:
 			return false;
 		}
 		//m_fOutgoingAudio.write((const char*) data, datalen);
-		Aws::Utils::ByteBuffer audio((const unsigned char *) data, datalen);
-		AudioInputEvent audioInputEvent;
-		audioInputEvent.SetAudioChunk(audio);
-		audioInputEvent.SetContentType("audio/lpcm; sample-rate=8000; sample-size-bits=16; channel-count=1; is-big-endian=false");
-		m_pStream->WriteAudioInputEvent(audioInputEvent);
-		m_pStream->flush();
+
+		// events are signed and flushed on the lex thread a window of audio at a time, rather than per frame here on the media thread
+		size_t dropped = 0;
+		// drops are counted here and reported from the lex thread, so a slow sender costs the media thread no logging
+		bool ready = m_audio.write(data, datalen, dropped);
+		{
+			std::lock_guard<std::mutex> lk(m_mutex);
+			m_packets++;
+			m_droppedBytes += dropped;
+			if (ready) m_bAudioReady = true;
+		}
+		if (ready) m_cond.notify_one();
 
 		return true;
 	}
@@ -476,18 +604,35 @@ public:
 	void processData() {
 		bool shutdownInitiated = false;
 		while (true) {
-			std::unique_lock<std::mutex> lk(m_mutex);
-			m_cond.wait(lk, [&, this] { 
-				return  m_bPlayDone || m_finished  || (m_finishing && !shutdownInitiated);
-			});
-
-			// we have data to process or have been told we're done
-			if (m_finished) return;
-			if (m_finishing) {
+			bool finishing, playDone, streamReady;
+			uint32_t droppedBytes;
+			{
+				// the timeout lets a partly filled window go out when frames stop arriving
+				std::unique_lock<std::mutex> lk(m_mutex);
+				m_cond.wait_for(lk, std::chrono::milliseconds(nAudioEventMs), [&, this] { 
+					return  m_bPlayDone || (m_bAudioReady && m_bStreamReady && !m_finishing) || m_finished  || (m_finishing && !shutdownInitiated);
+				});
+
+				// we have data to process or have been told we're done
+				if (m_finished) return;
+				finishing = m_finishing;
+				playDone = m_bPlayDone;
+				streamReady = m_bStreamReady;
+				droppedBytes = m_droppedBytes;
+				m_bPlayDone = false;
+				m_bAudioReady = false;
+			}
+
+			reportDrops(droppedBytes);
+
+			// events are written without the lock held, so the media thread never waits on signing or flushing
+			if (finishing) {
+				if (shutdownInitiated) continue;
 				shutdownInitiated = true;
 				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::writing disconnect event %p\n", this);
 
 				if (m_pStream) {
+					if (streamReady) sendAudio(std::chrono::milliseconds(0));
 					m_pStream->WriteAudioInputEvent({}); // per the spec, we have to send an empty event (i.e. without a payload) at the end.
 					DisconnectionEvent disconnectionEvent;
 					m_pStream->WriteDisconnectionEvent(disconnectionEvent);
@@ -501,24 +646,51 @@ public:
 
 				}
 			}
-			else {
-				if (m_bPlayDone) {
-					m_bPlayDone = false;
+			else if (streamReady) {
+				if (playDone) {
 					PlaybackCompletionEvent playbackCompletionEvent;
 					m_pStream->WritePlaybackCompletionEvent(playbackCompletionEvent);
 					m_pStream->flush();
 				}
+				sendAudio(std::chrono::milliseconds(nAudioEventMs));
 			}
 		}
 	}
 
 
 private:
+	// sends each full window of audio, and a partly filled one once it is maxAge old, as a single event
+	void sendAudio(std::chrono::milliseconds maxAge) {
+		Aws::Vector<unsigned char> bits;
+		bool sent = false;
+		auto start = std::chrono::steady_clock::now();
+		while (m_audio.read(bits, maxAge)) {
+			AudioInputEvent audioInputEvent;
+			audioInputEvent.SetAudioChunk(Aws::Utils::ByteBuffer(bits.data(), bits.size()));
+			audioInputEvent.SetContentType(AUDIO_CONTENT_TYPE);
+			m_pStream->WriteAudioInputEvent(audioInputEvent);
+			sent = true;
+		}
+		if (sent) {
+			m_pStream->flush();
+			if (std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(SEND_STALL_MS)) m_stalls++;
+		}
+	}
+
+	void reportDrops(uint32_t droppedBytes) {
+		auto now = std::chrono::steady_clock::now();
+		if (droppedBytes == m_reportedDroppedBytes || now - m_lastDropReport < std::chrono::seconds(DROP_REPORT_SECS)) return;
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "GStreamer %p sender is behind, dropped %u bytes of audio (%u stalled sends)\n",
+			this, droppedBytes - m_reportedDroppedBytes, m_stalls);
+		m_reportedDroppedBytes = droppedBytes;
+		m_lastDropReport = now;
+	}
+
 	std::string m_sessionId;
 	std::string  m_bot;
 	std::string  m_alias;
 	std::string  m_region;
-	Aws::UniquePtr<LexRuntimeV2Client> m_client;
+	std::shared_ptr<LexRuntimeV2Client> m_client;
 	StartConversationRequestEventStream* m_pStream;
 	StartConversationRequest m_request;
 	StartConversationHandler m_handler;
@@ -533,6 +705,15 @@ private:
 	//std::ofstream m_fOutgoingAudio;
 	bool m_bPlayDone;
 	bool m_bDiscardAudio;
+	bool m_bInMemoryAudio;
+	bool m_bStreamReady;
+	bool m_bAudioReady;
+	uint32_t m_droppedBytes;
+	uint32_t m_reportedDroppedBytes;
+	uint32_t m_stalls;
+	std::chrono::steady_clock::time_point m_lastDropReport;
+	AudioRing m_audio;
+	std::string m_audioId;
 };
 
 static void *SWITCH_THREAD_FUNC lex_thread(switch_thread_t *thread, void *obj) {
@@ -587,34 +768,110 @@ extern "C" {
 		}
     Aws::SDKOptions options;
 
-		if (awsTrace && 0 == strcmp("1", awsTrace)) {
-			awsLoggingEnabled = true;
-			options.loggingOptions.logLevel = Aws::Utils::Logging::LogLevel::Trace;
-
-			Aws::Utils::Logging::InitializeAWSLogging(
-					Aws::MakeShared<Aws::Utils::Logging::DefaultLogSystem>(
-						ALLOC_TAG, Aws::Utils::Logging::LogLevel::Trace, "aws_sdk_"));
+		// the sdk's logging always goes through the ring, left off unless asked for (AWS_TRACE=1 still means trace)
+		LogRing::Level sdkLogLevel = LogRing::LEVEL_OFF;
+		if (awsTrace && 0 == strcmp("1", awsTrace)) sdkLogLevel = LogRing::LEVEL_TRACE;
+		if (requestedSdkLogLevel && !LogRing::parseLevel(requestedSdkLogLevel, sdkLogLevel)) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "invalid AWS_LEX_SDK_LOG_LEVEL %s, ignoring it\n", requestedSdkLogLevel);
 		}
+		LogRing::initialize(nSdkLogSlots, sdkLogLevel);
+		Aws::Utils::Logging::InitializeAWSLogging(Aws::MakeShared<SdkLogSystem>(ALLOC_TAG));
 
     Aws::InitAPI(options);
 
-
+		ClientRegistry::initialize(nSdkThreads);
+		AudioStore::initialize(nMaxSessionAudioKB * 1024);
 
 		return SWITCH_STATUS_SUCCESS;
 	}
 	
 	switch_status_t aws_lex_cleanup() {
 		Aws::SDKOptions options;
+
+		// clients and the executor must be released before the API is shut down
+		ClientRegistry::deinitialize();
 		
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "mod_aws_lex: shutting down API");
-		if (awsLoggingEnabled) {
-			options.loggingOptions.logLevel = Aws::Utils::Logging::LogLevel::Trace;
-			Aws::Utils::Logging::ShutdownAWSLogging();
-		}
-	
     Aws::ShutdownAPI(options);
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "mod_aws_lex: shutdown API complete");
 
+		Aws::Utils::Logging::ShutdownAWSLogging();
+		LogRing::deinitialize();
+
+		AudioStore::deinitialize();
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	// sets the sdk log level if one is given, and reports the level and the ring's counters as json
+	char* aws_lex_sdk_log(const char* level) {
+		LogRing::Level l;
+		if (level && *level) {
+			if (!LogRing::parseLevel(level, l)) return NULL;
+			LogRing::setLevel(l);
+		}
+		LogRing::Stats stats;
+		LogRing::getStats(stats);
+
+		cJSON* jStats = cJSON_CreateObject();
+		cJSON_AddStringToObject(jStats, "level", LogRing::levelName(stats.level));
+		cJSON_AddNumberToObject(jStats, "logged", (double) stats.logged);
+		cJSON_AddNumberToObject(jStats, "dropped", (double) stats.dropped);
+		char* json = cJSON_PrintUnformatted(jStats);
+		cJSON_Delete(jStats);
+		return json;
+	}
+
+	// file interface playing agent audio held in memory: AWS_LEX_AUDIO_PREFIX://<id>
+	switch_status_t aws_lex_audio_open(switch_file_handle_t *handle, const char *path) {
+		if (switch_test_flag(handle, SWITCH_FILE_FLAG_WRITE)) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "aws_lex_audio_open: %s is read only\n", path);
+			return SWITCH_STATUS_FALSE;
+		}
+		std::shared_ptr<AudioStore::Clip> clip = AudioStore::open(path);
+		if (!clip) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "aws_lex_audio_open: no audio for %s\n", path);
+			return SWITCH_STATUS_FALSE;
+		}
+
+		audio_reader* reader = new audio_reader;
+		reader->clip = clip;
+		reader->offset = 0;
+		handle->private_info = reader;
+		handle->samplerate = clip->sampleRate;
+		handle->native_rate = clip->sampleRate;
+		handle->channels = 1;
+		handle->samples = AudioStore::size(clip) / sizeof(int16_t);
+		handle->format = 0;
+		handle->sections = 0;
+		handle->seekable = 1;
+		handle->speed = 0;
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	switch_status_t aws_lex_audio_close(switch_file_handle_t *handle) {
+		audio_reader* reader = (audio_reader *) handle->private_info;
+		delete reader;
+		handle->private_info = NULL;
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	switch_status_t aws_lex_audio_read(switch_file_handle_t *handle, void *data, switch_size_t *len) {
+		audio_reader* reader = (audio_reader *) handle->private_info;
+		size_t bytes = AudioStore::read(reader->clip, reader->offset, (char *) data, *len * sizeof(int16_t));
+		reader->offset += bytes;
+		*len = bytes / sizeof(int16_t);
+		return 0 == *len ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+	}
+
+	switch_status_t aws_lex_audio_seek(switch_file_handle_t *handle, unsigned int *cur_sample, int64_t samples, int whence) {
+		audio_reader* reader = (audio_reader *) handle->private_info;
+		int64_t total = AudioStore::size(reader->clip) / sizeof(int16_t);
+		int64_t pos = samples;
+		if (SEEK_CUR == whence) pos += reader->offset / sizeof(int16_t);
+		else if (SEEK_END == whence) pos += total;
+		pos = std::max((int64_t) 0, std::min(pos, total));
+		reader->offset = pos * sizeof(int16_t);
+		*cur_sample = (unsigned int) pos;
 		return SWITCH_STATUS_SUCCESS;
 	}
 
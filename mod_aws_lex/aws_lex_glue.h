@@ -3,6 +3,7 @@
 
 switch_status_t aws_lex_init();
 switch_status_t aws_lex_cleanup();
+char* aws_lex_sdk_log(const char* level);
 switch_status_t aws_lex_session_init(switch_core_session_t *session, responseHandler_t responseHandler, errorHandler_t errorHandler, 
 		uint32_t samples_per_second, char* bot, char* alias, char* region, char* locale, char *intent, char* metadata, struct cap_cb **cb);
 switch_status_t aws_lex_session_stop(switch_core_session_t *session, int channelIsClosing);
@@ -10,5 +11,10 @@ switch_status_t aws_lex_session_dtmf(switch_core_session_t *session, char* dtmf)
 switch_status_t aws_lex_session_play_done(switch_core_session_t *session);
 switch_bool_t aws_lex_frame(switch_media_bug_t *bug, void* user_data);
 
+switch_status_t aws_lex_audio_open(switch_file_handle_t *handle, const char *path);
+switch_status_t aws_lex_audio_close(switch_file_handle_t *handle);
+switch_status_t aws_lex_audio_read(switch_file_handle_t *handle, void *data, switch_size_t *len);
+switch_status_t aws_lex_audio_seek(switch_file_handle_t *handle, unsigned int *cur_sample, int64_t samples, int whence);
+
 void destroyChannelUserData(struct cap_cb* cb);
 #endif
\ No newline at end of file
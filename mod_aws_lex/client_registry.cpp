@@ -0,0 +1,153 @@
+#include "client_registry.hpp"
+
+#include <switch.h>
+#include <algorithm>
+
+#include <aws/core/auth/AWSCredentialsProviderChain.h>
+#include <aws/core/client/ClientConfiguration.h>
+
+/* clients that have had no active stream for this long are dropped */
+#define CLIENT_IDLE_EVICT_SECS (600)
+#define CLIENT_SWEEP_INTERVAL_SECS (60)
+
+using namespace aws_lex;
+
+static const char ALLOC_TAG[] = "drachtio";
+
+std::mutex ClientRegistry::mutex;
+std::map<std::string, std::shared_ptr<ClientRegistry::Entry> > ClientRegistry::entries;
+std::vector<std::shared_ptr<ClientRegistry::Pool> > ClientRegistry::pools;
+std::shared_ptr<Aws::Auth::AWSCredentialsProvider> ClientRegistry::defaultCredentials;
+unsigned int ClientRegistry::nExecutorThreads = 0;
+std::atomic<unsigned int> ClientRegistry::activeStreams(0);
+uint64_t ClientRegistry::clientsCreated = 0;
+uint64_t ClientRegistry::streams = 0;
+unsigned int ClientRegistry::peakStreams = 0;
+unsigned int ClientRegistry::peakPools = 0;
+unsigned int ClientRegistry::nextPoolId = 0;
+ClientRegistry::Clock::time_point ClientRegistry::lastSweep;
+
+// called after Aws::InitAPI
+void ClientRegistry::initialize(unsigned int executorThreads) {
+  std::lock_guard<std::mutex> lk(mutex);
+  nExecutorThreads = std::max(1U, executorThreads);
+  nextPoolId = 0;
+  pools.clear();
+  availablePool();
+  defaultCredentials = Aws::MakeShared<Aws::Auth::DefaultAWSCredentialsProviderChain>(ALLOC_TAG);
+  clientsCreated = streams = 0;
+  peakStreams = 0;
+  peakPools = 1;
+  lastSweep = Clock::now();
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "ClientRegistry::initialize executors of %u threads\n", nExecutorThreads);
+}
+
+// called before Aws::ShutdownAPI
+void ClientRegistry::deinitialize() {
+  std::lock_guard<std::mutex> lk(mutex);
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE,
+    "ClientRegistry::deinitialize %u clients, %llu created, %llu streams, peak %u concurrent streams on %u executors\n",
+    (unsigned int) entries.size(), (unsigned long long) clientsCreated, (unsigned long long) streams, peakStreams, peakPools);
+  entries.clear();
+  defaultCredentials.reset();
+
+  // joins the pool threads
+  pools.clear();
+}
+
+ClientRegistry::StreamRef::~StreamRef() {
+  entry->active--;
+  entry->pool->active--;
+  activeStreams--;
+}
+
+void ClientRegistry::evictIdle(Clock::time_point now) {
+  for (auto it = entries.begin(); it != entries.end();) {
+    if (0 == it->second->active && now - it->second->lastUsed >= std::chrono::seconds(CLIENT_IDLE_EVICT_SECS)) {
+      it = entries.erase(it);
+    }
+    else ++it;
+  }
+
+  // an executor beyond the first goes once the last client on it has been dropped; this joins its idle threads
+  for (auto it = pools.begin() + 1; it != pools.end();) {
+    bool inUse = 0 != (*it)->active || std::any_of(entries.begin(), entries.end(),
+      [&it](const std::pair<const std::string, std::shared_ptr<Entry> >& e) { return e.second->pool == *it; });
+    if (inUse) ++it;
+    else {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "ClientRegistry::evictIdle releasing executor %u\n", (*it)->id);
+      it = pools.erase(it);
+    }
+  }
+}
+
+// called with the mutex held; the first executor with a free thread, adding one if every thread is carrying a stream
+std::shared_ptr<ClientRegistry::Pool> ClientRegistry::availablePool() {
+  for (auto& pool : pools) {
+    if (pool->active < nExecutorThreads) return pool;
+  }
+  std::shared_ptr<Pool> pool = std::make_shared<Pool>();
+  pool->executor = Aws::MakeShared<Aws::Utils::Threading::PooledThreadExecutor>(ALLOC_TAG, nExecutorThreads);
+  pool->active = 0;
+  pool->id = nextPoolId++;
+  pools.push_back(pool);
+  if (pools.size() > peakPools) peakPools = pools.size();
+  if (pool->id > 0) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE,
+      "ClientRegistry::availablePool all %u threads of %u executors carry a stream; adding another executor\n",
+      nExecutorThreads, (unsigned int) pools.size() - 1);
+  }
+  return pool;
+}
+
+std::shared_ptr<ClientRegistry::Client> ClientRegistry::getClient(const std::string& region, const std::string& endpointOverride,
+  const std::string& accessKeyId, const std::string& secretAccessKey) {
+  auto now = Clock::now();
+  bool useDefault = accessKeyId.empty() || secretAccessKey.empty();
+  std::lock_guard<std::mutex> lk(mutex);
+  if (pools.empty()) return nullptr;
+
+  if (now - lastSweep > std::chrono::seconds(CLIENT_SWEEP_INTERVAL_SECS)) {
+    lastSweep = now;
+    evictIdle(now);
+  }
+
+  // the full secret goes into the key, so that only a session presenting the same secret is handed this client;
+  // a stream beyond the threads of an executor gets a client on the next one
+  std::shared_ptr<Pool> pool = availablePool();
+  std::string key = region + "|" + endpointOverride + "|" + (useDefault ? std::string("default") :
+    accessKeyId + ":" + secretAccessKey) + "|" + std::to_string(pool->id);
+  auto it = entries.find(key);
+  if (it == entries.end()) {
+    Aws::Client::ClientConfiguration config;
+    if (!region.empty()) config.region = region.c_str();
+    if (!endpointOverride.empty()) config.endpointOverride = endpointOverride.c_str();
+    config.executor = pool->executor;
+
+    std::shared_ptr<Aws::Auth::AWSCredentialsProvider> credentials = useDefault ? defaultCredentials :
+      Aws::MakeShared<Aws::Auth::SimpleAWSCredentialsProvider>(ALLOC_TAG, accessKeyId.c_str(), secretAccessKey.c_str());
+
+    std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+    entry->client = Aws::MakeShared<Client>(ALLOC_TAG, credentials, config);
+    entry->pool = pool;
+    entry->active = 0;
+    it = entries.insert(std::make_pair(key, entry)).first;
+    clientsCreated++;
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "ClientRegistry::getClient created client for region %s, %s credentials\n",
+      region.c_str(), useDefault ? "default" : "explicit");
+  }
+  std::shared_ptr<Entry> entry = it->second;
+
+  entry->active++;
+  pool->active++;
+  entry->lastUsed = now;
+  streams++;
+  unsigned int active = ++activeStreams;
+  if (active > peakStreams) peakStreams = active;
+
+  std::shared_ptr<StreamRef> ref = std::make_shared<StreamRef>();
+  ref->entry = entry;
+
+  // aliasing constructor: points at the client but owns the stream reference
+  return std::shared_ptr<Client>(ref, entry->client.get());
+}
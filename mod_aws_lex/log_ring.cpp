@@ -0,0 +1,173 @@
+#include "log_ring.hpp"
+
+#include <switch.h>
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+
+/* how long the drain thread sleeps once the ring is empty; producers never wake it, so this bounds the log latency */
+#define DRAIN_INTERVAL_MS (20)
+
+using namespace aws_lex;
+
+namespace {
+  const char* levelNames[] = {"off", "error", "warning", "info", "debug", "trace"};
+
+  switch_log_level_t switchLevel(LogRing::Level l) {
+    switch (l) {
+      case LogRing::LEVEL_ERROR: return SWITCH_LOG_ERROR;
+      case LogRing::LEVEL_WARNING: return SWITCH_LOG_WARNING;
+      case LogRing::LEVEL_INFO: return SWITCH_LOG_INFO;
+      default: return SWITCH_LOG_DEBUG;
+    }
+  }
+}
+
+LogRing::Slot* LogRing::slots = nullptr;
+size_t LogRing::mask = 0;
+std::atomic<size_t> LogRing::enqueuePos(0);
+size_t LogRing::dequeuePos = 0;
+std::atomic<int> LogRing::level(LogRing::LEVEL_OFF);
+std::atomic<uint64_t> LogRing::logged(0);
+std::atomic<uint64_t> LogRing::dropped(0);
+std::thread LogRing::drainThread;
+std::mutex LogRing::mutex;
+std::condition_variable LogRing::cv;
+bool LogRing::stopFlag = false;
+
+void LogRing::initialize(unsigned int nSlots, Level l) {
+  size_t capacity = 2;
+  while (capacity < nSlots) capacity <<= 1;
+
+  slots = new Slot[capacity];
+  for (size_t i = 0; i < capacity; i++) slots[i].seq.store(i, std::memory_order_relaxed);
+  mask = capacity - 1;
+  enqueuePos.store(0);
+  dequeuePos = 0;
+  logged.store(0);
+  dropped.store(0);
+  level.store(l);
+  stopFlag = false;
+  drainThread = std::thread(&LogRing::worker);
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "LogRing::initialize %u slots, sdk log level %s\n",
+    (unsigned int) capacity, levelName(l));
+}
+
+void LogRing::deinitialize() {
+  level.store(LEVEL_OFF);
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    stopFlag = true;
+  }
+  cv.notify_all();
+  if (drainThread.joinable()) drainThread.join();
+
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "LogRing::deinitialize %llu sdk log lines, %llu dropped\n",
+    (unsigned long long) logged.load(), (unsigned long long) dropped.load());
+  delete [] slots;
+  slots = nullptr;
+}
+
+void LogRing::setLevel(Level l) {
+  level.store(l);
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "LogRing sdk log level set to %s\n", levelName(l));
+}
+
+// claims the slot for the next line, or returns null if the ring is full
+LogRing::Slot* LogRing::claim(size_t& pos) {
+  if (!slots) return nullptr;
+  pos = enqueuePos.load(std::memory_order_relaxed);
+  for (;;) {
+    Slot* slot = &slots[pos & mask];
+    size_t seq = slot->seq.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+    if (0 == diff) {
+      if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return slot;
+    }
+    else if (diff < 0) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    else {
+      pos = enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void LogRing::publish(Slot* slot, size_t pos) {
+  size_t len = strlen(slot->text);
+  while (len > 0 && ('\n' == slot->text[len - 1] || '\r' == slot->text[len - 1])) slot->text[--len] = '\0';
+  slot->seq.store(pos + 1, std::memory_order_release);
+}
+
+void LogRing::push(Level l, const char* tag, const char* text) {
+  if (!enabled(l)) return;
+  size_t pos;
+  Slot* slot = claim(pos);
+  if (!slot) return;
+  slot->level = l;
+  snprintf(slot->tag, sizeof(slot->tag), "%s", tag ? tag : "");
+  snprintf(slot->text, sizeof(slot->text), "%s", text ? text : "");
+  publish(slot, pos);
+}
+
+void LogRing::vpush(Level l, const char* tag, const char* fmt, va_list args) {
+  if (!enabled(l)) return;
+  size_t pos;
+  Slot* slot = claim(pos);
+  if (!slot) return;
+  slot->level = l;
+  snprintf(slot->tag, sizeof(slot->tag), "%s", tag ? tag : "");
+  vsnprintf(slot->text, sizeof(slot->text), fmt, args);
+  publish(slot, pos);
+}
+
+void LogRing::getStats(Stats& out) {
+  out.level = getLevel();
+  out.logged = logged.load();
+  out.dropped = dropped.load();
+}
+
+bool LogRing::parseLevel(const char* name, Level& out) {
+  if (!name) return false;
+  for (int i = LEVEL_OFF; i <= LEVEL_TRACE; i++) {
+    if (0 == strcasecmp(name, levelNames[i])) {
+      out = static_cast<Level>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* LogRing::levelName(Level l) {
+  return l >= LEVEL_OFF && l <= LEVEL_TRACE ? levelNames[l] : "unknown";
+}
+
+void LogRing::worker() {
+  uint64_t reportedDrops = 0;
+  bool stopping = false;
+  while (!stopping) {
+    {
+      std::unique_lock<std::mutex> lk(mutex);
+      cv.wait_for(lk, std::chrono::milliseconds(DRAIN_INTERVAL_MS), [] { return stopFlag; });
+      stopping = stopFlag;
+    }
+
+    // only this thread dequeues, so the position needs no synchronization of its own
+    for (;;) {
+      Slot& slot = slots[dequeuePos & mask];
+      if (slot.seq.load(std::memory_order_acquire) != dequeuePos + 1) break;
+      switch_log_printf(SWITCH_CHANNEL_LOG, switchLevel(slot.level), "%s: %s\n", slot.tag, slot.text);
+      slot.seq.store(dequeuePos + mask + 1, std::memory_order_release);
+      dequeuePos++;
+      logged.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t drops = dropped.load(std::memory_order_relaxed);
+    if (drops != reportedDrops) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "LogRing dropped %llu sdk log lines, ring is full\n",
+        (unsigned long long) (drops - reportedDrops));
+      reportedDrops = drops;
+    }
+  }
+}
@@ -298,10 +298,27 @@ SWITCH_STANDARD_API(aws_lex_api_stop_function)
 }
 
 
+#define SDK_LOG_API_SYNTAX "[off|error|warning|info|debug|trace]"
+SWITCH_STANDARD_API(sdk_log_function)
+{
+	char *json = aws_lex_sdk_log(zstr(cmd) ? NULL : cmd);
+	if (json) {
+		stream->write_function(stream, "%s\n", json);
+		free(json);
+	}
+	else {
+		stream->write_function(stream, "-USAGE: %s\n", SDK_LOG_API_SYNTAX);
+	}
+	return SWITCH_STATUS_SUCCESS;
+}
+
 /* Macro expands to: switch_status_t mod_lex_load(switch_loadable_module_interface_t **module_interface, switch_memory_pool_t *pool) */
+static char *audio_formats[] = { AWS_LEX_AUDIO_PREFIX, NULL };
+
 SWITCH_MODULE_LOAD_FUNCTION(mod_aws_lex_load)
 {
 	switch_api_interface_t *api_interface;
+	switch_file_interface_t *file_interface;
 
 	/* create/register custom event message types */
 	if (switch_event_reserve_subclass(AWS_LEX_EVENT_INTENT) != SWITCH_STATUS_SUCCESS) {
@@ -342,16 +359,31 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_aws_lex_load)
 
 	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "mod_aws_lex API successfully loaded\n");
 
+	file_interface = (switch_file_interface_t *) switch_loadable_module_create_interface(*module_interface, SWITCH_FILE_INTERFACE);
+	file_interface->interface_name = modname;
+	file_interface->extens = audio_formats;
+	file_interface->file_open = aws_lex_audio_open;
+	file_interface->file_close = aws_lex_audio_close;
+	file_interface->file_read = aws_lex_audio_read;
+	file_interface->file_seek = aws_lex_audio_seek;
+
 	SWITCH_ADD_API(api_interface, "aws_lex_start", "Start an aws lex conversation", aws_lex_api_start_function, LEX_API_START_SYNTAX);
 	SWITCH_ADD_API(api_interface, "aws_lex_dtmf", "Send a dtmf entry to lex", aws_lex_api_dtmf_function, LEX_API_DTMF_SYNTAX);
 	SWITCH_ADD_API(api_interface, "aws_lex_play_done", "Notify lex that a play completed", aws_lex_api_play_done_function, LEX_API_PLAY_DONE_SYNTAX);
 	SWITCH_ADD_API(api_interface, "aws_lex_stop", "Terminate a aws lex", aws_lex_api_stop_function, LEX_API_STOP_SYNTAX);
+	SWITCH_ADD_API(api_interface, "aws_lex_sdk_log", "Set or show the AWS sdk log level", sdk_log_function, SDK_LOG_API_SYNTAX);
 
 	switch_console_set_complete("add aws_lex_stop");
 	switch_console_set_complete("add aws_lex_play_done");
 	switch_console_set_complete("add aws_lex_dtmf dtmf-entry");
 	switch_console_set_complete("add aws_lex_start project lang");
 	switch_console_set_complete("add aws_lex_start bot alias region locale");
+	switch_console_set_complete("add aws_lex_sdk_log off");
+	switch_console_set_complete("add aws_lex_sdk_log error");
+	switch_console_set_complete("add aws_lex_sdk_log warning");
+	switch_console_set_complete("add aws_lex_sdk_log info");
+	switch_console_set_complete("add aws_lex_sdk_log debug");
+	switch_console_set_complete("add aws_lex_sdk_log trace");
 
 	/* indicate that the module should continue to be loaded */
 	return SWITCH_STATUS_SUCCESS;
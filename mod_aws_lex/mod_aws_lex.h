@@ -14,6 +14,9 @@
 #define AWS_LEX_EVENT_PLAYBACK_INTERRUPTION "lex::playback_interruption"
 #define AWS_LEX_EVENT_ERROR "lex::error"
 
+/* file interface prefix for agent audio played from memory */
+#define AWS_LEX_AUDIO_PREFIX "lex_audio"
+
 #define MAX_LANG (12)
 #define MAX_BOTNAME (128)
 #define MAX_REGION (16)
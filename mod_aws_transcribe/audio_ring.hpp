@@ -0,0 +1,56 @@
+#ifndef __AWS_TRANSCRIBE_AUDIO_RING_HPP__
+#define __AWS_TRANSCRIBE_AUDIO_RING_HPP__
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <cstddef>
+
+#include <aws/core/utils/memory/stl/AWSVector.h>
+
+namespace aws_transcribe {
+
+/*
+ * Holds the audio written from the media thread in a fixed set of chunks allocated up front, so
+ * queuing a frame is a copy into memory that is already there.  A chunk spans one aggregation
+ * window, and is sent as a single AudioEvent once it is full, or once its oldest audio has waited
+ * a window (e.g. when frames stop arriving), instead of each frame being signed and sent as an
+ * event of its own.  If the sender falls behind and every chunk is full, the oldest chunk is
+ * dropped to make room.
+ */
+class AudioRing {
+public:
+  AudioRing(size_t chunkBytes, size_t numChunks);
+
+  // copies the audio in, adding to dropped any older audio dropped to make room; returns true if a full chunk is waiting
+  bool write(const void* data, size_t len, size_t& dropped);
+
+  // moves the oldest chunk into out if it is full or its oldest audio has waited at least maxAge;
+  // returns false if there was nothing to take
+  bool read(Aws::Vector<unsigned char>& out, std::chrono::milliseconds maxAge);
+
+  // true if read would take a chunk
+  bool ready(std::chrono::milliseconds maxAge);
+
+  size_t size();
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Chunk {
+    std::unique_ptr<unsigned char[]> data;
+    size_t len;
+    Clock::time_point started;
+  };
+
+  std::mutex m_mutex;
+  std::vector<Chunk> m_chunks;
+  size_t m_chunkBytes;
+  size_t m_head;
+  size_t m_used;
+  size_t m_bytes;
+};
+
+} // namespace aws_transcribe
+#endif
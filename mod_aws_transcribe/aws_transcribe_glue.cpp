@@ -7,14 +7,17 @@
 #include <mutex>
 #include <thread>
 #include <condition_variable>
+#include <atomic>
 #include <string>
 #include <sstream>
 #include <deque>
+#include <set>
+#include <algorithm>
 
 #include <aws/core/Aws.h>
 #include <aws/core/auth/AWSCredentialsProvider.h>
 #include <aws/core/client/ClientConfiguration.h>
-#include <aws/core/utils/logging/DefaultLogSystem.h>
+#include <aws/core/utils/logging/LogSystemInterface.h>
 #include <aws/core/utils/logging/AWSLogging.h>
 #include <aws/transcribestreaming/TranscribeStreamingServiceClient.h>
 #include <aws/transcribestreaming/model/StartStreamTranscriptionHandler.h>
@@ -22,10 +25,19 @@
 
 #include "mod_aws_transcribe.h"
 #include "simple_buffer.h"
+#include "client_registry.hpp"
+#include "audio_ring.hpp"
+#include "stream_executor.hpp"
+#include "log_ring.hpp"
 
 #define BUFFER_SECS (3)
 #define CHUNKSIZE (320)
 
+/* audio is sent in AudioEvents of at most this duration, and up to AUDIO_RING_MS of it is held while the sends catch up */
+#define MIN_AUDIO_EVENT_MS (20)
+#define MAX_AUDIO_EVENT_MS (200)
+#define AUDIO_RING_MS (5000)
+
 using namespace Aws;
 using namespace Aws::Utils;
 using namespace Aws::Auth;
@@ -36,6 +48,74 @@ using namespace Aws::TranscribeStreamingService::Model;
 const char ALLOC_TAG[] = "drachtio";
 
 static bool hasDefaultCredentials = false;
+static const char* requestedSdkThreads = std::getenv("AWS_TRANSCRIBE_SDK_THREADS");
+static unsigned int nSdkThreads = std::max(1, requestedSdkThreads ? ::atoi(requestedSdkThreads) : 64);
+static const char* requestedAudioEventMs = std::getenv("AWS_TRANSCRIBE_AUDIO_EVENT_MS");
+static unsigned int nAudioEventMs = std::min(MAX_AUDIO_EVENT_MS, std::max(MIN_AUDIO_EVENT_MS, requestedAudioEventMs ? ::atoi(requestedAudioEventMs) : 100));
+static const char* requestedWorkerThreads = std::getenv("AWS_TRANSCRIBE_WORKER_THREADS");
+static unsigned int nWorkerThreads = std::max(1, requestedWorkerThreads ? ::atoi(requestedWorkerThreads) : (int) std::thread::hardware_concurrency());
+static const char* requestedTeardownTimeoutMs = std::getenv("MOD_TRANSCRIBE_TEARDOWN_TIMEOUT_MS");
+static unsigned int nTeardownTimeoutMs = std::max(100, requestedTeardownTimeoutMs ? ::atoi(requestedTeardownTimeoutMs) : 5000);
+static std::atomic<uint64_t> abandonedStreams(0);
+static const char* requestedSdkLogLevel = std::getenv("AWS_TRANSCRIBE_SDK_LOG_LEVEL");
+static const char* requestedSdkLogSlots = std::getenv("AWS_TRANSCRIBE_SDK_LOG_SLOTS");
+static unsigned int nSdkLogSlots = std::max(16, requestedSdkLogSlots ? ::atoi(requestedSdkLogSlots) : 1024);
+
+using aws_transcribe::ClientRegistry;
+using aws_transcribe::AudioRing;
+using aws_transcribe::StreamExecutor;
+using aws_transcribe::LogRing;
+
+// hands the sdk's log output to the LogRing, which writes it to the freeswitch log from its own thread
+class SdkLogSystem : public Aws::Utils::Logging::LogSystemInterface {
+public:
+	Aws::Utils::Logging::LogLevel GetLogLevel(void) const {
+		switch (LogRing::getLevel()) {
+			case LogRing::LEVEL_ERROR: return Aws::Utils::Logging::LogLevel::Error;
+			case LogRing::LEVEL_WARNING: return Aws::Utils::Logging::LogLevel::Warn;
+			case LogRing::LEVEL_INFO: return Aws::Utils::Logging::LogLevel::Info;
+			case LogRing::LEVEL_DEBUG: return Aws::Utils::Logging::LogLevel::Debug;
+			case LogRing::LEVEL_TRACE: return Aws::Utils::Logging::LogLevel::Trace;
+			default: return Aws::Utils::Logging::LogLevel::Off;
+		}
+	}
+	void Log(Aws::Utils::Logging::LogLevel logLevel, const char* tag, const char* formatStr, ...) {
+		va_list args;
+		va_start(args, formatStr);
+		LogRing::vpush(ringLevel(logLevel), tag, formatStr, args);
+		va_end(args);
+	}
+	void vaLog(Aws::Utils::Logging::LogLevel logLevel, const char* tag, const char* formatStr, va_list args) {
+		LogRing::vpush(ringLevel(logLevel), tag, formatStr, args);
+	}
+	void LogStream(Aws::Utils::Logging::LogLevel logLevel, const char* tag, const Aws::OStringStream &messageStream) {
+		LogRing::push(ringLevel(logLevel), tag, messageStream.str().c_str());
+	}
+	void Flush() {}
+
+private:
+	static LogRing::Level ringLevel(Aws::Utils::Logging::LogLevel logLevel) {
+		switch (logLevel) {
+			case Aws::Utils::Logging::LogLevel::Fatal:
+			case Aws::Utils::Logging::LogLevel::Error: return LogRing::LEVEL_ERROR;
+			case Aws::Utils::Logging::LogLevel::Warn: return LogRing::LEVEL_WARNING;
+			case Aws::Utils::Logging::LogLevel::Info: return LogRing::LEVEL_INFO;
+			case Aws::Utils::Logging::LogLevel::Debug: return LogRing::LEVEL_DEBUG;
+			case Aws::Utils::Logging::LogLevel::Trace: return LogRing::LEVEL_TRACE;
+			default: return LogRing::LEVEL_OFF;
+		}
+	}
+};
+
+// streams that are open for audio, whose partly filled windows are sent from the shared flush tick
+class GStreamer;
+static std::mutex openStreamsMutex;
+static std::set<GStreamer*> openStreams;
+
+// audio is sent as 16 bit pcm at 16k, or 8k if that is what we receive
+static size_t audioBytesPerMs(uint32_t samples_per_second, uint16_t channels) {
+	return (samples_per_second > 8000 ? 16 : 8) * sizeof(int16_t) * std::max((uint16_t) 1, channels);
+}
 
 class GStreamer {
 public:
@@ -51,12 +131,10 @@ public:
 		const char* awsSecretAccessKey,
 		responseHandler_t responseHandler
   ) : m_sessionId(sessionId), m_bugname(bugname), m_finished(false), m_interim(interim), m_finishing(false), m_connected(false), m_connecting(false),
-	 		m_packets(0), m_responseHandler(responseHandler), m_pStream(nullptr), 
-			m_audioBuffer(320 * (samples_per_second == 8000 ? 1 : 2), 15) {
-		Aws::String key(awsAccessKeyId);
-		Aws::String secret(awsSecretAccessKey);
-		Aws::Client::ClientConfiguration config;
-		if (region != nullptr && strlen(region) > 0) config.region = region;
+	 		m_packets(0), m_responseHandler(responseHandler), m_pStream(nullptr), m_droppedBytes(0),
+			m_scheduled(false), m_dirty(false), m_sending(false), m_sendDirty(false), m_closed(false), m_done(false), m_abandoned(false),
+			m_audioBuffer(320 * (samples_per_second == 8000 ? 1 : 2), 15),
+			m_audio(audioBytesPerMs(samples_per_second, channels) * nAudioEventMs, AUDIO_RING_MS / nAudioEventMs) {
 		char keySnippet[20];
 
 		strncpy(keySnippet, awsAccessKeyId, 4);
@@ -64,24 +142,14 @@ public:
 		keySnippet[19] = '\0';
 
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p ACCESS_KEY_ID %s, region %s\n", this, keySnippet, region);		
-		if (*awsAccessKeyId && *awsSecretAccessKey) {
-			m_client = Aws::MakeUnique<TranscribeStreamingServiceClient>(ALLOC_TAG, AWSCredentials(awsAccessKeyId, awsSecretAccessKey), config);
-		}
-		else {
-			m_client = Aws::MakeUnique<TranscribeStreamingServiceClient>(ALLOC_TAG, config);
-		}
+		m_client = ClientRegistry::getClient(region ? region : "", awsAccessKeyId, awsSecretAccessKey);
 	
     m_handler.SetTranscriptEventCallback([this](const TranscriptEvent& ev)
     {
-			switch_core_session_t* psession = switch_core_session_locate(m_sessionId.c_str());
-			if (psession) {
-				switch_channel_t* channel = switch_core_session_get_channel(psession);
-				std::lock_guard<std::mutex> lk(m_mutex);
-				m_transcript = ev;
-				m_cond.notify_one();
-
-				switch_core_session_rwunlock(psession);
-			}
+			// queued rather than handed over in a single slot, so a result arriving before the last one is sent is not lost
+			std::lock_guard<std::mutex> lk(m_mutex);
+			m_transcripts.push_back(ev);
+			schedule();
     });
 
 		// not worth resampling to 16k if we get 8k ulaw or alaw in..
@@ -114,36 +182,28 @@ public:
 	}
 
 	void connect() {
-		if (m_connecting) return;
-		m_connecting = true;
+		{
+			std::lock_guard<std::mutex> lk(m_mutex);
+			if (m_connecting) return;
+			m_connecting = true;
+		}
 
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer:connect %p connecting to aws speech..\n", this);
 
     auto OnStreamReady = [this](Model::AudioStream& stream)
     {
-			switch_core_session_t* psession = switch_core_session_locate(m_sessionId.c_str());
-			if (psession) {
-				switch_channel_t* channel = switch_core_session_get_channel(psession);
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p got stream ready\n", this);
 
+			// audio buffered while connecting is moved over by the media thread on its next write;
+			// if we were stopped while connecting, the stream is closed straight away
+			{
+				std::lock_guard<std::mutex> lk(m_mutex);
 				m_pStream = &stream;
 				m_connected = true;
-
-
-				// send any buffered audio
-				int nFrames = m_audioBuffer.getNumItems();
-				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p got stream ready, %d buffered frames\n", this, nFrames);	
-				if (nFrames) {
-					char *p;
-					do {
-						p = m_audioBuffer.getNextChunk();
-						if (p) {
-							write(p, CHUNKSIZE);
-						}
-					} while (p);
-				}
-	
-				switch_core_session_rwunlock(psession);
+				if (m_finishing) scheduleSend();
 			}
+			std::lock_guard<std::mutex> lk(openStreamsMutex);
+			openStreams.insert(this);
     };
     auto OnResponseCallback = [this](const TranscribeStreamingServiceClient* pClient, 
 			const Model::StartStreamTranscriptionRequest& request, 
@@ -166,18 +226,23 @@ public:
 					cJSON_Delete(json);
 					switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p stream got error response %s : %s\n", this, message.c_str(), exception.c_str());
 				}
-
-				std::lock_guard<std::mutex> lk(m_mutex);
-				m_finished = true;
-				m_cond.notify_one();
-
 				switch_core_session_rwunlock(psession);
 			} else {
-				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p session is closed/hungup. Need to unblock thread.\n", this);
-				std::lock_guard<std::mutex> lk(m_mutex);
-				m_finished = true;
-				m_cond.notify_one();
+				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p session is closed/hungup.\n", this);
 			}
+
+			{
+				std::lock_guard<std::mutex> lk(openStreamsMutex);
+				openStreams.erase(this);
+			}
+
+			// the stream goes away once we return, so wait out any send to it that is queued or under way;
+			// we are only finished after that, since the streamer can be deleted as soon as we are
+			std::unique_lock<std::mutex> lk(m_mutex);
+			m_pStream = nullptr;
+			m_cond.wait(lk, [this] { return !m_sending; });
+			m_finished = true;
+			schedule();
     };
 
 		m_client->StartStreamTranscriptionAsync(m_request, OnStreamReady, OnResponseCallback, nullptr);
@@ -185,7 +250,7 @@ public:
 
 
 	~GStreamer() {
-		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::~GStreamer wrote %u packets %p\n", m_packets, this);		
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::~GStreamer wrote %u packets, dropped %u bytes %p\n", m_packets, m_droppedBytes, this);		
 	}
 
 	bool write(void* data, uint32_t datalen) {
@@ -201,15 +266,24 @@ public:
       return true;
     }
 
-		std::lock_guard<std::mutex> lk(m_mutex);
+		// the buffer is only ever touched from the media thread, so it is drained here rather than by the sdk
+		size_t dropped = 0;
+		bool ready = false;
+		if (m_audioBuffer.getNumItems()) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p sending %u buffered frames\n", this, m_audioBuffer.getNumItems());
+			char *p;
+			while ((p = m_audioBuffer.getNextChunk())) ready = m_audio.write(p, CHUNKSIZE, dropped) || ready;
+		}
 
-		const auto beg = static_cast<const unsigned char*>(data);
-		const auto end = beg + datalen;
-		Aws::Vector<unsigned char> bits { beg, end };
-		m_deqAudio.push_back(bits);
+		// a send is only posted from here once a full window of audio is waiting; the flush tick sends partly filled ones
+		ready = m_audio.write(data, datalen, dropped) || ready;
+		if (dropped > 0) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "GStreamer::write %p sends are behind, dropped %u bytes of audio\n", this, (unsigned int) dropped);
+		}
+		std::lock_guard<std::mutex> lk(m_mutex);
 		m_packets++;
-
-		m_cond.notify_one();
+		m_droppedBytes += dropped;
+		if (ready) scheduleSend();
 
 		return true;
 	}
@@ -220,120 +294,187 @@ public:
 		std::lock_guard<std::mutex> lk(m_mutex);
 
 		m_finishing = true;
-		m_cond.notify_one();
+		scheduleSend();
+		schedule();
 	}
 
-	void processData() {
-		bool shutdownInitiated = false;
-		while (true) {
-			std::unique_lock<std::mutex> lk(m_mutex);
-			m_cond.wait(lk, [&, this] { 
-				return (!m_deqAudio.empty() && !m_finishing)  || m_transcript.TranscriptHasBeenSet() || m_finished  || (m_finishing && !shutdownInitiated);
-			});
-
-
-			// we have data to process or have been told we're done
-			if (m_finished || !m_connected) return;
-
-			if (m_transcript.TranscriptHasBeenSet()) {
-				switch_core_session_t* psession = switch_core_session_locate(m_sessionId.c_str());
-				if (psession) {
-
-					//switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::got a transcript to send out %p\n", this);
-					bool isFinal = false;
-					std::ostringstream s;
-					s << "[";
-					for (auto&& r : m_transcript.GetTranscript().GetResults()) {
-						int count = 0;
-						std::ostringstream t1;
-						if (!isFinal && !r.GetIsPartial()) isFinal = true;
-						t1 << "{\"is_final\": " << (r.GetIsPartial() ? "false" : "true") << ", \"alternatives\": [";
-						for (auto&& alt : r.GetAlternatives()) {
-							std::ostringstream t2;
-							if (count++ == 0) t2 << "{\"transcript\": \"" << alt.GetTranscript() << "\"}";
-							else t2 << ", {\"transcript\": \"" << alt.GetTranscript() << "\"}";
-							t1 << t2.str();
-						}
-						t1 << "]}";
-						s << t1.str();
-					}
-					s << "]";
-					if (0 != s.str().compare("[]") && (isFinal || m_interim)) {
-						switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::writing transcript %p: %s\n", this, s.str().c_str() );
-						m_responseHandler(psession, s.str().c_str(), m_bugname.c_str());
-					}
-					TranscriptEvent empty;
-					m_transcript = empty; 
+	// waits up to timeout for the stream to close with no work for it queued or running, after which it can be deleted
+	bool waitForFinish(std::chrono::milliseconds timeout) {
+		std::unique_lock<std::mutex> lk(m_mutex);
+		return m_cond.wait_for(lk, timeout, [this] { return m_done && !m_scheduled; });
+	}
 
-					switch_core_session_rwunlock(psession);
-				}
-			}
-			if (m_finishing) {
-				shutdownInitiated = true;
-				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::writing disconnect event %p\n", this);
+	// gives up on a stream that did not finish in time: returns true if it has finished since and the caller
+	// should delete it, otherwise it deletes itself once the final response is in and its last transcripts are sent
+	bool abandon() {
+		std::lock_guard<std::mutex> lk(m_mutex);
+		if (m_done && !m_scheduled) return true;
+		m_abandoned = true;
+		return false;
+	}
 
-				if (m_pStream) {
-					m_pStream->flush();
-					m_pStream->Close();
-					m_pStream = nullptr;
-				}
-			}
+	// delivers transcripts, run on the executor; schedule() ensures it never runs on two threads at once
+	void pump() {
+		std::deque<TranscriptEvent> transcripts;
+		{
+			std::lock_guard<std::mutex> lk(m_mutex);
+			m_dirty = false;
+			transcripts.swap(m_transcripts);
+		}
+
+		// results are sent without the lock held, so the media thread is never waiting on them
+		for (const auto& ev : transcripts) sendTranscript(ev);
+
+		bool release = false;
+		{
+			std::lock_guard<std::mutex> lk(m_mutex);
+
+			// done once the final response is in, or when stopped without a stream ever having been started
+			if (m_finished || (m_finishing && !m_connecting)) m_done = true;
+			if (m_dirty && !m_done) StreamExecutor::post([this] { pump(); });
 			else {
-				// send out any queued speech packets
-				while (!m_deqAudio.empty()) {
-					Aws::Vector<unsigned char>& bits = m_deqAudio.front();
-					Aws::TranscribeStreamingService::Model::AudioEvent event(std::move(bits));
-					m_pStream->WriteAudioEvent(event);
-					m_deqAudio.pop_front();
-				}
+				m_scheduled = false;
+				release = m_done && m_abandoned;
 			}
+			m_cond.notify_all();
 		}
+		if (release) delete this;
 	}
 
 	bool isConnecting() {
     return m_connecting;
   }
 
+	// false only when the registry has not been initialized
+	bool hasClient() const {
+		return nullptr != m_client;
+	}
+
+	// called from the flush tick: sends a partly filled window once its oldest audio has waited a window's length
+	void flushIfDue() {
+		if (!m_audio.ready(std::chrono::milliseconds(nAudioEventMs))) return;
+		std::lock_guard<std::mutex> lk(m_mutex);
+		scheduleSend();
+	}
+
 private:
+	// called with the mutex held; queues a round of work unless one is already queued or running, in which case it goes round again
+	void schedule() {
+		m_dirty = true;
+		if (m_scheduled || m_done) return;
+		m_scheduled = true;
+		StreamExecutor::post([this] { pump(); });
+	}
+
+	// called with the mutex held; queues a send to the open stream unless one is already queued or running, in which case it goes round again
+	void scheduleSend() {
+		m_sendDirty = true;
+		if (m_sending || !m_pStream || m_closed) return;
+		m_sending = true;
+		StreamExecutor::post([this] { send(); });
+	}
+
+	// writes waiting audio to the stream, and closes it once we are finishing, run on the executor; with a single send
+	// per stream queued or running, a write blocked while the sdk has no room for the event holds up one worker at most
+	void send() {
+		std::unique_lock<std::mutex> lk(m_mutex);
+		AudioStream* pStream = m_pStream;
+		bool finishing = m_finishing;
+		m_sendDirty = false;
+		if (pStream && !m_closed) {
+			lk.unlock();
+			if (finishing) {
+				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::writing disconnect event %p\n", this);
+				sendAudio(pStream, std::chrono::milliseconds(0));
+				pStream->flush();
+				pStream->Close();
+			}
+			else sendAudio(pStream, std::chrono::milliseconds(nAudioEventMs));
+			lk.lock();
+			if (finishing) m_closed = true;
+		}
+
+		if (m_sendDirty && m_pStream && !m_closed) StreamExecutor::post([this] { send(); });
+		else {
+			m_sending = false;
+			m_cond.notify_all();
+		}
+	}
+
+	// sends each full window of audio, and a partly filled one once it is maxAge old, as a single event
+	void sendAudio(AudioStream* pStream, std::chrono::milliseconds maxAge) {
+		Aws::Vector<unsigned char> bits;
+		bool sent = false;
+		while (m_audio.read(bits, maxAge)) {
+			AudioEvent event(std::move(bits));
+			pStream->WriteAudioEvent(event);
+			sent = true;
+		}
+		if (sent) pStream->flush();
+	}
+
+	void sendTranscript(const TranscriptEvent& ev) {
+		switch_core_session_t* psession = switch_core_session_locate(m_sessionId.c_str());
+		if (!psession) return;
+
+		bool isFinal = false;
+		cJSON* jResults = cJSON_CreateArray();
+		for (auto&& r : ev.GetTranscript().GetResults()) {
+			if (!r.GetIsPartial()) isFinal = true;
+			cJSON* jResult = cJSON_CreateObject();
+			cJSON_AddItemToObject(jResult, "is_final", cJSON_CreateBool(!r.GetIsPartial()));
+			cJSON* jAlternatives = cJSON_CreateArray();
+			for (auto&& alt : r.GetAlternatives()) {
+				cJSON* jAlt = cJSON_CreateObject();
+				cJSON_AddStringToObject(jAlt, "transcript", alt.GetTranscript().c_str());
+				cJSON_AddItemToArray(jAlternatives, jAlt);
+			}
+			cJSON_AddItemToObject(jResult, "alternatives", jAlternatives);
+			cJSON_AddItemToArray(jResults, jResult);
+		}
+		if (cJSON_GetArraySize(jResults) > 0 && (isFinal || m_interim)) {
+			char* json = cJSON_PrintUnformatted(jResults);
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::writing transcript %p: %s\n", this, json);
+			m_responseHandler(psession, json, m_bugname.c_str());
+			free(json);
+		}
+		cJSON_Delete(jResults);
+		switch_core_session_rwunlock(psession);
+	}
+
 	std::string m_sessionId;
 	std::string m_bugname;
 	std::string  m_region;
-	Aws::UniquePtr<TranscribeStreamingServiceClient> m_client;
+	std::shared_ptr<TranscribeStreamingServiceClient> m_client;
 	AudioStream* m_pStream;
 	StartStreamTranscriptionRequest m_request;
 	StartStreamTranscriptionHandler m_handler;
-	TranscriptEvent m_transcript;
+	std::deque<TranscriptEvent> m_transcripts;
 	responseHandler_t m_responseHandler;
-	bool m_finishing;
+	std::atomic<bool> m_finishing;
 	bool m_interim;
-	bool m_finished;
-	bool m_connected;
+	std::atomic<bool> m_finished;
+	std::atomic<bool> m_connected;
 	bool m_connecting;
 	uint32_t m_packets;
+	uint32_t m_droppedBytes;
+	bool m_scheduled;
+	bool m_dirty;
+	bool m_sending;
+	bool m_sendDirty;
+	bool m_closed;
+	bool m_done;
+	bool m_abandoned;
 	std::mutex m_mutex;
 	std::condition_variable m_cond;
-	std::deque< Aws::Vector<unsigned char> > m_deqAudio;
 	SimpleBuffer m_audioBuffer;
+	AudioRing m_audio;
 };
 
-static void *SWITCH_THREAD_FUNC aws_transcribe_thread(switch_thread_t *thread, void *obj) {
-	struct cap_cb *cb = (struct cap_cb *) obj;
-	bool ok = true;
-	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "transcribe_thread: starting cb %p\n", (void *) cb);
-	GStreamer* pStreamer = new GStreamer(cb->sessionId, cb->bugname, cb->channels, cb->lang, cb->interim, cb->samples_per_second, cb->region, cb->awsAccessKeyId, cb->awsSecretAccessKey, 
-		cb->responseHandler);
-	if (!pStreamer) {
-		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "transcribe_thread: Error allocating streamer\n");
-		return nullptr;
-	}
-  if (!cb->vad) pStreamer->connect();
-	cb->streamer = pStreamer;
-	pStreamer->processData(); //blocks until done
-
-	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "transcribe_thread: stopping cb %p\n", (void *) cb);
-	delete pStreamer;
-	cb->streamer = nullptr;
-	return nullptr;
+// the shared timer's tick: posts a send for every open stream with a partly filled window that is due
+static void flushPartialWindows() {
+	std::lock_guard<std::mutex> lk(openStreamsMutex);
+	for (GStreamer* streamer : openStreams) streamer->flushIfDue();
 }
 
 static void killcb(struct cap_cb* cb) {
@@ -369,29 +510,61 @@ extern "C" {
 
 		}
     Aws::SDKOptions options;
-/*		
-    options.loggingOptions.logLevel = Aws::Utils::Logging::LogLevel::Trace;
 
-		Aws::Utils::Logging::InitializeAWSLogging(
-        Aws::MakeShared<Aws::Utils::Logging::DefaultLogSystem>(
-           ALLOC_TAG, Aws::Utils::Logging::LogLevel::Trace, "aws_sdk_transcribe"));
-*/
+		// the sdk's logging always goes through the ring, left off unless asked for; the options keep InitAPI from installing its own
+		LogRing::Level sdkLogLevel = LogRing::LEVEL_OFF;
+		if (requestedSdkLogLevel && !LogRing::parseLevel(requestedSdkLogLevel, sdkLogLevel)) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "invalid AWS_TRANSCRIBE_SDK_LOG_LEVEL %s, sdk logging is off\n", requestedSdkLogLevel);
+		}
+		LogRing::initialize(nSdkLogSlots, sdkLogLevel);
+		Aws::Utils::Logging::InitializeAWSLogging(Aws::MakeShared<SdkLogSystem>(ALLOC_TAG));
+
     Aws::InitAPI(options);
 
+		ClientRegistry::initialize(nSdkThreads);
+		StreamExecutor::initialize(nWorkerThreads, std::chrono::milliseconds(nAudioEventMs), flushPartialWindows);
+
 		return SWITCH_STATUS_SUCCESS;
 	}
 	
 	switch_status_t aws_transcribe_cleanup() {
 		Aws::SDKOptions options;
-		/*
-    options.loggingOptions.logLevel = Aws::Utils::Logging::LogLevel::Trace;
-		Aws::Utils::Logging::ShutdownAWSLogging();
-		*/
+
+		if (abandonedStreams > 0) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "aws_transcribe_cleanup %llu streams were abandoned without a final response\n",
+				(unsigned long long) abandonedStreams.load());
+		}
+		StreamExecutor::deinitialize();
+
+		// clients and the executor must be released before the API is shut down
+		ClientRegistry::deinitialize();
     Aws::ShutdownAPI(options);
 
+		Aws::Utils::Logging::ShutdownAWSLogging();
+		LogRing::deinitialize();
+
 		return SWITCH_STATUS_SUCCESS;
 	}
 
+	// sets the sdk log level if one is given, and reports the level and the ring's counters as json
+	char* aws_transcribe_sdk_log(const char* level) {
+		LogRing::Level l;
+		if (level && *level) {
+			if (!LogRing::parseLevel(level, l)) return NULL;
+			LogRing::setLevel(l);
+		}
+		LogRing::Stats stats;
+		LogRing::getStats(stats);
+
+		cJSON* jStats = cJSON_CreateObject();
+		cJSON_AddStringToObject(jStats, "level", LogRing::levelName(stats.level));
+		cJSON_AddNumberToObject(jStats, "logged", (double) stats.logged);
+		cJSON_AddNumberToObject(jStats, "dropped", (double) stats.dropped);
+		char* json = cJSON_PrintUnformatted(jStats);
+		cJSON_Delete(jStats);
+		return json;
+	}
+
 	// start transcribe on a channel
 	switch_status_t aws_transcribe_session_init(switch_core_session_t *session, responseHandler_t responseHandler, 
           uint32_t samples_per_second, uint32_t channels, char* lang, int interim, char* bugname, void **ppUserData
@@ -399,7 +572,6 @@ extern "C" {
 		switch_status_t status = SWITCH_STATUS_SUCCESS;
 		switch_channel_t *channel = switch_core_session_get_channel(session);
 		int err;
-		switch_threadattr_t *thd_attr = NULL;
 		switch_memory_pool_t *pool = switch_core_session_get_pool(session);
 		auto read_codec = switch_core_session_get_read_codec(session);
 		uint32_t sampleRate = read_codec->implementation->actual_samples_per_second;
@@ -491,10 +663,21 @@ extern "C" {
 			}
 		}
 
-		// create a thread to service the http/2 connection to aws
-		switch_threadattr_create(&thd_attr, pool);
-		switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
-		switch_thread_create(&cb->thread, thd_attr, aws_transcribe_thread, cb, pool);
+		// the stream is serviced by the shared executor rather than a thread of its own
+		{
+			GStreamer* streamer = new GStreamer(cb->sessionId, cb->bugname, cb->channels, cb->lang, cb->interim, cb->samples_per_second, cb->region,
+				cb->awsAccessKeyId, cb->awsSecretAccessKey, cb->responseHandler);
+			if (!streamer->hasClient()) {
+				switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "no aws client available, the module is not initialized\n");
+				delete streamer;
+				if (cb->resampler) speex_resampler_destroy(cb->resampler);
+				if (cb->vad) switch_vad_destroy(&cb->vad);
+				status = SWITCH_STATUS_FALSE;
+				goto done;
+			}
+			if (!cb->vad) streamer->connect();
+			cb->streamer = streamer;
+		}
 
 		*ppUserData = cb;
 	
@@ -510,20 +693,14 @@ extern "C" {
 			struct cap_cb *cb = (struct cap_cb *) switch_core_media_bug_get_user_data(bug);
 			switch_status_t st;
 
-			// close connection and get final responses
+			// close connection; the final responses are waited for once the callback mutex is released
 			switch_mutex_lock(cb->mutex);
 			GStreamer* streamer = (GStreamer *) cb->streamer;
+			cb->streamer = nullptr;
 			if (streamer) {
 				switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "aws_transcribe_session_stop: finish..%s\n", bugname);
 				streamer->finish();
 			}
-			if (cb->thread) {
-				switch_status_t retval;
-				switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "aws_transcribe_session_stop: waiting for read thread to complete %s\n", bugname);
-				switch_thread_join(&retval, cb->thread);
-				cb->thread = NULL;
-				switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "aws_transcribe_session_stop: read thread completed %s, %d\n", bugname, retval);
-			}
 			switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "aws_transcribe_session_stop: bugname - %s; going to kill callback\n", bugname);
 			killcb(cb);
 			switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "aws_transcribe_session_stop: bugname - %s; killed callback\n", bugname);
@@ -536,6 +713,17 @@ extern "C" {
 
 			switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "aws_transcribe_session_stop: bugname - %s; unlocking callback mutex\n", bugname);
 			switch_mutex_unlock(cb->mutex);
+
+			if (streamer) {
+				switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "aws_transcribe_session_stop: waiting for stream to finish %s\n", bugname);
+				if (streamer->waitForFinish(std::chrono::milliseconds(nTeardownTimeoutMs))) delete streamer;
+				else {
+					abandonedStreams++;
+					switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+						"aws_transcribe_session_stop: no final response within %u ms for %s, leaving the stream to finish on its own\n", nTeardownTimeoutMs, bugname);
+					if (streamer->abandon()) delete streamer;
+				}
+			}
 			switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "aws_transcribe_session_stop: Closed aws session\n");
 
 			return SWITCH_STATUS_SUCCESS;
@@ -3,6 +3,7 @@
 
 switch_status_t aws_transcribe_init();
 switch_status_t aws_transcribe_cleanup();
+char* aws_transcribe_sdk_log(const char* level);
 switch_status_t aws_transcribe_session_init(switch_core_session_t *session, responseHandler_t responseHandler, 
 		uint32_t samples_per_second, uint32_t channels, char* lang, int interim, char *bugname, void **ppUserData);
 switch_status_t aws_transcribe_session_stop(switch_core_session_t *session, int channelIsClosing, char* bugname);
@@ -0,0 +1,215 @@
+/*
+ * CPU benchmark for sending audio as signed event-stream messages at different aggregation windows.
+ *
+ * For each window, N streams each write the given seconds of 20 ms L16 frames into an AudioRing
+ * sized as the glue sizes it, and every window taken out of the ring is encoded and signed as an
+ * AudioEvent with the sdk's event-stream encoder, as the session's send loop does.  A 20 ms window
+ * is the old one event per frame.  Audio is pushed through as fast as it can be signed, and the
+ * cpu used is reported per stream per second of audio, along with the events signed per second.
+ *
+ * usage: event_signing_bench [options]; see usage() below
+ */
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <time.h>
+
+#include <aws/core/Aws.h>
+#include <aws/core/auth/AWSAuthSigner.h>
+#include <aws/core/auth/AWSCredentialsProvider.h>
+#include <aws/core/utils/event/EventMessage.h>
+#include <aws/core/utils/event/EventStreamEncoder.h>
+
+#include "../audio_ring.hpp"
+
+#define FRAME_MS (20)
+/* as in the glue */
+#define AUDIO_RING_MS (5000)
+
+using aws_transcribe::AudioRing;
+
+namespace {
+  struct Options {
+    unsigned int streams = 100;
+    unsigned int seconds = 10;
+    unsigned int sampleRate = 8000;
+    std::vector<unsigned int> windows = {20, 100, 200};
+    double maxCpuUsecs = 0;
+  };
+
+  struct Result {
+    double cpuUsecsPerStreamSec;
+    double eventsPerStreamSec;
+  };
+
+  static Options opts;
+
+  static void usage(const char* prog) {
+    fprintf(stderr,
+      "usage: %s [options]\n"
+      "  -n, --streams N        number of streams (default 100)\n"
+      "  -d, --seconds SECS     seconds of audio sent on each stream (default 10)\n"
+      "  -r, --rate HZ          8000 or 16000 (default 8000)\n"
+      "  -w, --windows LIST     comma separated aggregation windows in ms, as AWS_TRANSCRIBE_AUDIO_EVENT_MS (default 20,100,200)\n"
+      "      --max-cpu-us N     exit non-zero if the last window costs more than N usecs of cpu per stream per second\n",
+      prog);
+  }
+
+  static bool parseWindows(const char* list) {
+    opts.windows.clear();
+    std::string s(list);
+    size_t pos = 0;
+    while (pos <= s.size()) {
+      size_t comma = s.find(',', pos);
+      if (comma == std::string::npos) comma = s.size();
+      unsigned int ms = ::atoi(s.substr(pos, comma - pos).c_str());
+      if (ms < FRAME_MS || ms % FRAME_MS) return false;
+      opts.windows.push_back(ms);
+      pos = comma + 1;
+    }
+    return !opts.windows.empty();
+  }
+
+  static bool parseArgs(int argc, char** argv) {
+    static const struct option longOpts[] = {
+      {"streams", required_argument, nullptr, 'n'},
+      {"seconds", required_argument, nullptr, 'd'},
+      {"rate", required_argument, nullptr, 'r'},
+      {"windows", required_argument, nullptr, 'w'},
+      {"max-cpu-us", required_argument, nullptr, 1},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0}
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "n:d:r:w:h", longOpts, nullptr)) != -1) {
+      switch (c) {
+        case 'n': opts.streams = ::atoi(optarg); break;
+        case 'd': opts.seconds = ::atoi(optarg); break;
+        case 'r': opts.sampleRate = ::atoi(optarg); break;
+        case 'w': if (!parseWindows(optarg)) return false; break;
+        case 1: opts.maxCpuUsecs = ::atof(optarg); break;
+        default: return false;
+      }
+    }
+    if (opts.streams < 1 || opts.seconds < 1 || (opts.sampleRate != 8000 && opts.sampleRate != 16000)) return false;
+    return true;
+  }
+
+  static double threadCpuSecs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+  /*
+   * One stream's sending side: the ring the media thread writes into, and the signer and
+   * encoder the sdk keeps for the stream, each event's signature chained from the last.
+   */
+  class Stream {
+  public:
+    Stream(std::shared_ptr<Aws::Auth::AWSCredentialsProvider> credentials, size_t windowBytes, size_t numChunks) :
+      m_audio(windowBytes, numChunks), m_signer(credentials, "transcribe", "us-east-1"), m_encoder(&m_signer),
+      m_events(0), m_bytes(0) {
+      m_encoder.SetSignatureSeed("");
+    }
+
+    void write(const std::vector<unsigned char>& frame) {
+      size_t dropped = 0;
+      if (m_audio.write(frame.data(), frame.size(), dropped)) send();
+    }
+
+    // sends every full window, as the send loop does when the media thread wakes it
+    void send() {
+      while (m_audio.read(m_bits, std::chrono::milliseconds(AUDIO_RING_MS))) {
+        Aws::Utils::Event::Message msg;
+        msg.InsertEventHeader(":message-type", Aws::Utils::Event::EventHeaderValue(Aws::String("event")));
+        msg.InsertEventHeader(":event-type", Aws::Utils::Event::EventHeaderValue(Aws::String("AudioEvent")));
+        msg.InsertEventHeader(":content-type", Aws::Utils::Event::EventHeaderValue(Aws::String("application/octet-stream")));
+        msg.WriteEventPayload(m_bits.data(), m_bits.size());
+        m_bytes += m_encoder.EncodeAndSign(msg).size();
+        m_events++;
+      }
+    }
+
+    uint64_t events() const { return m_events; }
+    uint64_t bytes() const { return m_bytes; }
+
+  private:
+    AudioRing m_audio;
+    Aws::Client::AWSAuthEventStreamV4Signer m_signer;
+    Aws::Utils::Event::EventStreamEncoder m_encoder;
+    Aws::Vector<unsigned char> m_bits;
+    uint64_t m_events;
+    uint64_t m_bytes;
+  };
+
+  static Result run(unsigned int windowMs, const std::vector<unsigned char>& frame,
+    std::shared_ptr<Aws::Auth::AWSCredentialsProvider> credentials) {
+    std::vector<std::unique_ptr<Stream> > streams;
+    for (unsigned int i = 0; i < opts.streams; i++) {
+      streams.push_back(std::unique_ptr<Stream>(new Stream(credentials, frame.size() * windowMs / FRAME_MS, AUDIO_RING_MS / windowMs)));
+    }
+
+    // frames are interleaved across streams, as they arrive from the media threads
+    unsigned int nFrames = opts.seconds * 1000 / FRAME_MS;
+    double cpu0 = threadCpuSecs();
+    for (unsigned int f = 0; f < nFrames; f++) {
+      for (auto& stream : streams) stream->write(frame);
+    }
+    double cpu = threadCpuSecs() - cpu0;
+
+    uint64_t events = 0, bytes = 0;
+    for (auto& stream : streams) {
+      events += stream->events();
+      bytes += stream->bytes();
+    }
+    double streamSecs = (double) opts.streams * opts.seconds;
+    Result r;
+    r.cpuUsecsPerStreamSec = 1e6 * cpu / streamSecs;
+    r.eventsPerStreamSec = events / streamSecs;
+    printf("%4u ms window:  %7.1f us cpu per stream per second  %5.1f events per stream per second  %.1f%% framing overhead\n",
+      windowMs, r.cpuUsecsPerStreamSec, r.eventsPerStreamSec,
+      100.0 * (bytes - (double) nFrames * frame.size() * opts.streams) / ((double) nFrames * frame.size() * opts.streams));
+    fflush(stdout);
+    return r;
+  }
+}
+
+int main(int argc, char** argv) {
+  if (!parseArgs(argc, argv)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  Aws::SDKOptions options;
+  Aws::InitAPI(options);
+
+  // a quiet 400 Hz tone
+  std::vector<unsigned char> frame(320 * opts.sampleRate / 8000);
+  int16_t* samples = (int16_t *) frame.data();
+  for (size_t i = 0; i < frame.size() / 2; i++) {
+    samples[i] = (int16_t) (1000 * std::sin(2 * 3.14159265 * 400 * i / opts.sampleRate));
+  }
+
+  auto credentials = Aws::MakeShared<Aws::Auth::SimpleAWSCredentialsProvider>("event_signing_bench", "AKIDEXAMPLE", "secret");
+  printf("event_signing_bench: %u streams, %u seconds of audio each at %u Hz\n", opts.streams, opts.seconds, opts.sampleRate);
+
+  Result last = {0, 0};
+  for (unsigned int windowMs : opts.windows) last = run(windowMs, frame, credentials);
+
+  Aws::ShutdownAPI(options);
+
+  if (opts.maxCpuUsecs > 0 && last.cpuUsecsPerStreamSec > opts.maxCpuUsecs) {
+    fprintf(stderr, "FAIL: %.1f usecs of cpu per stream per second exceeds %.1f\n", last.cpuUsecsPerStreamSec, opts.maxCpuUsecs);
+    return 1;
+  }
+  return 0;
+}
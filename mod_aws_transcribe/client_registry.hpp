@@ -0,0 +1,84 @@
+#ifndef __AWS_TRANSCRIBE_CLIENT_REGISTRY_HPP__
+#define __AWS_TRANSCRIBE_CLIENT_REGISTRY_HPP__
+
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include <aws/core/auth/AWSCredentialsProvider.h>
+#include <aws/core/utils/threading/Executor.h>
+#include <aws/transcribestreaming/TranscribeStreamingServiceClient.h>
+
+namespace aws_transcribe {
+
+/*
+ * Shares streaming clients between sessions instead of constructing one, with its own http
+ * client, credentials chain and executor, for every call.  Clients are kept per region and
+ * credentials and run their streams on pooled executors.  Clients without explicit keys
+ * share a single default credentials chain, which caches what it resolves and refreshes it
+ * before it expires rather than walking the chain for each call.
+ *
+ * An open stream occupies an executor thread for its whole life, so rather than refuse a stream
+ * (or queue it, unstarted, behind the others) once every thread is taken, the registry adds
+ * another executor of the same size and creates clients on it for further streams.  Executors
+ * beyond the first are released once no client on them has been used for a while.  The client
+ * handed out counts as one active stream until the last copy of it is released.
+ */
+class ClientRegistry {
+public:
+  typedef Aws::TranscribeStreamingService::TranscribeStreamingServiceClient Client;
+
+  static void initialize(unsigned int executorThreads);
+  static void deinitialize();
+
+  // an empty key or secret selects the default credentials chain; returns null before initialize
+  static std::shared_ptr<Client> getClient(const std::string& region, const std::string& accessKeyId,
+    const std::string& secretAccessKey);
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  // an executor and the number of its threads carrying a stream
+  struct Pool {
+    std::shared_ptr<Aws::Utils::Threading::Executor> executor;
+    std::atomic<unsigned int> active;
+    unsigned int id;
+  };
+
+  struct Entry {
+    std::shared_ptr<Client> client;
+    std::shared_ptr<Pool> pool;
+    std::atomic<unsigned int> active;
+    Clock::time_point lastUsed;
+  };
+
+  // released along with the last copy of a client returned by getClient
+  struct StreamRef {
+    std::shared_ptr<Entry> entry;
+    ~StreamRef();
+  };
+
+  static void evictIdle(Clock::time_point now);
+  static std::shared_ptr<Pool> availablePool();
+
+  static std::mutex mutex;
+  static std::map<std::string, std::shared_ptr<Entry> > entries;
+  static std::vector<std::shared_ptr<Pool> > pools;
+  static std::shared_ptr<Aws::Auth::AWSCredentialsProvider> defaultCredentials;
+  static unsigned int nExecutorThreads;
+  static std::atomic<unsigned int> activeStreams;
+  static uint64_t clientsCreated;
+  static uint64_t streams;
+  static unsigned int peakStreams;
+  static unsigned int peakPools;
+  static unsigned int nextPoolId;
+  static Clock::time_point lastSweep;
+};
+
+} // namespace aws_transcribe
+#endif
@@ -0,0 +1,82 @@
+#ifndef __AWS_TRANSCRIBE_LOG_RING_HPP__
+#define __AWS_TRANSCRIBE_LOG_RING_HPP__
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace aws_transcribe {
+
+/*
+ * Carries the speech sdk's own log output to the freeswitch log without letting it block
+ * the threads that produce it.  Lines are formatted straight into a fixed ring of slots that
+ * producers claim without taking a lock, and a single thread drains the ring into
+ * switch_log_printf.  If the ring is full the line is dropped and counted rather than
+ * waited for.  The level can be changed at runtime; below it, nothing is formatted at all.
+ */
+class LogRing {
+public:
+  enum Level {
+    LEVEL_OFF = 0,
+    LEVEL_ERROR,
+    LEVEL_WARNING,
+    LEVEL_INFO,
+    LEVEL_DEBUG,
+    LEVEL_TRACE
+  };
+
+  struct Stats {
+    Level level;
+    uint64_t logged;
+    uint64_t dropped;
+  };
+
+  // slots is rounded up to a power of two
+  static void initialize(unsigned int slots, Level level);
+
+  // must be called once the sdk can no longer log
+  static void deinitialize();
+
+  static Level getLevel() { return static_cast<Level>(level.load(std::memory_order_relaxed)); }
+  static void setLevel(Level l);
+  static bool enabled(Level l) { return l != LEVEL_OFF && l <= getLevel(); }
+
+  static void push(Level l, const char* tag, const char* text);
+  static void vpush(Level l, const char* tag, const char* fmt, va_list args);
+
+  static void getStats(Stats& out);
+
+  static bool parseLevel(const char* name, Level& out);
+  static const char* levelName(Level l);
+
+private:
+  struct Slot {
+    std::atomic<size_t> seq;
+    Level level;
+    char tag[32];
+    char text[480];
+  };
+
+  static Slot* claim(size_t& pos);
+  static void publish(Slot* slot, size_t pos);
+  static void worker();
+
+  static Slot* slots;
+  static size_t mask;
+  static std::atomic<size_t> enqueuePos;
+  static size_t dequeuePos;
+  static std::atomic<int> level;
+  static std::atomic<uint64_t> logged;
+  static std::atomic<uint64_t> dropped;
+  static std::thread drainThread;
+  static std::mutex mutex;
+  static std::condition_variable cv;
+  static bool stopFlag;
+};
+
+} // namespace aws_transcribe
+#endif
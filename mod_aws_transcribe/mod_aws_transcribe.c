@@ -200,6 +200,20 @@ SWITCH_STANDARD_API(aws_transcribe_function)
 }
 
 
+#define SDK_LOG_API_SYNTAX "[off|error|warning|info|debug|trace]"
+SWITCH_STANDARD_API(sdk_log_function)
+{
+	char *json = aws_transcribe_sdk_log(zstr(cmd) ? NULL : cmd);
+	if (json) {
+		stream->write_function(stream, "%s\n", json);
+		free(json);
+	}
+	else {
+		stream->write_function(stream, "-USAGE: %s\n", SDK_LOG_API_SYNTAX);
+	}
+	return SWITCH_STATUS_SUCCESS;
+}
+
 SWITCH_MODULE_LOAD_FUNCTION(mod_aws_transcribe_load)
 {
 	switch_api_interface_t *api_interface;
@@ -224,6 +238,13 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_aws_transcribe_load)
 	SWITCH_ADD_API(api_interface, "uuid_aws_transcribe", "AWS Speech Transcription API", aws_transcribe_function, TRANSCRIBE_API_SYNTAX);
 	switch_console_set_complete("add uuid_aws_transcribe start lang-code [interim|final] [stereo|mono]");
 	switch_console_set_complete("add uuid_aws_transcribe stop ");
+	SWITCH_ADD_API(api_interface, "aws_transcribe_sdk_log", "Set or show the AWS sdk log level", sdk_log_function, SDK_LOG_API_SYNTAX);
+	switch_console_set_complete("add aws_transcribe_sdk_log off");
+	switch_console_set_complete("add aws_transcribe_sdk_log error");
+	switch_console_set_complete("add aws_transcribe_sdk_log warning");
+	switch_console_set_complete("add aws_transcribe_sdk_log info");
+	switch_console_set_complete("add aws_transcribe_sdk_log debug");
+	switch_console_set_complete("add aws_transcribe_sdk_log trace");
 
 	/* indicate that the module should continue to be loaded */
 	return SWITCH_STATUS_SUCCESS;
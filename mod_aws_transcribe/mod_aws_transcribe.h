@@ -32,7 +32,6 @@ struct cap_cb {
   SpeexResamplerState *resampler;
 	void* streamer;
 	responseHandler_t responseHandler;
-	switch_thread_t* thread;
 	int interim;
 
 	char lang[MAX_LANG];
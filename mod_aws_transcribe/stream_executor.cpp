@@ -0,0 +1,107 @@
+#include "stream_executor.hpp"
+
+#include <switch.h>
+#include <algorithm>
+
+using namespace aws_transcribe;
+
+std::mutex StreamExecutor::mutex;
+std::condition_variable StreamExecutor::cv;
+std::deque<StreamExecutor::task_t> StreamExecutor::tasks;
+std::vector<std::thread> StreamExecutor::threads;
+std::thread StreamExecutor::timerThread;
+std::condition_variable StreamExecutor::timerCv;
+std::chrono::milliseconds StreamExecutor::tickInterval(0);
+StreamExecutor::task_t StreamExecutor::tick;
+bool StreamExecutor::tickQueued = false;
+uint64_t StreamExecutor::executed = 0;
+uint64_t StreamExecutor::ticks = 0;
+bool StreamExecutor::stopFlag = false;
+
+void StreamExecutor::initialize(unsigned int nThreads, std::chrono::milliseconds interval, task_t onTick) {
+  nThreads = std::max(1U, nThreads);
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    stopFlag = false;
+    executed = ticks = 0;
+    tickInterval = std::max(std::chrono::milliseconds(1), interval);
+    tick = std::move(onTick);
+    tickQueued = false;
+  }
+  for (unsigned int i = 0; i < nThreads; i++) {
+    threads.push_back(std::thread(&StreamExecutor::worker));
+  }
+  timerThread = std::thread(&StreamExecutor::timer);
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "StreamExecutor::initialize %u threads, tick every %u ms\n", nThreads,
+    (unsigned int) tickInterval.count());
+}
+
+void StreamExecutor::deinitialize() {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    stopFlag = true;
+  }
+  cv.notify_all();
+  timerCv.notify_all();
+  if (timerThread.joinable()) timerThread.join();
+  for (auto& t : threads) {
+    if (t.joinable()) t.join();
+  }
+  threads.clear();
+
+  std::lock_guard<std::mutex> lk(mutex);
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "StreamExecutor::deinitialize ran %llu tasks and %llu ticks, %u left queued\n",
+    (unsigned long long) executed, (unsigned long long) ticks, (unsigned int) tasks.size());
+  tasks.clear();
+  tick = nullptr;
+}
+
+void StreamExecutor::post(task_t task) {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    tasks.push_back(std::move(task));
+  }
+  cv.notify_one();
+}
+
+void StreamExecutor::worker() {
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "StreamExecutor::worker starting\n");
+  std::unique_lock<std::mutex> lk(mutex);
+  while (!stopFlag) {
+    if (tasks.empty()) {
+      cv.wait(lk);
+      continue;
+    }
+
+    task_t task = std::move(tasks.front());
+    tasks.pop_front();
+    executed++;
+
+    // another thread may be needed for what is left
+    if (!tasks.empty()) cv.notify_one();
+
+    lk.unlock();
+    task();
+    lk.lock();
+  }
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "StreamExecutor::worker ending\n");
+}
+
+// the one timer for every session; a tick still queued when the next is due is not posted again
+void StreamExecutor::timer() {
+  std::unique_lock<std::mutex> lk(mutex);
+  while (!stopFlag) {
+    if (timerCv.wait_for(lk, tickInterval, [] { return stopFlag; })) break;
+    if (tickQueued || !tick) continue;
+    tickQueued = true;
+    tasks.push_back([] {
+      {
+        std::lock_guard<std::mutex> lk(mutex);
+        tickQueued = false;
+        ticks++;
+      }
+      tick();
+    });
+    cv.notify_one();
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef __AWS_TRANSCRIBE_STREAM_EXECUTOR_HPP__
+#define __AWS_TRANSCRIBE_STREAM_EXECUTOR_HPP__
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+namespace aws_transcribe {
+
+/*
+ * A small fixed pool of threads sending the audio and delivering the transcripts of every
+ * session.  Sessions post work when something happens instead of each parking a thread of its
+ * own on a condition variable for the whole call.  One shared timer posts the tick given to
+ * initialize at a fixed interval, for work that is due by time rather than by an event.
+ *
+ * A task runs on whichever thread is free, so work for one session that must not overlap
+ * has to be serialized by the session itself.
+ */
+class StreamExecutor {
+public:
+  typedef std::function<void()> task_t;
+
+  // tick is posted every tickInterval, unless the last one has not run yet
+  static void initialize(unsigned int nThreads, std::chrono::milliseconds tickInterval, task_t tick);
+  static void deinitialize();
+
+  static void post(task_t task);
+
+private:
+  static void worker();
+  static void timer();
+
+  static std::mutex mutex;
+  static std::condition_variable cv;
+  static std::deque<task_t> tasks;
+  static std::vector<std::thread> threads;
+  static std::thread timerThread;
+  static std::condition_variable timerCv;
+  static std::chrono::milliseconds tickInterval;
+  static task_t tick;
+  static bool tickQueued;
+  static uint64_t executed;
+  static uint64_t ticks;
+  static bool stopFlag;
+};
+
+} // namespace aws_transcribe
+#endif
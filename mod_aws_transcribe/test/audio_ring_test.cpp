@@ -0,0 +1,291 @@
+/*
+ * Stress test of the audio path from the media thread to the transcribe stream: a producer
+ * writes 20 ms frames into an AudioRing while a sender, woken when the session would post a
+ * send (for a full window, or from the shared flush tick once a partly filled one is due), takes
+ * each window out, encodes and signs it as an AudioEvent with the sdk's
+ * event-stream encoder, and writes it to a local stub that decodes and checks every message.
+ * Each frame carries a sequence number, so the stub can tell that no frame was lost or
+ * reordered on the way, and that everything written was either received or counted as
+ * dropped by the ring.  The runs cover a sender keeping up, a sender stalled long enough for
+ * the ring to overflow, and a producer writing as fast as it can.  AudioRing::ready, which the
+ * flush tick relies on, is checked against read on its own.
+ *
+ * The transcript queue inside the glue needs a FreeSWITCH session and is not covered here.
+ *
+ * usage: audio_ring_test; exits non-zero if any check fails
+ */
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <aws/core/Aws.h>
+#include <aws/core/auth/AWSAuthSigner.h>
+#include <aws/core/auth/AWSCredentialsProvider.h>
+#include <aws/core/utils/event/EventMessage.h>
+#include <aws/core/utils/event/EventStreamEncoder.h>
+
+#include "../audio_ring.hpp"
+#include "event_stream_stub.hpp"
+
+/* 8 kHz mono L16, as sent by the media bug */
+#define FRAME_BYTES (320)
+#define FRAME_MS (20)
+/* same sizing as the glue with the default AWS_TRANSCRIBE_AUDIO_EVENT_MS */
+#define AUDIO_EVENT_MS (100)
+#define AUDIO_RING_MS (5000)
+
+using aws_transcribe::AudioRing;
+using test::EventStreamStub;
+
+namespace {
+  unsigned int failures = 0;
+
+  void check(bool ok, const char* what, int line) {
+    if (ok) return;
+    fprintf(stderr, "audio_ring_test:%d: check failed: %s\n", line, what);
+    failures++;
+  }
+  #define CHECK(cond) check((cond), #cond, __LINE__)
+
+  /*
+   * Stands in for the session: write() is the media thread's side, and the sender thread
+   * runs the sends the session posts to the executor, writing signed events to the stub in
+   * place of the sdk's stream.
+   */
+  class Pipeline {
+  public:
+    Pipeline(unsigned short port, size_t numChunks) : m_audio(FRAME_BYTES * AUDIO_EVENT_MS / FRAME_MS, numChunks),
+      m_credentials(Aws::MakeShared<Aws::Auth::SimpleAWSCredentialsProvider>("audio_ring_test", "AKIDEXAMPLE", "secret")),
+      m_signer(m_credentials, "transcribe", "us-east-1"), m_encoder(&m_signer),
+      m_fd(-1), m_ready(false), m_finishing(false), m_paused(false), m_written(0), m_dropped(0) {
+      struct sockaddr_in addr = {};
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      addr.sin_port = htons(port);
+      m_fd = socket(AF_INET, SOCK_STREAM, 0);
+      if (m_fd >= 0 && connect(m_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(m_fd);
+        m_fd = -1;
+      }
+      m_encoder.SetSignatureSeed("");
+      m_sender = std::thread(&Pipeline::sendLoop, this);
+    }
+
+    ~Pipeline() {
+      if (m_sender.joinable()) finish();
+      if (m_fd >= 0) close(m_fd);
+    }
+
+    bool connected() const { return m_fd >= 0; }
+
+    void write(uint32_t seq) {
+      unsigned char frame[FRAME_BYTES];
+      memset(frame, 0x11, sizeof(frame));
+      memcpy(frame, &seq, sizeof(seq));
+
+      size_t dropped = 0;
+      bool ready = m_audio.write(frame, sizeof(frame), dropped);
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_written++;
+      m_dropped += dropped;
+      if (ready) {
+        m_ready = true;
+        m_cond.notify_all();
+      }
+    }
+
+    // holds the sender, as a write blocked on the network would
+    void pause(bool paused) {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_paused = paused;
+      m_cond.notify_all();
+    }
+
+    // sends what is left and ends the stream
+    void finish() {
+      {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_finishing = true;
+        m_paused = false;
+        m_cond.notify_all();
+      }
+      m_sender.join();
+    }
+
+    uint64_t written() {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      return m_written;
+    }
+
+    uint64_t droppedFrames() {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      return m_dropped / FRAME_BYTES;
+    }
+
+  private:
+    void sendLoop() {
+      std::unique_lock<std::mutex> lk(m_mutex);
+      while (true) {
+        m_cond.wait_for(lk, std::chrono::milliseconds(AUDIO_EVENT_MS), [this] { return m_ready || m_finishing; });
+
+        // a timeout stands in for the flush tick, which only posts a send once a partly filled window is due
+        if (!m_ready && !m_finishing && !m_audio.ready(std::chrono::milliseconds(AUDIO_EVENT_MS))) continue;
+        if (m_paused && !m_finishing) {
+          m_cond.wait(lk, [this] { return !m_paused || m_finishing; });
+        }
+        bool finishing = m_finishing;
+        m_ready = false;
+        lk.unlock();
+
+        Aws::Vector<unsigned char> bits;
+        while (m_audio.read(bits, std::chrono::milliseconds(finishing ? 0 : AUDIO_EVENT_MS))) {
+          Aws::Utils::Event::Message msg;
+          msg.InsertEventHeader(":message-type", Aws::Utils::Event::EventHeaderValue(Aws::String("event")));
+          msg.InsertEventHeader(":event-type", Aws::Utils::Event::EventHeaderValue(Aws::String("AudioEvent")));
+          msg.InsertEventHeader(":content-type", Aws::Utils::Event::EventHeaderValue(Aws::String("application/octet-stream")));
+          msg.WriteEventPayload(bits.data(), bits.size());
+          send(m_encoder.EncodeAndSign(msg));
+        }
+        if (finishing) {
+          send(m_encoder.EncodeAndSign(Aws::Utils::Event::Message()));
+          shutdown(m_fd, SHUT_WR);
+          break;
+        }
+        lk.lock();
+      }
+    }
+
+    void send(const Aws::Vector<unsigned char>& bits) {
+      size_t off = 0;
+      while (m_fd >= 0 && off < bits.size()) {
+        ssize_t n = ::send(m_fd, bits.data() + off, bits.size() - off, MSG_NOSIGNAL);
+        if (n <= 0) return;
+        off += n;
+      }
+    }
+
+    AudioRing m_audio;
+    std::shared_ptr<Aws::Auth::AWSCredentialsProvider> m_credentials;
+    Aws::Client::AWSAuthEventStreamV4Signer m_signer;
+    Aws::Utils::Event::EventStreamEncoder m_encoder;
+    int m_fd;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_sender;
+    bool m_ready;
+    bool m_finishing;
+    bool m_paused;
+    uint64_t m_written;
+    size_t m_dropped;
+  };
+
+  // everything written was either received in order or dropped by the ring, and every message decoded
+  void checkAccounting(Pipeline& pipeline) {
+    EventStreamStub::stop();
+    CHECK(EventStreamStub::malformed() == 0);
+    CHECK(EventStreamStub::outOfOrder() == 0);
+    CHECK(EventStreamStub::frames() + pipeline.droppedFrames() == pipeline.written());
+  }
+
+  // ready says whether read would take a chunk, without taking it
+  void readyMatchesRead() {
+    AudioRing ring(4, 4);
+    Aws::Vector<unsigned char> bits;
+    size_t dropped = 0;
+    CHECK(!ring.ready(std::chrono::milliseconds(0)));
+
+    ring.write("ab", 2, dropped);
+    CHECK(!ring.ready(std::chrono::milliseconds(1000)));
+    CHECK(!ring.read(bits, std::chrono::milliseconds(1000)));
+    CHECK(ring.ready(std::chrono::milliseconds(0)));
+
+    ring.write("cd", 2, dropped);
+    CHECK(ring.ready(std::chrono::milliseconds(1000)));
+    CHECK(ring.read(bits, std::chrono::milliseconds(1000)));
+    CHECK(bits.size() == 4);
+    CHECK(!ring.ready(std::chrono::milliseconds(0)));
+    CHECK(0 == dropped);
+  }
+
+  void senderKeepsUp() {
+    unsigned short port = EventStreamStub::start(FRAME_BYTES);
+    CHECK(port != 0);
+    Pipeline pipeline(port, AUDIO_RING_MS / AUDIO_EVENT_MS);
+    CHECK(pipeline.connected());
+
+    // two seconds of audio at ten times real time, then a partial window
+    for (uint32_t seq = 0; seq < 100; seq++) {
+      pipeline.write(seq);
+      std::this_thread::sleep_for(std::chrono::milliseconds(FRAME_MS / 10));
+    }
+    for (uint32_t seq = 100; seq < 102; seq++) pipeline.write(seq);
+    pipeline.finish();
+
+    checkAccounting(pipeline);
+    CHECK(pipeline.droppedFrames() == 0);
+    CHECK(EventStreamStub::frames() == 102);
+    // full windows go out as one event each, rather than one per frame
+    CHECK(EventStreamStub::events() <= 102 / (AUDIO_EVENT_MS / FRAME_MS) + 2);
+  }
+
+  void senderStalls() {
+    unsigned short port = EventStreamStub::start(FRAME_BYTES);
+    CHECK(port != 0);
+    Pipeline pipeline(port, 4);
+    CHECK(pipeline.connected());
+
+    // the ring holds four windows; twice that is written while the sender is held
+    pipeline.pause(true);
+    for (uint32_t seq = 0; seq < 8 * AUDIO_EVENT_MS / FRAME_MS; seq++) pipeline.write(seq);
+    pipeline.pause(false);
+    for (uint32_t seq = 8 * AUDIO_EVENT_MS / FRAME_MS; seq < 12 * AUDIO_EVENT_MS / FRAME_MS; seq++) pipeline.write(seq);
+    pipeline.finish();
+
+    checkAccounting(pipeline);
+    CHECK(pipeline.droppedFrames() > 0);
+  }
+
+  void producerFlatOut() {
+    unsigned short port = EventStreamStub::start(FRAME_BYTES);
+    CHECK(port != 0);
+    Pipeline pipeline(port, AUDIO_RING_MS / AUDIO_EVENT_MS);
+    CHECK(pipeline.connected());
+
+    // whether frames are dropped depends on how fast the sender signs; none may go missing either way
+    for (uint32_t seq = 0; seq < 100000; seq++) pipeline.write(seq);
+    pipeline.finish();
+
+    checkAccounting(pipeline);
+    CHECK(EventStreamStub::frames() > 0);
+  }
+}
+
+int main(int argc, char** argv) {
+  Aws::SDKOptions options;
+  Aws::InitAPI(options);
+
+  readyMatchesRead();
+  senderKeepsUp();
+  senderStalls();
+  producerFlatOut();
+
+  Aws::ShutdownAPI(options);
+
+  if (failures) {
+    fprintf(stderr, "audio_ring_test: %u checks failed\n", failures);
+    return 1;
+  }
+  fprintf(stderr, "audio_ring_test: all checks passed\n");
+  return 0;
+}
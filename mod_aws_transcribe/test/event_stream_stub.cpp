@@ -0,0 +1,204 @@
+#include "event_stream_stub.hpp"
+
+#include <map>
+#include <vector>
+#include <cstring>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <zlib.h>
+
+using namespace test;
+
+std::thread EventStreamStub::serviceThread;
+int EventStreamStub::listenFd = -1;
+size_t EventStreamStub::frameBytes = 0;
+int64_t EventStreamStub::lastSeq = -1;
+std::atomic<uint64_t> EventStreamStub::nEvents(0);
+std::atomic<uint64_t> EventStreamStub::nFrames(0);
+std::atomic<uint64_t> EventStreamStub::nOutOfOrder(0);
+std::atomic<uint64_t> EventStreamStub::nMalformed(0);
+
+/* total length, headers length and prelude crc */
+#define PRELUDE_BYTES (12)
+#define MESSAGE_CRC_BYTES (4)
+#define SIGNATURE_BYTES (32)
+
+namespace {
+  enum HeaderType_t {
+    HEADER_BOOL_TRUE = 0,
+    HEADER_BOOL_FALSE,
+    HEADER_BYTE,
+    HEADER_INT16,
+    HEADER_INT32,
+    HEADER_INT64,
+    HEADER_BYTE_BUF,
+    HEADER_STRING,
+    HEADER_TIMESTAMP,
+    HEADER_UUID
+  };
+
+  struct Header {
+    int type;
+    std::string value;
+  };
+
+  uint32_t be32(const unsigned char* p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+  }
+
+  uint16_t be16(const unsigned char* p) {
+    return (uint16_t) ((p[0] << 8) | p[1]);
+  }
+
+  uint32_t crc(const unsigned char* p, size_t len) {
+    return (uint32_t) crc32(0L, p, (uInt) len);
+  }
+
+  // size of a header value of a fixed-width type, or -1 for types prefixed by a length
+  int fixedWidth(int type) {
+    switch (type) {
+      case HEADER_BOOL_TRUE:
+      case HEADER_BOOL_FALSE: return 0;
+      case HEADER_BYTE: return 1;
+      case HEADER_INT16: return 2;
+      case HEADER_INT32: return 4;
+      case HEADER_INT64:
+      case HEADER_TIMESTAMP: return 8;
+      case HEADER_UUID: return 16;
+      default: return -1;
+    }
+  }
+
+  bool parseHeaders(const unsigned char* p, size_t len, std::map<std::string, Header>& headers) {
+    const unsigned char* end = p + len;
+    while (p < end) {
+      size_t nameLen = *p++;
+      if ((size_t) (end - p) < nameLen + 1) return false;
+      std::string name((const char *) p, nameLen);
+      p += nameLen;
+      Header h;
+      h.type = *p++;
+      int width = fixedWidth(h.type);
+      size_t valueLen;
+      if (width >= 0) valueLen = width;
+      else if (h.type == HEADER_BYTE_BUF || h.type == HEADER_STRING) {
+        if (end - p < 2) return false;
+        valueLen = be16(p);
+        p += 2;
+      }
+      else return false;
+      if ((size_t) (end - p) < valueLen) return false;
+      h.value.assign((const char *) p, valueLen);
+      p += valueLen;
+      headers[name] = h;
+    }
+    return true;
+  }
+
+  bool hasString(const std::map<std::string, Header>& headers, const char* name, const char* value) {
+    auto it = headers.find(name);
+    return it != headers.end() && it->second.type == HEADER_STRING && it->second.value == value;
+  }
+}
+
+unsigned short EventStreamStub::start(size_t bytesPerFrame) {
+  frameBytes = bytesPerFrame;
+  lastSeq = -1;
+  nEvents = 0;
+  nFrames = 0;
+  nOutOfOrder = 0;
+  nMalformed = 0;
+
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  socklen_t addrLen = sizeof(addr);
+  if (listenFd < 0 || bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listenFd, 1) != 0 ||
+    getsockname(listenFd, (struct sockaddr *) &addr, &addrLen) != 0) {
+    return 0;
+  }
+
+  serviceThread = std::thread(&EventStreamStub::serve);
+  return ntohs(addr.sin_port);
+}
+
+void EventStreamStub::stop() {
+  if (serviceThread.joinable()) serviceThread.join();
+  if (listenFd >= 0) close(listenFd);
+  listenFd = -1;
+}
+
+void EventStreamStub::serve() {
+  int fd = accept(listenFd, nullptr, nullptr);
+  if (fd < 0) return;
+
+  std::vector<unsigned char> buf;
+  unsigned char chunk[16384];
+  ssize_t n;
+  while ((n = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+    buf.insert(buf.end(), chunk, chunk + n);
+    size_t offset = 0;
+    while (buf.size() - offset >= PRELUDE_BYTES) {
+      uint32_t total = be32(&buf[offset]);
+      if (total < PRELUDE_BYTES + MESSAGE_CRC_BYTES) {
+        // the framing is lost; nothing after this can be trusted
+        nMalformed++;
+        close(fd);
+        return;
+      }
+      if (buf.size() - offset < total) break;
+      if (!decode(&buf[offset], total, true)) nMalformed++;
+      offset += total;
+    }
+    buf.erase(buf.begin(), buf.begin() + offset);
+  }
+  if (!buf.empty()) nMalformed++;
+  close(fd);
+}
+
+bool EventStreamStub::decode(const unsigned char* p, size_t len, bool outer) {
+  if (len < PRELUDE_BYTES + MESSAGE_CRC_BYTES || be32(p) != len) return false;
+  uint32_t headersLen = be32(p + 4);
+  if (be32(p + 8) != crc(p, 8)) return false;
+  if (be32(p + len - MESSAGE_CRC_BYTES) != crc(p, len - MESSAGE_CRC_BYTES)) return false;
+  if (PRELUDE_BYTES + headersLen + MESSAGE_CRC_BYTES > len) return false;
+
+  std::map<std::string, Header> headers;
+  if (!parseHeaders(p + PRELUDE_BYTES, headersLen, headers)) return false;
+  const unsigned char* payload = p + PRELUDE_BYTES + headersLen;
+  size_t payloadLen = len - PRELUDE_BYTES - headersLen - MESSAGE_CRC_BYTES;
+
+  if (outer) {
+    auto date = headers.find(":date");
+    auto signature = headers.find(":chunk-signature");
+    if (date == headers.end() || date->second.type != HEADER_TIMESTAMP) return false;
+    if (signature == headers.end() || signature->second.type != HEADER_BYTE_BUF || signature->second.value.size() != SIGNATURE_BYTES) {
+      return false;
+    }
+    // a signed message with no payload ends the stream
+    return 0 == payloadLen || decode(payload, payloadLen, false);
+  }
+
+  if (!hasString(headers, ":message-type", "event") || !hasString(headers, ":event-type", "AudioEvent") ||
+    !hasString(headers, ":content-type", "application/octet-stream")) {
+    return false;
+  }
+  nEvents++;
+  audio(payload, payloadLen);
+  return true;
+}
+
+void EventStreamStub::audio(const unsigned char* p, size_t len) {
+  if (len % frameBytes) nMalformed++;
+  for (size_t i = 0; i + frameBytes <= len; i += frameBytes) {
+    uint32_t seq;
+    memcpy(&seq, p + i, sizeof(seq));
+    if ((int64_t) seq <= lastSeq) nOutOfOrder++;
+    lastSeq = seq;
+    nFrames++;
+  }
+}
@@ -0,0 +1,49 @@
+#ifndef __EVENT_STREAM_STUB_HPP__
+#define __EVENT_STREAM_STUB_HPP__
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+namespace test {
+
+  /*
+   * Local stand-in for the receiving end of a transcribe audio stream.  Accepts one
+   * connection and decodes the event-stream messages written to it: each must be a signed
+   * wrapper (a :date and a 32 byte :chunk-signature) around an AudioEvent, with both
+   * prelude and message CRCs intact.  The audio is taken to be frames of frameBytes that
+   * start with a 32 bit sequence number, so that frames lost or reordered between the
+   * writer and the stub can be told apart from frames the writer chose to drop.
+   */
+  class EventStreamStub {
+  public:
+    // listens on an ephemeral port on the loopback interface; returns the port, or 0 on failure
+    static unsigned short start(size_t frameBytes);
+
+    // waits for the writer to close the connection
+    static void stop();
+
+    static uint64_t events() { return nEvents.load(); }
+    static uint64_t frames() { return nFrames.load(); }
+    static uint64_t outOfOrder() { return nOutOfOrder.load(); }
+    static uint64_t malformed() { return nMalformed.load(); }
+
+  private:
+    static void serve();
+    static bool decode(const unsigned char* p, size_t len, bool outer);
+    static void audio(const unsigned char* p, size_t len);
+
+    static std::thread serviceThread;
+    static int listenFd;
+    static size_t frameBytes;
+    static int64_t lastSeq;
+    static std::atomic<uint64_t> nEvents;
+    static std::atomic<uint64_t> nFrames;
+    static std::atomic<uint64_t> nOutOfOrder;
+    static std::atomic<uint64_t> nMalformed;
+  };
+
+} // namespace test
+
+#endif
@@ -11,14 +11,28 @@
 #include <sstream>
 #include <deque>
 #include <memory>
+#include <atomic>
+#include <future>
+#include <algorithm>
 
 #include <speechapi_cxx.h>
+#include <speechapi_cxx_diagnostics_logging.h>
 
 #include "mod_azure_transcribe.h"
 #include "simple_buffer.h"
+#include "teardown_executor.hpp"
+#include "log_ring.hpp"
+#include "config_cache.hpp"
+#include "ogg_opus_encoder.hpp"
+#include "write_worker.hpp"
 
 #define CHUNKSIZE (320)
 #define DEFAULT_SPEECH_TIMEOUT "180000"
+#define DEFAULT_OPUS_BITRATE (16000)
+
+/* audio is queued for the writer threads in 20 ms frames of 8 kHz 16 bit pcm */
+#define WRITE_FRAME_MS (20)
+#define WRITE_FRAME_BYTES (320)
 
 using namespace Microsoft::CognitiveServices::Speech;
 using namespace Microsoft::CognitiveServices::Speech::Audio;
@@ -32,6 +46,46 @@ static const char* proxyIP = std::getenv("JAMBONES_HTTP_PROXY_IP");
 static const char* proxyPort = std::getenv("JAMBONES_HTTP_PROXY_PORT");
 static const char* proxyUsername = std::getenv("JAMBONES_HTTP_PROXY_USERNAME");
 static const char* proxyPassword = std::getenv("JAMBONES_HTTP_PROXY_PASSWORD");
+static const char* requestedTeardownMaxPending = std::getenv("MOD_TRANSCRIBE_TEARDOWN_MAX_PENDING");
+static unsigned int nTeardownMaxPending = std::max(1, requestedTeardownMaxPending ? ::atoi(requestedTeardownMaxPending) : 1000);
+static const char* requestedTeardownTimeoutMs = std::getenv("MOD_TRANSCRIBE_TEARDOWN_TIMEOUT_MS");
+static unsigned int nTeardownTimeoutMs = std::max(100, requestedTeardownTimeoutMs ? ::atoi(requestedTeardownTimeoutMs) : 5000);
+static const char* requestedSdkLogLevel = std::getenv("AZURE_SDK_LOG_LEVEL");
+static const char* requestedSdkLogSlots = std::getenv("AZURE_SDK_LOG_SLOTS");
+static unsigned int nSdkLogSlots = std::max(16, requestedSdkLogSlots ? ::atoi(requestedSdkLogSlots) : 1024);
+static const char* requestedConfigCacheSize = std::getenv("AZURE_SPEECH_CONFIG_CACHE_SIZE");
+static unsigned int nConfigCacheSize = std::max(0, requestedConfigCacheSize ? ::atoi(requestedConfigCacheSize) : 64);
+static const char* requestedWriteThreads = std::getenv("AZURE_WRITE_THREADS");
+static unsigned int nWriteThreads = std::max(1, requestedWriteThreads ? ::atoi(requestedWriteThreads) : 4);
+static const char* requestedWriteQueueMs = std::getenv("AZURE_WRITE_QUEUE_MS");
+static unsigned int nWriteQueueMs = std::max(WRITE_FRAME_MS, requestedWriteQueueMs ? ::atoi(requestedWriteQueueMs) : 2000);
+static const char* requestedWriteStallMs = std::getenv("AZURE_WRITE_STALL_MS");
+static unsigned int nWriteStallMs = std::max(1, requestedWriteStallMs ? ::atoi(requestedWriteStallMs) : 100);
+
+using azure::LogRing;
+
+// the event logger does not say what level a line was logged at, so it is read from the line itself
+static LogRing::Level sdkLineLevel(const std::string& line) {
+	if (std::string::npos != line.find("ERROR")) return LogRing::LEVEL_ERROR;
+	if (std::string::npos != line.find("WARNING")) return LogRing::LEVEL_WARNING;
+	if (std::string::npos != line.find("VERBOSE")) return LogRing::LEVEL_DEBUG;
+	return LogRing::LEVEL_INFO;
+}
+
+// points the sdk's event logger at the LogRing, or detaches it so the sdk does no logging work at all
+static void applySdkLogLevel(LogRing::Level level) {
+	using namespace Microsoft::CognitiveServices::Speech::Diagnostics::Logging;
+	if (LogRing::LEVEL_OFF == level) {
+		EventLogger::SetCallback(nullptr);
+		return;
+	}
+	EventLogger::SetLevel(LogRing::LEVEL_ERROR == level ? Level::Error :
+		LogRing::LEVEL_WARNING == level ? Level::Warning :
+		LogRing::LEVEL_INFO == level ? Level::Info : Level::Verbose);
+	EventLogger::SetCallback([](std::string line) {
+		LogRing::push(sdkLineLevel(line), "azure_sdk", line.c_str());
+	});
+}
 
 class GStreamer {
 public:
@@ -47,7 +101,7 @@ public:
 		responseHandler_t responseHandler
   ) : m_sessionId(sessionId), m_bugname(bugname), m_finished(false), m_stopped(false), m_interim(interim), 
 	 m_connected(false), m_connecting(false), m_audioBuffer(320 * (samples_per_second == 8000 ? 1 : 2), 15),
-	m_responseHandler(responseHandler) {
+	m_responseHandler(responseHandler), m_inputClosed(false), m_pushClosed(false) {
 
 		switch_core_session_t* psession = switch_core_session_locate(sessionId);
 		if (!psession) throw std::invalid_argument( "session id no longer active" );
@@ -61,33 +115,45 @@ public:
 		const char* endpointId = switch_channel_get_variable(channel, "AZURE_SERVICE_ENDPOINT_ID");
 
 		auto sourceLanguageConfig = SourceLanguageConfig::FromLanguage(lang);
-		auto format = AudioStreamFormat::GetWaveFormatPCM(8000, 16, channels);
 		auto options = AudioProcessingOptions::Create(AUDIO_INPUT_PROCESSING_ENABLE_DEFAULT);
-		auto speechConfig = nullptr != endpoint ? 
-			(nullptr != subscriptionKey ?
-				SpeechConfig::FromEndpoint(endpoint, subscriptionKey) :
-				SpeechConfig::FromEndpoint(endpoint)) :
-			SpeechConfig::FromSubscription(subscriptionKey, region);
-		if (switch_true(switch_channel_get_variable(channel, "AZURE_USE_OUTPUT_FORMAT_DETAILED"))) {
-			speechConfig->SetOutputFormat(OutputFormat::Detailed);
-		}
-		if (nullptr != endpointId) {
-      switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG, "setting endpoint id: %s\n", endpointId);
-			speechConfig->SetEndpointId(endpointId);
-		}
-		if (!sdkInitialized && sdkLog) {
-			sdkInitialized = true;
-			speechConfig->SetProperty(PropertyId::Speech_LogFilename, sdkLog);
-		}
-		if (switch_true(switch_channel_get_variable(channel, "AZURE_AUDIO_LOGGING"))) {
-			speechConfig->EnableAudioLogging();
-		}
-
-    if (nullptr != proxyIP && nullptr != proxyPort) {
-      switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG, "setting proxy: %s:%s\n", proxyIP, proxyPort);
-      speechConfig->SetProxy(proxyIP, atoi(proxyPort), proxyUsername, proxyPassword);
-    }
 
+		// the config is shared by every session with the same credentials, so session settings go on the recognizer below
+		auto speechConfig = azure::ConfigCache::get(subscriptionKey ? subscriptionKey : "", region ? region : "", endpoint ? endpoint : "",
+			[endpoint, subscriptionKey, region]() {
+				auto config = nullptr != endpoint ? 
+					(nullptr != subscriptionKey ?
+						SpeechConfig::FromEndpoint(endpoint, subscriptionKey) :
+						SpeechConfig::FromEndpoint(endpoint)) :
+					SpeechConfig::FromSubscription(subscriptionKey, region);
+				if (!sdkInitialized && sdkLog) {
+					sdkInitialized = true;
+					config->SetProperty(PropertyId::Speech_LogFilename, sdkLog);
+				}
+				if (nullptr != proxyIP && nullptr != proxyPort) {
+					switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "setting proxy: %s:%s\n", proxyIP, proxyPort);
+					config->SetProxy(proxyIP, atoi(proxyPort), proxyUsername, proxyPassword);
+				}
+				return config;
+			});
+
+		// audio can be sent opus encoded in an ogg container rather than as raw pcm
+		const char* encoding = switch_channel_get_variable(channel, "AZURE_AUDIO_ENCODING");
+		if (encoding && 0 == strcasecmp(encoding, "opus")) {
+			const char* bitrate = switch_channel_get_variable(channel, "AZURE_OPUS_BITRATE");
+			if (channels != 1) {
+				switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_WARNING, "opus encoding is only supported for mono audio, sending pcm\n");
+			}
+			else {
+				m_encoder.reset(new azure::OggOpusEncoder());
+				if (!m_encoder->init(bitrate ? atoi(bitrate) : DEFAULT_OPUS_BITRATE)) {
+					switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_WARNING, "no opus codec loaded (is mod_opus loaded?), sending pcm\n");
+					m_encoder.reset();
+				}
+			}
+		}
+		auto format = m_encoder ?
+			AudioStreamFormat::GetCompressedFormat(AudioStreamContainerFormat::OGG_OPUS) :
+			AudioStreamFormat::GetWaveFormatPCM(8000, 16, channels);
 		m_pushStream = AudioInputStream::CreatePushStream(format);
 		auto audioConfig = AudioConfig::FromStreamInput(m_pushStream);
 
@@ -115,6 +181,17 @@ public:
 		// set properties 
 		auto &properties = m_recognizer->Properties;
 
+		if (switch_true(switch_channel_get_variable(channel, "AZURE_USE_OUTPUT_FORMAT_DETAILED"))) {
+			properties.SetProperty(PropertyId::SpeechServiceResponse_RequestDetailedResultTrueFalse, TrueString);
+		}
+		if (nullptr != endpointId) {
+      switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG, "setting endpoint id: %s\n", endpointId);
+			properties.SetProperty(PropertyId::SpeechServiceConnection_EndpointId, endpointId);
+		}
+		if (switch_true(switch_channel_get_variable(channel, "AZURE_AUDIO_LOGGING"))) {
+			properties.SetProperty(PropertyId::SpeechServiceConnection_EnableAudioLogging, TrueString);
+		}
+
 		// profanity options: Allowed values are "masked", "removed", and "raw".
 		const char* profanity = switch_channel_get_variable(channel, "AZURE_PROFANITY_OPTION");
 		if (profanity) {
@@ -164,6 +241,8 @@ public:
 				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer: got session stopped from microsoft\n");
 				switch_core_session_rwunlock(psession);
 			}
+			// last, since a stopped session may be released as soon as the teardown executor is signalled
+			azure::TeardownExecutor::notify();
 		};
 		auto onSpeechStartDetected = [this, responseHandler](const RecognitionEventArgs& args) {
 			switch_core_session_t* psession = switch_core_session_locate(m_sessionId.c_str());
@@ -239,11 +318,18 @@ public:
 		m_recognizer->Recognized += onRecognitionEvent;
 		m_recognizer->Canceled += onCanceled;
 
+		// added last, since the writer threads may call back into us as soon as it is added
+		m_writer = azure::WriteWorker::add(m_sessionId + " (" + m_bugname + ")", WRITE_FRAME_BYTES * channels,
+			nWriteQueueMs / WRITE_FRAME_MS, [this](const unsigned char* data, size_t len) {
+				writeToService(data, len);
+			});
+
 		switch_core_session_rwunlock(psession);
 	}
 
 	~GStreamer() {
 		//switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::~GStreamer %p\n", this);		
+		azure::WriteWorker::remove(m_writer);
 	}
 
 	void connect() {
@@ -257,20 +343,9 @@ public:
 			switch_core_session_t* psession = switch_core_session_locate(m_sessionId.c_str());
 			if (psession) {
 				auto sessionId = args.SessionId;
-				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer got session started from microsoft\n");
-
-				// send any buffered audio
-				int nFrames = m_audioBuffer.getNumItems();
-				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p got session started from azure, %d buffered frames\n", this, nFrames);	
-				if (nFrames) {
-					char *p;
-					do {
-						p = m_audioBuffer.getNextChunk();
-						if (p) {
-							write(p, CHUNKSIZE);
-						}
-					} while (p);
-				}
+				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p got session started from azure\n", this);
+
+				// any buffered audio is queued by the media thread ahead of its next frame
 				switch_core_session_rwunlock(psession);
 			}
 		};
@@ -279,6 +354,19 @@ public:
 
 	}
 
+	// opens the service connection while waiting for vad, so that it is ready by the time speech starts
+	void preconnect() {
+		if (m_connecting || m_connection) return;
+
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer:preconnect %p opening connection to azure speech..\n", this);
+		std::string sessionId = m_sessionId;
+		m_connection = Connection::FromRecognizer(m_recognizer);
+		m_connection->Connected += [sessionId](const ConnectionEventArgs& args) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %s connection opened ahead of recognition\n", sessionId.c_str());
+		};
+		m_connection->Open(true);
+	}
+
 	bool write(void* data, uint32_t datalen) {
 		if (m_finished) {
 			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::write not writing because we are finished, %p\n", this);
@@ -291,16 +379,47 @@ public:
       return true;
     }
 
-    m_pushStream->Write(static_cast<uint8_t*>(data), datalen);
+		// the push stream is written by the writer threads, so a stalled write never holds up the media thread
+		if (m_audioBuffer.getNumItems()) {
+			char *p;
+			while ((p = m_audioBuffer.getNextChunk())) m_writer->write(p, CHUNKSIZE);
+		}
+		m_writer->write(data, datalen);
 		return true;
 	}
 
-	void finish() {
+	// returns at once: a writer thread writes out the queued audio, for at most as long as the queue holds,
+	// then closes the push stream and asks for the final results; see isFinishComplete
+	void finishAsync() {
 		if (m_finished) return;
-		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::finish - calling  StopContinuousRecognitionAsync (%p)\n", this);
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::finishAsync - flushing audio before StopContinuousRecognitionAsync (%p)\n", this);
 		m_finished = true;
-		m_recognizer->StopContinuousRecognitionAsync().get();
-		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "GStreamer::finish - recognition has completed (%p)\n", this);
+		azure::WriteWorker::close(m_writer, std::chrono::milliseconds(nWriteQueueMs), [this] {
+			bool closed = closePushStream(true);
+			{
+				std::lock_guard<std::mutex> lk(m_stopMutex);
+				// nothing to stop if recognition never started, or if a forced close got here first
+				if (closed && m_connecting) m_stopped_future = m_recognizer->StopContinuousRecognitionAsync().share();
+				m_inputClosed = true;
+			}
+			azure::TeardownExecutor::notify();
+		});
+	}
+
+	// complete once the input is closed and the session has stopped, which is signalled to the teardown executor
+	bool isFinishComplete() {
+		std::lock_guard<std::mutex> lk(m_stopMutex);
+		return m_inputClosed && (m_stopped || !m_stopped_future.valid() ||
+			m_stopped_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+	}
+
+	// called by the teardown executor when the final results do not arrive in time: drops any audio still
+	// queued and closes the service connection, after which the session stops
+	void forceClose() {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::forceClose - closing push stream and connection (%p)\n", this);
+		closePushStream(false);
+		std::shared_ptr<Connection> connection = m_connection ? m_connection : Connection::FromRecognizer(m_recognizer);
+		connection->Close();
 	}
 
 	bool isStopped() {
@@ -312,19 +431,56 @@ public:
   }
 
 private:
+	// called from the writer threads, one frame at a time
+	void writeToService(const unsigned char* data, size_t len) {
+		// written under the lock, so that pages reach the push stream in the order they were made and nothing follows the close
+		std::lock_guard<std::mutex> lk(m_pushMutex);
+		if (m_pushClosed) return;
+		if (m_encoder) {
+			std::string pages;
+			m_encoder->encode(data, len, pages);
+			if (!pages.empty()) m_pushStream->Write(reinterpret_cast<uint8_t*>(&pages[0]), pages.size());
+			return;
+		}
+		m_pushStream->Write(const_cast<uint8_t*>(data), len);
+	}
+
+	// returns false if the push stream was already closed; unless forced, the last packets go out first
+	// on a page flagged end of stream
+	bool closePushStream(bool flush) {
+		std::lock_guard<std::mutex> lk(m_pushMutex);
+		if (m_pushClosed) return false;
+		if (flush && m_encoder) {
+			std::string pages;
+			m_encoder->finish(pages);
+			if (!pages.empty()) m_pushStream->Write(reinterpret_cast<uint8_t*>(&pages[0]), pages.size());
+		}
+		m_pushStream->Close();
+		m_pushClosed = true;
+		return true;
+	}
+
 	std::string m_sessionId;
 	std::string m_bugname;
 	std::string  m_region;
 	std::shared_ptr<SpeechRecognizer> m_recognizer;
+	std::shared_ptr<Connection> m_connection;
 	std::shared_ptr<PushAudioInputStream> m_pushStream;
+	std::unique_ptr<azure::OggOpusEncoder> m_encoder;
+	std::mutex m_pushMutex;
+	bool m_pushClosed;
+	std::shared_ptr<azure::WriteWorker::Writer> m_writer;
 
 	responseHandler_t m_responseHandler;
 	bool m_interim;
 	bool m_finished;
-	bool m_connected;
+	std::atomic<bool> m_connected;
 	bool m_connecting;
-	bool m_stopped;
+	std::atomic<bool> m_stopped;
 	SimpleBuffer m_audioBuffer;
+	std::mutex m_stopMutex;
+	bool m_inputClosed;
+	std::shared_future<void> m_stopped_future;
 };
 
 static void reaper(struct cap_cb *cb) {
@@ -332,10 +488,12 @@ static void reaper(struct cap_cb *cb) {
 	pStreamer.reset((GStreamer *)cb->streamer);
 	cb->streamer = nullptr;
 
-	std::thread t([pStreamer]{
-		pStreamer->finish();
-	});
-	t.detach();
+	// the teardown executor releases the recognizer once the final results are in, or closes it when they are late
+	pStreamer->finishAsync();
+	std::string tag = std::string(cb->sessionId) + " (" + cb->bugname + ")";
+	azure::TeardownExecutor::submit(tag, pStreamer,
+		[pStreamer] { return pStreamer->isFinishComplete(); },
+		[pStreamer] { pStreamer->forceClose(); });
 }
 
 static void killcb(struct cap_cb* cb) {
@@ -367,13 +525,78 @@ extern "C" {
 		else {
 			hasDefaultCredentials = true;
 		}
+		azure::TeardownExecutor::initialize(nTeardownMaxPending, nTeardownTimeoutMs);
+		azure::ConfigCache::initialize(nConfigCacheSize);
+		azure::WriteWorker::initialize(nWriteThreads, nWriteStallMs);
+
+		LogRing::Level sdkLogLevel = LogRing::LEVEL_OFF;
+		if (requestedSdkLogLevel && !LogRing::parseLevel(requestedSdkLogLevel, sdkLogLevel)) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "invalid AZURE_SDK_LOG_LEVEL %s, sdk logging is off\n", requestedSdkLogLevel);
+		}
+		LogRing::initialize(nSdkLogSlots, sdkLogLevel);
+		applySdkLogLevel(sdkLogLevel);
 		return SWITCH_STATUS_SUCCESS;
 	}
 	
 	switch_status_t azure_transcribe_cleanup() {
+		azure::TeardownExecutor::deinitialize();
+		azure::WriteWorker::deinitialize();
+		azure::ConfigCache::deinitialize();
+
+		applySdkLogLevel(LogRing::LEVEL_OFF);
+		LogRing::deinitialize();
 		return SWITCH_STATUS_SUCCESS;
 	}
 
+	// sets the sdk log level if one is given, and reports the level and the ring's counters as json
+	char* azure_transcribe_sdk_log(const char* level) {
+		LogRing::Level l;
+		if (level && *level) {
+			if (!LogRing::parseLevel(level, l)) return NULL;
+			LogRing::setLevel(l);
+			applySdkLogLevel(l);
+		}
+		LogRing::Stats stats;
+		LogRing::getStats(stats);
+
+		cJSON* jStats = cJSON_CreateObject();
+		cJSON_AddStringToObject(jStats, "level", LogRing::levelName(stats.level));
+		cJSON_AddNumberToObject(jStats, "logged", (double) stats.logged);
+		cJSON_AddNumberToObject(jStats, "dropped", (double) stats.dropped);
+		char* json = cJSON_PrintUnformatted(jStats);
+		cJSON_Delete(jStats);
+		return json;
+	}
+
+	// reports the writer threads' counters as json
+	char* azure_transcribe_stats() {
+		azure::WriteWorker::Stats writes;
+		azure::WriteWorker::getStats(writes);
+
+		cJSON* jStats = cJSON_CreateObject();
+		cJSON* jWrites = cJSON_CreateObject();
+		cJSON_AddNumberToObject(jWrites, "writers", writes.writers);
+		cJSON_AddNumberToObject(jWrites, "frames", (double) writes.frames);
+		cJSON_AddNumberToObject(jWrites, "dropped", (double) writes.dropped);
+		cJSON_AddNumberToObject(jWrites, "discarded", (double) writes.discarded);
+		cJSON_AddNumberToObject(jWrites, "stalls", (double) writes.stalls);
+		cJSON_AddItemToObject(jStats, "writes", jWrites);
+
+		azure::TeardownExecutor::Stats teardowns;
+		azure::TeardownExecutor::getStats(teardowns);
+		cJSON* jTeardowns = cJSON_CreateObject();
+		cJSON_AddNumberToObject(jTeardowns, "pending", teardowns.pending);
+		cJSON_AddNumberToObject(jTeardowns, "submitted", (double) teardowns.submitted);
+		cJSON_AddNumberToObject(jTeardowns, "completed", (double) teardowns.completed);
+		cJSON_AddNumberToObject(jTeardowns, "timedOut", (double) teardowns.timedOut);
+		cJSON_AddNumberToObject(jTeardowns, "overflowed", (double) teardowns.overflowed);
+		cJSON_AddNumberToObject(jTeardowns, "abandoned", (double) teardowns.abandoned);
+		cJSON_AddItemToObject(jStats, "teardowns", jTeardowns);
+		char* json = cJSON_PrintUnformatted(jStats);
+		cJSON_Delete(jStats);
+		return json;
+	}
+
 	// start transcribe on a channel
 	switch_status_t azure_transcribe_session_init(switch_core_session_t *session, responseHandler_t responseHandler, 
           uint32_t samples_per_second, uint32_t channels, char* lang, int interim, char* bugname, void **ppUserData
@@ -468,6 +691,7 @@ extern "C" {
 			streamer = new GStreamer(sessionId, bugname, channels, lang, interim, sampleRate, cb->region, subscriptionKey, responseHandler);
 			cb->streamer = streamer;
 			if (!cb->vad) streamer->connect();
+			else if (switch_channel_var_true(channel, "AZURE_PRECONNECT")) streamer->preconnect();
 		} catch (std::exception& e) {
 			switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "%s: Error initializing gstreamer: %s.\n", 
 				switch_channel_get_name(channel), e.what());
@@ -3,6 +3,8 @@
 
 switch_status_t azure_transcribe_init();
 switch_status_t azure_transcribe_cleanup();
+char* azure_transcribe_sdk_log(const char* level);
+char* azure_transcribe_stats();
 switch_status_t azure_transcribe_session_init(switch_core_session_t *session, responseHandler_t responseHandler, 
 		uint32_t samples_per_second, uint32_t channels, char* lang, int interim,  char* bugname, void **ppUserData);
 switch_status_t azure_transcribe_session_stop(switch_core_session_t *session, int channelIsClosing, char* bugname);
@@ -0,0 +1,189 @@
+/*
+ * CPU and bandwidth benchmark for sending a session's audio to azure as Ogg Opus rather than pcm.
+ *
+ * For each bitrate, N encoders each take the given seconds of 20 ms frames of 8 kHz speech-like
+ * audio, as the media bug hands them to the session, and produce the pages that would be
+ * written to the push stream, ending with finish().  Frames are pushed through as fast as they
+ * can be encoded.  The report gives the cpu used per stream per second of audio, the bytes
+ * sent per second against the 16000 of raw pcm, and the resulting compression ratio.
+ *
+ * usage: ogg_opus_bench [options]; see usage() below
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <time.h>
+
+#include "../ogg_opus_encoder.hpp"
+
+#define FRAME_MS (20)
+#define SAMPLE_RATE (8000)
+#define FRAME_BYTES (SAMPLE_RATE / 1000 * FRAME_MS * 2)
+
+using azure::OggOpusEncoder;
+
+namespace {
+  struct Options {
+    unsigned int streams = 100;
+    unsigned int seconds = 10;
+    std::vector<unsigned int> bitrates = {16000, 24000, 32000};
+    double maxCpuUsecs = 0;
+    double minRatio = 0;
+  };
+
+  struct Result {
+    double cpuUsecsPerStreamSec;
+    double ratio;
+  };
+
+  static Options opts;
+
+  static void usage(const char* prog) {
+    fprintf(stderr,
+      "usage: %s [options]\n"
+      "  -n, --streams N        number of streams (default 100)\n"
+      "  -d, --seconds SECS     seconds of audio encoded on each stream (default 10)\n"
+      "  -b, --bitrates LIST    comma separated bitrates, as AZURE_OPUS_BITRATE (default 16000,24000,32000)\n"
+      "      --max-cpu-us N     exit non-zero if any bitrate costs more than N usecs of cpu per stream per second\n"
+      "      --min-ratio N      exit non-zero if any bitrate sends more than 1/N of the raw pcm\n",
+      prog);
+  }
+
+  static bool parseBitrates(const char* list) {
+    opts.bitrates.clear();
+    std::string s(list);
+    size_t pos = 0;
+    while (pos <= s.size()) {
+      size_t comma = s.find(',', pos);
+      if (comma == std::string::npos) comma = s.size();
+      int bitrate = ::atoi(s.substr(pos, comma - pos).c_str());
+      if (bitrate < 6000) return false;
+      opts.bitrates.push_back(bitrate);
+      pos = comma + 1;
+    }
+    return !opts.bitrates.empty();
+  }
+
+  static bool parseArgs(int argc, char** argv) {
+    static const struct option longOpts[] = {
+      {"streams", required_argument, nullptr, 'n'},
+      {"seconds", required_argument, nullptr, 'd'},
+      {"bitrates", required_argument, nullptr, 'b'},
+      {"max-cpu-us", required_argument, nullptr, 1},
+      {"min-ratio", required_argument, nullptr, 2},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0}
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "n:d:b:h", longOpts, nullptr)) != -1) {
+      switch (c) {
+        case 'n': opts.streams = ::atoi(optarg); break;
+        case 'd': opts.seconds = ::atoi(optarg); break;
+        case 'b': if (!parseBitrates(optarg)) return false; break;
+        case 1: opts.maxCpuUsecs = ::atof(optarg); break;
+        case 2: opts.minRatio = ::atof(optarg); break;
+        default: return false;
+      }
+    }
+    return opts.streams >= 1 && opts.seconds >= 1;
+  }
+
+  static double threadCpuSecs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+  // a second of voiced, syllable-paced audio with a little noise, so that the encoder has real work to do
+  static std::string speechLike() {
+    std::string pcm(SAMPLE_RATE * 2, '\0');
+    int16_t* samples = (int16_t *) &pcm[0];
+    unsigned int seed = 1;
+    for (unsigned int i = 0; i < SAMPLE_RATE; i++) {
+      double t = (double) i / SAMPLE_RATE;
+      double envelope = 0.5 * (1 + std::sin(2 * 3.14159265 * 4 * t));
+      double voice = std::sin(2 * 3.14159265 * 140 * t) + 0.5 * std::sin(2 * 3.14159265 * 280 * t) +
+        0.25 * std::sin(2 * 3.14159265 * 700 * t + std::sin(2 * 3.14159265 * 3 * t));
+      seed = seed * 1103515245 + 12345;
+      double noise = ((seed >> 16) & 0x7fff) / 32768.0 - 0.5;
+      samples[i] = (int16_t) (6000 * envelope * voice + 300 * noise);
+    }
+    return pcm;
+  }
+
+  static Result run(unsigned int bitrate, const std::string& pcm, bool report) {
+    std::vector<std::unique_ptr<OggOpusEncoder> > encoders;
+    for (unsigned int i = 0; i < opts.streams; i++) {
+      encoders.push_back(std::unique_ptr<OggOpusEncoder>(new OggOpusEncoder()));
+      if (!encoders.back()->init(bitrate)) {
+        fprintf(stderr, "ogg_opus_bench: could not create an opus encoder\n");
+        exit(1);
+      }
+    }
+
+    // frames are interleaved across streams, as they arrive from the media threads
+    std::string pages;
+    unsigned int nFrames = opts.seconds * 1000 / FRAME_MS;
+    double cpu0 = threadCpuSecs();
+    for (unsigned int f = 0; f < nFrames; f++) {
+      const char* frame = pcm.data() + (f * FRAME_BYTES) % pcm.size();
+      for (auto& encoder : encoders) {
+        pages.clear();
+        encoder->encode(frame, FRAME_BYTES, pages);
+      }
+    }
+    for (auto& encoder : encoders) {
+      pages.clear();
+      encoder->finish(pages);
+    }
+    double cpu = threadCpuSecs() - cpu0;
+
+    uint64_t in = 0, out = 0;
+    for (auto& encoder : encoders) {
+      in += encoder->bytesIn();
+      out += encoder->bytesOut();
+    }
+    double streamSecs = (double) opts.streams * opts.seconds;
+    Result r;
+    r.cpuUsecsPerStreamSec = 1e6 * cpu / streamSecs;
+    r.ratio = out ? (double) in / out : 0;
+    if (!report) return r;
+    printf("%6u bps:  %7.1f us cpu per stream per second  %6.0f bytes sent per second (pcm %u)  %.1f:1\n",
+      bitrate, r.cpuUsecsPerStreamSec, out / streamSecs, SAMPLE_RATE * 2, r.ratio);
+    fflush(stdout);
+    return r;
+  }
+}
+
+int main(int argc, char** argv) {
+  if (!parseArgs(argc, argv)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::string pcm = speechLike();
+  printf("ogg_opus_bench: %u streams, %u seconds of 8 kHz audio each\n", opts.streams, opts.seconds);
+
+  // an unreported pass first, so that the first bitrate is not charged for warming the caches
+  run(opts.bitrates[0], pcm, false);
+
+  int rc = 0;
+  for (unsigned int bitrate : opts.bitrates) {
+    Result r = run(bitrate, pcm, true);
+    if (opts.maxCpuUsecs > 0 && r.cpuUsecsPerStreamSec > opts.maxCpuUsecs) {
+      fprintf(stderr, "FAIL: %u bps costs %.1f usecs of cpu per stream per second, more than %.1f\n",
+        bitrate, r.cpuUsecsPerStreamSec, opts.maxCpuUsecs);
+      rc = 1;
+    }
+    if (opts.minRatio > 0 && r.ratio < opts.minRatio) {
+      fprintf(stderr, "FAIL: %u bps compresses %.1f:1, less than %.1f:1\n", bitrate, r.ratio, opts.minRatio);
+      rc = 1;
+    }
+  }
+  return rc;
+}
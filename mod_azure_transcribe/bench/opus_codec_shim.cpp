@@ -0,0 +1,67 @@
+/*
+ * The few freeswitch core calls the encoder makes, backed directly by libopus in place of
+ * mod_opus, so that the encoder can be run without a running core.  Only OPUS is offered;
+ * the target bitrate is taken from maxaveragebitrate in the fmtp, as mod_opus does.
+ */
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <switch.h>
+#include <opus.h>
+
+namespace {
+  const char* kBitrateParam = "maxaveragebitrate=";
+
+  int fmtpBitrate(const char* fmtp) {
+    const char* p = fmtp ? strstr(fmtp, kBitrateParam) : nullptr;
+    return p ? ::atoi(p + strlen(kBitrateParam)) : 0;
+  }
+}
+
+// the encoder's log lines go to stderr
+void switch_log_printf(switch_text_channel_t channel, const char* file, const char* func, int line,
+  const char* userdata, switch_log_level_t level, const char* fmt, ...) {
+  if (level > SWITCH_LOG_NOTICE) return;
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+}
+
+// switch_core_codec_init is a macro for this; the fmtp is looked for in either string argument
+switch_status_t switch_core_codec_init_with_bitrate(switch_codec_t* codec, const char* codec_name, const char* fmtp,
+  const char* modname, uint32_t rate, int ms, int channels, uint32_t bitrate, uint32_t flags,
+  const switch_codec_settings_t* codec_settings, switch_memory_pool_t* pool) {
+  if (!codec_name || strcasecmp(codec_name, "OPUS") != 0) return SWITCH_STATUS_GENERR;
+
+  int error = OPUS_OK;
+  OpusEncoder* encoder = opus_encoder_create((opus_int32) rate, channels, OPUS_APPLICATION_VOIP, &error);
+  if (OPUS_OK != error || !encoder) return SWITCH_STATUS_GENERR;
+
+  int target = bitrate ? (int) bitrate : fmtpBitrate(fmtp) ? fmtpBitrate(fmtp) : fmtpBitrate(modname);
+  if (target > 0) opus_encoder_ctl(encoder, OPUS_SET_BITRATE(target));
+
+  codec->private_info = encoder;
+  return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_core_codec_encode(switch_codec_t* codec, switch_codec_t* other_codec, void* decoded_data,
+  uint32_t decoded_data_len, uint32_t decoded_rate, void* encoded_data, uint32_t* encoded_data_len,
+  uint32_t* encoded_rate, unsigned int* flag) {
+  OpusEncoder* encoder = static_cast<OpusEncoder*>(codec->private_info);
+  if (!encoder) return SWITCH_STATUS_GENERR;
+
+  opus_int32 n = opus_encode(encoder, static_cast<const opus_int16*>(decoded_data), (int) (decoded_data_len / 2),
+    static_cast<unsigned char*>(encoded_data), (opus_int32) *encoded_data_len);
+  if (n < 0) return SWITCH_STATUS_GENERR;
+  *encoded_data_len = (uint32_t) n;
+  return SWITCH_STATUS_SUCCESS;
+}
+
+switch_status_t switch_core_codec_destroy(switch_codec_t* codec) {
+  if (codec->private_info) opus_encoder_destroy(static_cast<OpusEncoder*>(codec->private_info));
+  codec->private_info = nullptr;
+  return SWITCH_STATUS_SUCCESS;
+}
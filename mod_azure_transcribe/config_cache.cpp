@@ -0,0 +1,62 @@
+#include "config_cache.hpp"
+
+#include <switch.h>
+
+using namespace azure;
+
+std::mutex ConfigCache::mutex;
+std::list<ConfigCache::Entry> ConfigCache::entries;
+std::unordered_map<std::string, std::list<ConfigCache::Entry>::iterator> ConfigCache::index;
+unsigned int ConfigCache::nMaxEntries = 0;
+ConfigCache::Stats ConfigCache::stats;
+
+void ConfigCache::initialize(unsigned int maxEntries) {
+  std::lock_guard<std::mutex> lk(mutex);
+  nMaxEntries = maxEntries;
+  stats = Stats();
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "ConfigCache::initialize max %u speech configs\n", nMaxEntries);
+}
+
+void ConfigCache::deinitialize() {
+  std::lock_guard<std::mutex> lk(mutex);
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE,
+    "ConfigCache::deinitialize %u entries, %llu hits, %llu misses, %llu evicted\n",
+    (unsigned int) entries.size(), (unsigned long long) stats.hits, (unsigned long long) stats.misses,
+    (unsigned long long) stats.evictions);
+  index.clear();
+  entries.clear();
+}
+
+std::shared_ptr<ConfigCache::SpeechConfig> ConfigCache::get(const std::string& subscriptionKey, const std::string& region,
+  const std::string& endpoint, factory_t create) {
+  if (0 == nMaxEntries) return create();
+
+  // the whole subscription key is part of the key, so that sessions with different keys never share a config
+  std::string key = endpoint + "|" + region + "|" + subscriptionKey;
+
+  // built under the lock so that concurrent sessions for new credentials do not each build one
+  std::lock_guard<std::mutex> lk(mutex);
+  auto it = index.find(key);
+  if (it != index.end()) {
+    entries.splice(entries.begin(), entries, it->second);
+    stats.hits++;
+    return it->second->config;
+  }
+
+  std::shared_ptr<SpeechConfig> config = create();
+  stats.misses++;
+  entries.push_front(Entry{key, config});
+  index[key] = entries.begin();
+  while (entries.size() > nMaxEntries) {
+    index.erase(entries.back().key);
+    entries.pop_back();
+    stats.evictions++;
+  }
+  return config;
+}
+
+void ConfigCache::getStats(Stats& out) {
+  std::lock_guard<std::mutex> lk(mutex);
+  out = stats;
+  out.entries = entries.size();
+}
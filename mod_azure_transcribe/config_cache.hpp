@@ -0,0 +1,60 @@
+#ifndef __AZURE_CONFIG_CACHE_HPP__
+#define __AZURE_CONFIG_CACHE_HPP__
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <cstdint>
+
+#include <speechapi_cxx.h>
+
+namespace azure {
+
+/*
+ * Shares one SpeechConfig between all sessions using the same subscription key, region and
+ * endpoint, rather than building a new one (and parsing the same properties into it) for
+ * every session.  Entries are keyed by the subscription key itself, not a digest of it, so
+ * that only sessions presenting the same key share a config.  The configs handed out are templates: recognizers copy what they need
+ * from them when created, so sessions must put their own settings on the recognizer's
+ * properties rather than on the config.  The least recently used templates are dropped
+ * once there are more than the configured number; a size of zero disables sharing.
+ */
+class ConfigCache {
+public:
+  typedef Microsoft::CognitiveServices::Speech::SpeechConfig SpeechConfig;
+  typedef std::function<std::shared_ptr<SpeechConfig>()> factory_t;
+
+  struct Stats {
+    unsigned int entries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+  };
+
+  static void initialize(unsigned int maxEntries);
+  static void deinitialize();
+
+  // returns the shared config for the credentials, calling create to build it if there is none
+  static std::shared_ptr<SpeechConfig> get(const std::string& subscriptionKey, const std::string& region,
+    const std::string& endpoint, factory_t create);
+
+  static void getStats(Stats& out);
+
+private:
+  struct Entry {
+    std::string key;
+    std::shared_ptr<SpeechConfig> config;
+  };
+
+  static std::mutex mutex;
+  static std::list<Entry> entries;
+  static std::unordered_map<std::string, std::list<Entry>::iterator> index;
+  static unsigned int nMaxEntries;
+  static Stats stats;
+};
+
+} // namespace azure
+#endif
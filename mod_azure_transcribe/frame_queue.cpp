@@ -0,0 +1,85 @@
+#include "frame_queue.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+using namespace azure;
+
+/*
+ * One more frame than can be queued is being filled by the producer, and one more may be held
+ * by the consumer, so there is always a free frame for the producer to take.
+ */
+FrameQueue::FrameQueue(size_t frameBytes, size_t capacity) : m_frameBytes(std::max((size_t) 1, frameBytes)),
+  m_capacity(std::max((size_t) 1, capacity)), m_frames(m_capacity + 2),
+  m_queue(new std::atomic<Frame*>[m_capacity]), m_head(0), m_tail(0),
+  m_free(new std::atomic<Frame*>[m_capacity + 2]), m_freeHead(0), m_freeTail(0),
+  m_spare(nullptr), m_pushed(0), m_dropped(0) {
+  for (size_t i = 0; i < m_capacity; i++) m_queue[i].store(nullptr, std::memory_order_relaxed);
+  for (size_t i = 0; i < m_frames.size(); i++) {
+    m_frames[i].data.reset(new unsigned char[m_frameBytes]);
+    m_frames[i].len = 0;
+    m_free[i].store(&m_frames[i], std::memory_order_relaxed);
+  }
+  m_freeHead.store(m_frames.size(), std::memory_order_release);
+}
+
+FrameQueue::Frame* FrameQueue::takeFree() {
+  if (m_spare) {
+    Frame* frame = m_spare;
+    m_spare = nullptr;
+    return frame;
+  }
+  uint64_t tail = m_freeTail.load(std::memory_order_relaxed);
+  if (tail == m_freeHead.load(std::memory_order_acquire)) return nullptr;
+  Frame* frame = m_free[tail % m_frames.size()].load(std::memory_order_relaxed);
+  m_freeTail.store(tail + 1, std::memory_order_release);
+  return frame;
+}
+
+size_t FrameQueue::push(const void* data, size_t len) {
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  size_t dropped = 0;
+  while (len > 0) {
+    Frame* frame = takeFree();
+    if (!frame) break;
+    frame->len = std::min(len, m_frameBytes);
+    memcpy(frame->data.get(), p, frame->len);
+    p += frame->len;
+    len -= frame->len;
+
+    // if the queue is full the oldest frame is taken back, unless the consumer gets to it first
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    uint64_t tail = m_tail.load(std::memory_order_acquire);
+    while (head - tail >= m_capacity) {
+      Frame* oldest = m_queue[tail % m_capacity].load(std::memory_order_relaxed);
+      if (m_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+        m_spare = oldest;
+        dropped++;
+        break;
+      }
+    }
+
+    m_queue[head % m_capacity].store(frame, std::memory_order_relaxed);
+    m_head.store(head + 1, std::memory_order_release);
+    m_pushed.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (dropped) m_dropped.fetch_add(dropped, std::memory_order_relaxed);
+  return dropped;
+}
+
+FrameQueue::Frame* FrameQueue::pop() {
+  uint64_t tail = m_tail.load(std::memory_order_acquire);
+  for (;;) {
+    if (tail >= m_head.load(std::memory_order_acquire)) return nullptr;
+    Frame* frame = m_queue[tail % m_capacity].load(std::memory_order_relaxed);
+
+    // fails if the producer dropped this frame in the meantime, in which case the next one is tried
+    if (m_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel, std::memory_order_acquire)) return frame;
+  }
+}
+
+void FrameQueue::release(Frame* frame) {
+  uint64_t head = m_freeHead.load(std::memory_order_relaxed);
+  m_free[head % m_frames.size()].store(frame, std::memory_order_relaxed);
+  m_freeHead.store(head + 1, std::memory_order_release);
+}
@@ -0,0 +1,66 @@
+#ifndef __AZURE_FRAME_QUEUE_HPP__
+#define __AZURE_FRAME_QUEUE_HPP__
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace azure {
+
+/*
+ * A bounded queue of audio frames between exactly one producer (the media thread) and one
+ * consumer (a writer thread), neither of which ever takes a lock or waits on the other.  Frames
+ * are copied into buffers allocated up front, which pass back and forth between the two sides.
+ * When the queue is full the producer drops the oldest queued frame rather than waiting for the
+ * consumer, so the time spent queueing a frame does not depend on how far behind the consumer is.
+ */
+class FrameQueue {
+public:
+  struct Frame {
+    std::unique_ptr<unsigned char[]> data;
+    size_t len;
+  };
+
+  FrameQueue(size_t frameBytes, size_t capacity);
+
+  // producer only: copies the audio in, split into frames of at most frameBytes; returns the number of older frames dropped
+  size_t push(const void* data, size_t len);
+
+  // consumer only: takes the oldest frame, which must be handed back with release; null if the queue is empty
+  Frame* pop();
+  void release(Frame* frame);
+
+  // consumer only: true if there is no frame to pop
+  bool empty() const { return m_tail.load(std::memory_order_acquire) >= m_head.load(std::memory_order_acquire); }
+
+  uint64_t pushed() const { return m_pushed.load(std::memory_order_relaxed); }
+  uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+  Frame* takeFree();
+
+  size_t m_frameBytes;
+  size_t m_capacity;
+  std::vector<Frame> m_frames;
+
+  // frames waiting for the consumer; the producer drops the oldest by advancing the tail itself
+  std::unique_ptr<std::atomic<Frame*>[]> m_queue;
+  std::atomic<uint64_t> m_head;
+  std::atomic<uint64_t> m_tail;
+
+  // frames handed back by the consumer
+  std::unique_ptr<std::atomic<Frame*>[]> m_free;
+  std::atomic<uint64_t> m_freeHead;
+  std::atomic<uint64_t> m_freeTail;
+
+  // a dropped frame, kept by the producer for its next push
+  Frame* m_spare;
+
+  std::atomic<uint64_t> m_pushed;
+  std::atomic<uint64_t> m_dropped;
+};
+
+} // namespace azure
+#endif
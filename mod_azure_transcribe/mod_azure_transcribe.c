@@ -171,6 +171,33 @@ SWITCH_STANDARD_API(azure_transcribe_function)
 }
 
 
+#define SDK_LOG_API_SYNTAX "[off|error|warning|info|debug|trace]"
+SWITCH_STANDARD_API(sdk_log_function)
+{
+	char *json = azure_transcribe_sdk_log(zstr(cmd) ? NULL : cmd);
+	if (json) {
+		stream->write_function(stream, "%s\n", json);
+		free(json);
+	}
+	else {
+		stream->write_function(stream, "-USAGE: %s\n", SDK_LOG_API_SYNTAX);
+	}
+	return SWITCH_STATUS_SUCCESS;
+}
+
+SWITCH_STANDARD_API(stats_function)
+{
+	char *json = azure_transcribe_stats();
+	if (json) {
+		stream->write_function(stream, "%s\n", json);
+		free(json);
+	}
+	else {
+		stream->write_function(stream, "-ERR Operation Failed\n");
+	}
+	return SWITCH_STATUS_SUCCESS;
+}
+
 SWITCH_MODULE_LOAD_FUNCTION(mod_azure_transcribe_load)
 {
 	switch_api_interface_t *api_interface;
@@ -207,6 +234,14 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_azure_transcribe_load)
 	SWITCH_ADD_API(api_interface, "uuid_azure_transcribe", "azure Speech Transcription API", azure_transcribe_function, TRANSCRIBE_API_SYNTAX);
 	switch_console_set_complete("add uuid_azure_transcribe start lang-code [interim|final] [stereo|mono] [bugname]");
 	switch_console_set_complete("add uuid_azure_transcribe stop ");
+	SWITCH_ADD_API(api_interface, "azure_transcribe_sdk_log", "Set or show the azure sdk log level", sdk_log_function, SDK_LOG_API_SYNTAX);
+	switch_console_set_complete("add azure_transcribe_sdk_log off");
+	switch_console_set_complete("add azure_transcribe_sdk_log error");
+	switch_console_set_complete("add azure_transcribe_sdk_log warning");
+	switch_console_set_complete("add azure_transcribe_sdk_log info");
+	switch_console_set_complete("add azure_transcribe_sdk_log debug");
+	switch_console_set_complete("add azure_transcribe_sdk_log trace");
+	SWITCH_ADD_API(api_interface, "azure_transcribe_stats", "Show azure transcribe audio write and teardown counters", stats_function, "");
 
 	/* indicate that the module should continue to be loaded */
 	return SWITCH_STATUS_SUCCESS;
@@ -0,0 +1,190 @@
+#include "ogg_opus_encoder.hpp"
+
+#include <cstring>
+#include <chrono>
+
+/* opus frames of 20 ms of 8 kHz mono audio */
+#define OPUS_SAMPLE_RATE (8000)
+#define OPUS_FRAME_MS (20)
+#define OPUS_FRAME_BYTES (OPUS_SAMPLE_RATE / 1000 * OPUS_FRAME_MS * 2)
+
+/* ogg granule positions always count 48 kHz samples */
+#define GRANULE_PER_FRAME (48 * OPUS_FRAME_MS)
+
+/* encoder lookahead at 48 kHz that a decoder should discard */
+#define OPUS_PRE_SKIP (312)
+
+/* packets framed into each ogg page; more packets per page means less overhead but more delay */
+#define OGG_PAGE_PACKETS (3)
+
+#define OGG_FLAG_BOS (0x02)
+#define OGG_FLAG_EOS (0x04)
+
+using namespace azure;
+
+namespace {
+  // ogg's crc32: polynomial 0x04c11db7, not reflected, no final xor
+  uint32_t oggCrc(const unsigned char* data, size_t len) {
+    static const std::vector<uint32_t> table = [] {
+      std::vector<uint32_t> t(256);
+      for (uint32_t i = 0; i < 256; i++) {
+        uint32_t r = i << 24;
+        for (int j = 0; j < 8; j++) r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : (r << 1);
+        t[i] = r;
+      }
+      return t;
+    }();
+    uint32_t crc = 0;
+    for (size_t i = 0; i < len; i++) crc = (crc << 8) ^ table[((crc >> 24) ^ data[i]) & 0xff];
+    return crc;
+  }
+
+  void putLe16(std::string& s, uint16_t v) {
+    s.push_back((char) (v & 0xff));
+    s.push_back((char) (v >> 8));
+  }
+  void putLe32(std::string& s, uint32_t v) {
+    for (int i = 0; i < 4; i++) s.push_back((char) ((v >> (8 * i)) & 0xff));
+  }
+  void putLe64(std::string& s, uint64_t v) {
+    for (int i = 0; i < 8; i++) s.push_back((char) ((v >> (8 * i)) & 0xff));
+  }
+
+  // ogg lacing: a run of 255s and a final value below 255 for each packet
+  void lace(std::vector<unsigned char>& lacing, size_t len) {
+    while (len >= 255) {
+      lacing.push_back(255);
+      len -= 255;
+    }
+    lacing.push_back((unsigned char) len);
+  }
+}
+
+OggOpusEncoder::OggOpusEncoder() : m_ready(false), m_headersWritten(false), m_finished(false), m_pagePackets(0), m_granule(0),
+  m_sequence(0), m_bytesIn(0), m_bytesOut(0) {
+  memset(&m_codec, 0, sizeof(m_codec));
+  m_serial = (uint32_t) std::chrono::steady_clock::now().time_since_epoch().count() ^ (uint32_t) (uintptr_t) this;
+}
+
+OggOpusEncoder::~OggOpusEncoder() {
+  if (m_ready) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "OggOpusEncoder: %llu bytes of pcm sent as %llu bytes\n",
+      (unsigned long long) m_bytesIn, (unsigned long long) m_bytesOut);
+    switch_core_codec_destroy(&m_codec);
+  }
+}
+
+bool OggOpusEncoder::init(uint32_t bitrate) {
+  char fmtp[64];
+  snprintf(fmtp, sizeof(fmtp), "maxaveragebitrate=%u; maxplaybackrate=%u", bitrate, OPUS_SAMPLE_RATE);
+  if (switch_core_codec_init(&m_codec, "OPUS", NULL, fmtp, OPUS_SAMPLE_RATE, OPUS_FRAME_MS, 1,
+    SWITCH_CODEC_FLAG_ENCODE, NULL, NULL) != SWITCH_STATUS_SUCCESS) {
+    return false;
+  }
+  m_ready = true;
+  return true;
+}
+
+void OggOpusEncoder::encode(const void* data, size_t len, std::string& out) {
+  if (!m_ready || m_finished) return;
+  size_t start = out.size();
+  if (!m_headersWritten) writeHeaders(out);
+
+  m_bytesIn += len;
+  m_pcm.append(static_cast<const char*>(data), len);
+  encodeFrames(out);
+  m_bytesOut += out.size() - start;
+}
+
+void OggOpusEncoder::finish(std::string& out) {
+  if (!m_ready || m_finished || !m_headersWritten) return;
+  size_t start = out.size();
+  m_finished = true;
+
+  if (!m_pcm.empty()) {
+    m_pcm.append(OPUS_FRAME_BYTES - m_pcm.size(), '\0');
+    encodeFrames(out);
+  }
+
+  // an end of stream page may carry no packets, if the last page was just completed
+  writePage(OGG_FLAG_EOS, m_granule, m_body, m_lacing, out);
+  m_body.clear();
+  m_lacing.clear();
+  m_pagePackets = 0;
+  m_bytesOut += out.size() - start;
+}
+
+void OggOpusEncoder::encodeFrames(std::string& out) {
+  size_t offset = 0;
+  while (m_pcm.size() - offset >= OPUS_FRAME_BYTES) {
+    unsigned char packet[SWITCH_RECOMMENDED_BUFFER_SIZE];
+    uint32_t packetLen = sizeof(packet);
+    uint32_t rate = OPUS_SAMPLE_RATE;
+    unsigned int flag = 0;
+    if (switch_core_codec_encode(&m_codec, NULL, &m_pcm[offset], OPUS_FRAME_BYTES, OPUS_SAMPLE_RATE,
+      packet, &packetLen, &rate, &flag) == SWITCH_STATUS_SUCCESS) {
+      m_granule += GRANULE_PER_FRAME;
+
+      // a frame the encoder chose not to send (dtx) is skipped
+      if (packetLen > 0) addPacket(packet, packetLen, out);
+    }
+    offset += OPUS_FRAME_BYTES;
+  }
+  m_pcm.erase(0, offset);
+}
+
+void OggOpusEncoder::writeHeaders(std::string& out) {
+  std::vector<unsigned char> lacing;
+
+  // identification header, alone on the first page
+  std::string head("OpusHead");
+  head.push_back(1);        // version
+  head.push_back(1);        // channels
+  putLe16(head, OPUS_PRE_SKIP);
+  putLe32(head, OPUS_SAMPLE_RATE);
+  putLe16(head, 0);         // output gain
+  head.push_back(0);        // channel mapping family
+  lace(lacing, head.size());
+  writePage(OGG_FLAG_BOS, 0, head, lacing, out);
+
+  // comment header, on a page of its own
+  static const char vendor[] = "freeswitch";
+  std::string tags("OpusTags");
+  putLe32(tags, sizeof(vendor) - 1);
+  tags.append(vendor, sizeof(vendor) - 1);
+  putLe32(tags, 0);         // user comments
+  lacing.clear();
+  lace(lacing, tags.size());
+  writePage(0, 0, tags, lacing, out);
+
+  m_headersWritten = true;
+}
+
+void OggOpusEncoder::addPacket(const unsigned char* packet, size_t len, std::string& out) {
+  m_body.append(reinterpret_cast<const char*>(packet), len);
+  lace(m_lacing, len);
+  if (++m_pagePackets < OGG_PAGE_PACKETS) return;
+
+  writePage(0, m_granule, m_body, m_lacing, out);
+  m_body.clear();
+  m_lacing.clear();
+  m_pagePackets = 0;
+}
+
+void OggOpusEncoder::writePage(unsigned char flags, uint64_t granule, const std::string& body,
+  const std::vector<unsigned char>& lacing, std::string& out) {
+  size_t start = out.size();
+  out.append("OggS", 4);
+  out.push_back(0);         // version
+  out.push_back((char) flags);
+  putLe64(out, granule);
+  putLe32(out, m_serial);
+  putLe32(out, m_sequence++);
+  putLe32(out, 0);          // crc, filled in below
+  out.push_back((char) lacing.size());
+  out.append(reinterpret_cast<const char*>(lacing.data()), lacing.size());
+  out.append(body);
+
+  uint32_t crc = oggCrc(reinterpret_cast<const unsigned char*>(out.data()) + start, out.size() - start);
+  for (int i = 0; i < 4; i++) out[start + 22 + i] = (char) ((crc >> (8 * i)) & 0xff);
+}
@@ -0,0 +1,62 @@
+#ifndef __AZURE_OGG_OPUS_ENCODER_HPP__
+#define __AZURE_OGG_OPUS_ENCODER_HPP__
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <switch.h>
+
+namespace azure {
+
+/*
+ * Turns a session's 8 kHz mono 16 bit pcm into an Ogg Opus stream that can be written to a
+ * push stream created with the OGG_OPUS compressed format, cutting what is sent to the
+ * service to a fraction of the raw pcm.  Encoding is done by whichever module provides the
+ * opus codec to freeswitch (normally mod_opus); the packets are then framed into ogg pages,
+ * a few packets to a page.  The stream headers are emitted ahead of the first page, and
+ * finish ends the stream with the remaining packets on a page flagged end of stream.
+ *
+ * Not thread safe; each session has its own encoder.
+ */
+class OggOpusEncoder {
+public:
+  OggOpusEncoder();
+  ~OggOpusEncoder();
+
+  // returns false if no opus codec is available
+  bool init(uint32_t bitrate);
+
+  // buffers the audio and appends any pages completed by it to out
+  void encode(const void* data, size_t len, std::string& out);
+
+  // encodes what is buffered, padded to a whole frame with silence, and appends the last page; nothing is encoded after
+  void finish(std::string& out);
+
+  uint64_t bytesIn() const { return m_bytesIn; }
+  uint64_t bytesOut() const { return m_bytesOut; }
+
+private:
+  void encodeFrames(std::string& out);
+  void writeHeaders(std::string& out);
+  void addPacket(const unsigned char* packet, size_t len, std::string& out);
+  void writePage(unsigned char flags, uint64_t granule, const std::string& body, const std::vector<unsigned char>& lacing,
+    std::string& out);
+
+  switch_codec_t m_codec;
+  bool m_ready;
+  bool m_headersWritten;
+  bool m_finished;
+  std::string m_pcm;
+  std::string m_body;
+  std::vector<unsigned char> m_lacing;
+  unsigned int m_pagePackets;
+  uint64_t m_granule;
+  uint32_t m_serial;
+  uint32_t m_sequence;
+  uint64_t m_bytesIn;
+  uint64_t m_bytesOut;
+};
+
+} // namespace azure
+#endif
@@ -0,0 +1,77 @@
+#ifndef __AZURE_TEARDOWN_EXECUTOR_HPP__
+#define __AZURE_TEARDOWN_EXECUTOR_HPP__
+
+#include <string>
+#include <list>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+
+namespace azure {
+
+/*
+ * Drains connections of stopped sessions without dedicating a thread to each one.
+ * A single timer thread tracks every outstanding teardown and releases it once it has
+ * closed, waking when notified of a close or when the next deadline passes; connections
+ * that do not close within the timeout (or that arrive while too many are already draining)
+ * are closed forcibly, and if even that does not complete they are parked until the module
+ * unloads rather than freed underneath the service thread.
+ */
+class TeardownExecutor {
+public:
+  struct Stats {
+    unsigned int pending;
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t timedOut;
+    uint64_t overflowed;
+    uint64_t abandoned;
+  };
+
+  static void initialize(unsigned int maxPendingTeardowns, unsigned int closeTimeoutMs);
+
+  // must be called after the transport has stopped, since it releases anything still outstanding
+  static void deinitialize();
+
+  // holder keeps the connection alive until isClosed returns true; forceClose (optional) is called on timeout
+  static void submit(const std::string& tag, std::shared_ptr<void> holder,
+    std::function<bool()> isClosed, std::function<void()> forceClose);
+
+  // called when a connection closes, so that outstanding teardowns are checked again
+  static void notify();
+
+  static void getStats(Stats& out);
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Job {
+    std::string tag;
+    std::shared_ptr<void> holder;
+    std::function<bool()> isClosed;
+    std::function<void()> forceClose;
+    Clock::time_point deadline;
+    bool forced;
+    bool overflowed;
+  };
+
+  static void worker();
+
+  static std::thread workerThread;
+  static std::mutex mutex;
+  static std::condition_variable cv;
+  static std::list<Job> jobs;
+  static std::list<std::shared_ptr<void> > abandoned;
+  static Stats stats;
+  static unsigned int maxPending;
+  static unsigned int timeoutMs;
+  static bool stopFlag;
+  static bool notified;
+};
+
+} // namespace azure
+#endif
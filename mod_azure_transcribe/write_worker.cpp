@@ -0,0 +1,181 @@
+#include "write_worker.hpp"
+
+#include <switch.h>
+#include <algorithm>
+
+/* dropped audio is reported at most this often per session */
+#define DROP_REPORT_INTERVAL_SECS (5)
+
+using namespace azure;
+
+std::vector<std::thread> WriteWorker::threads;
+std::mutex WriteWorker::mutex;
+std::condition_variable WriteWorker::cv;
+std::condition_variable WriteWorker::cvIdle;
+std::list<std::shared_ptr<WriteWorker::Writer> > WriteWorker::writers;
+std::deque<std::shared_ptr<WriteWorker::Writer> > WriteWorker::ready;
+unsigned int WriteWorker::nStallMs = 100;
+bool WriteWorker::stopFlag = false;
+WriteWorker::Stats WriteWorker::stats;
+
+WriteWorker::Writer::Writer(const std::string& tag, size_t frameBytes, size_t capacity, sink_t sink) :
+  m_tag(tag), m_queue(frameBytes, capacity), m_sink(sink), m_scheduled(false), m_draining(false), m_closing(false),
+  m_removed(false), m_closed(false), m_stalls(0), m_discarded(0), m_reportedDrops(0) {
+}
+
+// called by the writer thread servicing the writer; frames still queued once until (or the close deadline) has passed are discarded
+void WriteWorker::Writer::drain(Clock::time_point until) {
+  while (FrameQueue::Frame* frame = m_queue.pop()) {
+    auto start = Clock::now();
+    if (m_closing.load(std::memory_order_acquire)) until = std::min(until, m_closeBy);
+    if (start < until) {
+      m_sink(frame->data.get(), frame->len);
+      if (Clock::now() - start >= std::chrono::milliseconds(nStallMs)) m_stalls++;
+    }
+    else m_discarded++;
+    m_queue.release(frame);
+  }
+
+  uint64_t drops = m_queue.dropped();
+  auto now = Clock::now();
+  if (drops != m_reportedDrops && now - m_lastReport >= std::chrono::seconds(DROP_REPORT_INTERVAL_SECS)) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "WriteWorker %s: writes are behind, dropped %llu frames (%llu stalled writes)\n",
+      m_tag.c_str(), (unsigned long long) (drops - m_reportedDrops), (unsigned long long) m_stalls);
+    m_reportedDrops = drops;
+    m_lastReport = now;
+  }
+}
+
+void WriteWorker::initialize(unsigned int nThreads, unsigned int stallMs) {
+  std::lock_guard<std::mutex> lk(mutex);
+  nStallMs = std::max(1U, stallMs);
+  stopFlag = false;
+  stats = Stats();
+  for (unsigned int i = 0; i < std::max(1U, nThreads); i++) threads.push_back(std::thread(&WriteWorker::worker));
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "WriteWorker::initialize %u writer threads, writes slower than %u ms count as stalled\n",
+    (unsigned int) threads.size(), nStallMs);
+}
+
+void WriteWorker::deinitialize() {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    stopFlag = true;
+  }
+  cv.notify_all();
+  for (auto& t : threads) {
+    if (t.joinable()) t.join();
+  }
+  threads.clear();
+
+  std::lock_guard<std::mutex> lk(mutex);
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE,
+    "WriteWorker::deinitialize %u writers, %llu frames queued, %llu dropped, %llu discarded at close, %llu stalled writes\n",
+    (unsigned int) writers.size(), (unsigned long long) stats.frames, (unsigned long long) stats.dropped,
+    (unsigned long long) stats.discarded, (unsigned long long) stats.stalls);
+  ready.clear();
+  writers.clear();
+}
+
+std::shared_ptr<WriteWorker::Writer> WriteWorker::add(const std::string& tag, size_t frameBytes, size_t capacity, sink_t sink) {
+  std::shared_ptr<Writer> writer = std::make_shared<Writer>(tag, frameBytes, capacity, sink);
+  std::lock_guard<std::mutex> lk(mutex);
+  writers.push_back(writer);
+  return writer;
+}
+
+void WriteWorker::schedule(std::shared_ptr<Writer> writer) {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    ready.push_back(std::move(writer));
+  }
+  cv.notify_one();
+}
+
+void WriteWorker::close(const std::shared_ptr<Writer>& writer, std::chrono::milliseconds flushFor, closed_t onClosed) {
+  if (!writer || writer->m_removed) return;
+  writer->m_onClosed = onClosed;
+  writer->m_closeBy = Clock::now() + flushFor;
+  writer->m_closing.store(true, std::memory_order_release);
+
+  // a writer already scheduled or being drained sees the flag when it is done
+  if (!writer->m_scheduled.exchange(true, std::memory_order_acq_rel)) schedule(writer);
+}
+
+void WriteWorker::remove(const std::shared_ptr<Writer>& writer) {
+  if (!writer || writer->m_removed.exchange(true)) return;
+
+  // wait out a writer thread part way through draining or closing it; none will start again
+  std::unique_lock<std::mutex> lk(mutex);
+  cvIdle.wait(lk, [&writer] { return !writer->m_draining; });
+  writers.remove(writer);
+  bool closed = writer->m_closed;
+  lk.unlock();
+  if (!closed) account(*writer);
+}
+
+void WriteWorker::account(Writer& writer) {
+  std::lock_guard<std::mutex> lk(mutex);
+  stats.frames += writer.m_queue.pushed();
+  stats.dropped += writer.m_queue.dropped();
+  stats.discarded += writer.m_discarded;
+  stats.stalls += writer.m_stalls;
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "WriteWorker %s: %llu frames, %llu dropped, %llu discarded at close, %llu stalled writes\n",
+    writer.m_tag.c_str(), (unsigned long long) writer.m_queue.pushed(), (unsigned long long) writer.m_queue.dropped(),
+    (unsigned long long) writer.m_discarded, (unsigned long long) writer.m_stalls);
+}
+
+void WriteWorker::getStats(Stats& out) {
+  std::lock_guard<std::mutex> lk(mutex);
+  out = stats;
+  out.writers = writers.size();
+}
+
+// runs on a writer thread, which holds the writer's scheduled flag until it is done with it
+void WriteWorker::service(const std::shared_ptr<Writer>& writer) {
+  writer->m_draining.store(true);
+  bool closed = false;
+  if (!writer->m_removed.load()) {
+    if (writer->m_closing.load(std::memory_order_acquire)) {
+      writer->drain(writer->m_closeBy);
+      if (writer->m_onClosed) writer->m_onClosed();
+      writer->m_closed = closed = true;
+      account(*writer);
+    }
+    else writer->drain(Clock::time_point::max());
+  }
+  writer->m_draining.store(false);
+  if (writer->m_removed.load()) {
+    std::lock_guard<std::mutex> lk(mutex);
+    cvIdle.notify_all();
+  }
+
+  // a closed writer keeps its flag, so it is never scheduled again
+  if (closed) {
+    std::lock_guard<std::mutex> lk(mutex);
+    writers.remove(writer);
+    return;
+  }
+
+  // audio or a close that arrived while the flag was held would otherwise wait for the next frame
+  writer->m_scheduled.exchange(false, std::memory_order_acq_rel);
+  if ((!writer->m_queue.empty() || writer->m_closing.load(std::memory_order_acquire)) && !writer->m_removed.load() &&
+    !writer->m_scheduled.exchange(true, std::memory_order_acq_rel)) {
+    schedule(writer);
+  }
+}
+
+void WriteWorker::worker() {
+  std::unique_lock<std::mutex> lk(mutex);
+  while (!stopFlag) {
+    if (ready.empty()) {
+      cv.wait(lk);
+      continue;
+    }
+    std::shared_ptr<Writer> writer = std::move(ready.front());
+    ready.pop_front();
+    lk.unlock();
+    service(writer);
+    writer.reset();
+    lk.lock();
+  }
+}
@@ -0,0 +1,110 @@
+#ifndef __AZURE_WRITE_WORKER_HPP__
+#define __AZURE_WRITE_WORKER_HPP__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "frame_queue.hpp"
+
+namespace azure {
+
+/*
+ * Moves writes to the speech sdk off the media thread.  Each session queues its audio on a
+ * FrameQueue of its own, which never blocks the media thread, and a small pool of writer
+ * threads drains the queues into the sdk.  A session is handed to the writers when audio
+ * arrives for it while it is idle, so the writers sleep until there is something to write;
+ * while the writers keep up that costs the media thread a short lock for each frame, and
+ * nothing once a session's writes fall behind.  A session's queue is only drained by one
+ * writer at a time, so a session whose writes stall holds up one writer rather than all of
+ * them; writes that take longer than the stall threshold are counted.
+ */
+class WriteWorker {
+public:
+  typedef std::function<void(const unsigned char* data, size_t len)> sink_t;
+  typedef std::function<void()> closed_t;
+
+  class Writer : public std::enable_shared_from_this<Writer> {
+  public:
+    Writer(const std::string& tag, size_t frameBytes, size_t capacity, sink_t sink);
+
+    // media thread only; never blocks, dropping the oldest queued audio if the queue is full
+    void write(const void* data, size_t len) {
+      m_queue.push(data, len);
+      if (!m_scheduled.exchange(true, std::memory_order_acq_rel)) WriteWorker::schedule(shared_from_this());
+    }
+
+  private:
+    friend class WriteWorker;
+
+    void drain(std::chrono::steady_clock::time_point until);
+
+    std::string m_tag;
+    FrameQueue m_queue;
+    sink_t m_sink;
+    closed_t m_onClosed;
+    std::chrono::steady_clock::time_point m_closeBy;
+    std::atomic<bool> m_scheduled;
+    std::atomic<bool> m_draining;
+    std::atomic<bool> m_closing;
+    std::atomic<bool> m_removed;
+    bool m_closed;
+    uint64_t m_stalls;
+    uint64_t m_discarded;
+    uint64_t m_reportedDrops;
+    std::chrono::steady_clock::time_point m_lastReport;
+  };
+
+  struct Stats {
+    unsigned int writers;
+    uint64_t frames;
+    uint64_t dropped;
+    uint64_t discarded;
+    uint64_t stalls;
+  };
+
+  static void initialize(unsigned int threads, unsigned int stallMs);
+  static void deinitialize();
+
+  // sink is called from the writer threads, one call at a time, until the writer is closed or removed
+  static std::shared_ptr<Writer> add(const std::string& tag, size_t frameBytes, size_t capacity, sink_t sink);
+
+  // returns at once; a writer thread writes what is queued, discarding whatever is left after flushFor,
+  // and then calls onClosed.  Called at most once per writer, after the media thread's last write.
+  static void close(const std::shared_ptr<Writer>& writer, std::chrono::milliseconds flushFor, closed_t onClosed);
+
+  // returns once no writer thread is calling the sink or the close callback; nothing more is written
+  static void remove(const std::shared_ptr<Writer>& writer);
+
+  static void getStats(Stats& out);
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  static void schedule(std::shared_ptr<Writer> writer);
+  static void service(const std::shared_ptr<Writer>& writer);
+  static void worker();
+  static void account(Writer& writer);
+
+  static std::vector<std::thread> threads;
+  static std::mutex mutex;
+  static std::condition_variable cv;
+  static std::condition_variable cvIdle;
+  static std::list<std::shared_ptr<Writer> > writers;
+  static std::deque<std::shared_ptr<Writer> > ready;
+  static unsigned int nStallMs;
+  static bool stopFlag;
+  static Stats stats;
+};
+
+} // namespace azure
+#endif
@@ -0,0 +1,71 @@
+#ifndef __COBALT_CHANNEL_REGISTRY_HPP__
+#define __COBALT_CHANNEL_REGISTRY_HPP__
+
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+#include <grpc++/grpc++.h>
+
+namespace cobalt_speech {
+
+/*
+ * Shares grpc channels between sessions instead of creating (and handshaking) a new one per call.
+ * Channels are kept per target and credentials, each key holding a small set of subchannels with
+ * their own connection; streams are spread round-robin over subchannels that are below the
+ * per-connection stream cap, and another subchannel is added when they are all at the cap.
+ *
+ * The channel handed out carries a reference that counts as one active stream on its subchannel
+ * until the last copy of it (including any stub created from it) is released.
+ */
+class ChannelRegistry {
+public:
+  typedef std::function<std::shared_ptr<grpc::ChannelCredentials>()> credentialsFactory_t;
+
+  static void initialize(unsigned int subchannelsPerKey, unsigned int maxStreamsPerChannel, unsigned int keepaliveMs);
+  static void deinitialize();
+
+  // credentialsKey must identify the credentials makeCredentials returns (e.g. the contents of a key file);
+  // maxStreams overrides the default per-connection stream cap when non-zero
+  static std::shared_ptr<grpc::Channel> getChannel(const std::string& target, const std::string& credentialsKey,
+    credentialsFactory_t makeCredentials, unsigned int maxStreams = 0);
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Subchannel {
+    std::shared_ptr<grpc::Channel> channel;
+    std::atomic<unsigned int> active;
+    Clock::time_point lastUsed;
+  };
+
+  struct Entry {
+    std::vector<std::shared_ptr<Subchannel> > subchannels;
+    unsigned int next;
+    unsigned int maxStreams;
+  };
+
+  // released along with the last copy of a channel returned by getChannel
+  struct StreamRef {
+    std::shared_ptr<Subchannel> subchannel;
+    ~StreamRef() { subchannel->active--; }
+  };
+
+  static std::shared_ptr<Subchannel> createSubchannel(const std::string& target, credentialsFactory_t& makeCredentials);
+  static void evictIdle(Clock::time_point now);
+
+  static std::mutex mutex;
+  static std::map<std::string, Entry> entries;
+  static unsigned int nSubchannels;
+  static unsigned int nMaxStreams;
+  static unsigned int nKeepaliveMs;
+  static Clock::time_point lastSweep;
+};
+
+} // namespace cobalt_speech
+#endif
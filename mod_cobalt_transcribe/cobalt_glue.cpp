@@ -15,11 +15,47 @@ namespace cobalt_asr = cobaltspeech::transcribe::v5;
 
 #include "mod_cobalt_transcribe.h"
 #include "simple_buffer.h"
+#include "channel_registry.hpp"
+#include "grpc_engine.hpp"
+#include "endpoint_balancer.hpp"
+#include "context_cache.hpp"
 
 #define CHUNKSIZE (320)
 #define DEFAULT_CONTEXT_TOKEN "unk:default"
 
 namespace {
+  static const char *requestedGrpcSubchannels = std::getenv("MOD_TRANSCRIBE_GRPC_SUBCHANNELS");
+  static unsigned int nGrpcSubchannels = std::max(1, requestedGrpcSubchannels ? ::atoi(requestedGrpcSubchannels) : 2);
+  static const char *requestedGrpcMaxStreams = std::getenv("MOD_TRANSCRIBE_GRPC_MAX_STREAMS_PER_CHANNEL");
+  static unsigned int nGrpcMaxStreamsPerChannel = std::max(1, requestedGrpcMaxStreams ? ::atoi(requestedGrpcMaxStreams) : 100);
+  static const char *requestedGrpcKeepaliveMs = std::getenv("MOD_TRANSCRIBE_GRPC_KEEPALIVE_MS");
+  static unsigned int nGrpcKeepaliveMs = std::max(0, requestedGrpcKeepaliveMs ? ::atoi(requestedGrpcKeepaliveMs) : 30000);
+  static const char *requestedGrpcThreads = std::getenv("MOD_TRANSCRIBE_GRPC_THREADS");
+  static unsigned int nGrpcThreads = std::max(1, requestedGrpcThreads ? ::atoi(requestedGrpcThreads) : 2);
+  static const char *requestedGrpcMaxQueuedFrames = std::getenv("MOD_TRANSCRIBE_GRPC_MAX_QUEUED_FRAMES");
+  static unsigned int nGrpcMaxQueuedFrames = std::max(1, requestedGrpcMaxQueuedFrames ? ::atoi(requestedGrpcMaxQueuedFrames) : 250);
+  static const char *requestedTeardownTimeoutMs = std::getenv("MOD_TRANSCRIBE_TEARDOWN_TIMEOUT_MS");
+  static unsigned int nTeardownTimeoutMs = std::max(100, requestedTeardownTimeoutMs ? ::atoi(requestedTeardownTimeoutMs) : 5000);
+  static const char *requestedHealthCheckMs = std::getenv("MOD_TRANSCRIBE_HEALTH_CHECK_MS");
+  static unsigned int nHealthCheckMs = std::max(100, requestedHealthCheckMs ? ::atoi(requestedHealthCheckMs) : 5000);
+  static const char *requestedEjectFailures = std::getenv("MOD_TRANSCRIBE_EJECT_FAILURES");
+  static unsigned int nEjectFailures = std::max(1, requestedEjectFailures ? ::atoi(requestedEjectFailures) : 3);
+  static const char *requestedEjectSecs = std::getenv("MOD_TRANSCRIBE_EJECT_SECS");
+  static unsigned int nEjectSecs = std::max(0, requestedEjectSecs ? ::atoi(requestedEjectSecs) : 30);
+  static const char *requestedContextCacheSize = std::getenv("COBALT_CONTEXT_CACHE_SIZE");
+  static unsigned int nContextCacheSize = std::max(0, requestedContextCacheSize ? ::atoi(requestedContextCacheSize) : 100);
+  static const char *requestedContextCacheTtl = std::getenv("COBALT_CONTEXT_CACHE_TTL_SECS");
+  static unsigned int nContextCacheTtlSecs = std::max(1, requestedContextCacheTtl ? ::atoi(requestedContextCacheTtl) : 3600);
+
+  // hostport may be a comma-separated list of servers, from which the least loaded is used
+  std::shared_ptr<grpc::Channel> getChannel(const std::string& hostport) {
+    std::string target = hostport;
+    if (std::string::npos != hostport.find(',')) target = cobalt_speech::EndpointBalancer::acquire(hostport)->target();
+    return cobalt_speech::ChannelRegistry::getChannel(target, "insecure", [] {
+      return grpc::InsecureChannelCredentials();
+    });
+  }
+
   int case_insensitive_match(std::string s1, std::string s2) {
    std::transform(s1.begin(), s1.end(), s1.begin(), ::tolower);
    std::transform(s2.begin(), s2.end(), s2.begin(), ::tolower);
@@ -86,45 +122,21 @@ namespace {
     return decoded;
   }
 
-  const char* compile_context_phrases(switch_core_session_t *session, const char* hostport, const char* model, const char* token, const char* phrases) {
-    switch_channel_t *channel = switch_core_session_get_channel(session);
-    switch_event_t *event;
-
-    grpc::ClientContext context;
-    std::shared_ptr<grpc::Channel> grpcChannel ;
-    grpcChannel = grpc::CreateChannel(hostport, grpc::InsecureChannelCredentials());
-
-    if (!grpcChannel) {
-      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "failed creating grpc channel\n");	
-      return nullptr;
-    }
-
-    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "compile context, model: %s, token: %s, phrases: %s\n", model, token, phrases);
-
-    std::unique_ptr<cobalt_asr::TranscribeService::Stub> stub = std::move(cobalt_asr::TranscribeService::NewStub(grpcChannel));
-    
-    cobalt_asr::CompileContextRequest request;
-    cobalt_asr::CompileContextResponse response;
-
-    request.set_model_id(model);
-    request.set_token(token);
-
-
-    // hints are either a simple comma-separated list of phrases, or a json array of objects
-    // containing a phrase and a boost value
-    char* originalPhrases = strdup(phrases);
+  // hints are either a simple comma-separated list of phrases, or a json array of objects
+  // containing a phrase and a boost value
+  void parse_context_phrases(switch_core_session_t *session, const char* phrases, cobalt_asr::CompileContextRequest& request) {
     request.clear_phrases();
     auto *jPhrases = cJSON_Parse((char *) phrases);
     if (jPhrases) {
       int i = 0;
       cJSON *jPhrase = NULL;
-      cJSON_ArrayForEach(jPhrase, jPhrase) {
-        auto* contextPhrase = request.add_phrases();
+      cJSON_ArrayForEach(jPhrase, jPhrases) {
         cJSON *jItem = cJSON_GetObjectItem(jPhrase, "phrase");
         if (jItem) {
+          auto* contextPhrase = request.add_phrases();
           auto text = cJSON_GetStringValue(jItem);
           contextPhrase->set_text(text);
-          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "added text: %f\n", text);
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "added text: %s\n", text);
           if (cJSON_GetObjectItem(jPhrase, "boost")) {
             float boost = (float) cJSON_GetObjectItem(jPhrase, "boost")->valuedouble;
             contextPhrase->set_boost(boost);
@@ -145,21 +157,40 @@ namespace {
       }
       switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "added %d hints\n", request.phrases_size());
     }
+  }
+
+  // model, token and phrases in a canonical form, so that phrase lists differing only in order,
+  // spacing or duplicates share a compiled context
+  std::string context_cache_key(const cobalt_asr::CompileContextRequest& request) {
+    std::vector<std::string> items;
+    for (const auto& phrase : request.phrases()) {
+      char boost[32];
+      snprintf(boost, sizeof(boost), "%.3f", phrase.boost());
+      items.push_back(trim(phrase.text()) + "\t" + boost);
+    }
+    std::sort(items.begin(), items.end());
+    items.erase(std::unique(items.begin(), items.end()), items.end());
 
-    stub->CompileContext(&context, request, &response);
+    std::string key = request.model_id() + "\n" + request.token();
+    for (const auto& item : items) key += "\n" + item;
+    return key;
+  }
+
+  void fire_compile_context_event(switch_core_session_t *session, const char* phrases, const std::string& data, bool hasContext, bool cacheHit) {
+    switch_event_t *event;
 
     cJSON * jResult = cJSON_CreateObject();
-    cJSON_AddBoolToObject(jResult, "has_context", response.has_context());
-    auto& c = response.context();
-    auto data = base64_encode(c.data());
-    cJSON_AddItemToObject(jResult, "compiled_context", cJSON_CreateString(data.c_str()));
+    cJSON_AddBoolToObject(jResult, "has_context", hasContext);
+    cJSON_AddBoolToObject(jResult, "cache_hit", cacheHit);
+    cJSON_AddItemToObject(jResult, "compiled_context", cJSON_CreateString(base64_encode(data).c_str()));
     cJSON_AddItemToObject(jResult, "phrases", cJSON_CreateString(phrases));
 
     char* json = cJSON_PrintUnformatted(jResult);
 
     switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, TRANSCRIBE_EVENT_COMPILE_CONTEXT_RESPONSE);
-    switch_channel_event_set_data(channel, event);
+    if (session) switch_channel_event_set_data(switch_core_session_get_channel(session), event);
     switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "transcription-vendor", "cobalt");
+    switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "cache-hit", cacheHit ? "true" : "false");
     switch_event_add_body(event, "%s", json);
     switch_event_fire(&event);
 
@@ -167,26 +198,73 @@ namespace {
 
     free(json);
     cJSON_Delete(jResult);
+  }
 
-    free(originalPhrases);
+  /*
+   * Compiles phrases into a context for the model, or takes the context from the cache.  session
+   * may be NULL when precompiling.  On success data holds the compiled (not base64-encoded) context.
+   */
+  bool compile_context_phrases(switch_core_session_t *session, const char* hostport, const char* model, const char* token, const char* phrases,
+    std::string& data, bool& cacheHit) {
+    cobalt_asr::CompileContextRequest request;
+    cobalt_asr::CompileContextResponse response;
+
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "compile context, model: %s, token: %s, phrases: %s\n", model, token, phrases);
+
+    request.set_model_id(model);
+    request.set_token(token);
+    parse_context_phrases(session, phrases, request);
+
+    std::string key = context_cache_key(request);
+    cacheHit = cobalt_speech::ContextCache::get(key, data);
+    bool hasContext = cacheHit;
+
+    if (!cacheHit) {
+      grpc::ClientContext context;
+      std::shared_ptr<grpc::Channel> grpcChannel ;
+      grpcChannel = getChannel(hostport);
+
+      if (!grpcChannel) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "failed creating grpc channel\n");	
+        return false;
+      }
 
-    return response.has_context() ? c.data().c_str() : nullptr;
+      std::unique_ptr<cobalt_asr::TranscribeService::Stub> stub = std::move(cobalt_asr::TranscribeService::NewStub(grpcChannel));
+      grpc::Status status = stub->CompileContext(&context, request, &response);
+      if (!status.ok()) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "compile context failed: %s (%d)\n",
+          status.error_message().c_str(), status.error_code());
+      }
+      hasContext = status.ok() && response.has_context();
+      if (hasContext) {
+        data = response.context().data();
+        cobalt_speech::ContextCache::put(key, data);
+      }
+    }
+
+    fire_compile_context_event(session, phrases, data, hasContext, cacheHit);
+    return hasContext;
   }
 
 }
 
+static void grpc_on_response(struct cap_cb *cb, cobalt_asr::StreamingRecognizeResponse& response);
+static void grpc_on_finish(struct cap_cb *cb, const grpc::Status& status);
+
 class GStreamer {
 public:
 	GStreamer(
-    switch_core_session_t *session, const char* hostport, const char* model, uint32_t channels, int interim) : 
+    switch_core_session_t *session, struct cap_cb *cb, const char* hostport, const char* model, uint32_t channels, int interim) : 
       m_session(session), 
-      m_writesDone(false), 
+      m_cb(cb),
       m_connected(false), 
       m_interim(interim),
       m_hostport(hostport),
       m_model(model),
       m_channelCount(channels),
-      m_audioBuffer(CHUNKSIZE, 15) {
+      m_audioBuffer(CHUNKSIZE, 15),
+      m_stream(nGrpcMaxQueuedFrames),
+      m_gotResponse(false) {
   
     const char* var;
     char sessionId[256];
@@ -202,7 +280,13 @@ public:
     switch_channel_t *channel = switch_core_session_get_channel(m_session);
 
     std::shared_ptr<grpc::Channel> grpcChannel ;
-    grpcChannel = grpc::CreateChannel(m_hostport, grpc::InsecureChannelCredentials());
+    if (std::string::npos != m_hostport.find(',')) {
+      // a list of servers: hold on to the chosen one for the life of the stream
+      m_lease = cobalt_speech::EndpointBalancer::acquire(m_hostport);
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p using cobalt server %s\n", this, m_lease->target().c_str());
+      grpcChannel = getChannel(m_lease->target());
+    }
+    else grpcChannel = getChannel(m_hostport);
 
     if (!grpcChannel) {
       switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "GStreamer %p failed creating grpc channel\n", this);	
@@ -221,9 +305,6 @@ public:
     // Begin a stream.
 
     std::shared_ptr<grpc::Channel> grpcChannel = createGrpcConnection();
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p creating streamer\n", this);	
-  	m_streamer = m_stub->StreamingRecognize(&m_context);
-    m_connected = true;
 
     /* set configuration parameters which are carried in the RecognitionInitMessage */
     auto config = m_request.mutable_config();
@@ -259,13 +340,32 @@ public:
       config->mutable_context()->add_compiled()->set_data(data);
       switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p set compiled context %s\n", this, var);	
     }
+    // hints compiled for this session, normally taken from the context cache
+    else if (var = switch_channel_get_variable(channel, "COBALT_CONTEXT_PHRASES")) {
+      const char* token = switch_channel_get_variable(channel, "COBALT_CONTEXT_TOKEN");
+      std::string data;
+      bool cacheHit = false;
+      if (compile_context_phrases(m_session, m_hostport.c_str(), m_model.c_str(), token ? token : DEFAULT_CONTEXT_TOKEN, var, data, cacheHit)) {
+        config->mutable_context()->add_compiled()->set_data(data);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p set compiled context for phrases %s (%s)\n",
+          this, var, cacheHit ? "cached" : "compiled");
+      }
+    }
 
-    // read thread is waiting on this
-    m_promise.set_value();
-
-  	// Write the first request, containing the config only.
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p sending initial message\n", this);	
-  	m_streamer->Write(m_request);
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p creating streamer\n", this);	
+    struct cap_cb *cb = m_cb;
+    m_startedAt = std::chrono::steady_clock::now();
+    bool started = m_stream.start([this](grpc::ClientContext* context, grpc::CompletionQueue* cq) {
+        return m_stub->PrepareAsyncStreamingRecognize(context, cq);
+      },
+      m_request,  // the first request contains the config only
+      [cb](cobalt_asr::StreamingRecognizeResponse& response) { grpc_on_response(cb, response); },
+      [cb](const grpc::Status& status) { grpc_on_finish(cb, status); });
+    if (!started) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "GStreamer %p could not start a stream, the grpc engine is not running\n", this);
+      return;
+    }
+    m_connected = true;
     m_request.clear_config();
 
     // send any buffered audio
@@ -289,168 +389,148 @@ public:
       }
       return true;
     }
-    m_request.clear_audio();
-    m_request.mutable_audio()->set_data(data, datalen);
-    bool ok = m_streamer->Write(m_request);
-    return ok;
+    auto request = m_stream.acquire();
+    request.mutable_audio()->set_data(data, datalen);
+    return m_stream.write(std::move(request));
   }
 
-	uint32_t nextMessageSize(void) {
-		uint32_t size = 0;
-		m_streamer->NextMessageSize(&size);
-		return size;
-	}
-
-	bool read(cobalt_asr::StreamingRecognizeResponse* response) {
-		return m_streamer->Read(response);
-	}
-
-	grpc::Status finish() {
-		return m_streamer->Finish();
+	void writesDone() {
+    m_stream.writesDone();
 	}
 
-	void writesDone() {
-    // grpc crashes if we call this twice on a stream
-    if (!m_connected) {
-      cancelConnect();
-    }
-    else if (!m_writesDone) {
-      m_streamer->WritesDone();
-      m_writesDone = true;
+  bool waitForFinish() {
+    bool ok = m_stream.waitForFinish(nTeardownTimeoutMs);
+    if (m_stream.getDropped() > 0) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "GStreamer %p dropped %u audio frames the network could not keep up with\n",
+        this, m_stream.getDropped());
     }
-	}
+    return ok;
+  }
 
-  bool waitForConnect() {
-    std::shared_future<void> sf(m_promise.get_future());
-    sf.wait();
+  bool isConnected() {
     return m_connected;
   }
 
-  void cancelConnect() {
-    assert(!m_connected);
-    m_promise.set_value();
-  } 
+  // first response latency and outcome of the stream, reported when spreading streams over a list of servers
+  void noteResponse() {
+    if (m_lease && !m_gotResponse) {
+      m_gotResponse = true;
+      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_startedAt).count();
+      m_lease->recordLatency((unsigned int) ms);
+    }
+  }
 
-  bool isConnected() {
-    return m_connected;
+  void noteFinish(const grpc::Status& status) {
+    if (m_lease) {
+      auto code = status.error_code();
+      m_lease->complete(code != grpc::StatusCode::UNAVAILABLE && code != grpc::StatusCode::DEADLINE_EXCEEDED &&
+        code != grpc::StatusCode::RESOURCE_EXHAUSTED && code != grpc::StatusCode::INTERNAL);
+    }
   }
 
 private:
 	switch_core_session_t* m_session;
-  grpc::ClientContext m_context;
+  struct cap_cb *m_cb;
 	std::shared_ptr<grpc::Channel> m_channel;
 	std::unique_ptr<cobalt_asr::TranscribeService::Stub> m_stub;
   cobalt_asr::StreamingRecognizeRequest m_request;
-	std::unique_ptr< grpc::ClientReaderWriterInterface<cobalt_asr::StreamingRecognizeRequest, cobalt_asr::StreamingRecognizeResponse> > m_streamer;
-  bool m_writesDone;
   bool m_connected;
   bool m_interim;
   std::string m_hostport;
   std::string m_model;
-  std::promise<void> m_promise;
   SimpleBuffer m_audioBuffer;
   uint32_t m_channelCount;
+  cobalt_speech::AsyncStream<cobalt_asr::StreamingRecognizeRequest, cobalt_asr::StreamingRecognizeResponse> m_stream;
+  std::shared_ptr<cobalt_speech::EndpointBalancer::Lease> m_lease;
+  std::chrono::steady_clock::time_point m_startedAt;
+  bool m_gotResponse;
   char m_sessionId[256];
 };
 
-static void *SWITCH_THREAD_FUNC grpc_read_thread(switch_thread_t *thread, void *obj) {
-	struct cap_cb *cb = (struct cap_cb *) obj;
-	GStreamer* streamer = (GStreamer *) cb->streamer;
+static void grpc_on_response(struct cap_cb *cb, cobalt_asr::StreamingRecognizeResponse& response) {
+  GStreamer* streamer = (GStreamer *) cb->streamer;
+  if (streamer) streamer->noteResponse();
 
-  bool connected = streamer->waitForConnect();
-  if (!connected) {
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "cobalt transcribe grpc read thread exiting since we didnt connect\n") ;
-    return nullptr;
+  switch_core_session_t* session = switch_core_session_locate(cb->sessionId);
+  if (!session) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "grpc_on_response: session %s is gone!\n", cb->sessionId) ;
+    return;
+  }
+  if (response.has_error()) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "grpc_on_response: error: %s\n", response.error().message().c_str()) ;
+  }
+  if (!response.has_result()) {
+    switch_core_session_rwunlock(session);
+    return;
   }
 
-  // Read responses.
-  cobalt_asr::StreamingRecognizeResponse response;
-  while (streamer->read(&response)) {  // Returns false when no more to read.
-    switch_core_session_t* session = switch_core_session_locate(cb->sessionId);
-    if (!session) {
-      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "grpc_read_thread: session %s is gone!\n", cb->sessionId) ;
-      return nullptr;
-    }
-    if (response.has_error()) {
-      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "grpc_read_thread: error: %s\n", response.error().message().c_str()) ;
-    }
-    if (!response.has_result()) {
-      switch_core_session_rwunlock(session);
-      continue;
-    }
-
-    const auto& result = response.result();
-    auto is_final = !result.is_partial();
-    auto audio_channel = result.audio_channel();
-
-    cJSON * jResult = cJSON_CreateObject();
-    cJSON * jAlternatives = cJSON_CreateArray();
-    cJSON_AddItemToObject(jResult, "is_final", cJSON_CreateBool(is_final));
-    cJSON_AddItemToObject(jResult, "channel", cJSON_CreateNumber(audio_channel));
-    cJSON_AddItemToObject(jResult, "alternatives", jAlternatives);
-
-    for (int a = 0; a < result.alternatives_size(); ++a) {
-      auto alternative = result.alternatives(a);
-      cJSON* jAlt = cJSON_CreateObject();
-      cJSON* jTranscriptRaw = cJSON_CreateString(alternative.transcript_raw().c_str());
-
-      cJSON_AddItemToObject(jAlt, "confidence", cJSON_CreateNumber(alternative.confidence()));
-      cJSON_AddItemToObject(jAlt, "transcript_formatted", cJSON_CreateString(alternative.transcript_formatted().c_str()));
-      cJSON_AddItemToObject(jAlt, "transcript_raw", cJSON_CreateString(alternative.transcript_raw().c_str()));
-      cJSON_AddItemToObject(jAlt, "start_time_ms", cJSON_CreateNumber(alternative.start_time_ms()));
-      cJSON_AddItemToObject(jAlt, "duration_ms", cJSON_CreateNumber(alternative.duration_ms()));
-
-      if (alternative.has_word_details()) {
-        cJSON * jWords = cJSON_CreateArray();
-        cJSON * jWordsRaw = cJSON_CreateArray();
-        auto& word_details = alternative.word_details();
-        for (int b = 0; b < word_details.formatted_size(); ++b) {
-          cJSON* jWord = cJSON_CreateObject();
-          auto& word_info = word_details.formatted(b);
-          cJSON_AddItemToObject(jWord, "word", cJSON_CreateString(word_info.word().c_str()));
-          cJSON_AddItemToObject(jWord, "confidence", cJSON_CreateNumber(word_info.confidence()));
-          cJSON_AddItemToObject(jWord, "start_time_ms", cJSON_CreateNumber(word_info.start_time_ms()));
-          cJSON_AddItemToObject(jWord, "duration_ms", cJSON_CreateNumber(word_info.duration_ms()));
-
-          cJSON_AddItemToArray(jWords, jWord);
-        }
-        cJSON_AddItemToObject(jAlt, "formatted_words", jWords);
-
-        for (int c = 0; c < word_details.raw_size(); ++c) {
-          cJSON* jWord = cJSON_CreateObject();
-          auto& word_info = word_details.raw(c);
-          cJSON_AddItemToObject(jWord, "word", cJSON_CreateString(word_info.word().c_str()));
-          cJSON_AddItemToObject(jWord, "confidence", cJSON_CreateNumber(word_info.confidence()));
-          cJSON_AddItemToObject(jWord, "start_time_ms", cJSON_CreateNumber(word_info.start_time_ms()));
-          cJSON_AddItemToObject(jWord, "duration_ms", cJSON_CreateNumber(word_info.duration_ms()));
+  const auto& result = response.result();
+  auto is_final = !result.is_partial();
+  auto audio_channel = result.audio_channel();
+
+  cJSON * jResult = cJSON_CreateObject();
+  cJSON * jAlternatives = cJSON_CreateArray();
+  cJSON_AddItemToObject(jResult, "is_final", cJSON_CreateBool(is_final));
+  cJSON_AddItemToObject(jResult, "channel", cJSON_CreateNumber(audio_channel));
+  cJSON_AddItemToObject(jResult, "alternatives", jAlternatives);
+
+  for (int a = 0; a < result.alternatives_size(); ++a) {
+    auto alternative = result.alternatives(a);
+    cJSON* jAlt = cJSON_CreateObject();
+    cJSON* jTranscriptRaw = cJSON_CreateString(alternative.transcript_raw().c_str());
+
+    cJSON_AddItemToObject(jAlt, "confidence", cJSON_CreateNumber(alternative.confidence()));
+    cJSON_AddItemToObject(jAlt, "transcript_formatted", cJSON_CreateString(alternative.transcript_formatted().c_str()));
+    cJSON_AddItemToObject(jAlt, "transcript_raw", cJSON_CreateString(alternative.transcript_raw().c_str()));
+    cJSON_AddItemToObject(jAlt, "start_time_ms", cJSON_CreateNumber(alternative.start_time_ms()));
+    cJSON_AddItemToObject(jAlt, "duration_ms", cJSON_CreateNumber(alternative.duration_ms()));
+
+    if (alternative.has_word_details()) {
+      cJSON * jWords = cJSON_CreateArray();
+      cJSON * jWordsRaw = cJSON_CreateArray();
+      auto& word_details = alternative.word_details();
+      for (int b = 0; b < word_details.formatted_size(); ++b) {
+        cJSON* jWord = cJSON_CreateObject();
+        auto& word_info = word_details.formatted(b);
+        cJSON_AddItemToObject(jWord, "word", cJSON_CreateString(word_info.word().c_str()));
+        cJSON_AddItemToObject(jWord, "confidence", cJSON_CreateNumber(word_info.confidence()));
+        cJSON_AddItemToObject(jWord, "start_time_ms", cJSON_CreateNumber(word_info.start_time_ms()));
+        cJSON_AddItemToObject(jWord, "duration_ms", cJSON_CreateNumber(word_info.duration_ms()));
+
+        cJSON_AddItemToArray(jWords, jWord);
+      }
+      cJSON_AddItemToObject(jAlt, "formatted_words", jWords);
 
-          cJSON_AddItemToArray(jWordsRaw, jWord);
-        }
-        cJSON_AddItemToObject(jAlt, "raw_words", jWordsRaw);
+      for (int c = 0; c < word_details.raw_size(); ++c) {
+        cJSON* jWord = cJSON_CreateObject();
+        auto& word_info = word_details.raw(c);
+        cJSON_AddItemToObject(jWord, "word", cJSON_CreateString(word_info.word().c_str()));
+        cJSON_AddItemToObject(jWord, "confidence", cJSON_CreateNumber(word_info.confidence()));
+        cJSON_AddItemToObject(jWord, "start_time_ms", cJSON_CreateNumber(word_info.start_time_ms()));
+        cJSON_AddItemToObject(jWord, "duration_ms", cJSON_CreateNumber(word_info.duration_ms()));
 
+        cJSON_AddItemToArray(jWordsRaw, jWord);
       }
-      cJSON_AddItemToArray(jAlternatives, jAlt);
-    }
-    char* json = cJSON_PrintUnformatted(jResult);
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "cobalt models: %s\n", json) ;
-    cb->responseHandler(session, (const char *) json, cb->bugname, NULL);
-    free(json);
-
-    cJSON_Delete(jResult);
-  
-    switch_core_session_rwunlock(session);
-  }
+      cJSON_AddItemToObject(jAlt, "raw_words", jWordsRaw);
 
-  {
-    switch_core_session_t* session = switch_core_session_locate(cb->sessionId);
-    if (session) {
-      grpc::Status status = streamer->finish();
-      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "grpc_read_thread: finish() status %s (%d)\n", status.error_message().c_str(), status.error_code()) ;
-      switch_core_session_rwunlock(session);
     }
+    cJSON_AddItemToArray(jAlternatives, jAlt);
   }
+  char* json = cJSON_PrintUnformatted(jResult);
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "cobalt models: %s\n", json) ;
+  cb->responseHandler(session, (const char *) json, cb->bugname, NULL);
+  free(json);
 
-  return nullptr;
+  cJSON_Delete(jResult);
+  
+  switch_core_session_rwunlock(session);
+}
+
+static void grpc_on_finish(struct cap_cb *cb, const grpc::Status& status) {
+  GStreamer* streamer = (GStreamer *) cb->streamer;
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "grpc_on_finish: %s status %s (%d)\n", cb->sessionId,
+    status.error_message().c_str(), status.error_code()) ;
+  if (streamer) streamer->noteFinish(status);
 }
 
 extern "C" {
@@ -461,7 +541,7 @@ extern "C" {
 
       grpc::ClientContext context;
       std::shared_ptr<grpc::Channel> grpcChannel ;
-      grpcChannel = grpc::CreateChannel(hostport, grpc::InsecureChannelCredentials());
+      grpcChannel = getChannel(hostport);
 
       if (!grpcChannel) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "failed creating grpc channel\n");	
@@ -498,9 +578,19 @@ extern "C" {
       switch_channel_t *channel = switch_core_session_get_channel(session);
     	switch_event_t *event;
 
-      switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "compile context, model: %s, token: %s, phrases: %s\n", model, token, phrases);
+      std::string data;
+      bool cacheHit = false;
 
-      return compile_context_phrases(session, hostport, model, token, phrases) != nullptr ?
+      return compile_context_phrases(session, hostport, model, token, phrases, data, cacheHit) ?
+        SWITCH_STATUS_SUCCESS :
+        SWITCH_STATUS_FALSE;
+    }
+
+    switch_status_t cobalt_speech_precompile_context(char* hostport, char* model, char* token, char* phrases) {
+      std::string data;
+      bool cacheHit = false;
+
+      return compile_context_phrases(NULL, hostport, model, token, phrases, data, cacheHit) ?
         SWITCH_STATUS_SUCCESS :
         SWITCH_STATUS_FALSE;
     }
@@ -512,7 +602,7 @@ extern "C" {
 
       grpc::ClientContext context;
       std::shared_ptr<grpc::Channel> grpcChannel ;
-      grpcChannel = grpc::CreateChannel(hostport, grpc::InsecureChannelCredentials());
+      grpcChannel = getChannel(hostport);
 
       if (!grpcChannel) {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "failed creating grpc channel\n");	
@@ -582,10 +672,40 @@ extern "C" {
 
 
     switch_status_t cobalt_speech_init() {
+      cobalt_speech::ChannelRegistry::initialize(nGrpcSubchannels, nGrpcMaxStreamsPerChannel, nGrpcKeepaliveMs);
+      cobalt_speech::GrpcEngine::initialize(nGrpcThreads);
+      cobalt_speech::EndpointBalancer::initialize(nHealthCheckMs, nEjectFailures, nEjectSecs);
+      cobalt_speech::ContextCache::initialize(nContextCacheSize, nContextCacheTtlSecs);
       return SWITCH_STATUS_SUCCESS;
     }
 
+    // json array describing each server streams have been spread over; the caller frees the result
+    char* cobalt_speech_backend_stats() {
+      std::vector<cobalt_speech::EndpointBalancer::BackendStats> stats;
+      cobalt_speech::EndpointBalancer::getStats(stats);
+
+      cJSON* jBackends = cJSON_CreateArray();
+      for (const auto& s : stats) {
+        cJSON* jBackend = cJSON_CreateObject();
+        cJSON_AddStringToObject(jBackend, "target", s.target.c_str());
+        cJSON_AddBoolToObject(jBackend, "healthy", s.healthy);
+        cJSON_AddNumberToObject(jBackend, "active", s.active);
+        cJSON_AddNumberToObject(jBackend, "streams", (double) s.streams);
+        cJSON_AddNumberToObject(jBackend, "failures", (double) s.failures);
+        cJSON_AddNumberToObject(jBackend, "ejections", (double) s.ejections);
+        cJSON_AddNumberToObject(jBackend, "avg_first_response_ms", s.avgLatencyMs);
+        cJSON_AddItemToArray(jBackends, jBackend);
+      }
+      char* json = cJSON_PrintUnformatted(jBackends);
+      cJSON_Delete(jBackends);
+      return json;
+    }
+
     switch_status_t cobalt_speech_cleanup() {
+      cobalt_speech::GrpcEngine::deinitialize();
+      cobalt_speech::EndpointBalancer::deinitialize();
+      cobalt_speech::ChannelRegistry::deinitialize();
+      cobalt_speech::ContextCache::deinitialize();
       return SWITCH_STATUS_SUCCESS;
     }
     switch_status_t cobalt_speech_session_init(switch_core_session_t *session, responseHandler_t responseHandler, char* hostport,
@@ -649,7 +769,7 @@ extern "C" {
       GStreamer *streamer = NULL;
       try {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "cobalt_speech_session_init:  allocating streamer\n");
-        streamer = new GStreamer(session, hostport, model, channels, interim);
+        streamer = new GStreamer(session, cb, hostport, model, channels, interim);
         cb->streamer = streamer;
       } catch (std::exception& e) {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "%s: Error initializing gstreamer: %s.\n", 
@@ -662,14 +782,6 @@ extern "C" {
         streamer->connect();
       }
 
-      // create the read thread
-      switch_threadattr_t *thd_attr = NULL;
-      switch_memory_pool_t *pool = switch_core_session_get_pool(session);
-
-      switch_threadattr_create(&thd_attr, pool);
-      switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
-      switch_thread_create(&cb->thread, thd_attr, grpc_read_thread, cb, pool);
-
       *ppUserData = cb;
       return SWITCH_STATUS_SUCCESS;
     }
@@ -695,10 +807,9 @@ extern "C" {
         if (streamer) {
           streamer->writesDone();
 
-          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "cobalt_speech_session_cleanup: GStreamer (%p) waiting for read thread to complete\n", (void*)streamer);
-          switch_status_t st;
-          switch_thread_join(&st, cb->thread);
-          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "cobalt_speech_session_cleanup:  GStreamer (%p) read thread completed\n", (void*)streamer);
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "cobalt_speech_session_cleanup: GStreamer (%p) waiting for stream to finish\n", (void*)streamer);
+          streamer->waitForFinish();
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "cobalt_speech_session_cleanup:  GStreamer (%p) stream finished\n", (void*)streamer);
 
           delete streamer;
           cb->streamer = NULL;
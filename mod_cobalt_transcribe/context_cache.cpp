@@ -0,0 +1,75 @@
+#include "context_cache.hpp"
+
+#include <switch.h>
+
+using namespace cobalt_speech;
+
+std::mutex ContextCache::mutex;
+std::list<ContextCache::Entry> ContextCache::entries;
+std::unordered_map<std::string, std::list<ContextCache::Entry>::iterator> ContextCache::index;
+unsigned int ContextCache::nMaxEntries = 0;
+unsigned int ContextCache::nTtlSecs = 0;
+ContextCache::Stats ContextCache::stats;
+
+void ContextCache::initialize(unsigned int maxEntries, unsigned int ttlSecs) {
+  std::lock_guard<std::mutex> lk(mutex);
+  nMaxEntries = maxEntries;
+  nTtlSecs = ttlSecs;
+  stats = Stats();
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "ContextCache::initialize max %u compiled contexts, ttl %u secs\n",
+    nMaxEntries, nTtlSecs);
+}
+
+void ContextCache::deinitialize() {
+  std::lock_guard<std::mutex> lk(mutex);
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE,
+    "ContextCache::deinitialize %u entries, %llu hits, %llu misses, %llu expired, %llu evicted\n",
+    (unsigned int) entries.size(), (unsigned long long) stats.hits, (unsigned long long) stats.misses,
+    (unsigned long long) stats.expired, (unsigned long long) stats.evictions);
+  index.clear();
+  entries.clear();
+}
+
+bool ContextCache::get(const std::string& key, std::string& data) {
+  std::lock_guard<std::mutex> lk(mutex);
+  auto it = index.find(key);
+  if (it == index.end()) {
+    stats.misses++;
+    return false;
+  }
+  if (it->second->expiresAt <= Clock::now()) {
+    entries.erase(it->second);
+    index.erase(it);
+    stats.expired++;
+    stats.misses++;
+    return false;
+  }
+  entries.splice(entries.begin(), entries, it->second);
+  data = it->second->data;
+  stats.hits++;
+  return true;
+}
+
+void ContextCache::put(const std::string& key, const std::string& data) {
+  if (0 == nMaxEntries) return;
+
+  std::lock_guard<std::mutex> lk(mutex);
+  auto it = index.find(key);
+  if (it != index.end()) {
+    entries.erase(it->second);
+    index.erase(it);
+  }
+  entries.push_front(Entry{key, data, Clock::now() + std::chrono::seconds(nTtlSecs)});
+  index[key] = entries.begin();
+  while (entries.size() > nMaxEntries) {
+    index.erase(entries.back().key);
+    entries.pop_back();
+    stats.evictions++;
+  }
+}
+
+void ContextCache::getStats(Stats& out) {
+  std::lock_guard<std::mutex> lk(mutex);
+  out = stats;
+  out.entries = entries.size();
+}
@@ -0,0 +1,56 @@
+#ifndef __COBALT_CONTEXT_CACHE_HPP__
+#define __COBALT_CONTEXT_CACHE_HPP__
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+namespace cobalt_speech {
+
+/*
+ * Keeps the compiled context bytes returned by CompileContext, keyed by model, token and
+ * the normalized phrase list they were compiled from, so that sessions (and the compile
+ * api) reuse a context rather than paying an extra round trip and server-side compile
+ * for the same phrases on every call.  Entries expire after a ttl and the least recently
+ * used entry is dropped when the cache is full.
+ */
+class ContextCache {
+public:
+  struct Stats {
+    size_t entries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t expired;
+    uint64_t evictions;
+  };
+
+  static void initialize(unsigned int maxEntries, unsigned int ttlSecs);
+  static void deinitialize();
+
+  static bool get(const std::string& key, std::string& data);
+  static void put(const std::string& key, const std::string& data);
+
+  static void getStats(Stats& out);
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Entry {
+    std::string key;
+    std::string data;
+    Clock::time_point expiresAt;
+  };
+
+  static std::mutex mutex;
+  static std::list<Entry> entries;
+  static std::unordered_map<std::string, std::list<Entry>::iterator> index;
+  static unsigned int nMaxEntries;
+  static unsigned int nTtlSecs;
+  static Stats stats;
+};
+
+} // namespace cobalt_speech
+#endif
@@ -13,6 +13,36 @@
 /* Prototypes */
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_transcribe_shutdown);
 SWITCH_MODULE_RUNTIME_FUNCTION(mod_transcribe_runtime);
+#define TRANSCRIBE_API_PRECOMPILE_CONTEXT_SYNTAX "hostport model token phrases"
+SWITCH_STANDARD_API(precompile_context_function)
+{
+	char *mycmd = NULL, *argv[4] = { 0 };
+	int argc = 0;
+	switch_status_t status = SWITCH_STATUS_FALSE;
+
+	if (!zstr(cmd) && (mycmd = strdup(cmd))) {
+		argc = switch_separate_string(mycmd, ' ', argv, (sizeof(argv) / sizeof(argv[0])));
+	}
+
+	if (zstr(cmd) || argc < 4) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Error with command %s\n", cmd);
+		stream->write_function(stream, "-USAGE: %s\n", TRANSCRIBE_API_PRECOMPILE_CONTEXT_SYNTAX);
+		goto done;
+	}
+	status = cobalt_speech_precompile_context(argv[0], argv[1], argv[2], argv[3]);
+
+	if (status == SWITCH_STATUS_SUCCESS) {
+		stream->write_function(stream, "+OK Success\n");
+	} else {
+		stream->write_function(stream, "-ERR Operation Failed\n");
+	}
+
+  done:
+
+	switch_safe_free(mycmd);
+	return SWITCH_STATUS_SUCCESS;
+}
+
 SWITCH_MODULE_LOAD_FUNCTION(mod_transcribe_load);
 
 SWITCH_MODULE_DEFINITION(mod_cobalt_transcribe, mod_transcribe_load, mod_transcribe_shutdown, NULL);
@@ -297,6 +327,19 @@ SWITCH_STANDARD_API(compile_context_function)
 	return SWITCH_STATUS_SUCCESS;
 }
 
+SWITCH_STANDARD_API(backends_function)
+{
+	char *json = cobalt_speech_backend_stats();
+	if (json) {
+		stream->write_function(stream, "%s\n", json);
+		free(json);
+	}
+	else {
+		stream->write_function(stream, "-ERR Operation Failed\n");
+	}
+	return SWITCH_STATUS_SUCCESS;
+}
+
 SWITCH_MODULE_LOAD_FUNCTION(mod_transcribe_load)
 {
 	switch_api_interface_t *api_interface;
@@ -339,12 +382,17 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_transcribe_load)
 	switch_console_set_complete("add uuid_cobalt_transcribe hostport start model");
 	switch_console_set_complete("add uuid_cobalt_transcribe hostport stop ");
 
+	SWITCH_ADD_API(api_interface, "cobalt_transcribe_backends", "Soniox Speech Transcription API", backends_function, "");
+
 	SWITCH_ADD_API(api_interface, "uuid_cobalt_list_models", "Soniox Speech Transcription API", list_models_function, TRANSCRIBE_API_MODELS_SYNTAX);
 	switch_console_set_complete("add uuid_cobalt_list_models hostport");
 
 	SWITCH_ADD_API(api_interface, "uuid_cobalt_compile_context", "Soniox Speech Transcription API", compile_context_function, TRANSCRIBE_API_COMPILE_CONTEXT_SYNTAX);
 	switch_console_set_complete("add uuid_cobalt_compile_context hostport token phrases");
 
+	SWITCH_ADD_API(api_interface, "cobalt_precompile_context", "Soniox Speech Transcription API", precompile_context_function, TRANSCRIBE_API_PRECOMPILE_CONTEXT_SYNTAX);
+	switch_console_set_complete("add cobalt_precompile_context hostport model token phrases");
+
 	SWITCH_ADD_API(api_interface, "uuid_cobalt_get_version", "Soniox Speech Transcription API", version_function, TRANSCRIBE_API_VERSION_SYNTAX);
 	switch_console_set_complete("add uuid_cobalt_get_version hostport");
 
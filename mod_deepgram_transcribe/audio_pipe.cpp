@@ -1,4 +1,5 @@
 #include "audio_pipe.hpp"
+#include "teardown_executor.hpp"
 
 #include <cassert>
 #include <iostream>
@@ -72,6 +73,7 @@ int AudioPipe::lws_callback(struct lws *wsi,
         if (ap) {
           ap->m_state = LWS_CLIENT_FAILED;
           ap->m_callback(ap->m_uuid.c_str(),  ap->m_bugname.c_str(), deepgram::AudioPipe::CONNECT_FAIL, (char *) in, ap->isFinished());
+          deepgram::TeardownExecutor::notify();
         }
         else {
           lwsl_err("AudioPipe::lws_service_thread LWS_CALLBACK_CLIENT_CONNECTION_ERROR unable to find wsi %p..\n", wsi); 
@@ -115,6 +117,7 @@ int AudioPipe::lws_callback(struct lws *wsi,
         }
         ap->m_state = LWS_CLIENT_DISCONNECTED;
         ap->setClosed();
+        deepgram::TeardownExecutor::notify();
     
         //NB: after receiving any of the events above, any holder of a 
         //pointer or reference to this object must treat is as no longer valid
@@ -452,6 +455,7 @@ AudioPipe::AudioPipe(const char* uuid, const char* bugname, const char* host, un
   m_state(LWS_CLIENT_IDLE), m_wsi(nullptr), m_vhd(nullptr), m_apiKey(apiKey), m_callback(callback) {
 
   m_audio_buffer = new uint8_t[m_audio_buffer_max_len];
+  m_closed = m_promise.get_future().share();
 }
 AudioPipe::~AudioPipe() {
   if (m_audio_buffer) delete [] m_audio_buffer;
@@ -511,8 +515,19 @@ void AudioPipe::finish() {
   bufferForSending("{\"type\": \"CloseStream\"}");
 }
 
+// ask the server to finalize the current utterance, keeping the connection open for the next one
+void AudioPipe::flush() {
+  if (m_finished || m_state != LWS_CLIENT_CONNECTED) return;
+  bufferForSending("{\"type\": \"Finalize\"}");
+}
+
 void AudioPipe::waitForClose() {
-  std::shared_future<void> sf(m_promise.get_future());
-  sf.wait();
+  m_closed.wait();
   return;
 }
+
+// true once the service thread is done with this pipe, either because the socket closed or it never connected
+bool AudioPipe::isClosed() {
+  if (m_state == LWS_CLIENT_FAILED) return true;
+  return m_closed.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
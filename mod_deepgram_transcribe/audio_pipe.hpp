@@ -76,7 +76,9 @@ namespace deepgram {
 
     void close() ;
     void finish();
+    void flush();
     void waitForClose();
+    bool isClosed();
     void setClosed() { m_promise.set_value(); }
     bool isFinished() { return m_finished;}
 
@@ -137,6 +139,7 @@ namespace deepgram {
     bool m_finished;
     std::string m_bugname;
     std::promise<void> m_promise;
+    std::shared_future<void> m_closed;
   };
 
 } // namespace deepgram
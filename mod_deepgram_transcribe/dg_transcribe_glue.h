@@ -3,9 +3,11 @@
 
 switch_status_t dg_transcribe_init();
 switch_status_t dg_transcribe_cleanup();
+char* dg_transcribe_stats();
 switch_status_t dg_transcribe_session_init(switch_core_session_t *session, responseHandler_t responseHandler, 
 		uint32_t samples_per_second, uint32_t channels, char* lang, int interim, char* bugname, void **ppUserData);
 switch_status_t dg_transcribe_session_stop(switch_core_session_t *session, int channelIsClosing, char* bugname);
+switch_status_t dg_transcribe_session_finalize(switch_core_session_t *session, char* bugname);
 switch_bool_t dg_transcribe_frame(switch_core_session_t *session, switch_media_bug_t *bug);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,72 @@
+#ifndef __DIALOGFLOW_AUDIO_STORE_HPP__
+#define __DIALOGFLOW_AUDIO_STORE_HPP__
+
+#include <string>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+namespace dialogflow {
+
+/*
+ * Holds agent audio in memory as 16 bit mono pcm so it can be played to the caller through
+ * the module's file interface (<prefix>://<id>) instead of being written to a temp file,
+ * opened again for playback and removed at hangup.  Each session's clips are bounded in
+ * total size; once the bound is reached the session's oldest complete clips are dropped,
+ * although a clip that is being played stays readable until its playback closes.  A clip
+ * still being received is never dropped.  A clip may be played
+ * while it is still being received, so playback can start with the first chunk of audio.
+ */
+class AudioStore {
+public:
+  // pcm and complete are guarded by the clip's own mutex, so that playback does not contend with other sessions
+  struct Clip {
+    std::mutex mutex;
+    std::string pcm;
+    uint32_t sampleRate;
+    bool complete;
+  };
+
+  static void initialize(size_t maxSessionBytes);
+  static void deinitialize();
+
+  // stores a clip for the session and returns its id
+  static std::string add(const std::string& sessionId, uint32_t sampleRate, const char* data, size_t len, bool complete);
+
+  // appends audio to a clip still being received, or marks it complete
+  static bool append(const std::string& id, const char* data, size_t len);
+  static void complete(const std::string& id);
+
+  static std::shared_ptr<Clip> open(const std::string& id);
+
+  // copies up to len bytes from offset into buf, and reports whether the clip is complete; returns the number of bytes copied
+  static size_t read(const std::shared_ptr<Clip>& clip, size_t offset, char* buf, size_t len, bool& complete);
+
+  // bytes of audio received so far for the clip
+  static size_t size(const std::shared_ptr<Clip>& clip);
+
+  static void removeSession(const std::string& sessionId);
+
+  // locates the samples in a wav file, returning false if data is not 16 bit mono pcm wav
+  static bool parseWav(const std::string& data, uint32_t& sampleRate, size_t& offset, size_t& len);
+
+private:
+  struct SessionClips {
+    std::list<std::string> ids;
+    size_t bytes;
+  };
+
+  static void trim(SessionClips& session);
+  static void drop(Clip& clip);
+
+  static std::mutex mutex;
+  static std::map<std::string, std::shared_ptr<Clip> > clips;
+  static std::map<std::string, SessionClips> sessions;
+  static uint64_t nextId;
+  static size_t nMaxSessionBytes;
+};
+
+} // namespace dialogflow
+#endif
@@ -0,0 +1,135 @@
+#include "credentials_cache.hpp"
+
+#include <switch.h>
+#include <algorithm>
+
+/* lifetime of the jwts signed for a service account key; grpc re-signs one shortly before it expires */
+#define JWT_LIFETIME_SECS (3600)
+
+using namespace dialogflow;
+
+std::mutex CredentialsCache::mutex;
+std::list<CredentialsCache::Entry> CredentialsCache::entries;
+std::unordered_map<std::string, std::list<CredentialsCache::Entry>::iterator> CredentialsCache::index;
+size_t CredentialsCache::nCapacity = 32;
+unsigned int CredentialsCache::nChannels = 4;
+unsigned int CredentialsCache::nMaxStreams = 100;
+CredentialsCache::Stats CredentialsCache::stats;
+
+void CredentialsCache::initialize(size_t capacity, unsigned int channelsPerEndpoint, unsigned int maxStreamsPerChannel) {
+  std::lock_guard<std::mutex> lk(mutex);
+  nCapacity = std::max((size_t) 1, capacity);
+  nChannels = std::max(1U, channelsPerEndpoint);
+  nMaxStreams = std::max(1U, maxStreamsPerChannel);
+  stats = Stats();
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE,
+    "CredentialsCache::initialize up to %u service account keys, %u channels per endpoint, %u streams per channel\n",
+    (unsigned int) nCapacity, nChannels, nMaxStreams);
+}
+
+void CredentialsCache::deinitialize() {
+  std::lock_guard<std::mutex> lk(mutex);
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "CredentialsCache::deinitialize %u entries, %llu hits, %llu misses, %llu evictions\n",
+    (unsigned int) entries.size(), (unsigned long long) stats.hits, (unsigned long long) stats.misses, (unsigned long long) stats.evictions);
+  index.clear();
+  entries.clear();
+}
+
+std::shared_ptr<grpc::ChannelCredentials> CredentialsCache::createCredentials(const std::string& json) {
+  if (json.empty()) return grpc::GoogleDefaultCredentials();
+
+  auto callCreds = grpc::ServiceAccountJWTAccessCredentials(json, JWT_LIFETIME_SECS);
+  if (!callCreds) return nullptr;
+  return grpc::CompositeChannelCredentials(grpc::SslCredentials(grpc::SslCredentialsOptions()), callCreds);
+}
+
+std::shared_ptr<CredentialsCache::Channel> CredentialsCache::createChannel(const std::string& endpoint,
+  const std::shared_ptr<grpc::ChannelCredentials>& credentials) {
+  // a local subchannel pool gives each channel a connection of its own rather than the process-wide shared one
+  grpc::ChannelArguments args;
+  args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+
+  std::shared_ptr<Channel> ch = std::make_shared<Channel>();
+  ch->channel = grpc::CreateCustomChannel(endpoint, credentials, args);
+  ch->active = 0;
+  return ch;
+}
+
+std::shared_ptr<grpc::Channel> CredentialsCache::getChannel(const std::string& endpoint, const std::string& json) {
+  // the whole key file, so that channels are only ever shared between sessions using the same key
+  std::string key = json.empty() ? "default" : "jwt:" + json;
+  std::unique_lock<std::mutex> lk(mutex);
+  auto it = index.find(key);
+  if (it != index.end()) {
+    entries.splice(entries.begin(), entries, it->second);
+    stats.hits++;
+  }
+  else {
+    stats.misses++;
+    lk.unlock();
+
+    // built outside the lock, since parsing the key is the expensive part
+    auto credentials = createCredentials(json);
+    if (!credentials) {
+      // not cached, so that a corrected key is picked up
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "CredentialsCache::getChannel invalid service account key\n");
+      return nullptr;
+    }
+
+    lk.lock();
+    it = index.find(key);
+    if (it != index.end()) {
+      // built concurrently by another session: share the first one
+      entries.splice(entries.begin(), entries, it->second);
+    }
+    else {
+      entries.push_front(Entry{key, credentials, std::map<std::string, Channels>()});
+      index[key] = entries.begin();
+      while (entries.size() > nCapacity) {
+        index.erase(entries.back().key);
+        entries.pop_back();
+        stats.evictions++;
+      }
+    }
+  }
+
+  // round-robin over the channels that have room, opening the configured number first and another whenever they are
+  // all at the stream cap; channels connect lazily, so creating one under the lock is cheap
+  Entry& entry = entries.front();
+  Channels& ch = entry.endpoints[endpoint];
+  std::shared_ptr<Channel> chosen;
+  size_t n = ch.channels.size();
+  if (n < nChannels) {
+    chosen = createChannel(endpoint, entry.credentials);
+    ch.channels.push_back(chosen);
+    ch.next = 0;
+  }
+  else {
+    for (size_t i = 0; i < n && !chosen; i++) {
+      auto& candidate = ch.channels[(ch.next + i) % n];
+      if (candidate->active < nMaxStreams) {
+        chosen = candidate;
+        ch.next = (ch.next + i + 1) % n;
+      }
+    }
+    if (!chosen) {
+      chosen = createChannel(endpoint, entry.credentials);
+      ch.channels.push_back(chosen);
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "CredentialsCache::getChannel all %u channels to %s at %u streams, added another\n",
+        (unsigned int) n, endpoint.c_str(), nMaxStreams);
+    }
+  }
+
+  chosen->active++;
+  std::shared_ptr<StreamRef> ref = std::make_shared<StreamRef>();
+  ref->channel = chosen;
+
+  // aliasing constructor: points at the channel but owns the stream reference
+  return std::shared_ptr<grpc::Channel>(ref, chosen->channel.get());
+}
+
+void CredentialsCache::getStats(Stats& out) {
+  std::lock_guard<std::mutex> lk(mutex);
+  out = stats;
+  out.entries = entries.size();
+}
@@ -0,0 +1,86 @@
+#ifndef __DIALOGFLOW_CREDENTIALS_CACHE_HPP__
+#define __DIALOGFLOW_CREDENTIALS_CACHE_HPP__
+
+#include <string>
+#include <list>
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+#include <grpcpp/grpcpp.h>
+
+namespace dialogflow {
+
+/*
+ * Shares credentials and channels between sessions using the same service account key.
+ * Entries are keyed by the credentials json itself (an empty json meaning the application
+ * default credentials) and hold the ssl credentials composed with the key's jwt access
+ * credentials, which sign a jwt once and reuse it until shortly before it expires, along with
+ * the channels per endpoint built on them.  Streams are spread round-robin over the channels
+ * below the per-connection stream cap, and another channel is opened when they are all at the
+ * cap.  A session therefore neither parses the key nor signs a jwt nor handshakes a new
+ * connection.  The cache is a bounded LRU; channels of an evicted key stay open while sessions
+ * use them.
+ *
+ * The channel handed out carries a reference that counts as one active stream on it until the
+ * last copy of it (including any stub created from it) is released.
+ */
+class CredentialsCache {
+public:
+  struct Stats {
+    size_t entries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+  };
+
+  // channelsPerEndpoint are opened before streams share a connection, and more once each carries maxStreamsPerChannel
+  static void initialize(size_t capacity, unsigned int channelsPerEndpoint, unsigned int maxStreamsPerChannel);
+  static void deinitialize();
+
+  // a channel to endpoint authenticated with the service account key json, or the default credentials if json is empty
+  static std::shared_ptr<grpc::Channel> getChannel(const std::string& endpoint, const std::string& json);
+
+  static void getStats(Stats& out);
+
+private:
+  struct Channel {
+    std::shared_ptr<grpc::Channel> channel;
+    std::atomic<unsigned int> active;
+  };
+
+  struct Channels {
+    std::vector<std::shared_ptr<Channel> > channels;
+    unsigned int next;
+  };
+
+  // released along with the last copy of a channel returned by getChannel
+  struct StreamRef {
+    std::shared_ptr<Channel> channel;
+    ~StreamRef() { channel->active--; }
+  };
+
+  struct Entry {
+    std::string key;
+    std::shared_ptr<grpc::ChannelCredentials> credentials;
+    std::map<std::string, Channels> endpoints;
+  };
+
+  static std::shared_ptr<grpc::ChannelCredentials> createCredentials(const std::string& json);
+  static std::shared_ptr<Channel> createChannel(const std::string& endpoint, const std::shared_ptr<grpc::ChannelCredentials>& credentials);
+
+  static std::mutex mutex;
+  static std::list<Entry> entries;
+  static std::unordered_map<std::string, std::list<Entry>::iterator> index;
+  static size_t nCapacity;
+  static unsigned int nChannels;
+  static unsigned int nMaxStreams;
+  static Stats stats;
+};
+
+} // namespace dialogflow
+#endif
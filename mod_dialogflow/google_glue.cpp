@@ -16,15 +16,21 @@
 #include <sstream>
 #include <map>
 #include <set>
+#include <algorithm>
+#include <thread>
+#include <chrono>
 
 #include "google/cloud/dialogflow/cx/v3/session.grpc.pb.h"
 
 #include "mod_dialogflow.h"
 #include "parser.h"
+#include "audio_store.hpp"
+#include "credentials_cache.hpp"
 
 using google::cloud::dialogflow::cx::v3::Sessions;
 using google::cloud::dialogflow::cx::v3::StreamingDetectIntentRequest;
 using google::cloud::dialogflow::cx::v3::StreamingDetectIntentResponse;
+using google::cloud::dialogflow::cx::v3::DetectIntentResponse;
 using google::cloud::dialogflow::cx::v3::AudioEncoding;
 using google::cloud::dialogflow::cx::v3::InputAudioConfig;
 using google::cloud::dialogflow::cx::v3::OutputAudioConfig;
@@ -40,10 +46,36 @@ using google::protobuf::Struct;
 using google::protobuf::Value;
 using google::protobuf::MapPair;
 
+/* caller audio held while the next turn's stream is being set up: 5 secs of 16 bit mono at 16 kHz */
+#define MAX_PREOPEN_BUFFER_BYTES (16000 * 2 * 5)
+
+/* how long playback of agent audio still being received waits on silence for more before giving up */
+#define MAX_AUDIO_STARVATION_SECS (10)
+
 static uint64_t playCount = 0;
+static std::mutex audioFilesMutex;
 static std::multimap<std::string, std::string> audioFiles;
 static bool hasDefaultCredentials = false;
 
+static const char* requestedMaxSessionAudioKB = std::getenv("DIALOGFLOW_MAX_SESSION_AUDIO_KB");
+static unsigned int nMaxSessionAudioKB = std::max(64, requestedMaxSessionAudioKB ? ::atoi(requestedMaxSessionAudioKB) : 4096);
+static const char* requestedCredentialsCacheSize = std::getenv("DIALOGFLOW_CREDENTIALS_CACHE_SIZE");
+static unsigned int nCredentialsCacheSize = std::max(1, requestedCredentialsCacheSize ? ::atoi(requestedCredentialsCacheSize) : 32);
+static const char* requestedGrpcChannels = std::getenv("DIALOGFLOW_GRPC_CHANNELS");
+static unsigned int nGrpcChannels = std::max(1, requestedGrpcChannels ? ::atoi(requestedGrpcChannels) : 4);
+static const char* requestedGrpcMaxStreams = std::getenv("DIALOGFLOW_GRPC_MAX_STREAMS_PER_CHANNEL");
+static unsigned int nGrpcMaxStreams = std::max(1, requestedGrpcMaxStreams ? ::atoi(requestedGrpcMaxStreams) : 100);
+
+using dialogflow::AudioStore;
+using dialogflow::CredentialsCache;
+
+// an open playback of agent audio held in memory
+struct audio_reader {
+	std::shared_ptr<AudioStore::Clip> clip;
+	size_t offset;
+	size_t starved;
+};
+
 // Forward declaration for internal stop helper defined later in this file
 extern "C" switch_status_t google_dialogflow_session_stop(switch_core_session_t *session, int channelIsClosing);
 
@@ -53,15 +85,19 @@ static switch_status_t hanguphook(switch_core_session_t *session) {
 
 	if (state == CS_HANGUP || state == CS_ROUTING) {
 		char * sessionId = switch_core_session_get_uuid(session);
-		typedef std::multimap<std::string, std::string>::iterator MMAPIterator;
-		std::pair<MMAPIterator, MMAPIterator> result = audioFiles.equal_range(sessionId);
-		for (MMAPIterator it = result.first; it != result.second; it++) {
-			std::string filename = it->second;
-			std::remove(filename.c_str());
-			switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, 
-				"google_dialogflow_session_cleanup: removed audio file %s\n", filename.c_str());
+		{
+			std::lock_guard<std::mutex> lk(audioFilesMutex);
+			typedef std::multimap<std::string, std::string>::iterator MMAPIterator;
+			std::pair<MMAPIterator, MMAPIterator> result = audioFiles.equal_range(sessionId);
+			for (MMAPIterator it = result.first; it != result.second; it++) {
+				std::string filename = it->second;
+				std::remove(filename.c_str());
+				switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, 
+					"google_dialogflow_session_cleanup: removed audio file %s\n", filename.c_str());
+			}
+			audioFiles.erase(sessionId);
 		}
-		audioFiles.erase(sessionId);
+		AudioStore::removeSession(sessionId);
 		switch_core_event_hook_remove_state_change(session, hanguphook);
 	}
 	return SWITCH_STATUS_SUCCESS;
@@ -179,9 +215,12 @@ public:
             m_lang(lang), m_sessionId(switch_core_session_get_uuid(session)), m_environment("draft"), m_regionId("us"), m_agentId(""),
             m_speakingRate(), m_pitch(), m_volume(), m_voiceName(""), m_voiceGender(""), m_effects(""),
             m_sentimentAnalysis(false), m_finished(false), m_packets(0), m_needConfig(false),
-            m_startedWithEvent(false), m_rotatedToAudio(false) {
+            m_startedWithEvent(false), m_rotatedToAudio(false), m_preopen(true), m_buffering(false), m_droppedBytes(0),
+            m_nextOk(false), m_partialResponses(false), m_agentSpoke(false), m_haveEndOfUtterance(false) {
 		const char* var;
 		switch_channel_t* channel = switch_core_session_get_channel(session);
+		if ((var = switch_channel_get_variable(channel, "DIALOGFLOW_PREOPEN_STREAM"))) m_preopen = switch_true(var);
+		m_partialResponses = switch_true(switch_channel_get_variable(channel, "DIALOGFLOW_PARTIAL_RESPONSES"));
 		std::vector<std::string> tokens;
 		const char delim = ':';
 		tokenize(projectId, delim, tokens);
@@ -227,23 +266,23 @@ public:
 				}
 			}
 
+			// an empty json selects the default credentials
+			m_channel = CredentialsCache::getChannel(endpoint, json);
 			if (!json.empty()) {
-				auto callCreds = grpc::ServiceAccountJWTAccessCredentials(json, INT64_MAX);
-				auto channelCreds = grpc::SslCredentials(grpc::SslCredentialsOptions());
-				auto creds = grpc::CompositeChannelCredentials(channelCreds, callCreds);
-				m_channel = grpc::CreateChannel(endpoint, creds);
 				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer using %s credentials for channel\n", read_from_file ? "file" : "inline JSON");
-			} else {
-				auto creds = grpc::GoogleDefaultCredentials();
-				m_channel = grpc::CreateChannel(endpoint, creds);
 			}
 		} else {
-			auto creds = grpc::GoogleDefaultCredentials();
-			m_channel = grpc::CreateChannel(endpoint, creds);
+			m_channel = CredentialsCache::getChannel(endpoint, "");
+		}
+		if (!m_channel) {
+			throw std::runtime_error("Error creating grpc channel to " + endpoint);
 		}
     }
 
 	~GStreamer() {
+		completeTurnAudio();
+		discardNextStream();
+		finishRetiredStream();
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::~GStreamer wrote %u packets %p\n", m_packets, this);		
 	}
 
@@ -439,6 +478,7 @@ public:
             auto* queryParameters = m_request->mutable_query_params();
             queryParameters->set_analyze_query_text_sentiment(true);
         }
+        if (m_partialResponses) m_request->set_enable_partial_response(true);
 
 		m_streamer = m_stub->StreamingDetectIntent(m_context.get());
 		m_streamer->Write(*m_request);
@@ -450,26 +490,14 @@ public:
 			return false;
 		}
 
-        auto* qi = m_request->mutable_query_input();
-        qi->clear_text();
-        qi->clear_event();
-        qi->clear_intent();
-        auto* ai = qi->mutable_audio();
-        bool sendConfig = m_needConfig.exchange(false);
-        if (sendConfig) {
-            auto* audio_config = ai->mutable_config();
-            audio_config->set_sample_rate_hertz(16000);
-            audio_config->set_audio_encoding(AudioEncoding::AUDIO_ENCODING_LINEAR_16);
-            audio_config->set_single_utterance(true);
-            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::write sent new audio config to start next turn\n");
-        } else {
-            ai->clear_config();
-        }
-        ai->set_audio(reinterpret_cast<const char*>(data), datalen);
-
-		m_packets++;
-    return m_streamer->Write(*m_request);
-
+		// the agent has answered and the next turn's stream is being opened: hold the caller's audio for it
+		if (m_buffering) {
+			m_packets++;
+			if (m_pending.size() + datalen <= MAX_PREOPEN_BUFFER_BYTES) m_pending.append(reinterpret_cast<const char*>(data), datalen);
+			else m_droppedBytes += datalen;
+			return true;
+		}
+		return writeAudio(data, datalen);
 	}
 	bool read(StreamingDetectIntentResponse* response) {
 		return m_streamer->Read(response);
@@ -481,6 +509,8 @@ public:
 			return ok;
 		}
 		m_finished = true;
+		completeTurnAudio();
+		discardNextStream();
 		return m_streamer->Finish();
 	}
 	void writesDone() {
@@ -499,23 +529,128 @@ public:
         m_needConfig.store(true);
     }
 
+    /*
+     * Called from the read thread as soon as the agent's response arrives: opens and configures the
+     * stream for the next user turn in the background while the response is handled and its audio
+     * played, so the caller's first words do not wait on stream setup.  Caller audio is buffered
+     * until rotateToAudioConfig switches over to the new stream.
+     */
+    void preopenNextStream(switch_core_session_t* session) {
+        if (!m_preopen || m_finished || m_preopenThread.joinable()) return;
+
+        m_buffering = true;
+        m_nextRequest = buildAudioRequest();
+        m_nextContext = std::make_shared<grpc::ClientContext>();
+        m_preopenThread = std::thread([this]() {
+            m_nextStreamer = m_stub->StreamingDetectIntent(m_nextContext.get());
+            m_nextOk = m_nextStreamer->Write(*m_nextRequest);
+        });
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "GStreamer: pre-opening stream for next user turn\n");
+    }
+
     void rotateToAudioConfig(switch_core_session_t* session) {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO,
             "GStreamer: rotating stream to audio mode for next user turn\n");
-        // Gracefully finish current stream
-        try { m_streamer->WritesDone(); } catch (...) {}
-        try { m_streamer->Finish(); } catch (...) {}
 
-        // Create a new stream configured for audio input
-        m_request = std::make_shared<StreamingDetectIntentRequest>();
-        m_context = std::make_shared<grpc::ClientContext>();
+        // the current stream is finished by finishRetiredStream, outside the lock the caller holds
+        m_retiredStreamer = std::move(m_streamer);
+        m_retiredContext = m_context;
+
+        if (m_preopenThread.joinable()) {
+            m_preopenThread.join();
+            if (m_nextOk) {
+                m_request = m_nextRequest;
+                m_context = m_nextContext;
+                m_streamer = std::move(m_nextStreamer);
+                m_nextRequest.reset();
+                m_nextContext.reset();
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "GStreamer: switched to pre-opened stream\n");
+            }
+            else {
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING,
+                    "GStreamer: pre-opened stream failed, opening another\n");
+                discardNextStream();
+            }
+        }
+        if (!m_streamer) {
+            // Create a new stream configured for audio input
+            m_request = buildAudioRequest();
+            m_context = std::make_shared<grpc::ClientContext>();
+            m_streamer = m_stub->StreamingDetectIntent(m_context.get());
+            m_streamer->Write(*m_request);
+        }
+
+        // the first request carried the audio config; subsequent writes will send only audio bytes
+        m_needConfig.store(false);
+        m_buffering = false;
+        m_agentSpoke = false;
+        if (!m_pending.empty()) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG,
+                "GStreamer: sending %u bytes of caller audio buffered during stream setup (%u dropped)\n",
+                (unsigned int) m_pending.size(), m_droppedBytes);
+            writeAudio(&m_pending[0], m_pending.size());
+            m_pending.clear();
+        }
+        m_droppedBytes = 0;
+    }
+
+    /*
+     * Whether the turn needs a fresh stream once its final response is in: the agent delivered audio
+     * in some response of the turn, partial or not, or a pre-opened stream is waiting to be switched
+     * to.  The final response itself may carry no audio when it all came in partials.
+     */
+    void markAgentSpoke() {
+        m_agentSpoke = true;
+    }
+    bool needsRotation() const {
+        return m_agentSpoke || m_buffering;
+    }
+
+    // in-memory agent audio for the current turn, which grows as partial responses arrive
+    const std::string& turnAudio() const {
+        return m_turnAudioId;
+    }
+    void setTurnAudio(const std::string& id) {
+        m_turnAudioId = id;
+    }
+    void completeTurnAudio() {
+        if (m_turnAudioId.empty()) return;
+        AudioStore::complete(m_turnAudioId);
+        m_turnAudioId.clear();
+    }
+
+    void markEndOfUtterance() {
+        m_endOfUtteranceAt = std::chrono::steady_clock::now();
+        m_haveEndOfUtterance = true;
+    }
+
+    // ms from the end of the caller's speech to the first agent audio of the turn, or -1 if the turn had no speech
+    int takeTimeToFirstAudio() {
+        if (!m_haveEndOfUtterance) return -1;
+        m_haveEndOfUtterance = false;
+        return (int) std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_endOfUtteranceAt).count();
+    }
+
+    // finish the stream replaced by the last rotation
+    void finishRetiredStream() {
+        if (!m_retiredStreamer) return;
+        try { m_retiredStreamer->WritesDone(); } catch (...) {}
+        try { m_retiredStreamer->Finish(); } catch (...) {}
+        m_retiredStreamer.reset();
+        m_retiredContext.reset();
+    }
+
+private:
+    // a request opening a stream for a user turn spoken as audio
+    std::shared_ptr<StreamingDetectIntentRequest> buildAudioRequest() {
+        auto request = std::make_shared<StreamingDetectIntentRequest>();
         // Reuse same session path
         char szSession[256];
         snprintf(szSession, 256, "projects/%s/locations/%s/agents/%s/sessions/%s",
                  m_projectId.c_str(), m_regionId.c_str(), m_agentId.c_str(), m_sessionId.c_str());
-        m_request->set_session(szSession);
+        request->set_session(szSession);
 
-        auto* qi = m_request->mutable_query_input();
+        auto* qi = request->mutable_query_input();
         auto* audio_input = qi->mutable_audio();
         auto* audio_config = audio_input->mutable_config();
         audio_config->set_sample_rate_hertz(16000);
@@ -524,7 +659,7 @@ public:
         qi->set_language_code(m_lang.c_str());
 
         // Always request output audio
-        auto* outputAudioConfig = m_request->mutable_output_audio_config();
+        auto* outputAudioConfig = request->mutable_output_audio_config();
         outputAudioConfig->set_sample_rate_hertz(16000);
         outputAudioConfig->set_audio_encoding(OutputAudioEncoding::OUTPUT_AUDIO_ENCODING_LINEAR_16);
         if (isAnyOutputAudioConfigChanged()) {
@@ -548,17 +683,51 @@ public:
         }
 
         // Re-apply query params (channel)
-        auto* qp = m_request->mutable_query_params();
+        auto* qp = request->mutable_query_params();
         if (!m_qpChannel.empty()) {
             qp->set_channel(m_qpChannel);
         }
         if (m_sentimentAnalysis) qp->set_analyze_query_text_sentiment(true);
+        if (m_partialResponses) request->set_enable_partial_response(true);
+        return request;
+    }
 
-        m_streamer = m_stub->StreamingDetectIntent(m_context.get());
-        m_streamer->Write(*m_request);
-        // Subsequent writes will send only audio bytes
+    // cancel a pre-opened stream that will not be used
+    void discardNextStream() {
+        if (m_preopenThread.joinable()) m_preopenThread.join();
+        if (m_nextStreamer) {
+            m_nextContext->TryCancel();
+            try { m_nextStreamer->Finish(); } catch (...) {}
+            m_nextStreamer.reset();
+        }
+        m_nextContext.reset();
+        m_nextRequest.reset();
+        m_nextOk = false;
     }
 
+	bool writeAudio(const void* data, uint32_t datalen) {
+        auto* qi = m_request->mutable_query_input();
+        qi->clear_text();
+        qi->clear_event();
+        qi->clear_intent();
+        auto* ai = qi->mutable_audio();
+        bool sendConfig = m_needConfig.exchange(false);
+        if (sendConfig) {
+            auto* audio_config = ai->mutable_config();
+            audio_config->set_sample_rate_hertz(16000);
+            audio_config->set_audio_encoding(AudioEncoding::AUDIO_ENCODING_LINEAR_16);
+            audio_config->set_single_utterance(true);
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer::write sent new audio config to start next turn\n");
+        } else {
+            ai->clear_config();
+        }
+        ai->set_audio(reinterpret_cast<const char*>(data), datalen);
+
+		m_packets++;
+    return m_streamer->Write(*m_request);
+
+	}
+
 private:
     std::string m_sessionId;
     std::shared_ptr<grpc::ClientContext> m_context;
@@ -584,6 +753,22 @@ private:
     bool m_startedWithEvent;
     bool m_rotatedToAudio;
     std::string m_qpChannel;
+    bool m_preopen;
+    std::atomic<bool> m_buffering;
+    std::string m_pending;
+    uint32_t m_droppedBytes;
+    std::thread m_preopenThread;
+    std::shared_ptr<grpc::ClientContext> m_nextContext;
+    std::shared_ptr<StreamingDetectIntentRequest> m_nextRequest;
+    std::unique_ptr< grpc::ClientReaderWriterInterface<StreamingDetectIntentRequest, StreamingDetectIntentResponse> > m_nextStreamer;
+    bool m_nextOk;
+    std::shared_ptr<grpc::ClientContext> m_retiredContext;
+    std::unique_ptr< grpc::ClientReaderWriterInterface<StreamingDetectIntentRequest, StreamingDetectIntentResponse> > m_retiredStreamer;
+    bool m_partialResponses;
+    bool m_agentSpoke;
+    std::string m_turnAudioId;
+    std::chrono::steady_clock::time_point m_endOfUtteranceAt;
+    bool m_haveEndOfUtterance;
 };
 
 static void killcb(struct cap_cb* cb) {
@@ -626,6 +811,7 @@ static void *SWITCH_THREAD_FUNC grpc_read_thread(switch_thread_t *thread, void *
 					auto o = response.recognition_result().message_type();
                     if (0 == StreamingRecognitionResult::MessageType_Name(o).compare("END_OF_SINGLE_UTTERANCE")) {
                         type = DIALOGFLOW_EVENT_END_OF_UTTERANCE;
+                        streamer->markEndOfUtterance();
                         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG,
                             "grpc_read_thread: END_OF_SINGLE_UTTERANCE received\n");
                     }
@@ -639,8 +825,17 @@ static void *SWITCH_THREAD_FUNC grpc_read_thread(switch_thread_t *thread, void *
 
 			const std::string& audio = parser.parseAudio(response);
 			bool playAudio = !audio.empty() ;
+			bool partial = response.has_detect_intent_response() &&
+				response.detect_intent_response().response_type() == DetectIntentResponse::PARTIAL;
             if (response.has_detect_intent_response()) {
                 const auto& dir = response.detect_intent_response();
+                // the agent's audio means a new stream for the next turn: start opening it now
+                if (playAudio) {
+                    switch_mutex_lock(cb->mutex);
+                    streamer->markAgentSpoke();
+                    streamer->preopenNextStream(psession);
+                    switch_mutex_unlock(cb->mutex);
+                }
                 switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG,
                     "grpc_read_thread: detect_intent_response output_audio bytes=%zu config? %s\n",
                     audio.size(), dir.has_output_audio_config() ? "yes" : "no");
@@ -662,7 +857,7 @@ static void *SWITCH_THREAD_FUNC grpc_read_thread(switch_thread_t *thread, void *
 
                 auto toUpper = [](std::string s){ for (auto& c : s) c = toupper(c); return s; };
 
-                if (dir.has_query_result()) {
+                if (!partial && dir.has_query_result()) {
                     const auto& qr = dir.query_result();
                     std::string disp;
                     bool have_intent = false;
@@ -792,58 +987,106 @@ static void *SWITCH_THREAD_FUNC grpc_read_thread(switch_thread_t *thread, void *
             // save audio
             if (playAudio) {
 				std::ostringstream s;
-				s << SWITCH_GLOBAL_dirs.temp_dir << SWITCH_PATH_SEPARATOR <<
-					cb->sessionId << "_" <<  ++playCount;
-				switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG, "grpc_read_thread: received audio to play\n");
+				bool newClip = true;
+				switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG, "grpc_read_thread: received %saudio to play\n", partial ? "partial " : "");
 
+				int encoding = OutputAudioEncoding::OUTPUT_AUDIO_ENCODING_LINEAR_16;
 				if (response.has_detect_intent_response() && response.detect_intent_response().has_output_audio_config()) {
 					const OutputAudioConfig& cfg = response.detect_intent_response().output_audio_config();
 					switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG, "grpc_read_thread: encoding is %d\n", cfg.audio_encoding());
-					if (cfg.audio_encoding() == OutputAudioEncoding::OUTPUT_AUDIO_ENCODING_MP3) {
+					encoding = cfg.audio_encoding();
+				}
+
+				// keep linear16 audio in memory and play it through our file interface rather than a temp file
+				uint32_t sampleRate = 16000;
+				size_t offset = 0, len = audio.size();
+				if (switch_true(switch_channel_get_variable(channel, "DIALOGFLOW_AUDIO_IN_MEMORY")) &&
+					encoding == OutputAudioEncoding::OUTPUT_AUDIO_ENCODING_LINEAR_16 &&
+					(AudioStore::parseWav(audio, sampleRate, offset, len) || 0 != audio.compare(0, 4, "RIFF"))) {
+					if (!streamer->turnAudio().empty()) {
+						// a later partial response: extend the clip that is already playing
+						newClip = false;
+						if (!AudioStore::append(streamer->turnAudio(), audio.data() + offset, len)) {
+							switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_WARNING,
+								"grpc_read_thread: agent audio exceeds DIALOGFLOW_MAX_SESSION_AUDIO_KB, truncating\n");
+						}
+						switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG, "grpc_read_thread: appended %u bytes of audio to %s\n",
+							(unsigned int) len, streamer->turnAudio().c_str());
+					}
+					else {
+						// a partial response's clip stays open for the audio of the rest of the turn
+						std::string id = AudioStore::add(cb->sessionId, sampleRate, audio.data() + offset, len, !partial);
+						if (partial) streamer->setTurnAudio(id);
+						s << DIALOGFLOW_AUDIO_PREFIX << "://" << id;
+						switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG, "grpc_read_thread: holding %u bytes of audio at %s\n",
+							(unsigned int) len, s.str().c_str());
+					}
+				}
+				else {
+					s << SWITCH_GLOBAL_dirs.temp_dir << SWITCH_PATH_SEPARATOR <<
+						cb->sessionId << "_" <<  ++playCount;
+					if (encoding == OutputAudioEncoding::OUTPUT_AUDIO_ENCODING_MP3) {
 						s << ".mp3";
 					}
-					else if (cfg.audio_encoding() == OutputAudioEncoding::OUTPUT_AUDIO_ENCODING_OGG_OPUS) {
+					else if (encoding == OutputAudioEncoding::OUTPUT_AUDIO_ENCODING_OGG_OPUS) {
 						s << ".opus";
 					}
 					else {
 						s << ".wav";
 					}
+					std::ofstream f(s.str(), std::ofstream::binary);
+					f << audio;
+					f.close();
+					switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG, "grpc_read_thread: wrote audio to %s\n", s.str().c_str());
+
+					// add the file to the list of files played for this session, 
+					// we'll delete when session closes
+					std::lock_guard<std::mutex> lk(audioFilesMutex);
+					audioFiles.insert(std::pair<std::string, std::string>(cb->sessionId, s.str()));
 				}
-				std::ofstream f(s.str(), std::ofstream::binary);
-				f << audio;
-				f.close();
-				switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG, "grpc_read_thread: wrote audio to %s\n", s.str().c_str());
 
-				// add the file to the list of files played for this session, 
-				// we'll delete when session closes
-				audioFiles.insert(std::pair<std::string, std::string>(cb->sessionId, s.str()));
+				if (newClip) {
+					cJSON * jResponse = cJSON_CreateObject();
+					cJSON_AddItemToObject(jResponse, "path", cJSON_CreateString(s.str().c_str()));
+					cJSON_AddBoolToObject(jResponse, "partial", partial);
+					int ttfa = streamer->takeTimeToFirstAudio();
+					if (ttfa >= 0) {
+						cJSON_AddNumberToObject(jResponse, "time_to_first_audio_ms", ttfa);
+						switch_channel_set_variable_printf(channel, "dialogflow_time_to_first_audio_ms", "%d", ttfa);
+						switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_DEBUG,
+							"grpc_read_thread: first agent audio %d ms after end of caller speech\n", ttfa);
+					}
+					char* json = cJSON_PrintUnformatted(jResponse);
 
-				cJSON * jResponse = cJSON_CreateObject();
-				cJSON_AddItemToObject(jResponse, "path", cJSON_CreateString(s.str().c_str()));
-				char* json = cJSON_PrintUnformatted(jResponse);
+					cb->responseHandler(psession, DIALOGFLOW_EVENT_AUDIO_PROVIDED, json);
+					free(json);
+					cJSON_Delete(jResponse);
+
+					// Optional auto-play: play returned audio on the A leg when requested
+					const char* ap = switch_channel_get_variable(channel, "DIALOGFLOW_AUTOPLAY");
+					if (ap && switch_true(ap)) {
+						char args[1024];
+						snprintf(args, sizeof(args), "%s %s aleg", cb->sessionId, s.str().c_str());
+						switch_stream_handle_t stream = { 0 };
+						SWITCH_STANDARD_STREAM(stream);
+						switch_status_t st = switch_api_execute("uuid_broadcast", args, NULL, &stream);
+						switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_INFO,
+							"Auto-playing Dialogflow audio via uuid_broadcast: %s (status=%d)\n", args, st);
+						switch_safe_free(stream.data);
+					}
+				}
+			}
 
-				cb->responseHandler(psession, DIALOGFLOW_EVENT_AUDIO_PROVIDED, json);
-				free(json);
-				cJSON_Delete(jResponse);
+			// the final response of a turn the agent spoke in, in this response or an earlier partial one: close
+			// its audio and rotate to a fresh audio-configured stream for the next user turn
+			if (response.has_detect_intent_response() && !partial && (playAudio || streamer->needsRotation())) {
+				streamer->completeTurnAudio();
 
-				// Rotate to a fresh audio-configured stream for the next user turn
 				// synchronize with writer
 				switch_mutex_lock(cb->mutex);
 				streamer->rotateToAudioConfig(psession);
 				switch_mutex_unlock(cb->mutex);
-
-				// Optional auto-play: play returned audio on the A leg when requested
-				const char* ap = switch_channel_get_variable(channel, "DIALOGFLOW_AUTOPLAY");
-				if (ap && switch_true(ap)) {
-					char args[1024];
-					snprintf(args, sizeof(args), "%s %s aleg", cb->sessionId, s.str().c_str());
-					switch_stream_handle_t stream = { 0 };
-					SWITCH_STANDARD_STREAM(stream);
-					switch_status_t st = switch_api_execute("uuid_broadcast", args, NULL, &stream);
-					switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(psession), SWITCH_LOG_INFO,
-						"Auto-playing Dialogflow audio via uuid_broadcast: %s (status=%d)\n", args, st);
-					switch_safe_free(stream.data);
-				}
+				streamer->finishRetiredStream();
 			}
 			switch_core_session_rwunlock(psession);
 		}
@@ -885,10 +1128,82 @@ extern "C" {
 		else {
 			hasDefaultCredentials = true;
 		}
+		AudioStore::initialize(nMaxSessionAudioKB * 1024);
+		CredentialsCache::initialize(nCredentialsCacheSize, nGrpcChannels, nGrpcMaxStreams);
 		return SWITCH_STATUS_SUCCESS;
 	}
 	
 	switch_status_t google_dialogflow_cleanup() {
+		AudioStore::deinitialize();
+		CredentialsCache::deinitialize();
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	// file interface playing agent audio held in memory: DIALOGFLOW_AUDIO_PREFIX://<id>
+	switch_status_t google_dialogflow_audio_open(switch_file_handle_t *handle, const char *path) {
+		if (switch_test_flag(handle, SWITCH_FILE_FLAG_WRITE)) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "google_dialogflow_audio_open: %s is read only\n", path);
+			return SWITCH_STATUS_FALSE;
+		}
+		std::shared_ptr<AudioStore::Clip> clip = AudioStore::open(path);
+		if (!clip) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "google_dialogflow_audio_open: no audio for %s\n", path);
+			return SWITCH_STATUS_FALSE;
+		}
+
+		audio_reader* reader = new audio_reader;
+		reader->clip = clip;
+		reader->offset = 0;
+		reader->starved = 0;
+		handle->private_info = reader;
+		handle->samplerate = clip->sampleRate;
+		handle->native_rate = clip->sampleRate;
+		handle->channels = 1;
+		handle->samples = AudioStore::size(clip) / sizeof(int16_t);
+		handle->format = 0;
+		handle->sections = 0;
+		handle->seekable = 1;
+		handle->speed = 0;
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	switch_status_t google_dialogflow_audio_close(switch_file_handle_t *handle) {
+		audio_reader* reader = (audio_reader *) handle->private_info;
+		delete reader;
+		handle->private_info = NULL;
+		return SWITCH_STATUS_SUCCESS;
+	}
+
+	switch_status_t google_dialogflow_audio_read(switch_file_handle_t *handle, void *data, switch_size_t *len) {
+		audio_reader* reader = (audio_reader *) handle->private_info;
+		bool complete;
+		size_t bytes = AudioStore::read(reader->clip, reader->offset, (char *) data, *len * sizeof(int16_t), complete);
+		reader->offset += bytes;
+		if (0 == bytes && !complete) {
+			// played everything received so far: fill with silence while the rest of the turn's audio arrives
+			reader->starved += *len;
+			if (reader->starved > (size_t) handle->samplerate * MAX_AUDIO_STARVATION_SECS) {
+				switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "google_dialogflow_audio_read: gave up waiting for more audio\n");
+				*len = 0;
+				return SWITCH_STATUS_FALSE;
+			}
+			memset(data, 0, *len * sizeof(int16_t));
+			return SWITCH_STATUS_SUCCESS;
+		}
+		reader->starved = 0;
+		*len = bytes / sizeof(int16_t);
+		return 0 == *len ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+	}
+
+	switch_status_t google_dialogflow_audio_seek(switch_file_handle_t *handle, unsigned int *cur_sample, int64_t samples, int whence) {
+		audio_reader* reader = (audio_reader *) handle->private_info;
+		int64_t total = AudioStore::size(reader->clip) / sizeof(int16_t);
+		int64_t pos = samples;
+		if (SEEK_CUR == whence) pos += reader->offset / sizeof(int16_t);
+		else if (SEEK_END == whence) pos += total;
+		pos = std::max((int64_t) 0, std::min(pos, total));
+		reader->offset = pos * sizeof(int16_t);
+		*cur_sample = (unsigned int) pos;
 		return SWITCH_STATUS_SUCCESS;
 	}
 
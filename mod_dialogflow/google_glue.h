@@ -8,5 +8,10 @@ switch_status_t google_dialogflow_session_init(switch_core_session_t *session, r
 switch_status_t google_dialogflow_session_stop(switch_core_session_t *session, int channelIsClosing);
 switch_bool_t google_dialogflow_frame(switch_media_bug_t *bug, void* user_data);
 
+switch_status_t google_dialogflow_audio_open(switch_file_handle_t *handle, const char *path);
+switch_status_t google_dialogflow_audio_close(switch_file_handle_t *handle);
+switch_status_t google_dialogflow_audio_read(switch_file_handle_t *handle, void *data, switch_size_t *len);
+switch_status_t google_dialogflow_audio_seek(switch_file_handle_t *handle, unsigned int *cur_sample, int64_t samples, int whence);
+
 void destroyChannelUserData(struct cap_cb* cb);
 #endif
\ No newline at end of file
@@ -233,9 +233,12 @@ static switch_bool_t g_reserved_error = SWITCH_FALSE;
 static switch_bool_t g_reserved_transfer = SWITCH_FALSE;
 static switch_bool_t g_reserved_end_session = SWITCH_FALSE;
 
+static char *audio_formats[] = { DIALOGFLOW_AUDIO_PREFIX, NULL };
+
 SWITCH_MODULE_LOAD_FUNCTION(mod_dialogflow_load)
 {
 	switch_api_interface_t *api_interface;
+	switch_file_interface_t *file_interface;
 
 	/* create/register custom event message types */
 	if (switch_event_reserve_subclass(DIALOGFLOW_EVENT_INTENT) != SWITCH_STATUS_SUCCESS) {
@@ -282,6 +285,14 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_dialogflow_load)
 
 	switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "Google Dialogflow API successfully loaded\n");
 
+	file_interface = (switch_file_interface_t *) switch_loadable_module_create_interface(*module_interface, SWITCH_FILE_INTERFACE);
+	file_interface->interface_name = modname;
+	file_interface->extens = audio_formats;
+	file_interface->file_open = google_dialogflow_audio_open;
+	file_interface->file_close = google_dialogflow_audio_close;
+	file_interface->file_read = google_dialogflow_audio_read;
+	file_interface->file_seek = google_dialogflow_audio_seek;
+
 	SWITCH_ADD_API(api_interface, "dialogflow_start", "Start a google dialogflow", dialogflow_api_start_function, DIALOGFLOW_API_START_SYNTAX);
 	SWITCH_ADD_API(api_interface, "dialogflow_stop", "Terminate a google dialogflow", dialogflow_api_stop_function, DIALOGFLOW_API_STOP_SYNTAX);
 
@@ -15,6 +15,9 @@
 #define DIALOGFLOW_EVENT_TRANSFER "dialogflow::transfer"
 #define DIALOGFLOW_EVENT_END_SESSION "dialogflow::end_session"
 
+/* file interface prefix for agent audio played from memory */
+#define DIALOGFLOW_AUDIO_PREFIX "dialogflow_audio"
+
 #define MAX_LANG (12)
 #define MAX_PROJECT_ID (128)
 #define MAX_PATHLEN (256)
@@ -0,0 +1,306 @@
+/*
+ * Allocation benchmark for the gRPC engine's request and response handling.
+ *
+ * Opens N streaming calls through google_speech::AsyncStream against a mock recognizer
+ * running in a child process, and writes a 20 ms L16 frame on every stream every 20 ms,
+ * the way the media bug does.  The mock answers with an interim result every few frames
+ * and a final result when the stream is closed.  Every operator new in this process is
+ * counted, so the report shows heap allocations per stream per second and per frame,
+ * along with client cpu per stream.  --fresh-requests builds a new request for every frame
+ * rather than filling one from acquire(), which is the baseline the recycling is measured against.
+ *
+ * usage: grpc_engine_bench [options]; see usage() below
+ */
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include <switch.h>
+#include <grpcpp/grpcpp.h>
+#include <grpcpp/impl/codegen/async_stream.h>
+#include <grpcpp/impl/codegen/proto_utils.h>
+#include <grpcpp/impl/codegen/rpc_method.h>
+
+#include "../grpc_engine.hpp"
+#include "mock_recognizer.hpp"
+#include "speech_bench.pb.h"
+
+#define RTP_PACKETIZATION_PERIOD 20
+#define STREAMS_PER_CHANNEL 100
+#define WARMUP_SECS 2
+#define FINISH_TIMEOUT_MS 5000
+
+using bench::MockRecognizer;
+using bench::StreamingRecognizeRequest;
+using bench::StreamingRecognizeResponse;
+
+typedef google_speech::AsyncStream<StreamingRecognizeRequest, StreamingRecognizeResponse> stream_t;
+
+namespace {
+  std::atomic<uint64_t> nAllocs(0);
+  std::atomic<uint64_t> nAllocBytes(0);
+}
+
+// every allocation made through operator new, by the engine, grpc++ and protobuf alike;
+// grpc core allocates with malloc and is not counted
+void* operator new(size_t size) {
+  nAllocs.fetch_add(1, std::memory_order_relaxed);
+  nAllocBytes.fetch_add(size, std::memory_order_relaxed);
+  void* p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+
+// the engine logs through freeswitch, whose core is not running here; its lines go to stderr instead
+void switch_log_printf(switch_text_channel_t channel, const char* file, const char* func, int line,
+  const char* userdata, switch_log_level_t level, const char* fmt, ...) {
+  if (level > SWITCH_LOG_NOTICE) return;
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+}
+
+namespace {
+  struct Options {
+    unsigned int streams = 100;
+    unsigned int duration = 10;
+    unsigned int threads = 2;
+    unsigned int sampleRate = 8000;
+    unsigned int responseEvery = 10;
+    unsigned int queueSize = 250;
+    bool freshRequests = false;
+    double maxAllocsPerStream = 0;
+  };
+
+  struct Usage {
+    double cpuSecs;
+    uint64_t allocs;
+    uint64_t allocBytes;
+    uint64_t frames;
+    uint64_t responses;
+  };
+
+  static Options opts;
+  static std::atomic<bool> stopPacer(false);
+  static std::atomic<uint64_t> nFrames(0);
+  static std::atomic<uint64_t> nResponses(0);
+  static std::atomic<unsigned int> nFinished(0);
+  static std::atomic<unsigned int> nFailed(0);
+
+  static void usage(const char* prog) {
+    fprintf(stderr,
+      "usage: %s [options]\n"
+      "  -n, --streams N              number of concurrent streams (default 100)\n"
+      "  -d, --duration SECS          measurement time once all streams are up (default 10)\n"
+      "  -t, --threads N              engine threads, as MOD_TRANSCRIBE_GRPC_THREADS (default 2)\n"
+      "  -r, --rate HZ                8000 or 16000 (default 8000)\n"
+      "  -e, --response-every N       frames between interim results from the mock (default 10)\n"
+      "  -q, --queue N                requests queued per stream before the oldest is dropped (default 250)\n"
+      "      --fresh-requests         build a new request for every frame instead of using acquire()\n"
+      "      --max-allocs-per-stream N  exit non-zero if a stream makes more than N allocations a second\n",
+      prog);
+  }
+
+  static bool parseArgs(int argc, char** argv) {
+    static const struct option longOpts[] = {
+      {"streams", required_argument, nullptr, 'n'},
+      {"duration", required_argument, nullptr, 'd'},
+      {"threads", required_argument, nullptr, 't'},
+      {"rate", required_argument, nullptr, 'r'},
+      {"response-every", required_argument, nullptr, 'e'},
+      {"queue", required_argument, nullptr, 'q'},
+      {"fresh-requests", no_argument, nullptr, 1},
+      {"max-allocs-per-stream", required_argument, nullptr, 2},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0}
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "n:d:t:r:e:q:h", longOpts, nullptr)) != -1) {
+      switch (c) {
+        case 'n': opts.streams = ::atoi(optarg); break;
+        case 'd': opts.duration = ::atoi(optarg); break;
+        case 't': opts.threads = ::atoi(optarg); break;
+        case 'r': opts.sampleRate = ::atoi(optarg); break;
+        case 'e': opts.responseEvery = ::atoi(optarg); break;
+        case 'q': opts.queueSize = ::atoi(optarg); break;
+        case 1: opts.freshRequests = true; break;
+        case 2: opts.maxAllocsPerStream = ::atof(optarg); break;
+        default: return false;
+      }
+    }
+    if (opts.streams < 1 || opts.threads < 1 || opts.responseEvery < 1 || opts.queueSize < 1 ||
+      (opts.sampleRate != 8000 && opts.sampleRate != 16000)) {
+      return false;
+    }
+    return true;
+  }
+
+  static Usage snapshot() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    Usage u;
+    u.cpuSecs = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    u.allocs = nAllocs.load(std::memory_order_relaxed);
+    u.allocBytes = nAllocBytes.load(std::memory_order_relaxed);
+    u.frames = nFrames.load(std::memory_order_relaxed);
+    u.responses = nResponses.load(std::memory_order_relaxed);
+    return u;
+  }
+
+  // writes a frame on every stream each packetization period, as the media bug would
+  static void pacer(std::vector<std::unique_ptr<stream_t> >* streams, std::string frame) {
+    auto next = std::chrono::steady_clock::now();
+    while (!stopPacer.load(std::memory_order_relaxed)) {
+      std::this_thread::sleep_until(next);
+      for (auto& stream : *streams) {
+        StreamingRecognizeRequest request = opts.freshRequests ? StreamingRecognizeRequest() : stream->acquire();
+        request.set_audio_content(frame.data(), frame.size());
+        if (stream->write(std::move(request))) nFrames.fetch_add(1, std::memory_order_relaxed);
+      }
+      next += std::chrono::milliseconds(RTP_PACKETIZATION_PERIOD);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  if (!parseArgs(argc, argv)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  // forked before grpc is used in this process
+  std::string address = MockRecognizer::start(opts.responseEvery);
+  if (address.empty()) {
+    fprintf(stderr, "grpc_engine_bench: could not start the mock recognizer\n");
+    return 1;
+  }
+
+  google_speech::GrpcEngine::initialize(opts.threads);
+
+  // a connection per hundred streams, as separate channels rather than one shared subchannel
+  std::vector<std::shared_ptr<grpc::Channel> > channels;
+  std::vector<grpc::internal::RpcMethod> methods;
+  for (unsigned int i = 0; i < (opts.streams + STREAMS_PER_CHANNEL - 1) / STREAMS_PER_CHANNEL; i++) {
+    grpc::ChannelArguments args;
+    args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+    channels.push_back(grpc::CreateCustomChannel(address, grpc::InsecureChannelCredentials(), args));
+    methods.push_back(grpc::internal::RpcMethod(bench::kStreamingRecognizeMethod,
+      grpc::internal::RpcMethod::BIDI_STREAMING, channels.back()));
+  }
+
+  StreamingRecognizeRequest initial;
+  auto config = initial.mutable_streaming_config();
+  config->set_interim_results(true);
+  config->mutable_config()->set_language_code("en-US");
+  config->mutable_config()->set_sample_rate_hertz(opts.sampleRate);
+  config->mutable_config()->set_enable_word_time_offsets(true);
+
+  std::vector<std::unique_ptr<stream_t> > streams;
+  for (unsigned int i = 0; i < opts.streams; i++) {
+    grpc::ChannelInterface* channel = channels[i / STREAMS_PER_CHANNEL].get();
+    const grpc::internal::RpcMethod& method = methods[i / STREAMS_PER_CHANNEL];
+    streams.push_back(std::unique_ptr<stream_t>(new stream_t(opts.queueSize)));
+    streams.back()->start(
+      [channel, &method](grpc::ClientContext* context, grpc::CompletionQueue* cq) {
+        return stream_t::rpc_t(grpc::internal::ClientAsyncReaderWriterFactory<StreamingRecognizeRequest, StreamingRecognizeResponse>::Create(
+          channel, cq, method, context, false, nullptr));
+      },
+      initial,
+      [](StreamingRecognizeResponse& response) {
+        if (response.results_size() > 0) nResponses.fetch_add(1, std::memory_order_relaxed);
+      },
+      [](const grpc::Status& status) {
+        if (!status.ok()) nFailed++;
+        nFinished++;
+      });
+  }
+
+  // a quiet 400 Hz tone
+  size_t frameBytes = 320 * opts.sampleRate / 8000;
+  std::string frame(frameBytes, '\0');
+  int16_t* samples = (int16_t *) &frame[0];
+  for (size_t i = 0; i < frameBytes / 2; i++) {
+    samples[i] = (int16_t) (1000 * std::sin(2 * 3.14159265 * 400 * i / opts.sampleRate));
+  }
+
+  printf("grpc_engine_bench: %u streams over %zu channels at %u Hz, %u engine threads, %s requests, interim every %u frames\n",
+    opts.streams, channels.size(), opts.sampleRate, opts.threads, opts.freshRequests ? "fresh" : "recycled", opts.responseEvery);
+
+  std::thread pacerThread(pacer, &streams, frame);
+
+  // the first writes on a stream grow its queue and recycled requests to their working size
+  std::this_thread::sleep_for(std::chrono::seconds(WARMUP_SECS));
+  Usage u0 = snapshot();
+  auto measureStart = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(std::chrono::seconds(opts.duration));
+  Usage u1 = snapshot();
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - measureStart).count();
+
+  stopPacer = true;
+  pacerThread.join();
+
+  unsigned int dropped = 0;
+  for (auto& stream : streams) stream->writesDone();
+  for (auto& stream : streams) {
+    stream->waitForFinish(FINISH_TIMEOUT_MS);
+    dropped += stream->getDropped();
+  }
+  streams.clear();
+  google_speech::GrpcEngine::deinitialize();
+  MockRecognizer::stop();
+
+  uint64_t frames = u1.frames - u0.frames;
+  uint64_t responses = u1.responses - u0.responses;
+  double allocs = (double) (u1.allocs - u0.allocs);
+  double allocsPerStream = allocs / secs / opts.streams;
+
+  printf("frames written:     %" PRIu64 " (%" PRIu64 " responses received, %u frames dropped)\n", frames, responses, dropped);
+  printf("allocations:        %.1f per stream per second, %.2f per frame, %.0f bytes per frame\n",
+    allocsPerStream, frames ? allocs / frames : 0, frames ? (u1.allocBytes - u0.allocBytes) / (double) frames : 0);
+  printf("client cpu:         %.3f ms per stream per second\n", 1000 * (u1.cpuSecs - u0.cpuSecs) / secs / opts.streams);
+  printf("streams finished:   %u of %u, %u with an error status\n", nFinished.load(), opts.streams, nFailed.load());
+
+  int rc = 0;
+  if (nFailed > 0 || nFinished < opts.streams) {
+    fprintf(stderr, "FAIL: not every stream finished cleanly\n");
+    rc = 1;
+  }
+  if (opts.maxAllocsPerStream > 0 && allocsPerStream > opts.maxAllocsPerStream) {
+    fprintf(stderr, "FAIL: %.1f allocations per stream per second exceeds %.1f\n", allocsPerStream, opts.maxAllocsPerStream);
+    rc = 1;
+  }
+  return rc;
+}
@@ -0,0 +1,176 @@
+#include "mock_recognizer.hpp"
+
+#include <mutex>
+#include <cstdint>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <grpcpp/grpcpp.h>
+#include <grpcpp/generic/async_generic_service.h>
+
+#include "speech_bench.pb.h"
+
+using namespace bench;
+
+const char* const bench::kStreamingRecognizeMethod = "/bench.Recognizer/StreamingRecognize";
+
+pid_t MockRecognizer::child = -1;
+int MockRecognizer::stopFd = -1;
+
+namespace {
+  const char* kWords[] = {
+    "thank", "you", "for", "calling", "how", "can", "i", "help", "you", "today"
+  };
+
+  // a result shaped like google's: a transcript with per-word offsets, and a few alternatives for finals
+  grpc::ByteBuffer makeResponse(bool final) {
+    StreamingRecognizeResponse response;
+    auto result = response.add_results();
+    result->set_is_final(final);
+    result->set_stability(final ? 0.0f : 0.9f);
+    result->mutable_result_end_time()->set_seconds(3);
+    for (int a = 0; a < (final ? 3 : 1); a++) {
+      auto alternative = result->add_alternatives();
+      std::string transcript;
+      for (size_t w = 0; w < sizeof(kWords) / sizeof(kWords[0]); w++) {
+        auto word = alternative->add_words();
+        word->set_word(kWords[w]);
+        word->mutable_start_time()->set_nanos((int32_t) (w * 300000000 % 1000000000));
+        word->mutable_end_time()->set_nanos((int32_t) ((w * 300000000 + 250000000) % 1000000000));
+        word->set_confidence(0.9f);
+        if (!transcript.empty()) transcript += " ";
+        transcript += kWords[w];
+      }
+      alternative->set_transcript(transcript);
+      alternative->set_confidence(0.9f - a * 0.1f);
+    }
+    std::string bytes = response.SerializeAsString();
+    grpc::Slice slice(bytes);
+    return grpc::ByteBuffer(&slice, 1);
+  }
+
+  class Stream : public grpc::ServerGenericBidiReactor {
+  public:
+    Stream(const grpc::ByteBuffer& interim, const grpc::ByteBuffer& final, unsigned int every) :
+      m_interim(interim), m_final(final), m_every(every), m_reads(0), m_due(0),
+      m_writing(false), m_readsDone(false), m_finalSent(false), m_finished(false) {
+      StartRead(&m_request);
+    }
+
+    void OnReadDone(bool ok) override {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      if (!ok) m_readsDone = true;
+      else if (++m_reads % m_every == 0) m_due++;
+      next();
+      if (ok) StartRead(&m_request);
+    }
+
+    void OnWriteDone(bool ok) override {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_writing = false;
+      next();
+    }
+
+    void OnDone() override {
+      delete this;
+    }
+
+  private:
+    // called with the mutex held; one write at a time, then the final result and the status once the client is done
+    void next() {
+      if (m_writing || m_finished) return;
+      if (m_due > 0) {
+        m_due--;
+        m_writing = true;
+        StartWrite(&m_interim);
+      }
+      else if (m_readsDone && !m_finalSent) {
+        m_finalSent = true;
+        m_writing = true;
+        StartWrite(&m_final);
+      }
+      else if (m_readsDone) {
+        m_finished = true;
+        Finish(grpc::Status::OK);
+      }
+    }
+
+    std::mutex m_mutex;
+    grpc::ByteBuffer m_request;
+    grpc::ByteBuffer m_interim;
+    grpc::ByteBuffer m_final;
+    unsigned int m_every;
+    uint64_t m_reads;
+    uint64_t m_due;
+    bool m_writing;
+    bool m_readsDone;
+    bool m_finalSent;
+    bool m_finished;
+  };
+
+  class Service : public grpc::CallbackGenericService {
+  public:
+    Service(unsigned int every) : m_interim(makeResponse(false)), m_final(makeResponse(true)), m_every(every) {}
+
+    grpc::ServerGenericBidiReactor* CreateReactor(grpc::GenericCallbackServerContext* context) override {
+      return new Stream(m_interim, m_final, m_every);
+    }
+
+  private:
+    grpc::ByteBuffer m_interim;
+    grpc::ByteBuffer m_final;
+    unsigned int m_every;
+  };
+}
+
+std::string MockRecognizer::start(unsigned int responseEvery) {
+  int readyPipe[2], stopPipe[2];
+  if (pipe(readyPipe) != 0 || pipe(stopPipe) != 0) return std::string();
+
+  child = fork();
+  if (child < 0) return std::string();
+  if (0 == child) {
+    ::close(readyPipe[0]);
+    ::close(stopPipe[1]);
+    serve(responseEvery, readyPipe[1], stopPipe[0]);
+    _exit(0);
+  }
+
+  ::close(readyPipe[1]);
+  ::close(stopPipe[0]);
+  stopFd = stopPipe[1];
+  int port = 0;
+  ssize_t n = read(readyPipe[0], &port, sizeof(port));
+  ::close(readyPipe[0]);
+  if (n != sizeof(port) || port <= 0) {
+    stop();
+    return std::string();
+  }
+  return "127.0.0.1:" + std::to_string(port);
+}
+
+void MockRecognizer::stop() {
+  if (stopFd >= 0) ::close(stopFd);
+  stopFd = -1;
+  if (child > 0) waitpid(child, nullptr, 0);
+  child = -1;
+}
+
+void MockRecognizer::serve(unsigned int responseEvery, int readyFd, int doneFd) {
+  Service service(responseEvery);
+  int port = 0;
+  grpc::ServerBuilder builder;
+  builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &port);
+  builder.RegisterCallbackGenericService(&service);
+  std::unique_ptr<grpc::Server> server = builder.BuildAndStart();
+  if (!server) port = 0;
+  if (write(readyFd, &port, sizeof(port)) != sizeof(port) || !server) return;
+  ::close(readyFd);
+
+  // runs until the parent closes its end of the pipe, or exits
+  char c;
+  while (read(doneFd, &c, 1) > 0);
+  server->Shutdown(std::chrono::system_clock::now() + std::chrono::seconds(1));
+}
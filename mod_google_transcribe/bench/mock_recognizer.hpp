@@ -0,0 +1,37 @@
+#ifndef __MOCK_RECOGNIZER_HPP__
+#define __MOCK_RECOGNIZER_HPP__
+
+#include <string>
+
+#include <sys/types.h>
+
+namespace bench {
+
+  // method the mock serves; there is no generated stub, so the client names it directly
+  extern const char* const kStreamingRecognizeMethod;
+
+  /*
+   * Local stand-in for a streaming recognizer, run in a child process so that its
+   * allocations are not counted against the client.  Every stream gets an interim result
+   * for each responseEvery audio requests received, and a final result once the client
+   * half-closes.  Responses are serialized once up front and sent as raw bytes through a
+   * generic callback service, so the mock does almost no work of its own per message.
+   */
+  class MockRecognizer {
+  public:
+    // forks the server; returns its address, or an empty string if it could not be started
+    static std::string start(unsigned int responseEvery);
+
+    // shuts the server down and waits for the child to exit
+    static void stop();
+
+  private:
+    static void serve(unsigned int responseEvery, int readyFd, int doneFd);
+
+    static pid_t child;
+    static int stopFd;
+  };
+
+} // namespace bench
+
+#endif
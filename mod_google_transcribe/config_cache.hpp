@@ -0,0 +1,96 @@
+#ifndef __GOOGLE_CONFIG_CACHE_HPP__
+#define __GOOGLE_CONFIG_CACHE_HPP__
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+namespace google_speech {
+
+/*
+ * A bounded LRU cache of config fragments built from per-session settings such as
+ * hints, keyed by a hash of the text they were built from.  Campaign traffic sends
+ * the same large hint lists on many calls, so the fragment is parsed and built once
+ * and merged into each session's config thereafter.  A capacity of 0 disables caching.
+ */
+template <typename Message>
+class ConfigCache {
+public:
+  typedef std::function<void(Message*)> build_t;
+
+  struct Stats {
+    size_t entries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+  };
+
+  ConfigCache(size_t capacity) : m_capacity(capacity), m_stats() {}
+
+  // merges the fragment built from content into out, calling build only if it is not cached; returns true on a hit
+  bool merge(const std::string& content, Message* out, build_t build) {
+    size_t key = std::hash<std::string>{}(content);
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      auto it = m_index.find(key);
+      if (it != m_index.end() && it->second->content == content) {
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        out->MergeFrom(it->second->message);
+        m_stats.hits++;
+        return true;
+      }
+      m_stats.misses++;
+    }
+
+    Message built;
+    build(&built);
+    out->MergeFrom(built);
+    if (0 == m_capacity) return false;
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+    auto it = m_index.find(key);
+    if (it != m_index.end()) {
+      // built concurrently by another session, or a hash collision: keep the latest
+      m_entries.erase(it->second);
+      m_index.erase(it);
+    }
+    m_entries.push_front(Entry{content, std::move(built)});
+    m_index[key] = m_entries.begin();
+    while (m_entries.size() > m_capacity) {
+      m_index.erase(std::hash<std::string>{}(m_entries.back().content));
+      m_entries.pop_back();
+      m_stats.evictions++;
+    }
+    return false;
+  }
+
+  void getStats(Stats& out) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    out = m_stats;
+    out.entries = m_entries.size();
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_index.clear();
+    m_entries.clear();
+  }
+
+private:
+  struct Entry {
+    std::string content;
+    Message message;
+  };
+
+  size_t m_capacity;
+  std::mutex m_mutex;
+  std::list<Entry> m_entries;
+  std::unordered_map<size_t, typename std::list<Entry>::iterator> m_index;
+  Stats m_stats;
+};
+
+} // namespace google_speech
+#endif
@@ -0,0 +1,87 @@
+#include "credentials_cache.hpp"
+
+#include <switch.h>
+#include <algorithm>
+
+/* lifetime of the jwts signed for a service account key; grpc re-signs one shortly before it expires */
+#define JWT_LIFETIME_SECS (3600)
+
+using namespace google_speech;
+
+std::mutex CredentialsCache::mutex;
+std::list<CredentialsCache::Entry> CredentialsCache::entries;
+std::unordered_map<std::string, std::list<CredentialsCache::Entry>::iterator> CredentialsCache::index;
+std::shared_ptr<grpc::ChannelCredentials> CredentialsCache::defaultCredentials;
+size_t CredentialsCache::nCapacity = 32;
+CredentialsCache::Stats CredentialsCache::stats;
+
+void CredentialsCache::initialize(size_t capacity) {
+  std::lock_guard<std::mutex> lk(mutex);
+  nCapacity = std::max((size_t) 1, capacity);
+  stats = Stats();
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "CredentialsCache::initialize up to %u service account keys\n",
+    (unsigned int) nCapacity);
+}
+
+void CredentialsCache::deinitialize() {
+  std::lock_guard<std::mutex> lk(mutex);
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "CredentialsCache::deinitialize %u entries, %llu hits, %llu misses, %llu evictions\n",
+    (unsigned int) entries.size(), (unsigned long long) stats.hits, (unsigned long long) stats.misses, (unsigned long long) stats.evictions);
+  index.clear();
+  entries.clear();
+  defaultCredentials.reset();
+}
+
+std::shared_ptr<grpc::ChannelCredentials> CredentialsCache::get(const std::string& json, std::string& key) {
+  if (json.empty()) {
+    key = "default";
+    std::lock_guard<std::mutex> lk(mutex);
+    if (!defaultCredentials) defaultCredentials = grpc::GoogleDefaultCredentials();
+    return defaultCredentials;
+  }
+
+  // the whole key file, so that channels are only ever shared between sessions using the same key
+  key = "jwt:" + json;
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    auto it = index.find(key);
+    if (it != index.end()) {
+      entries.splice(entries.begin(), entries, it->second);
+      stats.hits++;
+      return it->second->credentials;
+    }
+    stats.misses++;
+  }
+
+  // built outside the lock, since parsing the key is the expensive part
+  auto channelCreds = grpc::SslCredentials(grpc::SslCredentialsOptions());
+  auto callCreds = grpc::ServiceAccountJWTAccessCredentials(json, JWT_LIFETIME_SECS);
+  if (!callCreds) {
+    // not cached, so that a corrected key is picked up; grpc fails calls on a channel without credentials
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "CredentialsCache::get invalid service account key\n");
+    return nullptr;
+  }
+  auto credentials = grpc::CompositeChannelCredentials(channelCreds, callCreds);
+
+  std::lock_guard<std::mutex> lk(mutex);
+  auto it = index.find(key);
+  if (it != index.end()) {
+    // built concurrently by another session: share the first one
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->credentials;
+  }
+  entries.push_front(Entry{key, credentials});
+  index[key] = entries.begin();
+  while (entries.size() > nCapacity) {
+    index.erase(entries.back().key);
+    entries.pop_back();
+    stats.evictions++;
+  }
+  return credentials;
+}
+
+void CredentialsCache::getStats(Stats& out) {
+  std::lock_guard<std::mutex> lk(mutex);
+  out = stats;
+  out.entries = entries.size();
+}
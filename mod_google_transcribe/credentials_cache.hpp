@@ -0,0 +1,56 @@
+#ifndef __GOOGLE_CREDENTIALS_CACHE_HPP__
+#define __GOOGLE_CREDENTIALS_CACHE_HPP__
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+#include <grpc++/grpc++.h>
+
+namespace google_speech {
+
+/*
+ * Builds channel credentials once per service account key rather than once per channel.
+ * Entries are keyed by the credentials json itself and hold the ssl credentials composed
+ * with the key's jwt access credentials, which sign a jwt once and reuse it until shortly
+ * before it expires; sharing them means the key is parsed and a jwt signed only when the
+ * previous one runs out, however many channels use the key.  The application default
+ * credentials are built once and shared the same way.  The cache is a bounded LRU.
+ */
+class CredentialsCache {
+public:
+  struct Stats {
+    size_t entries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+  };
+
+  static void initialize(size_t capacity);
+  static void deinitialize();
+
+  // credentials for the service account key json, or the application default credentials if json is empty;
+  // key is set to a string identifying them, for use as the channel registry's credentials key
+  static std::shared_ptr<grpc::ChannelCredentials> get(const std::string& json, std::string& key);
+
+  static void getStats(Stats& out);
+
+private:
+  struct Entry {
+    std::string key;
+    std::shared_ptr<grpc::ChannelCredentials> credentials;
+  };
+
+  static std::mutex mutex;
+  static std::list<Entry> entries;
+  static std::unordered_map<std::string, std::list<Entry>::iterator> index;
+  static std::shared_ptr<grpc::ChannelCredentials> defaultCredentials;
+  static size_t nCapacity;
+  static Stats stats;
+};
+
+} // namespace google_speech
+#endif
@@ -1,6 +1,10 @@
 #include <cstdlib>
+#include <cstdint>
 #include <algorithm>
 #include <future>
+#include <deque>
+#include <map>
+#include <mutex>
 
 #include <switch.h>
 #include <switch_json.h>
@@ -12,12 +16,17 @@
 
 #include "mod_google_transcribe.h"
 #include "simple_buffer.h"
+#include "channel_registry.hpp"
+#include "grpc_engine.hpp"
+#include "config_cache.hpp"
+#include "credentials_cache.hpp"
 
 using google::cloud::speech::v1p1beta1::RecognitionConfig;
 using google::cloud::speech::v1p1beta1::Speech;
 using google::cloud::speech::v1p1beta1::SpeechContext;
 using google::cloud::speech::v1p1beta1::StreamingRecognizeRequest;
 using google::cloud::speech::v1p1beta1::StreamingRecognizeResponse;
+using google::cloud::speech::v1p1beta1::StreamingRecognitionResult;
 using google::cloud::speech::v1p1beta1::SpeakerDiarizationConfig;
 using google::cloud::speech::v1p1beta1::SpeechAdaptation;
 using google::cloud::speech::v1p1beta1::PhraseSet;
@@ -47,7 +56,29 @@ using google::rpc::Status;
 
 #define CHUNKSIZE (320)
 
+/* google closes a stream after about 305 seconds of audio */
+#define DEFAULT_ROTATE_SECS (240)
+#define DEFAULT_ROTATION_OVERLAP_MS (2000)
+
 namespace {
+  static const char *requestedGrpcSubchannels = std::getenv("MOD_TRANSCRIBE_GRPC_SUBCHANNELS");
+  static unsigned int nGrpcSubchannels = std::max(1, requestedGrpcSubchannels ? ::atoi(requestedGrpcSubchannels) : 2);
+  static const char *requestedGrpcMaxStreams = std::getenv("MOD_TRANSCRIBE_GRPC_MAX_STREAMS_PER_CHANNEL");
+  static unsigned int nGrpcMaxStreamsPerChannel = std::max(1, requestedGrpcMaxStreams ? ::atoi(requestedGrpcMaxStreams) : 100);
+  static const char *requestedGrpcKeepaliveMs = std::getenv("MOD_TRANSCRIBE_GRPC_KEEPALIVE_MS");
+  static unsigned int nGrpcKeepaliveMs = std::max(0, requestedGrpcKeepaliveMs ? ::atoi(requestedGrpcKeepaliveMs) : 30000);
+  static const char *requestedGrpcThreads = std::getenv("MOD_TRANSCRIBE_GRPC_THREADS");
+  static unsigned int nGrpcThreads = std::max(1, requestedGrpcThreads ? ::atoi(requestedGrpcThreads) : 2);
+  static const char *requestedGrpcMaxQueuedFrames = std::getenv("MOD_TRANSCRIBE_GRPC_MAX_QUEUED_FRAMES");
+  static unsigned int nGrpcMaxQueuedFrames = std::max(1, requestedGrpcMaxQueuedFrames ? ::atoi(requestedGrpcMaxQueuedFrames) : 250);
+  static const char *requestedTeardownTimeoutMs = std::getenv("MOD_TRANSCRIBE_TEARDOWN_TIMEOUT_MS");
+  static unsigned int nTeardownTimeoutMs = std::max(100, requestedTeardownTimeoutMs ? ::atoi(requestedTeardownTimeoutMs) : 5000);
+  static const char *requestedConfigCacheSize = std::getenv("MOD_TRANSCRIBE_CONFIG_CACHE_SIZE");
+  static unsigned int nConfigCacheSize = std::max(0, requestedConfigCacheSize ? ::atoi(requestedConfigCacheSize) : 100);
+  static google_speech::ConfigCache<RecognitionConfig> hintsCache(nConfigCacheSize);
+  static const char *requestedCredentialsCacheSize = std::getenv("MOD_TRANSCRIBE_CREDENTIALS_CACHE_SIZE");
+  static unsigned int nCredentialsCacheSize = std::max(1, requestedCredentialsCacheSize ? ::atoi(requestedCredentialsCacheSize) : 32);
+
   int case_insensitive_match(std::string s1, std::string s2) {
    std::transform(s1.begin(), s1.end(), s1.begin(), ::tolower);
    std::transform(s2.begin(), s2.end(), s2.begin(), ::tolower);
@@ -55,13 +86,29 @@ namespace {
       return 1; //The strings are same
    return 0; //not matched
   }
+
+  uint64_t duration_ms(const google::protobuf::Duration& d) {
+    return d.seconds() * 1000 + d.nanos() / 1000000;
+  }
+
+  void add_ms(google::protobuf::Duration* d, uint64_t ms) {
+    int64_t nanos = d->nanos() + (int64_t) (ms % 1000) * 1000000;
+    d->set_seconds(d->seconds() + ms / 1000 + nanos / 1000000000);
+    d->set_nanos(nanos % 1000000000);
+  }
 }
 class GStreamer;
 
+static void grpc_on_response(struct cap_cb *cb, unsigned int generation, StreamingRecognizeResponse& response);
+static void grpc_on_finish(struct cap_cb *cb, unsigned int generation, const grpc::Status& status);
+
 class GStreamer {
 public:
+  typedef google_speech::AsyncStream<StreamingRecognizeRequest, StreamingRecognizeResponse> stream_t;
+
 	GStreamer(
     switch_core_session_t *session, 
+    struct cap_cb *cb,
     uint32_t channels, 
     char* lang, 
     int interim, 
@@ -75,8 +122,11 @@ public:
     int punctuation, 
     const char* model, 
     int enhanced, 
-		const char* hints) : m_session(session), m_writesDone(false), m_connected(false), 
-      m_audioBuffer(CHUNKSIZE, 15) {
+		const char* hints) : m_session(session), m_cb(cb), m_connected(false), 
+      m_audioBuffer(CHUNKSIZE, 15), m_continuous(false), m_rotateMs(DEFAULT_ROTATE_SECS * 1000),
+      m_overlapMs(DEFAULT_ROTATION_OVERLAP_MS), m_bytesPerMs(std::max(1U, config_sample_rate * 2 * channels / 1000)),
+      m_audioMs(0), m_bytesWritten(0), m_streamStartMs(0), m_switchAtMs(0), m_ringBytes(0),
+      m_wordOffsets(word_time_offset == 1), m_generation(0) {
   
     const char* var;
     const char* google_uri;
@@ -85,16 +135,13 @@ public:
     if (!(google_uri = switch_channel_get_variable(channel, "GOOGLE_SPEECH_TO_TEXT_URI"))) {
       google_uri = "speech.googleapis.com";
     }
-		if (var = switch_channel_get_variable(channel, "GOOGLE_APPLICATION_CREDENTIALS")) {
-			auto channelCreds = grpc::SslCredentials(grpc::SslCredentialsOptions());
-			auto callCreds = grpc::ServiceAccountJWTAccessCredentials(var);
-			auto creds = grpc::CompositeChannelCredentials(channelCreds, callCreds);
-			m_channel = grpc::CreateChannel(google_uri, creds);
-		}
-		else {
-			auto creds = grpc::GoogleDefaultCredentials();
-			m_channel = grpc::CreateChannel(google_uri, creds);
-		}
+		// credentials are shared by every channel using the same key, so a jwt is only signed when the last one expires
+		var = switch_channel_get_variable(channel, "GOOGLE_APPLICATION_CREDENTIALS");
+		std::string credentialsKey;
+		auto credentials = google_speech::CredentialsCache::get(var ? var : "", credentialsKey);
+		m_channel = google_speech::ChannelRegistry::getChannel(google_uri, credentialsKey, [credentials] {
+			return credentials;
+		});
 
   	m_stub = Speech::NewStub(m_channel);
   		
@@ -172,51 +219,56 @@ public:
       switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "use_enhanced\n");
     }
 
-    // hints  
+    // hints, built once per distinct hint list and boost
     if (hints != NULL) {
-      auto* adaptation = config->mutable_adaptation();
-      auto* phrase_set = adaptation->add_phrase_sets();
-      auto *context = config->add_speech_contexts();
-      float boost = -1;
-
-      // get boost setting for the phrase set in its entirety
-      if (switch_true(switch_channel_get_variable(channel, "GOOGLE_SPEECH_HINTS_BOOST"))) {
-     	  boost = (float) atof(switch_channel_get_variable(channel, "GOOGLE_SPEECH_HINTS_BOOST"));
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "boost value: %f\n", boost);
-        phrase_set->set_boost(boost);
-      }
+      const char* boost_str = switch_channel_get_variable(channel, "GOOGLE_SPEECH_HINTS_BOOST");
+      std::string content = std::string(hints) + "|" + (boost_str ? boost_str : "");
+      bool hit = hintsCache.merge(content, config, [&](RecognitionConfig* config) {
+        auto* adaptation = config->mutable_adaptation();
+        auto* phrase_set = adaptation->add_phrase_sets();
+        auto *context = config->add_speech_contexts();
+        float boost = -1;
+
+        // get boost setting for the phrase set in its entirety
+        if (switch_true(switch_channel_get_variable(channel, "GOOGLE_SPEECH_HINTS_BOOST"))) {
+       	  boost = (float) atof(switch_channel_get_variable(channel, "GOOGLE_SPEECH_HINTS_BOOST"));
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "boost value: %f\n", boost);
+          phrase_set->set_boost(boost);
+        }
 
-      // hints are either a simple comma-separated list of phrases, or a json array of objects
-      // containing a phrase and a boost value
-      auto *jHint = cJSON_Parse((char *) hints);
-      if (jHint) {
-        int i = 0;
-        cJSON *jPhrase = NULL;
-        cJSON_ArrayForEach(jPhrase, jHint) {
-          auto* phrase = phrase_set->add_phrases();
-          cJSON *jItem = cJSON_GetObjectItem(jPhrase, "phrase");
-          if (jItem) {
-            phrase->set_value(cJSON_GetStringValue(jItem));
-            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "phrase: %s\n", phrase->value().c_str());
-            if (cJSON_GetObjectItem(jPhrase, "boost")) {
-              phrase->set_boost((float) cJSON_GetObjectItem(jPhrase, "boost")->valuedouble);
-              switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "boost value: %f\n", phrase->boost());
+        // hints are either a simple comma-separated list of phrases, or a json array of objects
+        // containing a phrase and a boost value
+        auto *jHint = cJSON_Parse((char *) hints);
+        if (jHint) {
+          int i = 0;
+          cJSON *jPhrase = NULL;
+          cJSON_ArrayForEach(jPhrase, jHint) {
+            auto* phrase = phrase_set->add_phrases();
+            cJSON *jItem = cJSON_GetObjectItem(jPhrase, "phrase");
+            if (jItem) {
+              phrase->set_value(cJSON_GetStringValue(jItem));
+              switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "phrase: %s\n", phrase->value().c_str());
+              if (cJSON_GetObjectItem(jPhrase, "boost")) {
+                phrase->set_boost((float) cJSON_GetObjectItem(jPhrase, "boost")->valuedouble);
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "boost value: %f\n", phrase->boost());
+              }
+              i++;
             }
-            i++;
           }
+          cJSON_Delete(jHint);
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "added %d hints\n", i);
         }
-        cJSON_Delete(jHint);
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "added %d hints\n", i);
-      }
-      else {
-        char *phrases[500] = { 0 };
-        int argc = switch_separate_string((char *) hints, ',', phrases, 500);
-        for (int i = 0; i < argc; i++) {
-          auto* phrase = phrase_set->add_phrases();
-          phrase->set_value(phrases[i]);
+        else {
+          char *phrases[500] = { 0 };
+          int argc = switch_separate_string((char *) hints, ',', phrases, 500);
+          for (int i = 0; i < argc; i++) {
+            auto* phrase = phrase_set->add_phrases();
+            phrase->set_value(phrases[i]);
+          }
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "added %d hints\n", argc);
         }
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "added %d hints\n", argc);
-      }
+      });
+      switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "hints %s\n", hit ? "found in cache" : "built");
     }
 
     // alternative language
@@ -278,6 +330,25 @@ public:
       if (case_insensitive_match("other_outdoor_device", var)) metadata->set_recording_device_type(RecognitionMetadata_RecordingDeviceType_OTHER_OUTDOOR_DEVICE);
       if (case_insensitive_match("other_indoor_device", var)) metadata->set_recording_device_type(RecognitionMetadata_RecordingDeviceType_OTHER_INDOOR_DEVICE);
     }
+
+    // continuous recognition: replace the stream ahead of google's duration limit
+    if (single_utterance != 1 && switch_channel_var_true(channel, "GOOGLE_SPEECH_CONTINUOUS")) {
+      m_continuous = true;
+      if (var = switch_channel_get_variable(channel, "GOOGLE_SPEECH_ROTATE_SECS")) {
+        int secs = atoi(var);
+        if (secs >= 10 && secs <= 290) m_rotateMs = secs * 1000;
+      }
+      if (var = switch_channel_get_variable(channel, "GOOGLE_SPEECH_ROTATION_OVERLAP_MS")) {
+        int ms = atoi(var);
+        if (ms >= 0 && ms <= 10000) m_overlapMs = ms;
+      }
+      switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "continuous recognition, rotating every %u ms with %u ms overlap\n",
+        m_rotateMs, m_overlapMs);
+
+      // the overlap between streams is split by word start times; they are removed again if not asked for
+      config->set_enable_word_time_offsets(true);
+      m_generations[0] = Generation{0, 0, UINT64_MAX};
+    }
 	}
 
 	~GStreamer() {
@@ -286,16 +357,14 @@ public:
 
   void connect() {
     assert(!m_connected);
-    // Begin a stream.
-  	m_streamer = m_stub->StreamingRecognize(&m_context);
+    // Begin a stream; the first request contains the config only
+    m_stream.reset(new stream_t(nGrpcMaxQueuedFrames));
+    if (!startStream(*m_stream, m_generation)) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "GStreamer %p could not start a stream, the grpc engine is not running\n", this);
+      return;
+    }
     m_connected = true;
 
-    // read thread is waiting on this
-    m_promise.set_value();
-
-  	// Write the first request, containing the config only.
-  	m_streamer->Write(m_request);
-
     // send any buffered audio
     int nFrames = m_audioBuffer.getNumItems();
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p got stream ready, %d buffered frames\n", this, nFrames);	
@@ -317,45 +386,98 @@ public:
       }
       return true;
     }
-    m_request.set_audio_content(data, datalen);
-    bool ok = m_streamer->Write(m_request);
+    bool ok = writeAudio(*m_stream, data, datalen);
+    if (m_continuous) rotate(data, datalen);
     return ok;
   }
 
-	uint32_t nextMessageSize(void) {
-		uint32_t size = 0;
-		m_streamer->NextMessageSize(&size);
-		return size;
-	}
-
-	bool read(StreamingRecognizeResponse* response) {
-		return m_streamer->Read(response);
+	void writesDone() {
+    if (m_stream) m_stream->writesDone();
+    if (m_nextStream) m_nextStream->writesDone();
 	}
 
-	grpc::Status finish() {
-		return m_streamer->Finish();
-	}
+  bool waitForFinish() {
+    std::vector<std::unique_ptr<stream_t>> streams;
+    for (auto& retired : m_retired) streams.push_back(std::move(retired.second));
+    m_retired.clear();
+    if (m_nextStream) streams.push_back(std::move(m_nextStream));
+    if (m_stream) streams.push_back(std::move(m_stream));
 
-	void writesDone() {
-    // grpc crashes if we call this twice on a stream
-    if (!m_connected) {
-      cancelConnect();
+    bool ok = true;
+    unsigned int dropped = 0;
+    for (auto& stream : streams) {
+      ok = stream->waitForFinish(nTeardownTimeoutMs) && ok;
+      dropped += stream->getDropped();
     }
-    else if (!m_writesDone) {
-      m_streamer->WritesDone();
-      m_writesDone = true;
+    if (dropped > 0) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "GStreamer %p dropped %u audio frames the network could not keep up with\n",
+        this, dropped);
     }
-	}
+    return ok;
+  }
 
-  bool waitForConnect() {
-    std::shared_future<void> sf(m_promise.get_future());
-    sf.wait();
-    return m_connected;
+  bool isCurrentGeneration(unsigned int generation) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return generation == m_generation;
   }
 
-  void cancelConnect() {
-    assert(!m_connected);
-    m_promise.set_value();
+  /*
+   * In continuous mode decides whether a result is delivered, so that the overlap
+   * between consecutive streams is reported once.  Offsets are moved from the start of
+   * the stream's audio to the start of the session's.  Each stream then reports the words
+   * starting between the seam where it took over and the seam where it was replaced,
+   * whenever its results arrive; a stream not yet taken over reports nothing, and a
+   * retired one only finals.  Results without words are delivered whole unless they end
+   * before the stream took over.
+   */
+  bool acceptResult(unsigned int generation, StreamingRecognitionResult& result) {
+    if (!m_continuous) return true;
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (generation > m_generation || (generation < m_generation && !result.is_final())) return false;
+    auto it = m_generations.find(generation);
+    if (it == m_generations.end()) return false;
+    const Generation& gen = it->second;
+
+    if (gen.baseMs > 0) {
+      add_ms(result.mutable_result_end_time(), gen.baseMs);
+      for (int a = 0; a < result.alternatives_size(); a++) {
+        auto alternative = result.mutable_alternatives(a);
+        for (int w = 0; w < alternative->words_size(); w++) {
+          auto word = alternative->mutable_words(w);
+          add_ms(word->mutable_start_time(), gen.baseMs);
+          add_ms(word->mutable_end_time(), gen.baseMs);
+        }
+      }
+    }
+
+    if (result.alternatives_size() > 0 && result.alternatives(0).words_size() > 0) {
+      for (int a = 0; a < result.alternatives_size(); a++) {
+        auto alternative = result.mutable_alternatives(a);
+        if (0 == alternative->words_size()) continue;
+        // words are in time order, so those this stream reports are a contiguous run
+        auto words = alternative->mutable_words();
+        int first = 0, last = words->size();
+        while (first < last && duration_ms(words->Get(first).start_time()) < gen.fromMs) first++;
+        while (last > first && duration_ms(words->Get(last - 1).start_time()) >= gen.toMs) last--;
+        if (0 == first && words->size() == last) continue;
+        words->DeleteSubrange(last, words->size() - last);
+        words->DeleteSubrange(0, first);
+        std::string transcript;
+        for (const auto& word : *words) {
+          if (!transcript.empty()) transcript += " ";
+          transcript += word.word();
+        }
+        alternative->set_transcript(transcript);
+      }
+      if (0 == result.alternatives(0).words_size()) return false;
+    }
+    else if (duration_ms(result.result_end_time()) <= gen.fromMs) return false;
+
+    if (!m_wordOffsets) {
+      for (int a = 0; a < result.alternatives_size(); a++) result.mutable_alternatives(a)->clear_words();
+    }
+    return true;
   }
 
   bool isConnected() {
@@ -363,171 +485,299 @@ public:
   }
 
 private:
+  static bool writeAudio(stream_t& stream, const void* data, uint32_t datalen) {
+    auto request = stream.acquire();
+    request.set_audio_content(data, datalen);
+    return stream.write(std::move(request));
+  }
+
+  bool startStream(stream_t& stream, unsigned int generation) {
+    struct cap_cb *cb = m_cb;
+    return stream.start([this](grpc::ClientContext* context, grpc::CompletionQueue* cq) {
+        return m_stub->PrepareAsyncStreamingRecognize(context, cq);
+      },
+      m_request,
+      [cb, generation](StreamingRecognizeResponse& response) { grpc_on_response(cb, generation, response); },
+      [cb, generation](const grpc::Status& status) { grpc_on_finish(cb, generation, status); });
+  }
+
+  /*
+   * Called after each write in continuous mode.  Once the current stream has carried
+   * m_rotateMs of audio a new stream is opened and primed with the last m_overlapMs of
+   * audio; both streams then receive audio for the length of the overlap, after which
+   * the old stream is half-closed and left to deliver its remaining final results.
+   */
+  void rotate(void* data, uint32_t datalen) {
+    m_bytesWritten += datalen;
+    m_audioMs = m_bytesWritten / m_bytesPerMs;
+
+    if (m_overlapMs > 0) {
+      m_ring.push_back(std::string((const char *) data, datalen));
+      m_ringBytes += datalen;
+      while (m_ring.size() > 1 && m_ringBytes - m_ring.front().size() >= m_overlapMs * m_bytesPerMs) {
+        m_ringBytes -= m_ring.front().size();
+        m_ring.pop_front();
+      }
+    }
+
+    if (m_nextStream) {
+      writeAudio(*m_nextStream, data, datalen);
+      if (m_audioMs >= m_switchAtMs) switchStreams();
+    }
+    else if (m_audioMs - m_streamStartMs >= m_rotateMs) {
+      openNextStream();
+    }
+  }
+
+  void openNextStream() {
+    uint64_t primedMs = m_ringBytes / m_bytesPerMs;
+    unsigned int generation;
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      generation = m_generation + 1;
+      m_streamStartMs = m_audioMs - std::min(m_audioMs, primedMs);
+      m_generations[generation] = Generation{m_streamStartMs, UINT64_MAX, UINT64_MAX};
+    }
+
+    // streams retired at the previous rotation have long since finished
+    for (auto it = m_retired.begin(); it != m_retired.end();) {
+      if (it->second->isFinished()) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_generations.erase(it->first);
+        it = m_retired.erase(it);
+      }
+      else ++it;
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p opening stream %u at %llu ms, primed with %llu ms of audio\n",
+      this, generation, (unsigned long long) m_audioMs, (unsigned long long) primedMs);
+    m_nextStream.reset(new stream_t(nGrpcMaxQueuedFrames));
+    if (!startStream(*m_nextStream, generation)) {
+      // the current stream carries on, and the rotation is tried again a period later
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "GStreamer %p could not open stream %u, the grpc engine is not running\n", this, generation);
+      m_nextStream.reset();
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_generations.erase(generation);
+      return;
+    }
+    for (const auto& chunk : m_ring) {
+      writeAudio(*m_nextStream, chunk.data(), chunk.size());
+    }
+    m_switchAtMs = m_audioMs + m_overlapMs;
+  }
+
+  void switchStreams() {
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_generations[m_generation].toMs = m_audioMs;
+      m_generation++;
+      m_generations[m_generation].fromMs = m_audioMs;
+    }
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p switched to stream %u at %llu ms\n",
+      this, m_generation, (unsigned long long) m_audioMs);
+    m_stream->writesDone();
+    m_retired.push_back(std::make_pair(m_generation - 1, std::move(m_stream)));
+    m_stream = std::move(m_nextStream);
+  }
+
 	switch_core_session_t* m_session;
-  grpc::ClientContext m_context;
+  struct cap_cb *m_cb;
 	std::shared_ptr<grpc::Channel> m_channel;
 	std::unique_ptr<Speech::Stub> 	m_stub;
-	std::unique_ptr< grpc::ClientReaderWriterInterface<StreamingRecognizeRequest, StreamingRecognizeResponse> > m_streamer;
 	StreamingRecognizeRequest m_request;
-  bool m_writesDone;
   bool m_connected;
-  std::promise<void> m_promise;
   SimpleBuffer m_audioBuffer;
+  std::unique_ptr<stream_t> m_stream;
+
+  // continuous recognition
+  bool m_continuous;
+  uint32_t m_rotateMs;
+  uint32_t m_overlapMs;
+  uint32_t m_bytesPerMs;
+  uint64_t m_audioMs;
+  uint64_t m_bytesWritten;
+  uint64_t m_streamStartMs;
+  uint64_t m_switchAtMs;
+  std::unique_ptr<stream_t> m_nextStream;
+  std::vector<std::pair<unsigned int, std::unique_ptr<stream_t>>> m_retired;
+  std::deque<std::string> m_ring;
+  size_t m_ringBytes;
+
+  bool m_wordOffsets;
+
+  // offsets, in ms of the session's audio, of where a stream's audio starts and of the part it reports
+  struct Generation {
+    uint64_t baseMs;
+    uint64_t fromMs;
+    uint64_t toMs;
+  };
+
+  // shared with the engine threads delivering results
+  std::mutex m_mutex;
+  unsigned int m_generation;
+  std::map<unsigned int, Generation> m_generations;
 };
 
-static void *SWITCH_THREAD_FUNC grpc_read_thread(switch_thread_t *thread, void *obj) {
-  static int count;
-	struct cap_cb *cb = (struct cap_cb *) obj;
-	GStreamer* streamer = (GStreamer *) cb->streamer;
+static void grpc_on_response(struct cap_cb *cb, unsigned int generation, StreamingRecognizeResponse& response) {
+  GStreamer* streamer = (GStreamer *) cb->streamer;
 
-  bool connected = streamer->waitForConnect();
-  if (!connected) {
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "google transcribe grpc read thread exiting since we didnt connect\n") ;
-    return nullptr;
+  switch_core_session_t* session = switch_core_session_locate(cb->sessionId);
+  if (!session) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "grpc_on_response: session %s is gone!\n", cb->sessionId) ;
+    return;
   }
-
-  // Read responses.
-  StreamingRecognizeResponse response;
-  while (streamer->read(&response)) {  // Returns false when no more to read.
-    switch_core_session_t* session = switch_core_session_locate(cb->sessionId);
-    if (!session) {
-      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "grpc_read_thread: session %s is gone!\n", cb->sessionId) ;
-      return nullptr;
-    }
-    count++;
-    auto speech_event_type = response.speech_event_type();
-    if (response.has_error()) {
-      Status status = response.error();
-      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "grpc_read_thread: error %s (%d)\n", status.message().c_str(), status.code()) ;
-      cJSON* json = cJSON_CreateObject();
-      cJSON_AddStringToObject(json, "type", "error");
-      cJSON_AddStringToObject(json, "error", status.message().c_str());
-      char* jsonString = cJSON_PrintUnformatted(json);
-      cb->responseHandler(session, jsonString, cb->bugname);
-      free(jsonString);
-      cJSON_Delete(json);
-    }
-    
-    if (cb->play_file == 1){
-      cb->responseHandler(session, "play_interrupt", cb->bugname);
-    }
-    
-    for (int r = 0; r < response.results_size(); ++r) {
-      auto result = response.results(r);
-      cJSON * jResult = cJSON_CreateObject();
-      cJSON * jAlternatives = cJSON_CreateArray();
-      cJSON * jStability = cJSON_CreateNumber(result.stability());
-      cJSON * jIsFinal = cJSON_CreateBool(result.is_final());
-      cJSON * jLanguageCode = cJSON_CreateString(result.language_code().c_str());
-      cJSON * jChannelTag = cJSON_CreateNumber(result.channel_tag());
-
-      auto duration = result.result_end_time();
-      int32_t seconds = duration.seconds();
-      int64_t nanos = duration.nanos();
-      int span = (int) trunc(seconds * 1000. + ((float) nanos / 1000000.));
-      cJSON * jResultEndTime = cJSON_CreateNumber(span);
-
-      cJSON_AddItemToObject(jResult, "stability", jStability);
-      cJSON_AddItemToObject(jResult, "is_final", jIsFinal);
-      cJSON_AddItemToObject(jResult, "alternatives", jAlternatives);
-      cJSON_AddItemToObject(jResult, "language_code", jLanguageCode);
-      cJSON_AddItemToObject(jResult, "channel_tag", jChannelTag);
-      cJSON_AddItemToObject(jResult, "result_end_time", jResultEndTime);
-
-      for (int a = 0; a < result.alternatives_size(); ++a) {
-        auto alternative = result.alternatives(a);
-        cJSON* jAlt = cJSON_CreateObject();
-        cJSON* jConfidence = cJSON_CreateNumber(alternative.confidence());
-        cJSON* jTranscript = cJSON_CreateString(alternative.transcript().c_str());
-        cJSON_AddItemToObject(jAlt, "confidence", jConfidence);
-        cJSON_AddItemToObject(jAlt, "transcript", jTranscript);
-
-        if (alternative.words_size() > 0) {
-          cJSON * jWords = cJSON_CreateArray();
-          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "grpc_read_thread: %d words\n", alternative.words_size()) ;
-          for (int b = 0; b < alternative.words_size(); b++) {
-            auto words = alternative.words(b);
-            cJSON* jWord = cJSON_CreateObject();
-            cJSON_AddItemToObject(jWord, "word", cJSON_CreateString(words.word().c_str()));
-            if (words.has_start_time()) {
-              cJSON_AddItemToObject(jWord, "start_time", cJSON_CreateNumber(words.start_time().seconds()));
-            }
-            if (words.has_end_time()) {
-              cJSON_AddItemToObject(jWord, "end_time", cJSON_CreateNumber(words.end_time().seconds()));
-            }
-            int speaker_tag = words.speaker_tag();
-            if (speaker_tag > 0) {
-              cJSON_AddItemToObject(jWord, "speaker_tag", cJSON_CreateNumber(speaker_tag));
-            }
-            float confidence = words.confidence();
-            if (confidence > 0.0) {
-              cJSON_AddItemToObject(jWord, "confidence", cJSON_CreateNumber(confidence));
-            }
-
-            cJSON_AddItemToArray(jWords, jWord);
+  auto speech_event_type = response.speech_event_type();
+  if (response.has_error()) {
+    Status status = response.error();
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "grpc_on_response: error %s (%d)\n", status.message().c_str(), status.code()) ;
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "type", "error");
+    cJSON_AddStringToObject(json, "error", status.message().c_str());
+    char* jsonString = cJSON_PrintUnformatted(json);
+    cb->responseHandler(session, jsonString, cb->bugname);
+    free(jsonString);
+    cJSON_Delete(json);
+  }
+  
+  if (cb->play_file == 1){
+    cb->responseHandler(session, "play_interrupt", cb->bugname);
+  }
+  
+  for (int r = 0; r < response.results_size(); ++r) {
+    auto result = response.results(r);
+    if (!streamer->acceptResult(generation, result)) continue;
+
+    cJSON * jResult = cJSON_CreateObject();
+    cJSON * jAlternatives = cJSON_CreateArray();
+    cJSON * jStability = cJSON_CreateNumber(result.stability());
+    cJSON * jIsFinal = cJSON_CreateBool(result.is_final());
+    cJSON * jLanguageCode = cJSON_CreateString(result.language_code().c_str());
+    cJSON * jChannelTag = cJSON_CreateNumber(result.channel_tag());
+
+    auto duration = result.result_end_time();
+    int32_t seconds = duration.seconds();
+    int64_t nanos = duration.nanos();
+    int span = (int) trunc(seconds * 1000. + ((float) nanos / 1000000.));
+    cJSON * jResultEndTime = cJSON_CreateNumber(span);
+
+    cJSON_AddItemToObject(jResult, "stability", jStability);
+    cJSON_AddItemToObject(jResult, "is_final", jIsFinal);
+    cJSON_AddItemToObject(jResult, "alternatives", jAlternatives);
+    cJSON_AddItemToObject(jResult, "language_code", jLanguageCode);
+    cJSON_AddItemToObject(jResult, "channel_tag", jChannelTag);
+    cJSON_AddItemToObject(jResult, "result_end_time", jResultEndTime);
+
+    for (int a = 0; a < result.alternatives_size(); ++a) {
+      auto alternative = result.alternatives(a);
+      cJSON* jAlt = cJSON_CreateObject();
+      cJSON* jConfidence = cJSON_CreateNumber(alternative.confidence());
+      cJSON* jTranscript = cJSON_CreateString(alternative.transcript().c_str());
+      cJSON_AddItemToObject(jAlt, "confidence", jConfidence);
+      cJSON_AddItemToObject(jAlt, "transcript", jTranscript);
+
+      if (alternative.words_size() > 0) {
+        cJSON * jWords = cJSON_CreateArray();
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "grpc_on_response: %d words\n", alternative.words_size()) ;
+        for (int b = 0; b < alternative.words_size(); b++) {
+          auto words = alternative.words(b);
+          cJSON* jWord = cJSON_CreateObject();
+          cJSON_AddItemToObject(jWord, "word", cJSON_CreateString(words.word().c_str()));
+          if (words.has_start_time()) {
+            cJSON_AddItemToObject(jWord, "start_time", cJSON_CreateNumber(words.start_time().seconds()));
           }
-          cJSON_AddItemToObject(jAlt, "words", jWords);
+          if (words.has_end_time()) {
+            cJSON_AddItemToObject(jWord, "end_time", cJSON_CreateNumber(words.end_time().seconds()));
+          }
+          int speaker_tag = words.speaker_tag();
+          if (speaker_tag > 0) {
+            cJSON_AddItemToObject(jWord, "speaker_tag", cJSON_CreateNumber(speaker_tag));
+          }
+          float confidence = words.confidence();
+          if (confidence > 0.0) {
+            cJSON_AddItemToObject(jWord, "confidence", cJSON_CreateNumber(confidence));
+          }
+
+          cJSON_AddItemToArray(jWords, jWord);
         }
-        cJSON_AddItemToArray(jAlternatives, jAlt);
+        cJSON_AddItemToObject(jAlt, "words", jWords);
       }
+      cJSON_AddItemToArray(jAlternatives, jAlt);
+    }
 
-      char* json = cJSON_PrintUnformatted(jResult);
-      cb->responseHandler(session, (const char *) json, cb->bugname);
-      free(json);
+    char* json = cJSON_PrintUnformatted(jResult);
+    cb->responseHandler(session, (const char *) json, cb->bugname);
+    free(json);
 
-      cJSON_Delete(jResult);
-    }
+    cJSON_Delete(jResult);
+  }
 
-    if (speech_event_type == StreamingRecognizeResponse_SpeechEventType_END_OF_SINGLE_UTTERANCE) {
-      // we only get this when we have requested it, and recognition stops after we get this
-      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "grpc_read_thread: got end_of_utterance\n") ;
-      cb->got_end_of_utterance = 1;
-      cb->responseHandler(session, "end_of_utterance", cb->bugname);
-      if (cb->wants_single_utterance) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "grpc_read_thread: sending writesDone because we want only a single utterance\n") ;
-        streamer->writesDone();
-      }
+  if (speech_event_type == StreamingRecognizeResponse_SpeechEventType_END_OF_SINGLE_UTTERANCE) {
+    // we only get this when we have requested it, and recognition stops after we get this
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "grpc_on_response: got end_of_utterance\n") ;
+    cb->got_end_of_utterance = 1;
+    cb->responseHandler(session, "end_of_utterance", cb->bugname);
+    if (cb->wants_single_utterance) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "grpc_on_response: sending writesDone because we want only a single utterance\n") ;
+      streamer->writesDone();
     }
-    switch_core_session_rwunlock(session);
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "grpc_read_thread: got %d responses\n", response.results_size());
   }
+  switch_core_session_rwunlock(session);
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "grpc_on_response: got %d responses\n", response.results_size());
+}
 
-  {
-    switch_core_session_t* session = switch_core_session_locate(cb->sessionId);
-    if (session) {
-      grpc::Status status = streamer->finish();
-      if (11 == status.error_code()) {
-        if (std::string::npos != status.error_message().find("Exceeded maximum allowed stream duration")) {
-          cb->responseHandler(session, "max_duration_exceeded", cb->bugname);
-        }
-        else {
-          cb->responseHandler(session, "no_audio", cb->bugname);
-        }
+static void grpc_on_finish(struct cap_cb *cb, unsigned int generation, const grpc::Status& status) {
+  GStreamer* streamer = (GStreamer *) cb->streamer;
+  switch_core_session_t* session = switch_core_session_locate(cb->sessionId);
+  if (session) {
+    if (streamer && !streamer->isCurrentGeneration(generation)) {
+      // a stream replaced in continuous mode
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "grpc_on_finish: retired stream %u status %s (%d)\n",
+        generation, status.error_message().c_str(), status.error_code());
+    }
+    else if (11 == status.error_code()) {
+      if (std::string::npos != status.error_message().find("Exceeded maximum allowed stream duration")) {
+        cb->responseHandler(session, "max_duration_exceeded", cb->bugname);
+      }
+      else {
+        cb->responseHandler(session, "no_audio", cb->bugname);
       }
-      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "grpc_read_thread: finish() status %s (%d)\n", status.error_message().c_str(), status.error_code()) ;
-      switch_core_session_rwunlock(session);
     }
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "grpc_on_finish: status %s (%d)\n", status.error_message().c_str(), status.error_code()) ;
+    switch_core_session_rwunlock(session);
   }
-  return nullptr;
 }
 
 extern "C" {
 
     switch_status_t google_speech_init() {
+      google_speech::CredentialsCache::initialize(nCredentialsCacheSize);
       const char* gcsServiceKeyFile = std::getenv("GOOGLE_APPLICATION_CREDENTIALS");
       if (gcsServiceKeyFile) {
         try {
-          auto creds = grpc::GoogleDefaultCredentials();
+          // built now and shared by every session using the default credentials
+          std::string credentialsKey;
+          auto creds = google_speech::CredentialsCache::get("", credentialsKey);
         } catch (const std::exception& e) {
           switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, 
             "Error initializing google api with provided credentials in %s: %s\n", gcsServiceKeyFile, e.what());
           return SWITCH_STATUS_FALSE;
         }
       }
+      google_speech::ChannelRegistry::initialize(nGrpcSubchannels, nGrpcMaxStreamsPerChannel, nGrpcKeepaliveMs);
+      google_speech::GrpcEngine::initialize(nGrpcThreads);
       return SWITCH_STATUS_SUCCESS;
     }
 
     switch_status_t google_speech_cleanup() {
+      google_speech::GrpcEngine::deinitialize();
+      google_speech::ChannelRegistry::deinitialize();
+      google_speech::CredentialsCache::deinitialize();
+
+      google_speech::ConfigCache<RecognitionConfig>::Stats stats;
+      hintsCache.getStats(stats);
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "hints cache: %u entries, %llu hits, %llu misses, %llu evictions\n",
+        (unsigned int) stats.entries, (unsigned long long) stats.hits, (unsigned long long) stats.misses, (unsigned long long) stats.evictions);
+      hintsCache.clear();
       return SWITCH_STATUS_SUCCESS;
     }
     switch_status_t google_speech_session_init(switch_core_session_t *session, responseHandler_t responseHandler, 
@@ -594,7 +844,7 @@ extern "C" {
 
       GStreamer *streamer = NULL;
       try {
-        streamer = new GStreamer(session, channels, lang, interim, to_rate, sampleRate, single_utterance, separate_recognition, max_alternatives,
+        streamer = new GStreamer(session, cb, channels, lang, interim, to_rate, sampleRate, single_utterance, separate_recognition, max_alternatives,
          profanity_filter, word_time_offset, punctuation, model, enhanced, hints);
         cb->streamer = streamer;
       } catch (std::exception& e) {
@@ -605,14 +855,6 @@ extern "C" {
 
       if (!cb->vad) streamer->connect();
 
-      // create the read thread
-      switch_threadattr_t *thd_attr = NULL;
-      switch_memory_pool_t *pool = switch_core_session_get_pool(session);
-
-      switch_threadattr_create(&thd_attr, pool);
-      switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
-      switch_thread_create(&cb->thread, thd_attr, grpc_read_thread, cb, pool);
-
       *ppUserData = cb;
       return SWITCH_STATUS_SUCCESS;
     }
@@ -647,10 +889,9 @@ extern "C" {
         if (streamer) {
           streamer->writesDone();
 
-          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "google_speech_session_cleanup: GStreamer (%p) waiting for read thread to complete\n", (void*)streamer);
-          switch_status_t st;
-          switch_thread_join(&st, cb->thread);
-          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "google_speech_session_cleanup:  GStreamer (%p) read thread completed\n", (void*)streamer);
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "google_speech_session_cleanup: GStreamer (%p) waiting for stream to finish\n", (void*)streamer);
+          streamer->waitForFinish();
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "google_speech_session_cleanup:  GStreamer (%p) stream finished\n", (void*)streamer);
 
           delete streamer;
           cb->streamer = NULL;
@@ -46,7 +46,6 @@ struct cap_cb {
   SpeexResamplerState *resampler;
 	void* streamer;
 	responseHandler_t responseHandler;
-	switch_thread_t* thread;
   int wants_single_utterance;
   int got_end_of_utterance;
 	int play_file;
@@ -60,7 +60,6 @@ int AudioPipe::lws_callback(struct lws *wsi,
       {
         AudioPipe* ap = findAndRemovePendingConnect(wsi);
         if (ap) {
-          std::ostringstream oss;
           *ppAp = ap;
           ap->m_vhd = vhd;
           ap->m_state = LWS_CLIENT_CONNECTED;
@@ -70,13 +69,7 @@ int AudioPipe::lws_callback(struct lws *wsi,
             ap->close();
           }
           else {
-            oss << "{\"action\": \"start\",";
-            oss << "\"content-type\": \"audio/l16;rate=16000\"";
-            oss << ",\"interim_results\": true";
-            oss << ",\"low_latency\": false";
-            oss << "}";
-
-            ap->bufferForSending(oss.str().c_str());
+            ap->sendStartMessage();
             ap->m_callback(ap->m_uuid.c_str(), ap->m_bugname.c_str(), AudioPipe::CONNECT_SUCCESS, NULL,  ap->isFinished(), ap->isInterimTranscriptsEnabled());
           }
 
@@ -166,6 +159,16 @@ int AudioPipe::lws_callback(struct lws *wsi,
               std::string msg((char *)ap->m_recv_buf, ap->m_recv_buf_ptr - ap->m_recv_buf);
               //std::cerr << "Recv: " << msg << std::endl;
 
+              if (std::string::npos != msg.find("\"state\": \"listening\"")) {
+                if (ap->m_restart_pending && !ap->isFinished()) {
+                  // previous recognition request has completed, start the next one on the same connection;
+                  // it can be flushed once the service reports that it is listening too
+                  ap->m_restart_pending = false;
+                  ap->sendStartMessage();
+                }
+                else ap->m_listening = true;
+              }
+
               ap->m_callback(ap->m_uuid.c_str(), ap->m_bugname.c_str(), AudioPipe::MESSAGE, msg.c_str(),  ap->isFinished(), ap->isInterimTranscriptsEnabled());
               if (nullptr != ap->m_recv_buf) free(ap->m_recv_buf);
             }
@@ -215,6 +218,9 @@ int AudioPipe::lws_callback(struct lws *wsi,
           return -1;
         }
 
+        // hold audio until the next recognition request has been started
+        if (ap->m_restart_pending) return 0;
+
         // check for audio packets
         {
           std::lock_guard<std::mutex> lk(ap->m_audio_mutex);
@@ -441,7 +447,7 @@ bool AudioPipe::deinitialize() {
 // instance members
 AudioPipe::AudioPipe(const char* uuid, const char* bugname, const char* host, unsigned int port, const char* path,
   size_t bufLen, size_t minFreespace, notifyHandler_t callback) :
-  m_uuid(uuid), m_host(host), m_port(port), m_path(path), m_finished(false),  m_bugname(bugname),
+  m_uuid(uuid), m_host(host), m_port(port), m_path(path), m_finished(false), m_restart_pending(false), m_listening(false), m_bugname(bugname),
   m_audio_buffer_min_freespace(minFreespace), m_audio_buffer_max_len(bufLen), m_gracefulShutdown(false),
   m_audio_buffer_write_offset(LWS_PRE), m_recv_buf(nullptr), m_recv_buf_ptr(nullptr), m_interim(false),
   m_state(LWS_CLIENT_IDLE), m_wsi(nullptr), m_vhd(nullptr), m_callback(callback) {
@@ -510,6 +516,29 @@ void AudioPipe::finish() {
   bufferForSending("{\"action\": \"stop\"}");
 }
 
+void AudioPipe::sendStartMessage(void) {
+  std::ostringstream oss;
+  oss << "{\"action\": \"start\",";
+  oss << "\"content-type\": \"audio/l16;rate=16000\"";
+  oss << ",\"interim_results\": true";
+  oss << ",\"low_latency\": false";
+  oss << "}";
+
+  bufferForSending(oss.str().c_str());
+}
+
+// stop the current recognition request to get its final results, then start a new one on the same connection
+bool AudioPipe::flush() {
+  if (m_finished || m_state != LWS_CLIENT_CONNECTED) return false;
+
+  // until the request is listening, the listening message that acknowledges its start would be taken for the stop's
+  bool listening = true;
+  if (!m_listening.compare_exchange_strong(listening, false)) return false;
+  m_restart_pending = true;
+  bufferForSending("{\"action\": \"stop\"}");
+  return true;
+}
+
 void AudioPipe::waitForClose() {
   std::shared_future<void> sf(m_promise.get_future());
   sf.wait();
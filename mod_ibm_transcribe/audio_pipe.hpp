@@ -4,6 +4,7 @@
 #include <string>
 #include <list>
 #include <mutex>
+#include <atomic>
 #include <future>
 #include <queue>
 #include <unordered_map>
@@ -94,6 +95,8 @@ public:
 
   void close() ;
   void finish();
+  // asks for the current request's final results and starts another; false if the current request is not yet listening
+  bool flush();
   void waitForClose();
   void setClosed() { m_promise.set_value(); }
   bool isFinished() { return m_finished;}
@@ -129,6 +132,7 @@ private:
 
   
   bool connect_client(struct lws_per_vhost_data *vhd);
+  void sendStartMessage(void);
 
   LwsState_t m_state;
   std::string m_uuid;
@@ -152,6 +156,8 @@ private:
   log_emit_function m_logger;
   bool m_gracefulShutdown;
   bool m_finished;
+  std::atomic<bool> m_restart_pending;
+  std::atomic<bool> m_listening;
   bool m_interim;
   std::string m_access_token;
   std::string m_bugname;
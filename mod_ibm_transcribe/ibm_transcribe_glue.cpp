@@ -19,9 +19,11 @@
 #include "simple_buffer.h"
 #include "parser.hpp"
 #include "audio_pipe.hpp"
+#include "token_broker.hpp"
 
 #define RTP_PACKETIZATION_PERIOD 20
 #define FRAME_SIZE_8000  320 /*which means each 20ms frame as 320 bytes at 8 khz (1 channel only)*/
+#define DEFAULT_IAM_URL "https://iam.cloud.ibm.com/identity/token"
 
 namespace {
   static bool hasDefaultCredentials = false;
@@ -32,6 +34,11 @@ namespace {
   static unsigned int nServiceThreads = std::max(1, std::min(requestedNumServiceThreads ? ::atoi(requestedNumServiceThreads) : 1, 5));
   static unsigned int idxCallCount = 0;
   static uint32_t playCount = 0;
+  static const char *requestedIamUrl = std::getenv("IBM_IAM_URL");
+  static const char *requestedIamRefreshSecs = std::getenv("IBM_IAM_REFRESH_SECS");
+  static unsigned int nIamRefreshSecs = std::max(30, std::min(requestedIamRefreshSecs ? ::atoi(requestedIamRefreshSecs) : 300, 1800));
+  static const char *requestedIamWaitMs = std::getenv("IBM_IAM_WAIT_MS");
+  static unsigned int nIamWaitMs = std::max(0, std::min(requestedIamWaitMs ? ::atoi(requestedIamWaitMs) : 3000, 10000));
   static const std::map<ibm::AudioPipe::NotifyEvent_t, std::string> Event2Str = {
     {ibm::AudioPipe::CONNECT_SUCCESS, "CONNECT_SUCCESS"},
     {ibm::AudioPipe::CONNECT_FAIL, "CONNECT_FAIL"},
@@ -119,7 +126,7 @@ namespace {
       return oss.str();
   }
 
-  std::string& constructPath(switch_core_session_t* session, std::string& path, 
+  std::string& constructPath(switch_core_session_t* session, std::string& path, const std::string& accessToken,
     int sampleRate, int channels, const char* language, int interim) {
     switch_channel_t *channel = switch_core_session_get_channel(session);
     const char *var ;
@@ -130,9 +137,7 @@ namespace {
     oss << "/instances/" << instanceId << "/v1/recognize";
 
     // access token 
-    if (var = switch_channel_get_variable(channel, "IBM_ACCESS_TOKEN")) {
-      oss <<  "?access_token=" << var;
-    }
+    oss <<  "?access_token=" << accessToken;
 
     // model = voice
     if (var = switch_channel_get_variable(channel, "IBM_SPEECH_MODEL")) {
@@ -231,9 +236,21 @@ namespace {
 
     const char* region = switch_channel_get_variable(channel, "IBM_SPEECH_REGION");
     const char* instanceId = switch_channel_get_variable(channel, "IBM_SPEECH_INSTANCE_ID");
-    if (!region || !instanceId || !switch_channel_get_variable(channel, "IBM_ACCESS_TOKEN")) {
+    const char* apiKey = switch_channel_get_variable(channel, "IBM_API_KEY");
+    if (!apiKey) apiKey = defaultApiKey;
+    if (!region || !instanceId || (!switch_channel_get_variable(channel, "IBM_ACCESS_TOKEN") && !apiKey)) {
       switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, 
-        "missing IBM_SPEECH_REGION or IBM_SPEECH_INSTANCE_ID or IBM_ACCESS_TOKEN\n");
+        "missing IBM_SPEECH_REGION or IBM_SPEECH_INSTANCE_ID or IBM_ACCESS_TOKEN/IBM_API_KEY\n");
+      return SWITCH_STATUS_FALSE;
+    }
+
+    // an explicit access token takes precedence, otherwise use the cached token for the api key
+    std::string accessToken;
+    if (const char* var = switch_channel_get_variable(channel, "IBM_ACCESS_TOKEN")) {
+      accessToken = var;
+    }
+    else if (!ibm::TokenBroker::getToken(apiKey, accessToken, nIamWaitMs)) {
+      switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "unable to obtain IAM access token for api key\n");
       return SWITCH_STATUS_FALSE;
     }
 
@@ -245,7 +262,7 @@ namespace {
     oss << "api." << region << ".speech-to-text.watson.cloud.ibm.com";
     std::string host = oss.str();
     std::string path;
-    constructPath(session, path, desiredSampling, channels, lang, interim);
+    constructPath(session, path, accessToken, desiredSampling, channels, lang, interim);
     switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "host: %s, path: %s\n", host.c_str(), path.c_str());
 
     strncpy(tech_pvt->sessionId, switch_core_session_get_uuid(session), MAX_SESSION_ID);
@@ -267,8 +284,7 @@ namespace {
       return SWITCH_STATUS_FALSE;
     }
     
-    const char* access_token = switch_channel_get_variable(channel, "IBM_ACCESS_TOKEN");
-    ap->setAccessToken(access_token);
+    ap->setAccessToken(accessToken.c_str());
     ap->setBugname(bugname);
     if (interim) ap->enableInterimTranscripts(true);
 
@@ -318,11 +334,24 @@ extern "C" {
     ibm::AudioPipe::initialize(logs, lws_logger);
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "AudioPipe::initialize completed\n");
 
+    ibm::TokenBroker::initialize(requestedIamUrl ? requestedIamUrl : DEFAULT_IAM_URL, nIamRefreshSecs);
+		const char* apiKey = std::getenv("IBM_API_KEY");
+		if (NULL == apiKey) {
+			switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, 
+				"\"IBM_API_KEY\" env var not set; authentication will expect IBM_API_KEY or IBM_ACCESS_TOKEN channel variables to be set\n");
+		}
+		else {
+			hasDefaultCredentials = true;
+      defaultApiKey = apiKey;
+      ibm::TokenBroker::prefetch(apiKey);
+		}
+
 		return SWITCH_STATUS_SUCCESS;
   }
 
   switch_status_t ibm_transcribe_cleanup() {
     bool cleanup = false;
+    ibm::TokenBroker::deinitialize();
     cleanup = ibm::AudioPipe::deinitialize();
     if (cleanup == true) {
         return SWITCH_STATUS_SUCCESS;
@@ -393,6 +422,29 @@ extern "C" {
     return SWITCH_STATUS_SUCCESS;
   }
 	
+  switch_status_t ibm_transcribe_session_finalize(switch_core_session_t *session, char* bugname) {
+    switch_channel_t *channel = switch_core_session_get_channel(session);
+    switch_media_bug_t *bug = (switch_media_bug_t*) switch_channel_get_private(channel, bugname);
+    if (!bug) {
+      switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "ibm_transcribe_session_finalize: no bug %s\n", bugname);
+      return SWITCH_STATUS_FALSE;
+    }
+    private_t* tech_pvt = (private_t*) switch_core_media_bug_get_user_data(bug);
+    if (!tech_pvt) return SWITCH_STATUS_FALSE;
+
+    // get final results for the current utterance but keep streaming on the same connection
+    switch_status_t status = SWITCH_STATUS_FALSE;
+    switch_mutex_lock(tech_pvt->mutex);
+    ibm::AudioPipe *pAudioPipe = static_cast<ibm::AudioPipe *>(tech_pvt->pAudioPipe);
+    if (pAudioPipe) {
+      switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%u) ibm_transcribe_session_finalize\n", tech_pvt->id);
+      if (pAudioPipe->flush()) status = SWITCH_STATUS_SUCCESS;
+      else switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%u) ibm_transcribe_session_finalize: not listening yet\n", tech_pvt->id);
+    }
+    switch_mutex_unlock(tech_pvt->mutex);
+    return status;
+  }
+
 	switch_bool_t ibm_transcribe_frame(switch_core_session_t *session, switch_media_bug_t *bug) {
     private_t* tech_pvt = (private_t*) switch_core_media_bug_get_user_data(bug);
     size_t inuse = 0;
@@ -98,7 +98,7 @@ static switch_status_t do_stop(switch_core_session_t *session,  char* bugname)
 	return status;
 }
 
-#define TRANSCRIBE_API_SYNTAX "<uuid> [start|stop] lang-code [interim] [stereo|mono]"
+#define TRANSCRIBE_API_SYNTAX "<uuid> [start|stop|finalize] lang-code [interim] [stereo|mono]"
 SWITCH_STANDARD_API(ibm_transcribe_function)
 {
 	char *mycmd = NULL, *argv[6] = { 0 };
@@ -125,6 +125,10 @@ SWITCH_STANDARD_API(ibm_transcribe_function)
 				char *bugname = argc > 2 ? argv[2] : MY_BUG_NAME;
     		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "stop transcribing\n");
 				status = do_stop(lsession, bugname);
+			} else if (!strcasecmp(argv[1], "finalize")) {
+				char *bugname = argc > 2 ? argv[2] : MY_BUG_NAME;
+    		switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "finalize transcription %s\n", bugname);
+				status = ibm_transcribe_session_finalize(lsession, bugname);
 			} else if (!strcasecmp(argv[1], "start")) {
         char* lang = argv[2];
         int interim = argc > 3 && !strcmp(argv[3], "interim");
@@ -201,6 +205,7 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_ibm_transcribe_load)
 	SWITCH_ADD_API(api_interface, "uuid_ibm_transcribe", "IBM Speech Transcription API", ibm_transcribe_function, TRANSCRIBE_API_SYNTAX);
 	switch_console_set_complete("add uuid_ibm_transcribe start lang-code [interim|final] [stereo|mono]");
 	switch_console_set_complete("add uuid_ibm_transcribe stop ");
+	switch_console_set_complete("add uuid_ibm_transcribe finalize ");
 
 	/* indicate that the module should continue to be loaded */
 	return SWITCH_STATUS_SUCCESS;
@@ -0,0 +1,231 @@
+#include "token_broker.hpp"
+
+#include <switch.h>
+#include <switch_json.h>
+#include <curl/curl.h>
+#include <vector>
+#include <algorithm>
+
+/* tokens unused for this long are no longer refreshed */
+#define TOKEN_IDLE_EVICT_SECS (2 * 3600)
+/* retry interval after a failed fetch */
+#define TOKEN_RETRY_SECS (5)
+/* a token this close to expiry is not handed out to new sessions */
+#define TOKEN_MIN_REMAINING_SECS (30)
+
+using namespace ibm;
+
+namespace {
+  static size_t writeCallback(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    std::string* body = static_cast<std::string*>(userdata);
+    body->append(ptr, size * nmemb);
+    return size * nmemb;
+  }
+}
+
+std::thread TokenBroker::workerThread;
+std::mutex TokenBroker::mutex;
+std::condition_variable TokenBroker::cvWorker;
+std::condition_variable TokenBroker::cvReady;
+std::map<std::string, TokenBroker::Entry> TokenBroker::tokens;
+std::string TokenBroker::url;
+unsigned int TokenBroker::refreshMargin;
+bool TokenBroker::stopFlag;
+
+void TokenBroker::initialize(const char* iamUrl, unsigned int refreshMarginSecs) {
+  std::lock_guard<std::mutex> lk(mutex);
+  url = iamUrl;
+  refreshMargin = refreshMarginSecs;
+  stopFlag = false;
+  workerThread = std::thread(&TokenBroker::worker);
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "TokenBroker::initialize iam url %s, refresh %u secs before expiry\n",
+    url.c_str(), refreshMargin);
+}
+
+void TokenBroker::deinitialize() {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    stopFlag = true;
+  }
+  cvWorker.notify_all();
+  cvReady.notify_all();
+  if (workerThread.joinable()) workerThread.join();
+
+  std::lock_guard<std::mutex> lk(mutex);
+  tokens.clear();
+}
+
+bool TokenBroker::isValid(const Entry& entry, Clock::time_point now) {
+  return !entry.token.empty() && entry.expiresAt > now + std::chrono::seconds(TOKEN_MIN_REMAINING_SECS);
+}
+
+void TokenBroker::prefetch(const std::string& apiKey) {
+  auto now = Clock::now();
+  std::lock_guard<std::mutex> lk(mutex);
+  auto it = tokens.find(apiKey);
+  if (it == tokens.end()) {
+    Entry entry = {};
+    entry.refreshAt = now;
+    entry.lastUsed = now;
+    tokens.insert(std::make_pair(apiKey, entry));
+    cvWorker.notify_one();
+  }
+}
+
+bool TokenBroker::getToken(const std::string& apiKey, std::string& token, unsigned int waitMs) {
+  auto now = Clock::now();
+  std::unique_lock<std::mutex> lk(mutex);
+  if (stopFlag) return false;
+
+  auto it = tokens.find(apiKey);
+  if (it == tokens.end()) {
+    Entry entry = {};
+    entry.refreshAt = now;
+    it = tokens.insert(std::make_pair(apiKey, entry)).first;
+  }
+  Entry& entry = it->second;
+  entry.lastUsed = now;
+
+  if (isValid(entry, now)) {
+    token = entry.token;
+    return true;
+  }
+
+  // cold cache (or the token could not be refreshed in time): ask the worker and wait for the next attempt
+  unsigned int attempts = entry.attempts;
+  entry.refreshAt = now;
+  cvWorker.notify_one();
+
+  // the entry is looked up again on each wakeup, since deinitialize (or the worker) may have removed it meanwhile
+  cvReady.wait_for(lk, std::chrono::milliseconds(waitMs), [&apiKey, attempts] {
+    if (stopFlag) return true;
+    auto it = tokens.find(apiKey);
+    return it == tokens.end() || it->second.attempts != attempts;
+  });
+  if (stopFlag) return false;
+  it = tokens.find(apiKey);
+  if (it != tokens.end() && isValid(it->second, Clock::now())) {
+    token = it->second.token;
+    return true;
+  }
+  return false;
+}
+
+bool TokenBroker::fetch(const std::string& apiKey, std::string& token, unsigned int& expiresInSecs, std::string& err) {
+  CURL* easy = curl_easy_init();
+  if (!easy) {
+    err = "curl_easy_init failed";
+    return false;
+  }
+
+  char* escaped = curl_easy_escape(easy, apiKey.c_str(), apiKey.length());
+  std::string postData = "grant_type=urn:ibm:params:oauth:grant-type:apikey&apikey=";
+  postData.append(escaped);
+  curl_free(escaped);
+
+  std::string body;
+  long responseCode = 0;
+  struct curl_slist *hdrs = nullptr;
+  hdrs = curl_slist_append(hdrs, "Content-Type: application/x-www-form-urlencoded");
+  hdrs = curl_slist_append(hdrs, "Accept: application/json");
+
+  curl_easy_setopt(easy, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(easy, CURLOPT_HTTPHEADER, hdrs);
+  curl_easy_setopt(easy, CURLOPT_POSTFIELDS, postData.c_str());
+  curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, writeCallback);
+  curl_easy_setopt(easy, CURLOPT_WRITEDATA, &body);
+  curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT_MS, 3000L);
+  curl_easy_setopt(easy, CURLOPT_TIMEOUT, 10L);
+
+  CURLcode rc = curl_easy_perform(easy);
+  if (CURLE_OK == rc) curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &responseCode);
+  curl_slist_free_all(hdrs);
+  curl_easy_cleanup(easy);
+
+  if (CURLE_OK != rc) {
+    err = curl_easy_strerror(rc);
+    return false;
+  }
+  if (200 != responseCode) {
+    err = "http status " + std::to_string(responseCode) + ": " + body;
+    return false;
+  }
+
+  cJSON* json = cJSON_Parse(body.c_str());
+  if (!json) {
+    err = "invalid json response";
+    return false;
+  }
+  const char* accessToken = cJSON_GetStringValue(cJSON_GetObjectItem(json, "access_token"));
+  cJSON* jExpiresIn = cJSON_GetObjectItem(json, "expires_in");
+  bool ok = accessToken && jExpiresIn && cJSON_IsNumber(jExpiresIn);
+  if (ok) {
+    token = accessToken;
+    expiresInSecs = (unsigned int) jExpiresIn->valueint;
+  }
+  else err = "response missing access_token or expires_in";
+  cJSON_Delete(json);
+  return ok;
+}
+
+void TokenBroker::worker() {
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "TokenBroker::worker starting\n");
+  std::unique_lock<std::mutex> lk(mutex);
+  while (!stopFlag) {
+    auto now = Clock::now();
+    auto next = now + std::chrono::hours(1);
+    std::vector<std::string> due;
+
+    for (auto it = tokens.begin(); it != tokens.end();) {
+      Entry& entry = it->second;
+      if (now - entry.lastUsed > std::chrono::seconds(TOKEN_IDLE_EVICT_SECS)) {
+        it = tokens.erase(it);
+        continue;
+      }
+      if (entry.refreshAt <= now && !entry.inProgress) {
+        entry.inProgress = true;
+        due.push_back(it->first);
+      }
+      else if (entry.refreshAt < next) next = entry.refreshAt;
+      ++it;
+    }
+
+    if (due.empty()) {
+      cvWorker.wait_until(lk, next);
+      continue;
+    }
+
+    lk.unlock();
+    for (const auto& apiKey : due) {
+      std::string token, err;
+      unsigned int expiresIn = 0;
+      bool ok = fetch(apiKey, token, expiresIn, err);
+      auto fetchedAt = Clock::now();
+
+      std::lock_guard<std::mutex> guard(mutex);
+      auto it = tokens.find(apiKey);
+      if (it == tokens.end()) continue;
+      Entry& entry = it->second;
+      entry.inProgress = false;
+      entry.attempts++;
+      if (ok) {
+        // refresh ahead of expiry, but never more often than every half lifetime
+        unsigned int refreshIn = std::max(expiresIn / 2, expiresIn > refreshMargin ? expiresIn - refreshMargin : 0);
+        entry.token = token;
+        entry.expiresAt = fetchedAt + std::chrono::seconds(expiresIn);
+        entry.refreshAt = fetchedAt + std::chrono::seconds(refreshIn);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "TokenBroker::worker fetched token, expires in %u secs, refresh in %u secs\n",
+          expiresIn, refreshIn);
+      }
+      else {
+        entry.refreshAt = fetchedAt + std::chrono::seconds(TOKEN_RETRY_SECS);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "TokenBroker::worker failed fetching token from %s: %s\n",
+          url.c_str(), err.c_str());
+      }
+    }
+    cvReady.notify_all();
+    lk.lock();
+  }
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "TokenBroker::worker ending\n");
+}
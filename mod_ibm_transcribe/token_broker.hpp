@@ -0,0 +1,56 @@
+#ifndef __IBM_TOKEN_BROKER_HPP__
+#define __IBM_TOKEN_BROKER_HPP__
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+
+namespace ibm {
+
+/*
+ * Exchanges IBM Cloud api keys for IAM access tokens and caches them per api key.
+ * A single worker thread fetches tokens and refreshes them ahead of expiry, so
+ * that sessions can normally pick up a valid token without any network round trip.
+ */
+class TokenBroker {
+public:
+  static void initialize(const char* iamUrl, unsigned int refreshMarginSecs);
+  static void deinitialize();
+
+  // start fetching a token for this api key in the background, if not already cached
+  static void prefetch(const std::string& apiKey);
+
+  // returns a cached token; if none is available yet waits up to waitMs for the first fetch to complete
+  static bool getToken(const std::string& apiKey, std::string& token, unsigned int waitMs);
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Entry {
+    std::string token;
+    Clock::time_point expiresAt;
+    Clock::time_point refreshAt;
+    Clock::time_point lastUsed;
+    unsigned int attempts;
+    bool inProgress;
+  };
+
+  static void worker();
+  static bool fetch(const std::string& apiKey, std::string& token, unsigned int& expiresInSecs, std::string& err);
+  static bool isValid(const Entry& entry, Clock::time_point now);
+
+  static std::thread workerThread;
+  static std::mutex mutex;
+  static std::condition_variable cvWorker;
+  static std::condition_variable cvReady;
+  static std::map<std::string, Entry> tokens;
+  static std::string url;
+  static unsigned int refreshMargin;
+  static bool stopFlag;
+};
+
+} // namespace ibm
+#endif
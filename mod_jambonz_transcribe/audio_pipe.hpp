@@ -67,7 +67,7 @@ public:
     m_audio_buffer_write_offset += len;
   }
   void binaryWritePtrResetToZero(void) {
-    m_audio_buffer_write_offset = 0;
+    m_audio_buffer_write_offset = LWS_PRE;
   }
   void lockAudioBuffer(void) {
     m_audio_mutex.lock();
@@ -77,6 +77,7 @@ public:
   void close() ;
   void finish();
   void waitForClose();
+  bool isClosed();
   void setClosed() { m_promise.set_value(); }
   bool isFinished() { return m_finished;}
 
@@ -136,6 +137,7 @@ private:
   bool m_finished;
   std::string m_bugname;
   std::promise<void> m_promise;
+  std::shared_future<void> m_closed;
 };
 
 } // namespace jambonz
@@ -5,6 +5,7 @@
 #include <mutex>
 #include <thread>
 #include <list>
+#include <vector>
 #include <algorithm>
 #include <functional>
 #include <cassert>
@@ -17,6 +18,7 @@
 #include "simple_buffer.h"
 #include "parser.hpp"
 #include "audio_pipe.hpp"
+#include "teardown_executor.hpp"
 
 #define RTP_PACKETIZATION_PERIOD 20
 #define FRAME_SIZE_8000  320 /*which means each 20ms frame as 320 bytes at 8 khz (1 channel only)*/
@@ -28,6 +30,10 @@ namespace {
   static int nAudioBufferSecs = std::max(1, std::min(requestedBufferSecs ? ::atoi(requestedBufferSecs) : 2, 5));
   static const char *requestedNumServiceThreads = std::getenv("MOD_AUDIO_FORK_SERVICE_THREADS");
   static unsigned int nServiceThreads = std::max(1, std::min(requestedNumServiceThreads ? ::atoi(requestedNumServiceThreads) : 1, 5));
+  static const char *requestedTeardownMaxPending = std::getenv("MOD_TRANSCRIBE_TEARDOWN_MAX_PENDING");
+  static unsigned int nTeardownMaxPending = std::max(1, requestedTeardownMaxPending ? ::atoi(requestedTeardownMaxPending) : 1000);
+  static const char *requestedTeardownTimeoutMs = std::getenv("MOD_TRANSCRIBE_TEARDOWN_TIMEOUT_MS");
+  static unsigned int nTeardownTimeoutMs = std::max(100, requestedTeardownTimeoutMs ? ::atoi(requestedTeardownTimeoutMs) : 5000);
   static unsigned int idxCallCount = 0;
   static uint32_t playCount = 0;
 
@@ -110,12 +116,57 @@ namespace {
     pAp.reset((jambonz::AudioPipe *)tech_pvt->pAudioPipe);
     tech_pvt->pAudioPipe = nullptr;
 
-    std::thread t([pAp, tech_pvt]{
-      pAp->finish();
-      pAp->waitForClose();
-      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "%s (%u) got remote close\n", tech_pvt->sessionId, tech_pvt->id);
-    });
-    t.detach();
+    // ask for final results; the teardown executor frees the pipe once the far end has closed the socket
+    pAp->finish();
+    std::string tag = std::string(tech_pvt->sessionId) + " (" + std::to_string(tech_pvt->id) + ")";
+    jambonz::TeardownExecutor::submit(tag, pAp,
+      [pAp] { return pAp->isClosed(); },
+      [pAp] { pAp->close(); });
+  }
+
+  /* write a frame header for framed binary mode; see FRAME_HEADER_LEN */
+  static void writeFrameHeader(char *p, uint32_t seq, uint64_t captureTs, uint32_t samples) {
+    uint8_t *b = (uint8_t *) p;
+    for (int i = 0; i < 4; i++) b[i] = (seq >> (24 - 8 * i)) & 0xff;
+    for (int i = 0; i < 8; i++) b[4 + i] = (captureTs >> (56 - 8 * i)) & 0xff;
+    for (int i = 0; i < 4; i++) b[12 + i] = (samples >> (24 - 8 * i)) & 0xff;
+  }
+
+  /* the server may echo the capture timestamp of the latest frame included in a transcript */
+  static void recordLatency(private_t *tech_pvt, cJSON* jMessage) {
+    cJSON* jTs = cJSON_GetObjectItem(jMessage, "captureTs");
+    if (!tech_pvt->framed || !jTs || !cJSON_IsNumber(jTs)) return;
+
+    uint64_t captureTs = (uint64_t) jTs->valuedouble;
+    uint64_t now = (uint64_t) switch_time_ref();
+    if (captureTs > now) return;
+
+    switch_mutex_lock(tech_pvt->mutex);
+    tech_pvt->latency_ms[tech_pvt->latency_count++ % MAX_LATENCY_SAMPLES] = (uint32_t) ((now - captureTs) / 1000);
+    switch_mutex_unlock(tech_pvt->mutex);
+  }
+
+  static void sendLatencyReport(switch_core_session_t *session, private_t *tech_pvt) {
+    if (!tech_pvt->framed || 0 == tech_pvt->latency_count) return;
+
+    size_t n = std::min(tech_pvt->latency_count, (uint32_t) MAX_LATENCY_SAMPLES);
+    std::vector<uint32_t> samples(tech_pvt->latency_ms, tech_pvt->latency_ms + n);
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double pct) {
+      return samples[std::min(samples.size() - 1, (size_t) (pct * samples.size()))];
+    };
+
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "framesCaptured", tech_pvt->frame_seq);
+    cJSON_AddNumberToObject(json, "count", tech_pvt->latency_count);
+    cJSON_AddNumberToObject(json, "p50", percentile(0.50));
+    cJSON_AddNumberToObject(json, "p90", percentile(0.90));
+    cJSON_AddNumberToObject(json, "p99", percentile(0.99));
+    cJSON_AddNumberToObject(json, "max", samples.back());
+    char* jsonString = cJSON_PrintUnformatted(json);
+    tech_pvt->responseHandler(session, TRANSCRIBE_EVENT_LATENCY, jsonString, tech_pvt->bugname, 1);
+    free(jsonString);
+    cJSON_Delete(json);
   }
 
   static void destroy_tech_pvt(private_t *tech_pvt) {
@@ -142,8 +193,16 @@ namespace {
     cJSON* json = cJSON_CreateObject();
     cJSON_AddStringToObject(json, "type", "start");
     cJSON_AddStringToObject(json, "language", tech_pvt->language);
-    cJSON_AddStringToObject(json, "format", "raw");
+    cJSON_AddStringToObject(json, "format", tech_pvt->framed ? "framed" : "raw");
     cJSON_AddStringToObject(json, "encoding", "LINEAR16");
+    if (tech_pvt->framed) {
+      cJSON* jFraming = cJSON_CreateObject();
+      cJSON_AddNumberToObject(jFraming, "version", 1);
+      cJSON_AddNumberToObject(jFraming, "headerLength", FRAME_HEADER_LEN);
+      cJSON_AddStringToObject(jFraming, "byteOrder", "network");
+      cJSON_AddStringToObject(jFraming, "clock", "monotonic-usecs");
+      cJSON_AddItemToObject(json, "framing", jFraming);
+    }
     cJSON_AddBoolToObject(json, "interimResults", tech_pvt->interim);
     cJSON_AddNumberToObject(json, "sampleRateHz", 8000);
     if (var = switch_channel_get_variable(channel, "JAMBONZ_STT_OPTIONS")) {
@@ -214,6 +273,7 @@ namespace {
                 tech_pvt->responseHandler(session, TRANSCRIBE_EVENT_ERROR, message, tech_pvt->bugname, finished);
               }
               else if (type && 0 == strcmp(type, "transcription")) {
+                recordLatency(tech_pvt, jMessage);
                 tech_pvt->responseHandler(session, TRANSCRIBE_EVENT_RESULTS, message, tech_pvt->bugname, finished);
               }
               else {
@@ -267,9 +327,15 @@ namespace {
     tech_pvt->channels = channels;
     tech_pvt->id = ++idxCallCount;
     tech_pvt->buffer_overrun_notified = 0;
+    tech_pvt->framed = switch_true(switch_channel_get_variable(channel, "JAMBONZ_STT_FRAMED_AUDIO"));
     strncpy(tech_pvt->bugname, bugname, MAX_BUG_LEN);
     
     size_t buflen = LWS_PRE + (FRAME_SIZE_8000 * desiredSampling / 8000 * channels * 1000 / RTP_PACKETIZATION_PERIOD * nAudioBufferSecs);
+    size_t minFreespace = read_impl.decoded_bytes_per_packet;
+    if (tech_pvt->framed) {
+      buflen += FRAME_HEADER_LEN * 1000 / RTP_PACKETIZATION_PERIOD * nAudioBufferSecs;
+      minFreespace += FRAME_HEADER_LEN;
+    }
 
     const char* apiKey = switch_channel_get_variable(channel, "JAMBONZ_STT_API_KEY");
     if (!apiKey && defaultApiKey) apiKey = defaultApiKey;
@@ -279,7 +345,7 @@ namespace {
     }
 
     jambonz::AudioPipe* ap = new jambonz::AudioPipe(tech_pvt->sessionId, bugname, tech_pvt->host, tech_pvt->port, tech_pvt->path, 
-      tech_pvt->sslFlags, buflen, read_impl.decoded_bytes_per_packet, apiKey, eventCallback);
+      tech_pvt->sslFlags, buflen, minFreespace, apiKey, eventCallback);
     if (!ap) {
       switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "Error allocating AudioPipe\n");
       return SWITCH_STATUS_FALSE;
@@ -329,6 +395,7 @@ extern "C" {
     // | LLL_INFO | LLL_PARSER | LLL_HEADER | LLL_EXT | LLL_CLIENT  | LLL_LATENCY | LLL_DEBUG ;
     
     jambonz::AudioPipe::initialize(logs, lws_logger);
+    jambonz::TeardownExecutor::initialize(nTeardownMaxPending, nTeardownTimeoutMs);
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "AudioPipe::initialize completed\n");
 
 		const char* apiKey = std::getenv("JAMBONZ_STT_API_KEY");
@@ -346,11 +413,31 @@ extern "C" {
   switch_status_t jb_transcribe_cleanup() {
     bool cleanup = false;
     cleanup = jambonz::AudioPipe::deinitialize();
+    jambonz::TeardownExecutor::deinitialize();
     if (cleanup == true) {
         return SWITCH_STATUS_SUCCESS;
     }
     return SWITCH_STATUS_FALSE;
   }
+
+  // reports the counters of the connections being drained after a stop, as json
+  char* jb_transcribe_stats() {
+    jambonz::TeardownExecutor::Stats teardowns;
+    jambonz::TeardownExecutor::getStats(teardowns);
+
+    cJSON* jStats = cJSON_CreateObject();
+    cJSON* jTeardowns = cJSON_CreateObject();
+    cJSON_AddNumberToObject(jTeardowns, "pending", teardowns.pending);
+    cJSON_AddNumberToObject(jTeardowns, "submitted", (double) teardowns.submitted);
+    cJSON_AddNumberToObject(jTeardowns, "completed", (double) teardowns.completed);
+    cJSON_AddNumberToObject(jTeardowns, "timedOut", (double) teardowns.timedOut);
+    cJSON_AddNumberToObject(jTeardowns, "overflowed", (double) teardowns.overflowed);
+    cJSON_AddNumberToObject(jTeardowns, "abandoned", (double) teardowns.abandoned);
+    cJSON_AddItemToObject(jStats, "teardowns", jTeardowns);
+    char* json = cJSON_PrintUnformatted(jStats);
+    cJSON_Delete(jStats);
+    return json;
+  }
 	
   switch_status_t jb_transcribe_session_init(switch_core_session_t *session, 
     responseHandler_t responseHandler, uint32_t samples_per_second, uint32_t channels, 
@@ -398,6 +485,7 @@ extern "C" {
         switch_channel_set_private(channel, bugname, NULL);
         uint32_t id = tech_pvt->id;
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "(%u) jb_transcribe_session_stop\n", id);
+        sendLatencyReport(session, tech_pvt);
         if (!channelIsClosing) {
           switch_core_media_bug_remove(session, &bug);
         }
@@ -435,10 +523,12 @@ extern "C" {
 
       pAudioPipe->lockAudioBuffer();
       size_t available = pAudioPipe->binarySpaceAvailable();
+      // in framed mode every frame is preceded by a header, so leave room for it
+      size_t hdrlen = tech_pvt->framed ? FRAME_HEADER_LEN : 0;
       if (NULL == tech_pvt->resampler) {
         switch_frame_t frame = { 0 };
-        frame.data = pAudioPipe->binaryWritePtr();
-        frame.buflen = available;
+        frame.data = pAudioPipe->binaryWritePtr() + hdrlen;
+        frame.buflen = available - hdrlen;
         while (true) {
 
           // check if buffer would be overwritten; dump packets if so
@@ -451,16 +541,23 @@ extern "C" {
               tech_pvt->id);
             pAudioPipe->binaryWritePtrResetToZero();
 
-            frame.data = pAudioPipe->binaryWritePtr();
-            frame.buflen = available = pAudioPipe->binarySpaceAvailable();
+            available = pAudioPipe->binarySpaceAvailable();
+            frame.data = pAudioPipe->binaryWritePtr() + hdrlen;
+            frame.buflen = available - hdrlen;
           }
 
           switch_status_t rv = switch_core_media_bug_read(bug, &frame, SWITCH_TRUE);
           if (rv != SWITCH_STATUS_SUCCESS) break;
           if (frame.datalen) {
-            pAudioPipe->binaryWritePtrAdd(frame.datalen);
-            frame.buflen = available = pAudioPipe->binarySpaceAvailable();
-            frame.data = pAudioPipe->binaryWritePtr();
+            if (tech_pvt->framed) {
+              // sequence numbers keep advancing across dropped frames so the far end can detect the gap
+              writeFrameHeader(pAudioPipe->binaryWritePtr(), tech_pvt->frame_seq++, switch_time_ref(),
+                frame.datalen / (2 * tech_pvt->channels));
+            }
+            pAudioPipe->binaryWritePtrAdd(hdrlen + frame.datalen);
+            available = pAudioPipe->binarySpaceAvailable();
+            frame.data = pAudioPipe->binaryWritePtr() + hdrlen;
+            frame.buflen = available - hdrlen;
             dirty = true;
           }
         }
@@ -472,19 +569,22 @@ extern "C" {
         frame.buflen = SWITCH_RECOMMENDED_BUFFER_SIZE;
         while (switch_core_media_bug_read(bug, &frame, SWITCH_TRUE) == SWITCH_STATUS_SUCCESS) {
           if (frame.datalen) {
-            spx_uint32_t out_len = available >> 1;  // space for samples which are 2 bytes
+            spx_uint32_t out_len = available > hdrlen ? (available - hdrlen) >> 1 : 0;  // space for samples which are 2 bytes
             spx_uint32_t in_len = frame.samples;
 
             speex_resampler_process_interleaved_int(tech_pvt->resampler, 
               (const spx_int16_t *) frame.data, 
               (spx_uint32_t *) &in_len, 
-              (spx_int16_t *) ((char *) pAudioPipe->binaryWritePtr()),
+              (spx_int16_t *) ((char *) pAudioPipe->binaryWritePtr() + hdrlen),
               &out_len);
 
             if (out_len > 0) {
               // bytes written = num samples * 2 * num channels
               size_t bytes_written = out_len << tech_pvt->channels;
-              pAudioPipe->binaryWritePtrAdd(bytes_written);
+              if (tech_pvt->framed) {
+                writeFrameHeader(pAudioPipe->binaryWritePtr(), tech_pvt->frame_seq++, switch_time_ref(), out_len);
+              }
+              pAudioPipe->binaryWritePtrAdd(hdrlen + bytes_written);
               available = pAudioPipe->binarySpaceAvailable();
               dirty = true;
             }
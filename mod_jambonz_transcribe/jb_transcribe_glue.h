@@ -5,6 +5,7 @@ int parse_ws_uri(switch_channel_t *channel, const char* szServerUri, char* host,
 
 switch_status_t jb_transcribe_init();
 switch_status_t jb_transcribe_cleanup();
+char* jb_transcribe_stats();
 switch_status_t jb_transcribe_session_init(switch_core_session_t *session, responseHandler_t responseHandler, 
 		uint32_t samples_per_second, uint32_t channels, char* lang, int interim, char* bugname, void **ppUserData);
 switch_status_t jb_transcribe_session_stop(switch_core_session_t *session, int channelIsClosing, char* bugname);
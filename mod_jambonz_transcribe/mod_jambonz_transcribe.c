@@ -176,6 +176,19 @@ SWITCH_STANDARD_API(jb_transcribe_function)
 }
 
 
+SWITCH_STANDARD_API(stats_function)
+{
+	char *json = jb_transcribe_stats();
+	if (json) {
+		stream->write_function(stream, "%s\n", json);
+		free(json);
+	}
+	else {
+		stream->write_function(stream, "-ERR Operation Failed\n");
+	}
+	return SWITCH_STATUS_SUCCESS;
+}
+
 SWITCH_MODULE_LOAD_FUNCTION(mod_jambonz_transcribe_load)
 {
 	switch_api_interface_t *api_interface;
@@ -201,6 +214,8 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_jambonz_transcribe_load)
 	switch_console_set_complete("add uuid_jambonz_transcribe start lang-code [interim|final] [stereo|mono]");
 	switch_console_set_complete("add uuid_jambonz_transcribe stop ");
 
+	SWITCH_ADD_API(api_interface, "jambonz_transcribe_stats", "Show jambonz transcribe teardown counters", stats_function, "");
+
 	/* indicate that the module should continue to be loaded */
 	return SWITCH_STATUS_SUCCESS;
 }
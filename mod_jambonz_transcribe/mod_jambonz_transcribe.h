@@ -15,6 +15,7 @@
 #define TRANSCRIBE_EVENT_BUFFER_OVERRUN  "jambonz_transcribe::buffer_overrun"
 #define TRANSCRIBE_EVENT_DISCONNECT      "jambonz_transcribe::disconnect"
 #define TRANSCRIBE_EVENT_ERROR      "jambonz_transcribe::error"
+#define TRANSCRIBE_EVENT_LATENCY    "jambonz_transcribe::latency"
 
 #define MAX_LANG_LEN (12)
 #define MAX_SESSION_ID (256)
@@ -22,6 +23,10 @@
 #define MAX_PATH_LEN (4096)
 #define MAX_BUG_LEN (64)
 
+/* framed binary mode: seq (u32), capture ts in usecs (u64), samples per channel (u32), all network byte order */
+#define FRAME_HEADER_LEN (16)
+#define MAX_LATENCY_SAMPLES (512)
+
 typedef void (*responseHandler_t)(switch_core_session_t* session, const char* eventName, const char* json, const char* bugname, int finished);
 
 struct private_data {
@@ -41,6 +46,10 @@ struct private_data {
   int  channels;
   int interim;
   unsigned int id;
+  int framed;
+  uint32_t frame_seq;
+  uint32_t latency_ms[MAX_LATENCY_SAMPLES];
+  uint32_t latency_count;
   int buffer_overrun_notified:1;
   int is_finished:1;
 };
@@ -0,0 +1,177 @@
+#include "endpoint_balancer.hpp"
+
+#include <switch.h>
+#include <sstream>
+#include <algorithm>
+
+/* weight of the newest sample in the moving average of first-response latency */
+#define LATENCY_SMOOTHING (0.2)
+
+using namespace nuance_speech;
+
+namespace {
+  std::vector<std::string> splitEndpoints(const std::string& endpoints) {
+    std::vector<std::string> targets;
+    std::stringstream ss(endpoints);
+    std::string target;
+    while (std::getline(ss, target, ',')) {
+      size_t start = target.find_first_not_of(" \t");
+      size_t end = target.find_last_not_of(" \t");
+      if (start != std::string::npos) targets.push_back(target.substr(start, end - start + 1));
+    }
+    return targets;
+  }
+}
+
+std::mutex EndpointBalancer::mutex;
+std::condition_variable EndpointBalancer::cv;
+std::thread EndpointBalancer::healthThread;
+std::map<std::string, std::shared_ptr<EndpointBalancer::Backend> > EndpointBalancer::backends;
+unsigned int EndpointBalancer::next = 0;
+unsigned int EndpointBalancer::nHealthCheckMs = 5000;
+unsigned int EndpointBalancer::nMaxFailures = 3;
+unsigned int EndpointBalancer::nEjectSecs = 30;
+bool EndpointBalancer::stopFlag = false;
+
+void EndpointBalancer::initialize(unsigned int healthCheckMs, unsigned int maxFailures, unsigned int ejectSecs) {
+  std::lock_guard<std::mutex> lk(mutex);
+  nHealthCheckMs = std::max(100U, healthCheckMs);
+  nMaxFailures = std::max(1U, maxFailures);
+  nEjectSecs = ejectSecs;
+  stopFlag = false;
+  healthThread = std::thread(&EndpointBalancer::worker);
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "EndpointBalancer::initialize health check every %u ms, eject for %u secs after %u failures\n",
+    nHealthCheckMs, nEjectSecs, nMaxFailures);
+}
+
+void EndpointBalancer::deinitialize() {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    stopFlag = true;
+  }
+  cv.notify_all();
+  if (healthThread.joinable()) healthThread.join();
+
+  std::lock_guard<std::mutex> lk(mutex);
+  for (auto& it : backends) {
+    Backend& b = *it.second;
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE,
+      "EndpointBalancer %s: %llu streams, %llu failures, %llu ejections, avg first response %.0f ms\n",
+      b.target.c_str(), (unsigned long long) b.streams, (unsigned long long) b.failures, (unsigned long long) b.ejections, b.avgLatencyMs);
+  }
+  backends.clear();
+}
+
+// called with the mutex held
+std::shared_ptr<EndpointBalancer::Backend> EndpointBalancer::getBackend(const std::string& target) {
+  auto it = backends.find(target);
+  if (it != backends.end()) return it->second;
+
+  std::shared_ptr<Backend> b = std::make_shared<Backend>();
+  b->target = target;
+  b->probe = grpc::CreateChannel(target, grpc::InsecureChannelCredentials());
+  b->active = 0;
+  b->healthy = true;
+  b->consecutiveFailures = 0;
+  b->streams = b->failures = b->ejections = 0;
+  b->avgLatencyMs = 0;
+  backends.insert(std::make_pair(target, b));
+  return b;
+}
+
+// called with the mutex held
+void EndpointBalancer::eject(Backend& backend, const char* reason) {
+  if (backend.healthy) {
+    backend.ejections++;
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "EndpointBalancer ejecting %s for %u secs: %s\n",
+      backend.target.c_str(), nEjectSecs, reason);
+  }
+  backend.healthy = false;
+  backend.ejectedUntil = Clock::now() + std::chrono::seconds(nEjectSecs);
+}
+
+std::shared_ptr<EndpointBalancer::Lease> EndpointBalancer::acquire(const std::string& endpoints) {
+  std::vector<std::string> targets = splitEndpoints(endpoints);
+  if (targets.empty()) targets.push_back(endpoints);
+
+  std::lock_guard<std::mutex> lk(mutex);
+  std::shared_ptr<Backend> best;
+  bool bestHealthy = false;
+  unsigned int start = next++;
+
+  // least outstanding streams among healthy servers, starting the scan at a rotating offset to break ties
+  for (size_t i = 0; i < targets.size(); i++) {
+    std::shared_ptr<Backend> b = getBackend(targets[(start + i) % targets.size()]);
+    if (!best || (b->healthy && !bestHealthy) || (b->healthy == bestHealthy && b->active < best->active)) {
+      best = b;
+      bestHealthy = b->healthy;
+    }
+  }
+  if (!bestHealthy && targets.size() > 1) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "EndpointBalancer all of %s are ejected, using %s\n",
+      endpoints.c_str(), best->target.c_str());
+  }
+  best->active++;
+  best->streams++;
+  return std::make_shared<Lease>(best);
+}
+
+EndpointBalancer::Lease::~Lease() {
+  m_backend->active--;
+}
+
+void EndpointBalancer::Lease::recordLatency(unsigned int ms) {
+  std::lock_guard<std::mutex> lk(mutex);
+  Backend& b = *m_backend;
+  b.avgLatencyMs = 0 == b.avgLatencyMs ? ms : (1 - LATENCY_SMOOTHING) * b.avgLatencyMs + LATENCY_SMOOTHING * ms;
+}
+
+void EndpointBalancer::Lease::complete(bool ok) {
+  std::lock_guard<std::mutex> lk(mutex);
+  if (m_completed) return;
+  m_completed = true;
+
+  Backend& b = *m_backend;
+  if (ok) {
+    b.consecutiveFailures = 0;
+    return;
+  }
+  b.failures++;
+  if (++b.consecutiveFailures >= nMaxFailures) eject(b, "consecutive stream failures");
+}
+
+void EndpointBalancer::getStats(std::vector<BackendStats>& out) {
+  std::lock_guard<std::mutex> lk(mutex);
+  out.clear();
+  for (auto& it : backends) {
+    Backend& b = *it.second;
+    BackendStats s = {b.target, b.healthy, b.active, b.streams, b.failures, b.ejections, b.avgLatencyMs};
+    out.push_back(s);
+  }
+}
+
+void EndpointBalancer::worker() {
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "EndpointBalancer::worker starting\n");
+  std::unique_lock<std::mutex> lk(mutex);
+  while (!stopFlag) {
+    cv.wait_for(lk, std::chrono::milliseconds(nHealthCheckMs));
+    if (stopFlag) break;
+
+    auto now = Clock::now();
+    for (auto& it : backends) {
+      Backend& b = *it.second;
+
+      // asking for the state also makes an idle channel try to connect
+      grpc_connectivity_state state = b.probe->GetState(true);
+      if (GRPC_CHANNEL_TRANSIENT_FAILURE == state || GRPC_CHANNEL_SHUTDOWN == state) {
+        eject(b, "connection failed");
+      }
+      else if (!b.healthy && now >= b.ejectedUntil && GRPC_CHANNEL_READY == state) {
+        b.healthy = true;
+        b.consecutiveFailures = 0;
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "EndpointBalancer re-admitting %s\n", b.target.c_str());
+      }
+    }
+  }
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "EndpointBalancer::worker ending\n");
+}
@@ -128,9 +128,17 @@ static switch_status_t start_capture(switch_core_session_t *session, switch_medi
 	/* required channel vars */
 	var = switch_channel_get_variable(channel, "NUANCE_KRYPTON_ENDPOINT");
 
-  if (!var && !switch_channel_get_variable(channel, "NUANCE_ACCESS_TOKEN")) {
+  if (!var && !switch_channel_get_variable(channel, "NUANCE_ACCESS_TOKEN") &&
+		!switch_channel_get_variable(channel, "NUANCE_CLIENT_ID") && !getenv("NUANCE_CLIENT_ID")) {
 		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, 
-			"either NUANCE_ACCESS_TOKEN or NUANCE_KRYPTON_ENDPOINT channel var must be defined\n");
+			"either NUANCE_ACCESS_TOKEN, NUANCE_CLIENT_ID or NUANCE_KRYPTON_ENDPOINT channel var must be defined\n");
+		return SWITCH_STATUS_FALSE;
+	}
+	/* a client id is only exchanged for a token together with its secret */
+	if (!var && !switch_channel_get_variable(channel, "NUANCE_ACCESS_TOKEN") &&
+		!switch_channel_get_variable(channel, "NUANCE_CLIENT_SECRET") && !getenv("NUANCE_CLIENT_SECRET")) {
+		switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, 
+			"NUANCE_CLIENT_SECRET channel var or env var must be defined along with NUANCE_CLIENT_ID\n");
 		return SWITCH_STATUS_FALSE;
 	}
 
@@ -213,6 +221,19 @@ SWITCH_STANDARD_API(transcribe_function)
 	return SWITCH_STATUS_SUCCESS;
 }
 
+SWITCH_STANDARD_API(backends_function)
+{
+	char *json = nuance_speech_backend_stats();
+	if (json) {
+		stream->write_function(stream, "%s\n", json);
+		free(json);
+	}
+	else {
+		stream->write_function(stream, "-ERR Operation Failed\n");
+	}
+	return SWITCH_STATUS_SUCCESS;
+}
+
 SWITCH_MODULE_LOAD_FUNCTION(mod_transcribe_load)
 {
 	switch_api_interface_t *api_interface;
@@ -251,6 +272,8 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_transcribe_load)
 	switch_console_set_complete("add uuid_nuance_transcribe start lang-code");
 	switch_console_set_complete("add uuid_nuance_transcribe stop ");
 
+	SWITCH_ADD_API(api_interface, "nuance_transcribe_backends", "Nuance Speech Transcription API", backends_function, "");
+
 	/* indicate that the module should continue to be loaded */
 	return SWITCH_STATUS_SUCCESS;
 }
@@ -29,7 +29,6 @@ struct cap_cb {
   SpeexResamplerState *resampler;
 	void* streamer;
 	responseHandler_t responseHandler;
-	switch_thread_t* thread;
 	int end_of_utterance;
 	switch_vad_t * vad;
 	uint32_t samples_per_second;
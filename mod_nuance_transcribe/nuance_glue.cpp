@@ -17,6 +17,11 @@
 
 #include "mod_nuance_transcribe.h"
 #include "simple_buffer.h"
+#include "channel_registry.hpp"
+#include "grpc_engine.hpp"
+#include "endpoint_balancer.hpp"
+#include "config_cache.hpp"
+#include "token_broker.hpp"
 
 using nuance::asr::v1::Recognizer;
 using nuance::asr::v1::RecognitionRequest;
@@ -34,8 +39,39 @@ using nuance::asr::v1::Hypothesis;
 
 
 #define CHUNKSIZE (320)
+#define DEFAULT_MIX_TOKEN_URL "https://auth.crt.nuance.com/oauth2/token"
+#define DEFAULT_MIX_SCOPE "asr"
 
 namespace {
+  static const char *requestedGrpcSubchannels = std::getenv("MOD_TRANSCRIBE_GRPC_SUBCHANNELS");
+  static unsigned int nGrpcSubchannels = std::max(1, requestedGrpcSubchannels ? ::atoi(requestedGrpcSubchannels) : 2);
+  static const char *requestedGrpcMaxStreams = std::getenv("MOD_TRANSCRIBE_GRPC_MAX_STREAMS_PER_CHANNEL");
+  static unsigned int nGrpcMaxStreamsPerChannel = std::max(1, requestedGrpcMaxStreams ? ::atoi(requestedGrpcMaxStreams) : 100);
+  static const char *requestedGrpcKeepaliveMs = std::getenv("MOD_TRANSCRIBE_GRPC_KEEPALIVE_MS");
+  static unsigned int nGrpcKeepaliveMs = std::max(0, requestedGrpcKeepaliveMs ? ::atoi(requestedGrpcKeepaliveMs) : 30000);
+  static const char *requestedGrpcThreads = std::getenv("MOD_TRANSCRIBE_GRPC_THREADS");
+  static unsigned int nGrpcThreads = std::max(1, requestedGrpcThreads ? ::atoi(requestedGrpcThreads) : 2);
+  static const char *requestedGrpcMaxQueuedFrames = std::getenv("MOD_TRANSCRIBE_GRPC_MAX_QUEUED_FRAMES");
+  static unsigned int nGrpcMaxQueuedFrames = std::max(1, requestedGrpcMaxQueuedFrames ? ::atoi(requestedGrpcMaxQueuedFrames) : 250);
+  static const char *requestedTeardownTimeoutMs = std::getenv("MOD_TRANSCRIBE_TEARDOWN_TIMEOUT_MS");
+  static unsigned int nTeardownTimeoutMs = std::max(100, requestedTeardownTimeoutMs ? ::atoi(requestedTeardownTimeoutMs) : 5000);
+  static const char *requestedHealthCheckMs = std::getenv("MOD_TRANSCRIBE_HEALTH_CHECK_MS");
+  static unsigned int nHealthCheckMs = std::max(100, requestedHealthCheckMs ? ::atoi(requestedHealthCheckMs) : 5000);
+  static const char *requestedEjectFailures = std::getenv("MOD_TRANSCRIBE_EJECT_FAILURES");
+  static unsigned int nEjectFailures = std::max(1, requestedEjectFailures ? ::atoi(requestedEjectFailures) : 3);
+  static const char *requestedEjectSecs = std::getenv("MOD_TRANSCRIBE_EJECT_SECS");
+  static unsigned int nEjectSecs = std::max(0, requestedEjectSecs ? ::atoi(requestedEjectSecs) : 30);
+  static const char *requestedConfigCacheSize = std::getenv("MOD_TRANSCRIBE_CONFIG_CACHE_SIZE");
+  static unsigned int nConfigCacheSize = std::max(0, requestedConfigCacheSize ? ::atoi(requestedConfigCacheSize) : 100);
+  static nuance_speech::ConfigCache<RecognitionInitMessage> resourcesCache(nConfigCacheSize);
+  static const char *requestedKryptonMaxStreams = std::getenv("NUANCE_KRYPTON_MAX_STREAMS_PER_CHANNEL");
+  static unsigned int nKryptonMaxStreamsPerChannel = std::max(1, requestedKryptonMaxStreams ? ::atoi(requestedKryptonMaxStreams) : 1);
+  static const char *requestedMixTokenUrl = std::getenv("NUANCE_TOKEN_URL");
+  static const char *requestedMixRefreshSecs = std::getenv("NUANCE_TOKEN_REFRESH_SECS");
+  static unsigned int nMixRefreshSecs = std::max(30, std::min(requestedMixRefreshSecs ? ::atoi(requestedMixRefreshSecs) : 120, 1800));
+  static const char *requestedMixWaitMs = std::getenv("NUANCE_TOKEN_WAIT_MS");
+  static unsigned int nMixWaitMs = std::max(0, std::min(requestedMixWaitMs ? ::atoi(requestedMixWaitMs) : 3000, 10000));
+
   int case_insensitive_match(std::string s1, std::string s2) {
    std::transform(s1.begin(), s1.end(), s1.begin(), ::tolower);
    std::transform(s2.begin(), s2.end(), s2.begin(), ::tolower);
@@ -45,16 +81,21 @@ namespace {
   }
 }
 
+static void grpc_on_response(struct cap_cb *cb, RecognitionResponse& response);
+static void grpc_on_finish(struct cap_cb *cb, const grpc::Status& status);
+
 class GStreamer {
 public:
 	GStreamer(
-    switch_core_session_t *session, uint32_t channels, char* lang, int interim) : 
+    switch_core_session_t *session, struct cap_cb *cb, uint32_t channels, char* lang, int interim) : 
       m_session(session), 
-      m_writesDone(false), 
+      m_cb(cb),
       m_connected(false), 
       m_language(lang),
       m_interim(interim),
-      m_audioBuffer(CHUNKSIZE, 15) {
+      m_audioBuffer(CHUNKSIZE, 15),
+      m_stream(nGrpcMaxQueuedFrames),
+      m_gotResponse(false) {
   
     const char* var;
     char sessionId[256];
@@ -67,42 +108,49 @@ public:
 		//switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_INFO, "GStreamer::~GStreamer - deleting channel and stub: %p\n", (void*)this);
 	}
 
-  std::shared_ptr<grpc::Channel> createUniqueChannel(const std::string& target) {
-    grpc::ChannelArguments channelArgs;
-
-    // Generate a unique value for the custom argument
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(1, 1000000);
-    std::string uniqueArgValue = "unique_value_" + std::to_string(dis(gen));
-
-    // Set a custom channel argument with the unique value
-    channelArgs.SetString("unique_custom_arg", uniqueArgValue);
-
-    return grpc::CreateCustomChannel(target, grpc::InsecureChannelCredentials(), channelArgs);
-  }
-
   void createInitMessage() {
     switch_channel_t *channel = switch_core_session_get_channel(m_session);
 
     std::shared_ptr<grpc::Channel> grpcChannel ;
     const char* var = switch_channel_get_variable(channel, "NUANCE_KRYPTON_ENDPOINT");
+    if (var && strchr(var, ',')) {
+      // a list of servers: use the one with the fewest outstanding streams
+      m_lease = nuance_speech::EndpointBalancer::acquire(var);
+      var = m_lease->target().c_str();
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p using krypton server %s\n", this, var);
+    }
     if (var) {
-      //auto channelCreds = grpc::SslCredentials(grpc::SslCredentialsOptions());
-      //grpcChannel = grpc::CreateChannel(var, channelCreds);
-      // grpcChannel = grpc::CreateChannel(var, grpc::InsecureChannelCredentials());
-      // Hosted Krypton endpoint does not allow different grpc thread re-use same tcp connection.
-      // Use custom grpc channel to force grpc c/c++ lib open new tcp connection.
-      grpcChannel = createUniqueChannel(var);
+      // Hosted Krypton endpoint does not allow different grpc thread re-use same tcp connection
+      // for concurrent streams, so by default each subchannel carries one stream at a time.
+      grpcChannel = nuance_speech::ChannelRegistry::getChannel(var, "insecure", [] {
+        return grpc::InsecureChannelCredentials();
+      }, nKryptonMaxStreamsPerChannel);
     }
     else {
-      var = switch_channel_get_variable(channel, "NUANCE_ACCESS_TOKEN");
-      assert(var); // we should not get here unless we have a valid access token
-
-      auto channelCreds = grpc::SslCredentials(grpc::SslCredentialsOptions());
-      auto callCreds = grpc::AccessTokenCredentials(var);
-      auto creds = grpc::CompositeChannelCredentials(channelCreds, callCreds);
-      grpcChannel = grpc::CreateChannel("asr.api.nuance.com:443", creds);
+      // the token is attached per call so that sessions with different tokens can share the channel
+      grpcChannel = nuance_speech::ChannelRegistry::getChannel("asr.api.nuance.com:443", "ssl", [] {
+        return grpc::SslCredentials(grpc::SslCredentialsOptions());
+      });
+      var = "asr.api.nuance.com:443";
+
+      const char* accessToken = switch_channel_get_variable(channel, "NUANCE_ACCESS_TOKEN");
+      if (accessToken) {
+        m_stream.context().set_credentials(grpc::AccessTokenCredentials(accessToken));
+      }
+      else {
+        // shared credentials that attach a token cached by the broker, so the session does not wait on the token service
+        const char* clientId = switch_channel_get_variable(channel, "NUANCE_CLIENT_ID");
+        const char* clientSecret = switch_channel_get_variable(channel, "NUANCE_CLIENT_SECRET");
+        const char* scope = switch_channel_get_variable(channel, "NUANCE_SCOPE");
+        if (!clientId) clientId = std::getenv("NUANCE_CLIENT_ID");
+        if (!clientSecret) clientSecret = std::getenv("NUANCE_CLIENT_SECRET");
+        assert(clientId && clientSecret); // we should not get here unless we have an access token or a client id and secret
+
+        auto credentials = nuance_speech::TokenBroker::getCallCredentials(clientId, clientSecret,
+          scope ? scope : DEFAULT_MIX_SCOPE);
+        if (!credentials) throw std::runtime_error("Error creating Mix call credentials");
+        m_stream.context().set_credentials(credentials);
+      }
     }
 
     if (!grpcChannel) {
@@ -263,104 +311,107 @@ public:
 
     msg->clear_resources();
     if (var = switch_channel_get_variable(channel, "NUANCE_RESOURCES")) {
-      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p setting resources %s\n", this, var);	
-      cJSON* json = cJSON_Parse(var);
-      if (json) {
-        if (cJSON_IsArray(json)) {
-          int count = cJSON_GetArraySize(json);
-          for (int i = 0; i < count; i++) {
-            cJSON* obj = cJSON_GetArrayItem(json, i);
-            if (obj && cJSON_IsObject(obj)) {
-              bool added = false;
-
-              /* inline wordset */
-              cJSON* cInlineWordSet = cJSON_GetObjectItem(obj, "inlineWordset");
-              if (cInlineWordSet && cJSON_IsString(cInlineWordSet)) {
-                const char* inlineWordSet = cJSON_GetStringValue(cInlineWordSet);
-                cJSON* test = cJSON_Parse(inlineWordSet);
-                if (test) {
+      bool hit = resourcesCache.merge(var, msg, [&](RecognitionInitMessage* msg) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p setting resources %s\n", this, var);	
+        cJSON* json = cJSON_Parse(var);
+        if (json) {
+          if (cJSON_IsArray(json)) {
+            int count = cJSON_GetArraySize(json);
+            for (int i = 0; i < count; i++) {
+              cJSON* obj = cJSON_GetArrayItem(json, i);
+              if (obj && cJSON_IsObject(obj)) {
+                bool added = false;
+
+                /* inline wordset */
+                cJSON* cInlineWordSet = cJSON_GetObjectItem(obj, "inlineWordset");
+                if (cInlineWordSet && cJSON_IsString(cInlineWordSet)) {
+                  const char* inlineWordSet = cJSON_GetStringValue(cInlineWordSet);
+                  cJSON* test = cJSON_Parse(inlineWordSet);
+                  if (test) {
+                    added = true;
+                    auto resource = msg->add_resources();
+                    resource->set_inline_wordset(inlineWordSet);
+                    cJSON_Delete(test);
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p adding inlineWordset: %s\n", this, inlineWordSet);	
+                  }
+                  else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "GStreamer %p an inline wordset must be valid JSON: '%s' is not.\n", this, inlineWordSet);
+                  }
+                }
+
+                /* builtins */
+                cJSON* cBuiltin = cJSON_GetObjectItem(obj, "builtin");
+                if (cBuiltin && cJSON_IsString(cBuiltin)) {
+                  const char* builtin = cJSON_GetStringValue(cBuiltin);
                   added = true;
                   auto resource = msg->add_resources();
-                  resource->set_inline_wordset(inlineWordSet);
-                  cJSON_Delete(test);
-                  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p adding inlineWordset: %s\n", this, inlineWordSet);	
+                  resource->set_builtin(builtin);
+                  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p adding builtin: %s\n", this, builtin);	
                 }
-                else {
-                  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "GStreamer %p an inline wordset must be valid JSON: '%s' is not.\n", this, inlineWordSet);
-                }
-              }
 
-              /* builtins */
-              cJSON* cBuiltin = cJSON_GetObjectItem(obj, "builtin");
-              if (cBuiltin && cJSON_IsString(cBuiltin)) {
-                const char* builtin = cJSON_GetStringValue(cBuiltin);
-                added = true;
-                auto resource = msg->add_resources();
-                resource->set_builtin(builtin);
-                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p adding builtin: %s\n", this, builtin);	
-              }
-
-              if (added) {
-                auto idx = msg->resources_size() - 1;
-                auto resource = msg->mutable_resources(idx);
-                cJSON* cReuse = cJSON_GetObjectItem(obj, "reuse");
-                if (cReuse && cJSON_IsString(cReuse)) {
-                  const char* reuse = cJSON_GetStringValue(cReuse);
-                  if (0 == strcmp(reuse, "low_reuse")) {
-                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p reuse to: %s\n", this, reuse);	
-                    resource->set_reuse(EnumResourceReuse::LOW_REUSE);
-                  }
-                  else if (0 == strcmp(reuse, "high_reuse")) {
-                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p reuse to: %s\n", this, reuse);	
-                    resource->set_reuse(EnumResourceReuse::HIGH_REUSE);
+                if (added) {
+                  auto idx = msg->resources_size() - 1;
+                  auto resource = msg->mutable_resources(idx);
+                  cJSON* cReuse = cJSON_GetObjectItem(obj, "reuse");
+                  if (cReuse && cJSON_IsString(cReuse)) {
+                    const char* reuse = cJSON_GetStringValue(cReuse);
+                    if (0 == strcmp(reuse, "low_reuse")) {
+                      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p reuse to: %s\n", this, reuse);	
+                      resource->set_reuse(EnumResourceReuse::LOW_REUSE);
+                    }
+                    else if (0 == strcmp(reuse, "high_reuse")) {
+                      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p reuse to: %s\n", this, reuse);	
+                      resource->set_reuse(EnumResourceReuse::HIGH_REUSE);
+                    }
                   }
-                }
 
-                cJSON* cWeightName = cJSON_GetObjectItem(obj, "weightName");
-                if (cWeightName && cJSON_IsString(cWeightName)) {
-                  const char* weightName = cJSON_GetStringValue(cWeightName);
-                  if (0 == strcmp(weightName, "defaultWeight")) {
-                    resource->set_weight_enum(EnumWeight::DEFAULT_WEIGHT);
-                  }
-                  else if (0 == strcmp(weightName, "lowest")) {
-                    resource->set_weight_enum(EnumWeight::LOWEST);                  
-                  }
-                  else if (0 == strcmp(weightName, "low")) {
-                    resource->set_weight_enum(EnumWeight::LOW);
-                  }
-                  else if (0 == strcmp(weightName, "medium")) {
-                    resource->set_weight_enum(EnumWeight::MEDIUM);
+                  cJSON* cWeightName = cJSON_GetObjectItem(obj, "weightName");
+                  if (cWeightName && cJSON_IsString(cWeightName)) {
+                    const char* weightName = cJSON_GetStringValue(cWeightName);
+                    if (0 == strcmp(weightName, "defaultWeight")) {
+                      resource->set_weight_enum(EnumWeight::DEFAULT_WEIGHT);
+                    }
+                    else if (0 == strcmp(weightName, "lowest")) {
+                      resource->set_weight_enum(EnumWeight::LOWEST);                  
+                    }
+                    else if (0 == strcmp(weightName, "low")) {
+                      resource->set_weight_enum(EnumWeight::LOW);
+                    }
+                    else if (0 == strcmp(weightName, "medium")) {
+                      resource->set_weight_enum(EnumWeight::MEDIUM);
                     
-                  }
-                  else if (0 == strcmp(weightName, "high")) {
-                    resource->set_weight_enum(EnumWeight::HIGH);
+                    }
+                    else if (0 == strcmp(weightName, "high")) {
+                      resource->set_weight_enum(EnumWeight::HIGH);
                     
-                  }
-                  else if (0 == strcmp(weightName, "highest")) {
-                    resource->set_weight_enum(EnumWeight::HIGHEST);
+                    }
+                    else if (0 == strcmp(weightName, "highest")) {
+                      resource->set_weight_enum(EnumWeight::HIGHEST);
                     
+                    }
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p weightName to: %s\n", this, weightName);	
                   }
-                  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p weightName to: %s\n", this, weightName);	
-                }
 
-                cJSON* cWeightValue = cJSON_GetObjectItem(obj, "weightValue");
-                if (cWeightValue && cJSON_IsNumber(cWeightValue)) {
-                  double weightValue = cWeightValue->valuedouble;
-                  resource->set_weight_value(weightValue);
-                  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p weightName to: %.2f\n", this, weightValue);	
+                  cJSON* cWeightValue = cJSON_GetObjectItem(obj, "weightValue");
+                  if (cWeightValue && cJSON_IsNumber(cWeightValue)) {
+                    double weightValue = cWeightValue->valuedouble;
+                    resource->set_weight_value(weightValue);
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p weightName to: %.2f\n", this, weightValue);	
+                  }
                 }
               }
             }
           }
+          else {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "GStreamer %p resources must be an array: %s\n", this, var);
+          }
+          cJSON_Delete(json);
         }
         else {
-          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "GStreamer %p resources must be an array: %s\n", this, var);
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "GStreamer %p invalid resources json: %s\n", this, var);
         }
-        cJSON_Delete(json);
-      }
-      else {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "GStreamer %p invalid resources json: %s\n", this, var);
-      }
+      });
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p resources %s\n", this, hit ? "found in cache" : "built");
     }    
   }
 
@@ -371,16 +422,20 @@ public:
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p creating initial nuance message\n", this);	
     createInitMessage();
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p creating streamer\n", this);	
-  	m_streamer = m_stub->Recognize(&m_context);
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p connected to nuance\n", this);	
+    struct cap_cb *cb = m_cb;
+    m_startedAt = std::chrono::steady_clock::now();
+    bool started = m_stream.start([this](grpc::ClientContext* context, grpc::CompletionQueue* cq) {
+        return m_stub->PrepareAsyncRecognize(context, cq);
+      },
+      m_request,  // the first request contains the config only
+      [cb](RecognitionResponse& response) { grpc_on_response(cb, response); },
+      [cb](const grpc::Status& status) { grpc_on_finish(cb, status); });
+    if (!started) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "GStreamer %p could not start a stream, the grpc engine is not running\n", this);
+      return;
+    }
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p connecting to nuance\n", this);	
     m_connected = true;
-
-    // read thread is waiting on this
-    m_promise.set_value();
-
-  	// Write the first request, containing the config only.
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p sending initial message\n", this);	
-  	m_streamer->Write(m_request);
     //m_request.clear_recognition_init_message();
 
     // send any buffered audio
@@ -404,201 +459,233 @@ public:
       }
       return true;
     }
-    m_request.clear_audio();
-    m_request.set_audio(data, datalen);
-    bool ok = m_streamer->Write(m_request);
-    return ok;
+    auto request = m_stream.acquire();
+    request.set_audio(data, datalen);
+    return m_stream.write(std::move(request));
   }
 
-	uint32_t nextMessageSize(void) {
-		uint32_t size = 0;
-		m_streamer->NextMessageSize(&size);
-		return size;
-	}
-
-	bool read(RecognitionResponse* response) {
-		return m_streamer->Read(response);
-	}
-
-	grpc::Status finish() {
-		return m_streamer->Finish();
-	}
-
   void startTimers() {
     RecognitionRequest request;
     auto msg = request.mutable_control_message()->mutable_start_timers_message();
-    m_streamer->Write(request);
+    m_stream.write(request);
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p sent start timers control message\n", this);	
   }
 
 	void writesDone() {
-    // grpc crashes if we call this twice on a stream
-    if (!m_connected) {
-      cancelConnect();
-    }
-    else if (!m_writesDone) {
-      m_streamer->WritesDone();
-      m_writesDone = true;
-    }
+    m_stream.writesDone();
 	}
 
-  bool waitForConnect() {
-    std::shared_future<void> sf(m_promise.get_future());
-    sf.wait();
+  bool waitForFinish() {
+    bool ok = m_stream.waitForFinish(nTeardownTimeoutMs);
+    if (m_stream.getDropped() > 0) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "GStreamer %p dropped %u audio frames the network could not keep up with\n",
+        this, m_stream.getDropped());
+    }
+    return ok;
+  }
+
+  bool isConnected() {
     return m_connected;
   }
 
-  void cancelConnect() {
-    assert(!m_connected);
-    m_promise.set_value();
+  // first response latency and outcome of the stream, reported when spreading streams over a list of servers
+  void noteResponse() {
+    if (m_lease && !m_gotResponse) {
+      m_gotResponse = true;
+      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_startedAt).count();
+      m_lease->recordLatency((unsigned int) ms);
+    }
   }
 
-  bool isConnected() {
-    return m_connected;
+  void noteFinish(const grpc::Status& status) {
+    if (m_lease) {
+      auto code = status.error_code();
+      m_lease->complete(code != grpc::StatusCode::UNAVAILABLE && code != grpc::StatusCode::DEADLINE_EXCEEDED &&
+        code != grpc::StatusCode::RESOURCE_EXHAUSTED && code != grpc::StatusCode::INTERNAL);
+    }
   }
 
 private:
 	switch_core_session_t* m_session;
-  grpc::ClientContext m_context;
+  struct cap_cb *m_cb;
 	std::shared_ptr<grpc::Channel> m_channel;
 	std::unique_ptr<Recognizer::Stub> m_stub;
   RecognitionInitMessage m_msg;
   RecognitionRequest m_request;
-	std::unique_ptr< grpc::ClientReaderWriterInterface<RecognitionRequest, RecognitionResponse> > m_streamer;
-  bool m_writesDone;
   bool m_connected;
   bool m_interim;
   std::string m_language;
-  std::promise<void> m_promise;
   SimpleBuffer m_audioBuffer;
+  nuance_speech::AsyncStream<RecognitionRequest, RecognitionResponse> m_stream;
+  std::shared_ptr<nuance_speech::EndpointBalancer::Lease> m_lease;
+  std::chrono::steady_clock::time_point m_startedAt;
+  bool m_gotResponse;
   char m_sessionId[256];
 };
 
-static void *SWITCH_THREAD_FUNC grpc_read_thread(switch_thread_t *thread, void *obj) {
-  static int count;
-	struct cap_cb *cb = (struct cap_cb *) obj;
-	GStreamer* streamer = (GStreamer *) cb->streamer;
-
-  bool connected = streamer->waitForConnect();
-  if (!connected) {
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "nuance transcribe grpc read thread exiting since we didnt connect\n") ;
-    return nullptr;
-  }
+static void grpc_on_response(struct cap_cb *cb, RecognitionResponse& response) {
+  static std::atomic<int> count;
+  GStreamer* streamer = (GStreamer *) cb->streamer;
+  if (streamer) streamer->noteResponse();
 
-  // Read responses.
-  RecognitionResponse response;
-  while (streamer->read(&response)) {  // Returns false when no more to read.
-    count++;
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "response counter:  %d\n",count) ;
+  count++;
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "response counter:  %d\n",count.load()) ;
 
-    switch_core_session_t* session = switch_core_session_locate(cb->sessionId);
-    if (!session) {
-      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "grpc_read_thread: session %s is gone!\n", cb->sessionId) ;
-      return nullptr;
-    }
+  switch_core_session_t* session = switch_core_session_locate(cb->sessionId);
+  if (!session) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "grpc_on_response: session %s is gone!\n", cb->sessionId) ;
+    return;
+  }
 
-    // 3 types of responses: status, start of speech, result
-    bool processed = false;
-    if (response.has_status()) {
-      processed = true;
-      Status status = response.status();
-      uint32_t code = status.code();
-      if (code <= 200) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p got status code %d\n", streamer, code);
-        if (code == 200) {
-          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "GStreamer %p transcription complete\n", streamer);
-          cb->responseHandler(session, "end_of_transcription", cb->bugname, NULL);
-        }
-      }
-      else {
-        auto message = status.message();
-        auto details = status.details();
-        cJSON* jError = cJSON_CreateObject();
-        cJSON_AddStringToObject(jError, "type", "error");
-        cJSON_AddNumberToObject(jError, "code", code);
-        cJSON_AddStringToObject(jError, "error", status.message().c_str());
-        cJSON_AddStringToObject(jError, "details", status.details().c_str());        
-        char* error = cJSON_PrintUnformatted(jError);
-
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "GStreamer %p got non-success code %d - %s : %s\n", streamer, code, message.c_str(), details.c_str());
-        cb->responseHandler(session, "error", cb->bugname, error);
-
-        free(error);
-        cJSON_Delete(jError);
+  // 3 types of responses: status, start of speech, result
+  bool processed = false;
+  if (response.has_status()) {
+    processed = true;
+    Status status = response.status();
+    uint32_t code = status.code();
+    if (code <= 200) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p got status code %d\n", streamer, code);
+      if (code == 200) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "GStreamer %p transcription complete\n", streamer);
+        cb->responseHandler(session, "end_of_transcription", cb->bugname, NULL);
       }
     }
-    if (response.has_start_of_speech()) {
-        processed = true;
-        auto start_of_speech = response.start_of_speech();
-        auto first_audio_to_start_of_speech_ms = start_of_speech.first_audio_to_start_of_speech_ms();
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "GStreamer %p got start of speech %d\n", streamer, first_audio_to_start_of_speech_ms);	
-        cb->responseHandler(session, "start_of_speech", cb->bugname, NULL);
+    else {
+      auto message = status.message();
+      auto details = status.details();
+      cJSON* jError = cJSON_CreateObject();
+      cJSON_AddStringToObject(jError, "type", "error");
+      cJSON_AddNumberToObject(jError, "code", code);
+      cJSON_AddStringToObject(jError, "error", status.message().c_str());
+      cJSON_AddStringToObject(jError, "details", status.details().c_str());        
+      char* error = cJSON_PrintUnformatted(jError);
+
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "GStreamer %p got non-success code %d - %s : %s\n", streamer, code, message.c_str(), details.c_str());
+      cb->responseHandler(session, "error", cb->bugname, error);
+
+      free(error);
+      cJSON_Delete(jError);
     }
-    if (response.has_result()){
+  }
+  if (response.has_start_of_speech()) {
       processed = true;
-      const Result& result = response.result();
-      EnumResultType type = result.result_type();
-      bool is_final = type == EnumResultType::FINAL;
-      int nAlternatives = result.hypotheses_size();
-
-      cJSON * jResult = cJSON_CreateObject();
-      cJSON * jAlternatives = cJSON_CreateArray();
-      cJSON * jIsFinal = cJSON_CreateBool(is_final);
-
-      cJSON_AddItemToObject(jResult, "is_final", jIsFinal);
-      cJSON_AddItemToObject(jResult, "alternatives", jAlternatives);
-
-      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p got a %s result with %d hypotheses\n", streamer, is_final ? "final" : "interim", nAlternatives);	
-      for (int i = 0; i < nAlternatives; i++) {
-        auto hypothesis = result.hypotheses(i);
-        auto formatted_text = hypothesis.formatted_text();
-        auto minimally_formatted_text = hypothesis.minimally_formatted_text();
-        auto encrypted_tokenization = hypothesis.encrypted_tokenization();
-        auto average_confidence = hypothesis.average_confidence();
-        auto rejected = hypothesis.rejected();
-        auto grammar_id = hypothesis.grammar_id();
-
-        cJSON* jAlt = cJSON_CreateObject();
-        cJSON* jConfidence = cJSON_CreateNumber(hypothesis.confidence());
-        cJSON* jAverageConfidence = cJSON_CreateNumber(hypothesis.average_confidence());
-        cJSON* jTranscript = cJSON_CreateString(hypothesis.formatted_text().c_str());
-        cJSON* jMinimallyFormattedText = cJSON_CreateString(hypothesis.minimally_formatted_text().c_str());
-        cJSON* jEncryptedTokenization = cJSON_CreateString(hypothesis.encrypted_tokenization().c_str());
-        if (hypothesis.has_grammar_id()) {
-          cJSON* jGrammarId = cJSON_CreateString(hypothesis.grammar_id().c_str());
-          cJSON_AddItemToObject(jAlt, "grammar_id", jGrammarId);
-        }
-        cJSON* jRejected = cJSON_CreateBool(hypothesis.rejected());
-        if (hypothesis.has_detected_wakeup_word()) {
-          cJSON* jDetectedWakeupWord = cJSON_CreateString(hypothesis.detected_wakeup_word().c_str());
-          cJSON_AddItemToObject(jAlt, "detectedWakeupWord", jDetectedWakeupWord);
-        }
-
-        cJSON_AddItemToObject(jAlt, "confidence", jConfidence);
-        cJSON_AddItemToObject(jAlt, "averageConfidence", jAverageConfidence);
-        cJSON_AddItemToObject(jAlt, "transcript", jTranscript);
-        cJSON_AddItemToObject(jAlt, "rejected", jRejected);
-        cJSON_AddItemToObject(jAlt, "minimallyFormattedText", jMinimallyFormattedText);
-        if (!encrypted_tokenization.empty()) cJSON_AddItemToObject(jAlt, "encryptedTokenization", jEncryptedTokenization);
-        cJSON_AddItemToArray(jAlternatives, jAlt);
+      auto start_of_speech = response.start_of_speech();
+      auto first_audio_to_start_of_speech_ms = start_of_speech.first_audio_to_start_of_speech_ms();
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "GStreamer %p got start of speech %d\n", streamer, first_audio_to_start_of_speech_ms);	
+      cb->responseHandler(session, "start_of_speech", cb->bugname, NULL);
+  }
+  if (response.has_result()){
+    processed = true;
+    const Result& result = response.result();
+    EnumResultType type = result.result_type();
+    bool is_final = type == EnumResultType::FINAL;
+    int nAlternatives = result.hypotheses_size();
+
+    cJSON * jResult = cJSON_CreateObject();
+    cJSON * jAlternatives = cJSON_CreateArray();
+    cJSON * jIsFinal = cJSON_CreateBool(is_final);
+
+    cJSON_AddItemToObject(jResult, "is_final", jIsFinal);
+    cJSON_AddItemToObject(jResult, "alternatives", jAlternatives);
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p got a %s result with %d hypotheses\n", streamer, is_final ? "final" : "interim", nAlternatives);	
+    for (int i = 0; i < nAlternatives; i++) {
+      auto hypothesis = result.hypotheses(i);
+      auto formatted_text = hypothesis.formatted_text();
+      auto minimally_formatted_text = hypothesis.minimally_formatted_text();
+      auto encrypted_tokenization = hypothesis.encrypted_tokenization();
+      auto average_confidence = hypothesis.average_confidence();
+      auto rejected = hypothesis.rejected();
+      auto grammar_id = hypothesis.grammar_id();
+
+      cJSON* jAlt = cJSON_CreateObject();
+      cJSON* jConfidence = cJSON_CreateNumber(hypothesis.confidence());
+      cJSON* jAverageConfidence = cJSON_CreateNumber(hypothesis.average_confidence());
+      cJSON* jTranscript = cJSON_CreateString(hypothesis.formatted_text().c_str());
+      cJSON* jMinimallyFormattedText = cJSON_CreateString(hypothesis.minimally_formatted_text().c_str());
+      cJSON* jEncryptedTokenization = cJSON_CreateString(hypothesis.encrypted_tokenization().c_str());
+      if (hypothesis.has_grammar_id()) {
+        cJSON* jGrammarId = cJSON_CreateString(hypothesis.grammar_id().c_str());
+        cJSON_AddItemToObject(jAlt, "grammar_id", jGrammarId);
+      }
+      cJSON* jRejected = cJSON_CreateBool(hypothesis.rejected());
+      if (hypothesis.has_detected_wakeup_word()) {
+        cJSON* jDetectedWakeupWord = cJSON_CreateString(hypothesis.detected_wakeup_word().c_str());
+        cJSON_AddItemToObject(jAlt, "detectedWakeupWord", jDetectedWakeupWord);
       }
-      char* json = cJSON_PrintUnformatted(jResult);
-      cb->responseHandler(session, (const char *) json, cb->bugname, NULL);
-      free(json);
 
-      cJSON_Delete(jResult);
+      cJSON_AddItemToObject(jAlt, "confidence", jConfidence);
+      cJSON_AddItemToObject(jAlt, "averageConfidence", jAverageConfidence);
+      cJSON_AddItemToObject(jAlt, "transcript", jTranscript);
+      cJSON_AddItemToObject(jAlt, "rejected", jRejected);
+      cJSON_AddItemToObject(jAlt, "minimallyFormattedText", jMinimallyFormattedText);
+      if (!encrypted_tokenization.empty()) cJSON_AddItemToObject(jAlt, "encryptedTokenization", jEncryptedTokenization);
+      cJSON_AddItemToArray(jAlternatives, jAlt);
     }
-    switch_core_session_rwunlock(session);
+    char* json = cJSON_PrintUnformatted(jResult);
+    cb->responseHandler(session, (const char *) json, cb->bugname, NULL);
+    free(json);
+
+    cJSON_Delete(jResult);
   }
-  return nullptr;
+  switch_core_session_rwunlock(session);
+}
+
+static void grpc_on_finish(struct cap_cb *cb, const grpc::Status& status) {
+  GStreamer* streamer = (GStreamer *) cb->streamer;
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "grpc_on_finish: %s status %s (%d)\n", cb->sessionId,
+    status.error_message().c_str(), status.error_code()) ;
+  if (streamer) streamer->noteFinish(status);
 }
 extern "C" {
 
     switch_status_t nuance_speech_init() {
+      nuance_speech::ChannelRegistry::initialize(nGrpcSubchannels, nGrpcMaxStreamsPerChannel, nGrpcKeepaliveMs);
+      nuance_speech::GrpcEngine::initialize(nGrpcThreads);
+      nuance_speech::EndpointBalancer::initialize(nHealthCheckMs, nEjectFailures, nEjectSecs);
+      nuance_speech::TokenBroker::initialize(requestedMixTokenUrl ? requestedMixTokenUrl : DEFAULT_MIX_TOKEN_URL, nMixRefreshSecs, nMixWaitMs);
+
+      const char* clientId = std::getenv("NUANCE_CLIENT_ID");
+      const char* clientSecret = std::getenv("NUANCE_CLIENT_SECRET");
+      if (clientId && clientSecret) {
+        nuance_speech::TokenBroker::prefetch(clientId, clientSecret, DEFAULT_MIX_SCOPE);
+      }
       return SWITCH_STATUS_SUCCESS;
     }
 
+    // json array describing each server streams have been spread over; the caller frees the result
+    char* nuance_speech_backend_stats() {
+      std::vector<nuance_speech::EndpointBalancer::BackendStats> stats;
+      nuance_speech::EndpointBalancer::getStats(stats);
+
+      cJSON* jBackends = cJSON_CreateArray();
+      for (const auto& s : stats) {
+        cJSON* jBackend = cJSON_CreateObject();
+        cJSON_AddStringToObject(jBackend, "target", s.target.c_str());
+        cJSON_AddBoolToObject(jBackend, "healthy", s.healthy);
+        cJSON_AddNumberToObject(jBackend, "active", s.active);
+        cJSON_AddNumberToObject(jBackend, "streams", (double) s.streams);
+        cJSON_AddNumberToObject(jBackend, "failures", (double) s.failures);
+        cJSON_AddNumberToObject(jBackend, "ejections", (double) s.ejections);
+        cJSON_AddNumberToObject(jBackend, "avg_first_response_ms", s.avgLatencyMs);
+        cJSON_AddItemToArray(jBackends, jBackend);
+      }
+      char* json = cJSON_PrintUnformatted(jBackends);
+      cJSON_Delete(jBackends);
+      return json;
+    }
+
     switch_status_t nuance_speech_cleanup() {
+      nuance_speech::GrpcEngine::deinitialize();
+      nuance_speech::EndpointBalancer::deinitialize();
+      nuance_speech::ChannelRegistry::deinitialize();
+      nuance_speech::TokenBroker::deinitialize();
+
+      nuance_speech::ConfigCache<RecognitionInitMessage>::Stats stats;
+      resourcesCache.getStats(stats);
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "resources cache: %u entries, %llu hits, %llu misses, %llu evictions\n",
+        (unsigned int) stats.entries, (unsigned long long) stats.hits, (unsigned long long) stats.misses, (unsigned long long) stats.evictions);
+      resourcesCache.clear();
       return SWITCH_STATUS_SUCCESS;
     }
     switch_status_t nuance_speech_session_init(switch_core_session_t *session, responseHandler_t responseHandler, 
@@ -662,7 +749,7 @@ extern "C" {
       GStreamer *streamer = NULL;
       try {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "nuance_speech_session_init:  allocating streamer\n");
-        streamer = new GStreamer(session, channels, lang, interim);
+        streamer = new GStreamer(session, cb, channels, lang, interim);
         cb->streamer = streamer;
       } catch (std::exception& e) {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "%s: Error initializing gstreamer: %s.\n", 
@@ -675,14 +762,6 @@ extern "C" {
         streamer->connect();
       }
 
-      // create the read thread
-      switch_threadattr_t *thd_attr = NULL;
-      switch_memory_pool_t *pool = switch_core_session_get_pool(session);
-
-      switch_threadattr_create(&thd_attr, pool);
-      switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
-      switch_thread_create(&cb->thread, thd_attr, grpc_read_thread, cb, pool);
-
       *ppUserData = cb;
       return SWITCH_STATUS_SUCCESS;
     }
@@ -721,10 +800,9 @@ extern "C" {
         if (streamer) {
           streamer->writesDone();
 
-          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "nuance_speech_session_cleanup: GStreamer (%p) waiting for read thread to complete\n", (void*)streamer);
-          switch_status_t st;
-          switch_thread_join(&st, cb->thread);
-          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "nuance_speech_session_cleanup:  GStreamer (%p) read thread completed\n", (void*)streamer);
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "nuance_speech_session_cleanup: GStreamer (%p) waiting for stream to finish\n", (void*)streamer);
+          streamer->waitForFinish();
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "nuance_speech_session_cleanup:  GStreamer (%p) stream finished\n", (void*)streamer);
 
           delete streamer;
           cb->streamer = NULL;
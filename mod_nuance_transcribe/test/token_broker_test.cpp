@@ -0,0 +1,169 @@
+/*
+ * Tests the Mix token broker against a local stand-in for the token service: tokens are
+ * fetched with the client credentials flow, cached per client id and scope, fetched ahead of
+ * time by prefetch, refetched when a client's secret is rotated (and not switched back by
+ * credentials created with the old secret), and a failing token service makes a session
+ * give up after the configured wait rather than hang, with later sessions failing at once
+ * rather than hitting the service ahead of the retry backoff.
+ *
+ * usage: token_broker_test; exits non-zero if any check fails
+ */
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <switch.h>
+#include <curl/curl.h>
+
+#include "../token_broker.hpp"
+#include "token_stub.hpp"
+
+#define WAIT_MS (1000)
+
+using nuance_speech::TokenBroker;
+using test::TokenStub;
+
+// the broker logs through freeswitch, whose core is not running here; its lines go to stderr instead
+void switch_log_printf(switch_text_channel_t channel, const char* file, const char* func, int line,
+  const char* userdata, switch_log_level_t level, const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+}
+
+namespace {
+  unsigned int failures = 0;
+
+  void check(bool ok, const char* what, int line) {
+    if (ok) return;
+    fprintf(stderr, "token_broker_test:%d: check failed: %s\n", line, what);
+    failures++;
+  }
+  #define CHECK(cond) check((cond), #cond, __LINE__)
+
+  bool waitFor(std::function<bool()> pred, unsigned int ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    while (!pred()) {
+      if (std::chrono::steady_clock::now() > deadline) return false;
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return true;
+  }
+
+  unsigned int elapsedMs(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - since).count();
+  }
+
+  void coldFetchAndCache() {
+    std::string token;
+    CHECK(TokenBroker::getToken("client-a", "secret-1", "asr", token));
+    CHECK(token == "token-1");
+    CHECK(TokenStub::requests() == 1);
+    CHECK(TokenStub::lastCredentials() == "client-a:secret-1");
+    CHECK(TokenStub::lastBody() == "grant_type=client_credentials&scope=asr");
+
+    // served from the cache
+    CHECK(TokenBroker::getToken("client-a", "secret-1", "asr", token));
+    CHECK(token == "token-1");
+    CHECK(TokenStub::requests() == 1);
+  }
+
+  void secretRotation() {
+    auto oldCredentials = TokenBroker::getCallCredentials("client-a", "secret-1", "asr");
+    CHECK(oldCredentials != nullptr);
+    CHECK(TokenBroker::getCallCredentials("client-a", "secret-1", "asr") == oldCredentials);
+    unsigned int before = TokenStub::requests();
+
+    // a session with the new secret gets new credentials, and the token is refetched with the new secret
+    auto newCredentials = TokenBroker::getCallCredentials("client-a", "secret-2", "asr");
+    CHECK(newCredentials != nullptr && newCredentials != oldCredentials);
+    CHECK(waitFor([before] { return TokenStub::requests() == before + 1; }, WAIT_MS));
+    CHECK(TokenStub::lastCredentials() == "client-a:secret-2");
+
+    // a call still using the old credentials gets the new token, without switching the secret back
+    std::string token;
+    CHECK(waitFor([&token] {
+      return TokenBroker::getToken("client-a", "secret-1", "asr", token) && token == "token-" + std::to_string(TokenStub::requests());
+    }, WAIT_MS));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    CHECK(TokenStub::requests() == before + 1);
+    CHECK(TokenBroker::getCallCredentials("client-a", "secret-2", "asr") == newCredentials);
+  }
+
+  void scopesAreSeparate() {
+    unsigned int before = TokenStub::requests();
+    std::string token;
+    CHECK(TokenBroker::getToken("client-a", "secret-2", "tts", token));
+    CHECK(TokenStub::requests() == before + 1);
+    CHECK(TokenStub::lastBody() == "grant_type=client_credentials&scope=tts");
+  }
+
+  void prefetch() {
+    unsigned int before = TokenStub::requests();
+    TokenBroker::prefetch("client-c", "secret-c", "asr");
+    CHECK(waitFor([before] { return TokenStub::requests() == before + 1; }, WAIT_MS));
+
+    // already cached, so the session does not wait on the token service
+    std::string token;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    auto start = std::chrono::steady_clock::now();
+    CHECK(TokenBroker::getToken("client-c", "secret-c", "asr", token));
+    CHECK(elapsedMs(start) < 50);
+    CHECK(TokenStub::requests() == before + 1);
+  }
+
+  void failingService() {
+    TokenStub::setFailingClient("client-b");
+    std::string token;
+    unsigned int before = TokenStub::requests();
+    auto start = std::chrono::steady_clock::now();
+    CHECK(!TokenBroker::getToken("client-b", "secret-b", "asr", token));
+    CHECK(elapsedMs(start) < WAIT_MS + 500);
+    CHECK(TokenStub::requests() == before + 1);
+
+    // calls arriving during the outage fail at once, and do not cut short the retry backoff
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 10; i++) CHECK(!TokenBroker::getToken("client-b", "secret-b", "asr", token));
+    CHECK(elapsedMs(start) < 50);
+    CHECK(TokenStub::requests() == before + 1);
+
+    // once the service is back, the retry picks up a token
+    TokenStub::setFailingClient("");
+    CHECK(waitFor([&token] { return TokenBroker::getToken("client-b", "secret-b", "asr", token); }, 5000 + 2 * WAIT_MS));
+    CHECK(TokenStub::requests() == before + 2);
+  }
+}
+
+int main(int argc, char** argv) {
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  std::string url = TokenStub::start(3600);
+  if (url.empty()) {
+    fprintf(stderr, "token_broker_test: could not start the token service stub\n");
+    return 2;
+  }
+  TokenBroker::initialize(url.c_str(), 120, WAIT_MS);
+
+  coldFetchAndCache();
+  secretRotation();
+  scopesAreSeparate();
+  prefetch();
+  failingService();
+
+  TokenBroker::deinitialize();
+  std::string token;
+  CHECK(!TokenBroker::getToken("client-a", "secret-2", "asr", token));
+
+  TokenStub::stop();
+  curl_global_cleanup();
+
+  if (failures) {
+    fprintf(stderr, "token_broker_test: %u checks failed\n", failures);
+    return 1;
+  }
+  fprintf(stderr, "token_broker_test: all checks passed\n");
+  return 0;
+}
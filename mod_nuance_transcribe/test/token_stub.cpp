@@ -0,0 +1,131 @@
+#include "token_stub.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+using namespace test;
+
+std::thread TokenStub::serviceThread;
+std::mutex TokenStub::mutex;
+int TokenStub::listenFd = -1;
+unsigned int TokenStub::expiresIn = 3600;
+std::string TokenStub::failingClient;
+std::string TokenStub::credentials;
+std::string TokenStub::body;
+std::atomic<bool> TokenStub::stopFlag(false);
+std::atomic<unsigned int> TokenStub::nRequests(0);
+
+namespace {
+  std::string base64Decode(const std::string& in) {
+    static const std::string chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    unsigned int bits = 0;
+    int nBits = 0;
+    for (char c : in) {
+      size_t v = chars.find(c);
+      if (v == std::string::npos) break;
+      bits = (bits << 6) | (unsigned int) v;
+      nBits += 6;
+      if (nBits >= 8) {
+        nBits -= 8;
+        out.push_back((char) ((bits >> nBits) & 0xff));
+      }
+    }
+    return out;
+  }
+
+  // value of the named header, or an empty string
+  std::string header(const std::string& head, const char* name) {
+    size_t len = strlen(name);
+    size_t pos = 0;
+    while ((pos = head.find("\r\n", pos)) != std::string::npos) {
+      pos += 2;
+      if (strncasecmp(head.c_str() + pos, name, len) == 0 && head[pos + len] == ':') {
+        size_t start = head.find_first_not_of(' ', pos + len + 1);
+        return head.substr(start, head.find("\r\n", start) - start);
+      }
+    }
+    return std::string();
+  }
+}
+
+std::string TokenStub::start(unsigned int expiresInSecs) {
+  expiresIn = expiresInSecs;
+  stopFlag = false;
+  nRequests = 0;
+
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  socklen_t addrLen = sizeof(addr);
+  if (listenFd < 0 || bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listenFd, 16) != 0 ||
+    getsockname(listenFd, (struct sockaddr *) &addr, &addrLen) != 0) {
+    return std::string();
+  }
+
+  serviceThread = std::thread(&TokenStub::serve);
+  return "http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) + "/oauth2/token";
+}
+
+void TokenStub::stop() {
+  stopFlag = true;
+  if (serviceThread.joinable()) serviceThread.join();
+  if (listenFd >= 0) close(listenFd);
+  listenFd = -1;
+}
+
+void TokenStub::serve() {
+  while (!stopFlag) {
+    struct pollfd pfd = { listenFd, POLLIN, 0 };
+    if (poll(&pfd, 1, 100) <= 0) continue;
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0) continue;
+    handle(fd);
+    close(fd);
+  }
+}
+
+void TokenStub::handle(int fd) {
+  std::string request;
+  char buf[4096];
+  size_t headEnd = std::string::npos;
+  size_t contentLength = 0;
+  while (true) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0) return;
+    request.append(buf, n);
+    if (headEnd == std::string::npos && (headEnd = request.find("\r\n\r\n")) != std::string::npos) {
+      contentLength = (size_t) atoi(header(request.substr(0, headEnd + 2), "Content-Length").c_str());
+    }
+    if (headEnd != std::string::npos && request.size() >= headEnd + 4 + contentLength) break;
+  }
+
+  std::string head = request.substr(0, headEnd + 2);
+  std::string auth = header(head, "Authorization");
+  std::string decoded = auth.compare(0, 6, "Basic ") == 0 ? base64Decode(auth.substr(6)) : std::string();
+  std::string clientId = decoded.substr(0, decoded.find(':'));
+  unsigned int n = ++nRequests;
+
+  bool fail;
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    credentials = decoded;
+    body = request.substr(headEnd + 4, contentLength);
+    fail = !failingClient.empty() && clientId == failingClient;
+  }
+
+  std::string status = fail ? "500 Internal Server Error" : "200 OK";
+  std::string json = fail ? "{\"error\":\"server_error\"}" :
+    "{\"access_token\":\"token-" + std::to_string(n) + "\",\"expires_in\":" + std::to_string(expiresIn) + ",\"token_type\":\"bearer\"}";
+  std::string response = "HTTP/1.1 " + status + "\r\nContent-Type: application/json\r\nContent-Length: " +
+    std::to_string(json.size()) + "\r\nConnection: close\r\n\r\n" + json;
+  send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+}
@@ -0,0 +1,58 @@
+#ifndef __TOKEN_STUB_HPP__
+#define __TOKEN_STUB_HPP__
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace test {
+
+  /*
+   * Local stand-in for the Mix token service.  Answers each POST with a token numbered in
+   * the order requests arrive, or with an error status for a client id listed as failing,
+   * and records the basic authorization and body of the last request so that tests can
+   * check which secret and scope a token was fetched with.  One connection at a time is
+   * served, on a dedicated thread.
+   */
+  class TokenStub {
+  public:
+    // listens on an ephemeral port on the loopback interface; returns the url to fetch tokens from
+    static std::string start(unsigned int expiresInSecs);
+    static void stop();
+
+    static void setFailingClient(const std::string& clientId) {
+      std::lock_guard<std::mutex> lk(mutex);
+      failingClient = clientId;
+    }
+
+    static unsigned int requests() { return nRequests.load(); }
+
+    // "id:secret" from the basic authorization of the last request
+    static std::string lastCredentials() {
+      std::lock_guard<std::mutex> lk(mutex);
+      return credentials;
+    }
+    static std::string lastBody() {
+      std::lock_guard<std::mutex> lk(mutex);
+      return body;
+    }
+
+  private:
+    static void serve();
+    static void handle(int fd);
+
+    static std::thread serviceThread;
+    static std::mutex mutex;
+    static int listenFd;
+    static unsigned int expiresIn;
+    static std::string failingClient;
+    static std::string credentials;
+    static std::string body;
+    static std::atomic<bool> stopFlag;
+    static std::atomic<unsigned int> nRequests;
+  };
+
+} // namespace test
+
+#endif
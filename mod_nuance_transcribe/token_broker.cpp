@@ -0,0 +1,294 @@
+#include "token_broker.hpp"
+
+#include <switch.h>
+#include <switch_json.h>
+#include <curl/curl.h>
+#include <vector>
+#include <algorithm>
+
+/* tokens unused for this long are no longer refreshed */
+#define TOKEN_IDLE_EVICT_SECS (2 * 3600)
+/* retry interval after a failed fetch */
+#define TOKEN_RETRY_SECS (5)
+/* a token this close to expiry is not handed out to new calls */
+#define TOKEN_MIN_REMAINING_SECS (30)
+
+using namespace nuance_speech;
+
+namespace {
+  static size_t writeCallback(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    std::string* body = static_cast<std::string*>(userdata);
+    body->append(ptr, size * nmemb);
+    return size * nmemb;
+  }
+
+  // runs on grpc's own plugin threads (it is a blocking plugin), so a first call waiting on a fetch holds up no one else
+  class TokenPlugin : public grpc::MetadataCredentialsPlugin {
+  public:
+    TokenPlugin(const std::string& clientId, const std::string& clientSecret, const std::string& scope) :
+      m_clientId(clientId), m_clientSecret(clientSecret), m_scope(scope) {}
+
+    grpc::Status GetMetadata(grpc::string_ref serviceUrl, grpc::string_ref methodName,
+      const grpc::AuthContext& channelAuthContext, std::multimap<grpc::string, grpc::string>* metadata) {
+      std::string token;
+      if (!TokenBroker::getToken(m_clientId, m_clientSecret, m_scope, token)) {
+        return grpc::Status(grpc::StatusCode::UNAUTHENTICATED, "no Mix access token available for client " + m_clientId);
+      }
+      metadata->insert(std::make_pair("authorization", "Bearer " + token));
+      return grpc::Status::OK;
+    }
+
+  private:
+    std::string m_clientId;
+    std::string m_clientSecret;
+    std::string m_scope;
+  };
+}
+
+std::thread TokenBroker::workerThread;
+std::mutex TokenBroker::mutex;
+std::condition_variable TokenBroker::cvWorker;
+std::condition_variable TokenBroker::cvReady;
+std::map<std::string, TokenBroker::Entry> TokenBroker::tokens;
+std::string TokenBroker::url;
+unsigned int TokenBroker::refreshMargin;
+unsigned int TokenBroker::nWaitMs;
+bool TokenBroker::stopFlag = true;
+
+void TokenBroker::initialize(const char* tokenUrl, unsigned int refreshMarginSecs, unsigned int waitMs) {
+  std::lock_guard<std::mutex> lk(mutex);
+  url = tokenUrl;
+  refreshMargin = refreshMarginSecs;
+  nWaitMs = waitMs;
+  stopFlag = false;
+  workerThread = std::thread(&TokenBroker::worker);
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "TokenBroker::initialize token url %s, refresh %u secs before expiry\n",
+    url.c_str(), refreshMargin);
+}
+
+void TokenBroker::deinitialize() {
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    stopFlag = true;
+  }
+  cvWorker.notify_all();
+  cvReady.notify_all();
+  if (workerThread.joinable()) workerThread.join();
+
+  std::lock_guard<std::mutex> lk(mutex);
+  tokens.clear();
+}
+
+bool TokenBroker::isValid(const Entry& entry, Clock::time_point now) {
+  return !entry.token.empty() && entry.expiresAt > now + std::chrono::seconds(TOKEN_MIN_REMAINING_SECS);
+}
+
+// called with the mutex held; entries are keyed by client id and scope only, and the secret of an existing entry
+// is only replaced when rotate is set, so the plugins of earlier sessions, created with the old secret, cannot switch it back
+TokenBroker::Entry& TokenBroker::findEntry(const std::string& clientId, const std::string& clientSecret,
+  const std::string& scope, Clock::time_point now, bool rotate) {
+  std::string key = clientId + "|" + scope;
+  auto it = tokens.find(key);
+  if (it == tokens.end()) {
+    Entry entry = {};
+    entry.clientId = clientId;
+    entry.clientSecret = clientSecret;
+    entry.scope = scope;
+    entry.refreshAt = now;
+    it = tokens.insert(std::make_pair(key, entry)).first;
+    cvWorker.notify_one();
+  }
+  else if (rotate && it->second.clientSecret != clientSecret) {
+    // the secret was rotated: the cached token stays usable until one has been fetched with the new secret,
+    // and new sessions get credentials whose plugin carries the new secret
+    it->second.clientSecret = clientSecret;
+    it->second.credentials.reset();
+    it->second.refreshAt = now;
+    it->second.failed = false;
+    cvWorker.notify_one();
+  }
+  it->second.lastUsed = now;
+  return it->second;
+}
+
+void TokenBroker::prefetch(const std::string& clientId, const std::string& clientSecret, const std::string& scope) {
+  std::lock_guard<std::mutex> lk(mutex);
+  if (!stopFlag) findEntry(clientId, clientSecret, scope, Clock::now(), true);
+}
+
+std::shared_ptr<grpc::CallCredentials> TokenBroker::getCallCredentials(const std::string& clientId,
+  const std::string& clientSecret, const std::string& scope) {
+  std::lock_guard<std::mutex> lk(mutex);
+  if (stopFlag) return nullptr;
+  Entry& entry = findEntry(clientId, clientSecret, scope, Clock::now(), true);
+  if (!entry.credentials) {
+    entry.credentials = grpc::MetadataCredentialsFromPlugin(
+      std::unique_ptr<grpc::MetadataCredentialsPlugin>(new TokenPlugin(clientId, clientSecret, scope)));
+  }
+  return entry.credentials;
+}
+
+bool TokenBroker::getToken(const std::string& clientId, const std::string& clientSecret, const std::string& scope, std::string& token) {
+  auto now = Clock::now();
+  std::unique_lock<std::mutex> lk(mutex);
+  if (stopFlag) return false;
+
+  Entry& entry = findEntry(clientId, clientSecret, scope, now, false);
+  if (isValid(entry, now)) {
+    token = entry.token;
+    return true;
+  }
+
+  // after a failed fetch the retry backoff stands, and a call that would not see the next attempt in time fails now
+  // rather than holding a plugin thread; otherwise (cold cache, or a refresh scheduled too late) ask for one early
+  if (entry.failed) {
+    if (entry.refreshAt > now + std::chrono::milliseconds(nWaitMs)) return false;
+  }
+  else if (entry.refreshAt > now) {
+    entry.refreshAt = now;
+    cvWorker.notify_one();
+  }
+  unsigned int attempts = entry.attempts;
+  cvReady.wait_for(lk, std::chrono::milliseconds(nWaitMs), [&entry, attempts] {
+    return stopFlag || entry.attempts != attempts;
+  });
+  if (!stopFlag && isValid(entry, Clock::now())) {
+    token = entry.token;
+    return true;
+  }
+  return false;
+}
+
+bool TokenBroker::fetch(const Entry& entry, std::string& token, unsigned int& expiresInSecs, std::string& err) {
+  CURL* easy = curl_easy_init();
+  if (!easy) {
+    err = "curl_easy_init failed";
+    return false;
+  }
+
+  // Mix expects the client id and secret url encoded before they are used for basic authentication
+  char* escapedId = curl_easy_escape(easy, entry.clientId.c_str(), entry.clientId.length());
+  char* escapedSecret = curl_easy_escape(easy, entry.clientSecret.c_str(), entry.clientSecret.length());
+  char* escapedScope = curl_easy_escape(easy, entry.scope.c_str(), entry.scope.length());
+  std::string username(escapedId), password(escapedSecret);
+  std::string postData = "grant_type=client_credentials&scope=";
+  postData.append(escapedScope);
+  curl_free(escapedId);
+  curl_free(escapedSecret);
+  curl_free(escapedScope);
+
+  std::string body;
+  long responseCode = 0;
+  struct curl_slist *hdrs = nullptr;
+  hdrs = curl_slist_append(hdrs, "Content-Type: application/x-www-form-urlencoded");
+  hdrs = curl_slist_append(hdrs, "Accept: application/json");
+
+  curl_easy_setopt(easy, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(easy, CURLOPT_HTTPHEADER, hdrs);
+  curl_easy_setopt(easy, CURLOPT_HTTPAUTH, (long) CURLAUTH_BASIC);
+  curl_easy_setopt(easy, CURLOPT_USERNAME, username.c_str());
+  curl_easy_setopt(easy, CURLOPT_PASSWORD, password.c_str());
+  curl_easy_setopt(easy, CURLOPT_POSTFIELDS, postData.c_str());
+  curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, writeCallback);
+  curl_easy_setopt(easy, CURLOPT_WRITEDATA, &body);
+  curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT_MS, 3000L);
+  curl_easy_setopt(easy, CURLOPT_TIMEOUT, 10L);
+
+  CURLcode rc = curl_easy_perform(easy);
+  if (CURLE_OK == rc) curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &responseCode);
+  curl_slist_free_all(hdrs);
+  curl_easy_cleanup(easy);
+
+  if (CURLE_OK != rc) {
+    err = curl_easy_strerror(rc);
+    return false;
+  }
+  if (200 != responseCode) {
+    err = "http status " + std::to_string(responseCode) + ": " + body;
+    return false;
+  }
+
+  cJSON* json = cJSON_Parse(body.c_str());
+  if (!json) {
+    err = "invalid json response";
+    return false;
+  }
+  const char* accessToken = cJSON_GetStringValue(cJSON_GetObjectItem(json, "access_token"));
+  cJSON* jExpiresIn = cJSON_GetObjectItem(json, "expires_in");
+  bool ok = accessToken && jExpiresIn && cJSON_IsNumber(jExpiresIn);
+  if (ok) {
+    token = accessToken;
+    expiresInSecs = (unsigned int) jExpiresIn->valueint;
+  }
+  else err = "response missing access_token or expires_in";
+  cJSON_Delete(json);
+  return ok;
+}
+
+void TokenBroker::worker() {
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "TokenBroker::worker starting\n");
+  std::unique_lock<std::mutex> lk(mutex);
+  while (!stopFlag) {
+    auto now = Clock::now();
+    auto next = now + std::chrono::hours(1);
+    std::vector<std::pair<std::string, Entry> > due;
+
+    for (auto it = tokens.begin(); it != tokens.end();) {
+      Entry& entry = it->second;
+      if (now - entry.lastUsed > std::chrono::seconds(TOKEN_IDLE_EVICT_SECS)) {
+        it = tokens.erase(it);
+        continue;
+      }
+      if (entry.refreshAt <= now && !entry.inProgress) {
+        entry.inProgress = true;
+        due.push_back(*it);
+      }
+      else if (entry.refreshAt < next) next = entry.refreshAt;
+      ++it;
+    }
+
+    if (due.empty()) {
+      cvWorker.wait_until(lk, next);
+      continue;
+    }
+
+    lk.unlock();
+    for (const auto& d : due) {
+      std::string token, err;
+      unsigned int expiresIn = 0;
+      bool ok = fetch(d.second, token, expiresIn, err);
+      auto fetchedAt = Clock::now();
+
+      std::lock_guard<std::mutex> guard(mutex);
+      auto it = tokens.find(d.first);
+      if (it == tokens.end()) continue;
+      Entry& entry = it->second;
+      entry.inProgress = false;
+      entry.attempts++;
+      if (entry.clientSecret != d.second.clientSecret) {
+        // the secret changed while this fetch was under way; fetch again with the new one
+        entry.refreshAt = fetchedAt;
+      }
+      else if (ok) {
+        // refresh ahead of expiry, but never more often than every half lifetime
+        unsigned int refreshIn = std::max(expiresIn / 2, expiresIn > refreshMargin ? expiresIn - refreshMargin : 0);
+        entry.token = token;
+        entry.failed = false;
+        entry.expiresAt = fetchedAt + std::chrono::seconds(expiresIn);
+        entry.refreshAt = fetchedAt + std::chrono::seconds(refreshIn);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "TokenBroker::worker fetched token for %s, expires in %u secs, refresh in %u secs\n",
+          entry.clientId.c_str(), expiresIn, refreshIn);
+      }
+      else {
+        entry.refreshAt = fetchedAt + std::chrono::seconds(TOKEN_RETRY_SECS);
+        entry.failed = true;
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "TokenBroker::worker failed fetching token for %s from %s: %s\n",
+          entry.clientId.c_str(), url.c_str(), err.c_str());
+      }
+    }
+    cvReady.notify_all();
+    lk.lock();
+  }
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "TokenBroker::worker ending\n");
+}
@@ -0,0 +1,75 @@
+#ifndef __NUANCE_TOKEN_BROKER_HPP__
+#define __NUANCE_TOKEN_BROKER_HPP__
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+
+#include <grpc++/grpc++.h>
+
+namespace nuance_speech {
+
+/*
+ * Obtains Mix OAuth access tokens with the client credentials flow and caches them per
+ * client id and scope.  A single worker thread fetches tokens and refreshes them ahead of
+ * expiry, and each client id and scope has one shared CallCredentials that attaches the
+ * cached token to a call as it starts.  Sessions therefore never wait on the token service
+ * themselves: the first call for a client id waits, in grpc's credentials plugin thread,
+ * for the first fetch, and later calls pick up a cached token.
+ */
+class TokenBroker {
+public:
+  static void initialize(const char* tokenUrl, unsigned int refreshMarginSecs, unsigned int waitMs);
+  static void deinitialize();
+
+  // start fetching a token for this client in the background, if not already cached; a changed secret replaces the old one
+  static void prefetch(const std::string& clientId, const std::string& clientSecret, const std::string& scope);
+
+  // credentials to set on a call's context, shared by every call for this client and scope; a changed secret replaces the old one
+  static std::shared_ptr<grpc::CallCredentials> getCallCredentials(const std::string& clientId,
+    const std::string& clientSecret, const std::string& scope);
+
+  // returns a cached token; if none is available yet waits up to the configured time for the first fetch to complete.
+  // clientSecret is only used if the client has no entry, so a caller holding an outdated secret does not replace a newer one
+  static bool getToken(const std::string& clientId, const std::string& clientSecret, const std::string& scope, std::string& token);
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Entry {
+    std::string clientId;
+    std::string clientSecret;
+    std::string scope;
+    std::string token;
+    std::shared_ptr<grpc::CallCredentials> credentials;
+    Clock::time_point expiresAt;
+    Clock::time_point refreshAt;
+    Clock::time_point lastUsed;
+    unsigned int attempts;
+    bool inProgress;
+    bool failed;
+  };
+
+  static Entry& findEntry(const std::string& clientId, const std::string& clientSecret, const std::string& scope,
+    Clock::time_point now, bool rotate);
+  static void worker();
+  static bool fetch(const Entry& entry, std::string& token, unsigned int& expiresInSecs, std::string& err);
+  static bool isValid(const Entry& entry, Clock::time_point now);
+
+  static std::thread workerThread;
+  static std::mutex mutex;
+  static std::condition_variable cvWorker;
+  static std::condition_variable cvReady;
+  static std::map<std::string, Entry> tokens;
+  static std::string url;
+  static unsigned int refreshMargin;
+  static unsigned int nWaitMs;
+  static bool stopFlag;
+};
+
+} // namespace nuance_speech
+#endif
@@ -0,0 +1,120 @@
+#include "channel_registry.hpp"
+
+#include <switch.h>
+#include <algorithm>
+
+/* keys whose subchannels have all been idle this long are dropped */
+#define CHANNEL_IDLE_EVICT_SECS (600)
+#define CHANNEL_SWEEP_INTERVAL_SECS (60)
+
+using namespace nvidia_speech;
+
+std::mutex ChannelRegistry::mutex;
+std::map<std::string, ChannelRegistry::Entry> ChannelRegistry::entries;
+unsigned int ChannelRegistry::nSubchannels = 1;
+unsigned int ChannelRegistry::nMaxStreams = 100;
+unsigned int ChannelRegistry::nKeepaliveMs = 0;
+ChannelRegistry::Clock::time_point ChannelRegistry::lastSweep;
+
+void ChannelRegistry::initialize(unsigned int subchannelsPerKey, unsigned int maxStreamsPerChannel, unsigned int keepaliveMs) {
+  std::lock_guard<std::mutex> lk(mutex);
+  nSubchannels = std::max(1U, subchannelsPerKey);
+  nMaxStreams = std::max(1U, maxStreamsPerChannel);
+  nKeepaliveMs = keepaliveMs;
+  lastSweep = Clock::now();
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "ChannelRegistry::initialize %u subchannels per key, %u streams per channel, keepalive %u ms\n",
+    nSubchannels, nMaxStreams, nKeepaliveMs);
+}
+
+void ChannelRegistry::deinitialize() {
+  std::lock_guard<std::mutex> lk(mutex);
+  entries.clear();
+}
+
+std::shared_ptr<ChannelRegistry::Subchannel> ChannelRegistry::createSubchannel(const std::string& target, credentialsFactory_t& makeCredentials) {
+  grpc::ChannelArguments args;
+
+  // a local subchannel pool gives each subchannel a connection of its own rather than the process-wide shared one
+  args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+  if (nKeepaliveMs > 0) {
+    args.SetInt(GRPC_ARG_KEEPALIVE_TIME_MS, nKeepaliveMs);
+    args.SetInt(GRPC_ARG_KEEPALIVE_TIMEOUT_MS, 10000);
+    args.SetInt(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1);
+    args.SetInt(GRPC_ARG_HTTP2_MAX_PINGS_WITHOUT_DATA, 0);
+  }
+
+  std::shared_ptr<Subchannel> sub = std::make_shared<Subchannel>();
+  sub->channel = grpc::CreateCustomChannel(target, makeCredentials(), args);
+  sub->active = 0;
+  sub->lastUsed = Clock::now();
+  return sub;
+}
+
+void ChannelRegistry::evictIdle(Clock::time_point now) {
+  for (auto it = entries.begin(); it != entries.end();) {
+    bool idle = true;
+    for (auto& sub : it->second.subchannels) {
+      if (sub->active > 0 || now - sub->lastUsed < std::chrono::seconds(CHANNEL_IDLE_EVICT_SECS)) {
+        idle = false;
+        break;
+      }
+    }
+    if (idle) it = entries.erase(it);
+    else ++it;
+  }
+}
+
+std::shared_ptr<grpc::Channel> ChannelRegistry::getChannel(const std::string& target, const std::string& credentialsKey,
+  credentialsFactory_t makeCredentials, unsigned int maxStreams) {
+  auto now = Clock::now();
+  std::lock_guard<std::mutex> lk(mutex);
+
+  if (now - lastSweep > std::chrono::seconds(CHANNEL_SWEEP_INTERVAL_SECS)) {
+    lastSweep = now;
+    evictIdle(now);
+  }
+
+  std::string key = target + "|" + credentialsKey;
+  auto it = entries.find(key);
+  if (it == entries.end()) {
+    Entry entry;
+    entry.next = 0;
+    entry.maxStreams = maxStreams > 0 ? maxStreams : nMaxStreams;
+    it = entries.insert(std::make_pair(key, entry)).first;
+  }
+  Entry& entry = it->second;
+
+  // round-robin over the subchannels that have room, creating subchannels up to the configured number first
+  std::shared_ptr<Subchannel> chosen;
+  if (entry.subchannels.size() < nSubchannels) {
+    chosen = createSubchannel(target, makeCredentials);
+    entry.subchannels.push_back(chosen);
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "ChannelRegistry::getChannel created subchannel %u for %s\n",
+      (unsigned int) entry.subchannels.size(), target.c_str());
+  }
+  else {
+    size_t n = entry.subchannels.size();
+    for (size_t i = 0; i < n && !chosen; i++) {
+      auto& sub = entry.subchannels[(entry.next + i) % n];
+      if (sub->active < entry.maxStreams) {
+        chosen = sub;
+        entry.next = (entry.next + i + 1) % n;
+      }
+    }
+    if (!chosen) {
+      chosen = createSubchannel(target, makeCredentials);
+      entry.subchannels.push_back(chosen);
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "ChannelRegistry::getChannel all %u subchannels for %s at %u streams, added another\n",
+        (unsigned int) n, target.c_str(), entry.maxStreams);
+    }
+  }
+  if (!chosen->channel) return nullptr;
+
+  chosen->active++;
+  chosen->lastUsed = now;
+  std::shared_ptr<StreamRef> ref = std::make_shared<StreamRef>();
+  ref->subchannel = chosen;
+
+  // aliasing constructor: points at the channel but owns the stream reference
+  return std::shared_ptr<grpc::Channel>(ref, chosen->channel.get());
+}
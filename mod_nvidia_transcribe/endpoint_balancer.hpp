@@ -0,0 +1,101 @@
+#ifndef __NVIDIA_ENDPOINT_BALANCER_HPP__
+#define __NVIDIA_ENDPOINT_BALANCER_HPP__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include <grpc++/grpc++.h>
+
+namespace nvidia_speech {
+
+/*
+ * Spreads streams over a comma-separated list of self-hosted servers, so that a farm of
+ * servers can be used without an external balancer pinning long-lived streams to one node.
+ * Each new stream goes to the healthy server with the fewest outstanding streams.
+ *
+ * A server is ejected after a run of failed streams, or when its connection goes into
+ * transient failure, and is re-admitted once the ejection period has passed and a health
+ * check finds its connection usable again.  If every server in a list is ejected, streams
+ * are spread over all of them rather than refused.
+ */
+class EndpointBalancer {
+public:
+  struct BackendStats {
+    std::string target;
+    bool healthy;
+    unsigned int active;
+    uint64_t streams;
+    uint64_t failures;
+    uint64_t ejections;
+    double avgLatencyMs;
+  };
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Backend {
+    std::string target;
+    std::shared_ptr<grpc::Channel> probe;
+    std::atomic<unsigned int> active;
+    bool healthy;
+    unsigned int consecutiveFailures;
+    Clock::time_point ejectedUntil;
+    uint64_t streams;
+    uint64_t failures;
+    uint64_t ejections;
+    double avgLatencyMs;
+  };
+
+public:
+  // one stream's claim on a server; the server's outstanding count drops when the lease is released
+  class Lease {
+  public:
+    Lease(std::shared_ptr<Backend> backend) : m_backend(backend), m_completed(false) {}
+    ~Lease();
+
+    const std::string& target() const { return m_backend->target; }
+
+    // time from starting the stream to its first response
+    void recordLatency(unsigned int ms);
+
+    // outcome of the stream; failures count towards ejecting the server
+    void complete(bool ok);
+
+  private:
+    std::shared_ptr<Backend> m_backend;
+    bool m_completed;
+  };
+
+  static void initialize(unsigned int healthCheckMs, unsigned int maxFailures, unsigned int ejectSecs);
+  static void deinitialize();
+
+  static std::shared_ptr<Lease> acquire(const std::string& endpoints);
+
+  static void getStats(std::vector<BackendStats>& out);
+
+private:
+  static std::shared_ptr<Backend> getBackend(const std::string& target);
+  static void eject(Backend& backend, const char* reason);
+  static void worker();
+
+  static std::mutex mutex;
+  static std::condition_variable cv;
+  static std::thread healthThread;
+  static std::map<std::string, std::shared_ptr<Backend> > backends;
+  static unsigned int next;
+  static unsigned int nHealthCheckMs;
+  static unsigned int nMaxFailures;
+  static unsigned int nEjectSecs;
+  static bool stopFlag;
+};
+
+} // namespace nvidia_speech
+#endif
@@ -205,6 +205,19 @@ SWITCH_STANDARD_API(transcribe_function)
 	return SWITCH_STATUS_SUCCESS;
 }
 
+SWITCH_STANDARD_API(backends_function)
+{
+	char *json = nvidia_speech_backend_stats();
+	if (json) {
+		stream->write_function(stream, "%s\n", json);
+		free(json);
+	}
+	else {
+		stream->write_function(stream, "-ERR Operation Failed\n");
+	}
+	return SWITCH_STATUS_SUCCESS;
+}
+
 SWITCH_MODULE_LOAD_FUNCTION(mod_transcribe_load)
 {
 	switch_api_interface_t *api_interface;
@@ -243,6 +256,8 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_transcribe_load)
 	switch_console_set_complete("add uuid_nvidia_transcribe start lang-code");
 	switch_console_set_complete("add uuid_nvidia_transcribe stop ");
 
+	SWITCH_ADD_API(api_interface, "nvidia_transcribe_backends", "Nvidia Speech Transcription API", backends_function, "");
+
 	/* indicate that the module should continue to be loaded */
 	return SWITCH_STATUS_SUCCESS;
 }
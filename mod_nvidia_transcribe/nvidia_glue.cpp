@@ -14,10 +14,36 @@ namespace nr = nvidia::riva;
 
 #include "mod_nvidia_transcribe.h"
 #include "simple_buffer.h"
+#include "channel_registry.hpp"
+#include "grpc_engine.hpp"
+#include "endpoint_balancer.hpp"
+#include "config_cache.hpp"
 
 #define CHUNKSIZE (320)
 
 namespace {
+  static const char *requestedGrpcSubchannels = std::getenv("MOD_TRANSCRIBE_GRPC_SUBCHANNELS");
+  static unsigned int nGrpcSubchannels = std::max(1, requestedGrpcSubchannels ? ::atoi(requestedGrpcSubchannels) : 2);
+  static const char *requestedGrpcMaxStreams = std::getenv("MOD_TRANSCRIBE_GRPC_MAX_STREAMS_PER_CHANNEL");
+  static unsigned int nGrpcMaxStreamsPerChannel = std::max(1, requestedGrpcMaxStreams ? ::atoi(requestedGrpcMaxStreams) : 100);
+  static const char *requestedGrpcKeepaliveMs = std::getenv("MOD_TRANSCRIBE_GRPC_KEEPALIVE_MS");
+  static unsigned int nGrpcKeepaliveMs = std::max(0, requestedGrpcKeepaliveMs ? ::atoi(requestedGrpcKeepaliveMs) : 30000);
+  static const char *requestedGrpcThreads = std::getenv("MOD_TRANSCRIBE_GRPC_THREADS");
+  static unsigned int nGrpcThreads = std::max(1, requestedGrpcThreads ? ::atoi(requestedGrpcThreads) : 2);
+  static const char *requestedGrpcMaxQueuedFrames = std::getenv("MOD_TRANSCRIBE_GRPC_MAX_QUEUED_FRAMES");
+  static unsigned int nGrpcMaxQueuedFrames = std::max(1, requestedGrpcMaxQueuedFrames ? ::atoi(requestedGrpcMaxQueuedFrames) : 250);
+  static const char *requestedTeardownTimeoutMs = std::getenv("MOD_TRANSCRIBE_TEARDOWN_TIMEOUT_MS");
+  static unsigned int nTeardownTimeoutMs = std::max(100, requestedTeardownTimeoutMs ? ::atoi(requestedTeardownTimeoutMs) : 5000);
+  static const char *requestedHealthCheckMs = std::getenv("MOD_TRANSCRIBE_HEALTH_CHECK_MS");
+  static unsigned int nHealthCheckMs = std::max(100, requestedHealthCheckMs ? ::atoi(requestedHealthCheckMs) : 5000);
+  static const char *requestedEjectFailures = std::getenv("MOD_TRANSCRIBE_EJECT_FAILURES");
+  static unsigned int nEjectFailures = std::max(1, requestedEjectFailures ? ::atoi(requestedEjectFailures) : 3);
+  static const char *requestedEjectSecs = std::getenv("MOD_TRANSCRIBE_EJECT_SECS");
+  static unsigned int nEjectSecs = std::max(0, requestedEjectSecs ? ::atoi(requestedEjectSecs) : 30);
+  static const char *requestedConfigCacheSize = std::getenv("MOD_TRANSCRIBE_CONFIG_CACHE_SIZE");
+  static unsigned int nConfigCacheSize = std::max(0, requestedConfigCacheSize ? ::atoi(requestedConfigCacheSize) : 100);
+  static nvidia_speech::ConfigCache<nr_asr::RecognitionConfig> hintsCache(nConfigCacheSize);
+
   int case_insensitive_match(std::string s1, std::string s2) {
    std::transform(s1.begin(), s1.end(), s1.begin(), ::tolower);
    std::transform(s2.begin(), s2.end(), s2.begin(), ::tolower);
@@ -27,16 +53,21 @@ namespace {
   }
 }
 
+static void grpc_on_response(struct cap_cb *cb, nr_asr::StreamingRecognizeResponse& response);
+static void grpc_on_finish(struct cap_cb *cb, const grpc::Status& status);
+
 class GStreamer {
 public:
 	GStreamer(
-    switch_core_session_t *session, uint32_t channels, char* lang, int interim) : 
+    switch_core_session_t *session, struct cap_cb *cb, uint32_t channels, char* lang, int interim) : 
       m_session(session), 
-      m_writesDone(false), 
+      m_cb(cb),
       m_connected(false), 
       m_language(lang),
       m_interim(interim),
-      m_audioBuffer(CHUNKSIZE, 15) {
+      m_audioBuffer(CHUNKSIZE, 15),
+      m_stream(nGrpcMaxQueuedFrames),
+      m_gotResponse(false) {
   
     const char* var;
     char sessionId[256];
@@ -52,7 +83,15 @@ public:
     switch_channel_t *channel = switch_core_session_get_channel(m_session);
 
     const char* var = switch_channel_get_variable(channel, "NVIDIA_RIVA_URI");
-    std::shared_ptr<grpc::Channel> grpcChannel = grpc::CreateChannel(var, grpc::InsecureChannelCredentials());
+    if (var && strchr(var, ',')) {
+      // a list of servers: use the one with the fewest outstanding streams
+      m_lease = nvidia_speech::EndpointBalancer::acquire(var);
+      var = m_lease->target().c_str();
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p using riva server %s\n", this, var);
+    }
+    std::shared_ptr<grpc::Channel> grpcChannel = nvidia_speech::ChannelRegistry::getChannel(var, "insecure", [] {
+      return grpc::InsecureChannelCredentials();
+    });
     if (!grpcChannel) {
       switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "GStreamer %p failed creating grpc channel to %s\n", this, var);	
       throw std::runtime_error(std::string("Error creating grpc channel to ") + var);
@@ -119,49 +158,54 @@ public:
     /* hints */
     const char* hints = switch_channel_get_variable(channel, "NVIDIA_HINTS");
     if (hints) {
-      float boost = -1;
-      nr_asr::SpeechContext* speech_context = config->add_speech_contexts();
-
-      // hints are either a simple comma-separated list of phrases, or a json array of objects
-      // containing a phrase and a boost value
-      auto *jHint = cJSON_Parse((char *) hints);
-      if (jHint) {
-        int i = 0;
-        cJSON *jPhrase = NULL;
-        cJSON_ArrayForEach(jPhrase, jHint) {
-          cJSON *jItem = cJSON_GetObjectItem(jPhrase, "phrase");
-          if (jItem) {
-            nr_asr::SpeechContext* speech_context = config->add_speech_contexts();
-            auto *phrase = cJSON_GetStringValue(jItem);
-            speech_context->add_phrases(phrase);
-            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "hint: %s\n", phrase);
-            if (cJSON_GetObjectItem(jPhrase, "boost")) {
-              float boost = (float) cJSON_GetObjectItem(jPhrase, "boost")->valuedouble;
-              speech_context->set_boost(boost);
-              switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "boost value: %f\n", boost);
+      const char* boost_str = switch_channel_get_variable(channel, "NVIDIA_HINTS_BOOST");
+      std::string content = std::string(hints) + "|" + (boost_str ? boost_str : "");
+      bool hit = hintsCache.merge(content, config, [&](nr_asr::RecognitionConfig* config) {
+        float boost = -1;
+        nr_asr::SpeechContext* speech_context = config->add_speech_contexts();
+
+        // hints are either a simple comma-separated list of phrases, or a json array of objects
+        // containing a phrase and a boost value
+        auto *jHint = cJSON_Parse((char *) hints);
+        if (jHint) {
+          int i = 0;
+          cJSON *jPhrase = NULL;
+          cJSON_ArrayForEach(jPhrase, jHint) {
+            cJSON *jItem = cJSON_GetObjectItem(jPhrase, "phrase");
+            if (jItem) {
+              nr_asr::SpeechContext* speech_context = config->add_speech_contexts();
+              auto *phrase = cJSON_GetStringValue(jItem);
+              speech_context->add_phrases(phrase);
+              switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "hint: %s\n", phrase);
+              if (cJSON_GetObjectItem(jPhrase, "boost")) {
+                float boost = (float) cJSON_GetObjectItem(jPhrase, "boost")->valuedouble;
+                speech_context->set_boost(boost);
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "boost value: %f\n", boost);
+              }
+              i++;
             }
-            i++;
           }
+          cJSON_Delete(jHint);
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "added %d hints\n", i);
         }
-        cJSON_Delete(jHint);
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "added %d hints\n", i);
-      }
-      else {
-        /* single set of hints */
-        nr_asr::SpeechContext* speech_context = config->add_speech_contexts();
-        char *phrases[500] = { 0 };
-        int argc = switch_separate_string((char *) hints, ',', phrases, 500);
-        for (int i = 0; i < argc; i++) {
-          speech_context->add_phrases(phrases[i]);
-        }
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "added %d hints\n", argc);
-        const char* boost_str = switch_channel_get_variable(channel, "NVIDIA_HINTS_BOOST");
-        if (boost_str) {
-          float boost = (float) atof(boost_str);
-          speech_context->set_boost(boost);
-          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "boost value: %f\n", boost);
+        else {
+          /* single set of hints */
+          nr_asr::SpeechContext* speech_context = config->add_speech_contexts();
+          char *phrases[500] = { 0 };
+          int argc = switch_separate_string((char *) hints, ',', phrases, 500);
+          for (int i = 0; i < argc; i++) {
+            speech_context->add_phrases(phrases[i]);
+          }
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "added %d hints\n", argc);
+          const char* boost_str = switch_channel_get_variable(channel, "NVIDIA_HINTS_BOOST");
+          if (boost_str) {
+            float boost = (float) atof(boost_str);
+            speech_context->set_boost(boost);
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "boost value: %f\n", boost);
+          }
         }
-      }
+      });
+      switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "hints %s\n", hit ? "found in cache" : "built");
     }
 
     /* speaker diarization */
@@ -201,15 +245,19 @@ public:
 
     createInitMessage();
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p creating streamer\n", this);	
-  	m_streamer = m_stub->StreamingRecognize(&m_context);
+    struct cap_cb *cb = m_cb;
+    m_startedAt = std::chrono::steady_clock::now();
+    bool started = m_stream.start([this](grpc::ClientContext* context, grpc::CompletionQueue* cq) {
+        return m_stub->PrepareAsyncStreamingRecognize(context, cq);
+      },
+      m_request,  // the first request contains the config only
+      [cb](nr_asr::StreamingRecognizeResponse& response) { grpc_on_response(cb, response); },
+      [cb](const grpc::Status& status) { grpc_on_finish(cb, status); });
+    if (!started) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "GStreamer %p could not start a stream, the grpc engine is not running\n", this);
+      return;
+    }
     m_connected = true;
-
-    // read thread is waiting on this
-    m_promise.set_value();
-
-  	// Write the first request, containing the config only.
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p sending initial message\n", this);	
-  	m_streamer->Write(m_request);
     m_request.clear_streaming_config();
 
     // send any buffered audio
@@ -233,159 +281,181 @@ public:
       }
       return true;
     }
-    m_request.clear_audio_content();
-    m_request.set_audio_content(data, datalen);
-    bool ok = m_streamer->Write(m_request);
-    return ok;
+    auto request = m_stream.acquire();
+    request.set_audio_content(data, datalen);
+    return m_stream.write(std::move(request));
   }
 
-	uint32_t nextMessageSize(void) {
-		uint32_t size = 0;
-		m_streamer->NextMessageSize(&size);
-		return size;
-	}
-
-	bool read(nr_asr::StreamingRecognizeResponse* response) {
-		return m_streamer->Read(response);
-	}
-
-	grpc::Status finish() {
-		return m_streamer->Finish();
-	}
-
   void startTimers() {
     //nr_asr::StreamingRecognizeRequest request;
     //auto msg = request.mutable_control_message()->mutable_start_timers_message();
-    //m_streamer->Write(request);
+    //m_stream.write(request);
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p sent start timers control message\n", this);	
   }
 
 	void writesDone() {
-    // grpc crashes if we call this twice on a stream
-    if (!m_connected) {
-      cancelConnect();
-    }
-    else if (!m_writesDone) {
-      m_streamer->WritesDone();
-      m_writesDone = true;
-    }
+    m_stream.writesDone();
 	}
 
-  bool waitForConnect() {
-    std::shared_future<void> sf(m_promise.get_future());
-    sf.wait();
-    return m_connected;
+  bool waitForFinish() {
+    bool ok = m_stream.waitForFinish(nTeardownTimeoutMs);
+    if (m_stream.getDropped() > 0) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "GStreamer %p dropped %u audio frames the network could not keep up with\n",
+        this, m_stream.getDropped());
+    }
+    return ok;
   }
 
-  void cancelConnect() {
-    assert(!m_connected);
-    m_promise.set_value();
-  } 
-
   bool isConnected() {
     return m_connected;
   }
 
+  // first response latency and outcome of the stream, reported when spreading streams over a list of servers
+  void noteResponse() {
+    if (m_lease && !m_gotResponse) {
+      m_gotResponse = true;
+      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_startedAt).count();
+      m_lease->recordLatency((unsigned int) ms);
+    }
+  }
+
+  void noteFinish(const grpc::Status& status) {
+    if (m_lease) {
+      auto code = status.error_code();
+      m_lease->complete(code != grpc::StatusCode::UNAVAILABLE && code != grpc::StatusCode::DEADLINE_EXCEEDED &&
+        code != grpc::StatusCode::RESOURCE_EXHAUSTED && code != grpc::StatusCode::INTERNAL);
+    }
+  }
+
 private:
 	switch_core_session_t* m_session;
-  grpc::ClientContext m_context;
+  struct cap_cb *m_cb;
 	std::shared_ptr<grpc::Channel> m_channel;
 	std::unique_ptr<nr_asr::RivaSpeechRecognition::Stub> m_stub;
   nr_asr::StreamingRecognizeRequest m_request;
-	std::unique_ptr< grpc::ClientReaderWriterInterface<nr_asr::StreamingRecognizeRequest, nr_asr::StreamingRecognizeResponse> > m_streamer;
-  bool m_writesDone;
   bool m_connected;
   bool m_interim;
   std::string m_language;
-  std::promise<void> m_promise;
   SimpleBuffer m_audioBuffer;
+  nvidia_speech::AsyncStream<nr_asr::StreamingRecognizeRequest, nr_asr::StreamingRecognizeResponse> m_stream;
+  std::shared_ptr<nvidia_speech::EndpointBalancer::Lease> m_lease;
+  std::chrono::steady_clock::time_point m_startedAt;
+  bool m_gotResponse;
   char m_sessionId[256];
 };
 
-static void *SWITCH_THREAD_FUNC grpc_read_thread(switch_thread_t *thread, void *obj) {
-  static int count;
-	struct cap_cb *cb = (struct cap_cb *) obj;
-	GStreamer* streamer = (GStreamer *) cb->streamer;
+static void grpc_on_response(struct cap_cb *cb, nr_asr::StreamingRecognizeResponse& response) {
+  GStreamer* streamer = (GStreamer *) cb->streamer;
+  if (streamer) streamer->noteResponse();
 
-  bool connected = streamer->waitForConnect();
-  if (!connected) {
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "nvidia transcribe grpc read thread exiting since we didnt connect\n") ;
-    return nullptr;
+  switch_core_session_t* session = switch_core_session_locate(cb->sessionId);
+  if (!session) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "grpc_on_response: session %s is gone!\n", cb->sessionId) ;
+    return;
   }
-
-  // Read responses.
-  nr_asr::StreamingRecognizeResponse response;
-  while (streamer->read(&response)) {  // Returns false when no more to read.
-    count++;
-    switch_core_session_t* session = switch_core_session_locate(cb->sessionId);
-    if (!session) {
-      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "grpc_read_thread: session %s is gone!\n", cb->sessionId) ;
-      return nullptr;
-    }
-    for (int r = 0; r < response.results_size(); ++r) {
-      const auto& result = response.results(r);
-      bool is_final = result.is_final();
-      int num_alternatives = result.alternatives_size();
-      int channel_tag = result.channel_tag();
-      float stability = result.stability();
-
-      cJSON * jResult = cJSON_CreateObject();
-      cJSON * jIsFinal = cJSON_CreateBool(is_final);
-      cJSON * jAlternatives = cJSON_CreateArray();
-      cJSON * jAudioProcessed = cJSON_CreateNumber(result.audio_processed());
-      cJSON * jChannelTag = cJSON_CreateNumber(channel_tag );
-      cJSON * jStability = cJSON_CreateNumber(stability );
-      cJSON_AddItemToObject(jResult, "alternatives", jAlternatives);
-      cJSON_AddItemToObject(jResult, "is_final", jIsFinal);
-      cJSON_AddItemToObject(jResult, "audio_processed", jAudioProcessed);
-      cJSON_AddItemToObject(jResult, "stability", jStability);
-
-      for (int a = 0; a < num_alternatives; ++a) {
-        cJSON* jAlt = cJSON_CreateObject();
-        cJSON* jTranscript = cJSON_CreateString(result.alternatives(a).transcript().c_str());
-        cJSON_AddItemToObject(jAlt, "transcript", jTranscript);
-
-        if (is_final) {
-          auto confidence = result.alternatives(a).confidence();
-          cJSON_AddNumberToObject(jAlt, "confidence", confidence);
-          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "confidence %.2f\n", confidence) ;
-
-          int words = result.alternatives(a).words_size();
-          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "got %d words\n", words) ;
-          if (words > 0) {
-            cJSON* jWords = cJSON_CreateArray();
-            for (int w = 0; w < words; w++) {
-              cJSON* jWordInfo = cJSON_CreateObject();
-              cJSON_AddItemToArray(jWords, jWordInfo);
-              auto& wordInfo = result.alternatives(a).words(w);
-              cJSON_AddStringToObject(jWordInfo, "word", wordInfo.word().c_str());
-              cJSON_AddNumberToObject(jWordInfo, "start_time", wordInfo.start_time());
-              cJSON_AddNumberToObject(jWordInfo, "end_time", wordInfo.end_time());
-              cJSON_AddNumberToObject(jWordInfo, "confidence", wordInfo.confidence());
-              cJSON_AddNumberToObject(jWordInfo, "speaker_tag", wordInfo.speaker_tag());
-            }
-            cJSON_AddItemToObject(jAlt, "words", jWords);
+  for (int r = 0; r < response.results_size(); ++r) {
+    const auto& result = response.results(r);
+    bool is_final = result.is_final();
+    int num_alternatives = result.alternatives_size();
+    int channel_tag = result.channel_tag();
+    float stability = result.stability();
+
+    cJSON * jResult = cJSON_CreateObject();
+    cJSON * jIsFinal = cJSON_CreateBool(is_final);
+    cJSON * jAlternatives = cJSON_CreateArray();
+    cJSON * jAudioProcessed = cJSON_CreateNumber(result.audio_processed());
+    cJSON * jChannelTag = cJSON_CreateNumber(channel_tag );
+    cJSON * jStability = cJSON_CreateNumber(stability );
+    cJSON_AddItemToObject(jResult, "alternatives", jAlternatives);
+    cJSON_AddItemToObject(jResult, "is_final", jIsFinal);
+    cJSON_AddItemToObject(jResult, "audio_processed", jAudioProcessed);
+    cJSON_AddItemToObject(jResult, "stability", jStability);
+
+    for (int a = 0; a < num_alternatives; ++a) {
+      cJSON* jAlt = cJSON_CreateObject();
+      cJSON* jTranscript = cJSON_CreateString(result.alternatives(a).transcript().c_str());
+      cJSON_AddItemToObject(jAlt, "transcript", jTranscript);
+
+      if (is_final) {
+        auto confidence = result.alternatives(a).confidence();
+        cJSON_AddNumberToObject(jAlt, "confidence", confidence);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "confidence %.2f\n", confidence) ;
+
+        int words = result.alternatives(a).words_size();
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "got %d words\n", words) ;
+        if (words > 0) {
+          cJSON* jWords = cJSON_CreateArray();
+          for (int w = 0; w < words; w++) {
+            cJSON* jWordInfo = cJSON_CreateObject();
+            cJSON_AddItemToArray(jWords, jWordInfo);
+            auto& wordInfo = result.alternatives(a).words(w);
+            cJSON_AddStringToObject(jWordInfo, "word", wordInfo.word().c_str());
+            cJSON_AddNumberToObject(jWordInfo, "start_time", wordInfo.start_time());
+            cJSON_AddNumberToObject(jWordInfo, "end_time", wordInfo.end_time());
+            cJSON_AddNumberToObject(jWordInfo, "confidence", wordInfo.confidence());
+            cJSON_AddNumberToObject(jWordInfo, "speaker_tag", wordInfo.speaker_tag());
           }
+          cJSON_AddItemToObject(jAlt, "words", jWords);
         }
-        cJSON_AddItemToArray(jAlternatives, jAlt);
       }
-      char* json = cJSON_PrintUnformatted(jResult);
-      cb->responseHandler(session, (const char *) json, cb->bugname, NULL);
-      free(json);
-
-      cJSON_Delete(jResult);
+      cJSON_AddItemToArray(jAlternatives, jAlt);
     }
-    switch_core_session_rwunlock(session);
+    char* json = cJSON_PrintUnformatted(jResult);
+    cb->responseHandler(session, (const char *) json, cb->bugname, NULL);
+    free(json);
+
+    cJSON_Delete(jResult);
   }
-  return nullptr;
+  switch_core_session_rwunlock(session);
+}
+
+static void grpc_on_finish(struct cap_cb *cb, const grpc::Status& status) {
+  GStreamer* streamer = (GStreamer *) cb->streamer;
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "grpc_on_finish: %s status %s (%d)\n", cb->sessionId,
+    status.error_message().c_str(), status.error_code()) ;
+  if (streamer) streamer->noteFinish(status);
 }
 extern "C" {
 
     switch_status_t nvidia_speech_init() {
+      nvidia_speech::ChannelRegistry::initialize(nGrpcSubchannels, nGrpcMaxStreamsPerChannel, nGrpcKeepaliveMs);
+      nvidia_speech::GrpcEngine::initialize(nGrpcThreads);
+      nvidia_speech::EndpointBalancer::initialize(nHealthCheckMs, nEjectFailures, nEjectSecs);
       return SWITCH_STATUS_SUCCESS;
     }
 
+    // json array describing each server streams have been spread over; the caller frees the result
+    char* nvidia_speech_backend_stats() {
+      std::vector<nvidia_speech::EndpointBalancer::BackendStats> stats;
+      nvidia_speech::EndpointBalancer::getStats(stats);
+
+      cJSON* jBackends = cJSON_CreateArray();
+      for (const auto& s : stats) {
+        cJSON* jBackend = cJSON_CreateObject();
+        cJSON_AddStringToObject(jBackend, "target", s.target.c_str());
+        cJSON_AddBoolToObject(jBackend, "healthy", s.healthy);
+        cJSON_AddNumberToObject(jBackend, "active", s.active);
+        cJSON_AddNumberToObject(jBackend, "streams", (double) s.streams);
+        cJSON_AddNumberToObject(jBackend, "failures", (double) s.failures);
+        cJSON_AddNumberToObject(jBackend, "ejections", (double) s.ejections);
+        cJSON_AddNumberToObject(jBackend, "avg_first_response_ms", s.avgLatencyMs);
+        cJSON_AddItemToArray(jBackends, jBackend);
+      }
+      char* json = cJSON_PrintUnformatted(jBackends);
+      cJSON_Delete(jBackends);
+      return json;
+    }
+
     switch_status_t nvidia_speech_cleanup() {
+      nvidia_speech::GrpcEngine::deinitialize();
+      nvidia_speech::EndpointBalancer::deinitialize();
+      nvidia_speech::ChannelRegistry::deinitialize();
+
+      nvidia_speech::ConfigCache<nr_asr::RecognitionConfig>::Stats stats;
+      hintsCache.getStats(stats);
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "hints cache: %u entries, %llu hits, %llu misses, %llu evictions\n",
+        (unsigned int) stats.entries, (unsigned long long) stats.hits, (unsigned long long) stats.misses, (unsigned long long) stats.evictions);
+      hintsCache.clear();
       return SWITCH_STATUS_SUCCESS;
     }
     switch_status_t nvidia_speech_session_init(switch_core_session_t *session, responseHandler_t responseHandler, 
@@ -449,7 +519,7 @@ extern "C" {
       GStreamer *streamer = NULL;
       try {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "nvidia_speech_session_init:  allocating streamer\n");
-        streamer = new GStreamer(session, channels, lang, interim);
+        streamer = new GStreamer(session, cb, channels, lang, interim);
         cb->streamer = streamer;
       } catch (std::exception& e) {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "%s: Error initializing gstreamer: %s.\n", 
@@ -462,14 +532,6 @@ extern "C" {
         streamer->connect();
       }
 
-      // create the read thread
-      switch_threadattr_t *thd_attr = NULL;
-      switch_memory_pool_t *pool = switch_core_session_get_pool(session);
-
-      switch_threadattr_create(&thd_attr, pool);
-      switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
-      switch_thread_create(&cb->thread, thd_attr, grpc_read_thread, cb, pool);
-
       *ppUserData = cb;
       return SWITCH_STATUS_SUCCESS;
     }
@@ -495,10 +557,9 @@ extern "C" {
         if (streamer) {
           streamer->writesDone();
 
-          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "nvidia_speech_session_cleanup: GStreamer (%p) waiting for read thread to complete\n", (void*)streamer);
-          switch_status_t st;
-          switch_thread_join(&st, cb->thread);
-          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "nvidia_speech_session_cleanup:  GStreamer (%p) read thread completed\n", (void*)streamer);
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "nvidia_speech_session_cleanup: GStreamer (%p) waiting for stream to finish\n", (void*)streamer);
+          streamer->waitForFinish();
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "nvidia_speech_session_cleanup:  GStreamer (%p) stream finished\n", (void*)streamer);
 
           delete streamer;
           cb->streamer = NULL;
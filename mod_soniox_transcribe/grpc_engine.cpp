@@ -0,0 +1,55 @@
+#include "grpc_engine.hpp"
+
+#include <switch.h>
+#include <algorithm>
+
+using namespace soniox_speech;
+
+std::mutex GrpcEngine::mutex;
+std::vector<std::unique_ptr<grpc::CompletionQueue> > GrpcEngine::queues;
+std::vector<std::thread> GrpcEngine::threads;
+std::atomic<unsigned int> GrpcEngine::next(0);
+
+void GrpcEngine::initialize(unsigned int nThreads) {
+  std::lock_guard<std::mutex> lk(mutex);
+  nThreads = std::max(1U, nThreads);
+  for (unsigned int i = 0; i < nThreads; i++) {
+    queues.push_back(std::unique_ptr<grpc::CompletionQueue>(new grpc::CompletionQueue()));
+  }
+  for (unsigned int i = 0; i < nThreads; i++) {
+    threads.push_back(std::thread(&GrpcEngine::worker, queues[i].get()));
+  }
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "GrpcEngine::initialize %u completion queue threads\n", nThreads);
+}
+
+void GrpcEngine::deinitialize() {
+  // taken out under the lock so that no stream is handed a queue being shut down
+  std::vector<std::unique_ptr<grpc::CompletionQueue> > closing;
+  std::vector<std::thread> workers;
+  {
+    std::lock_guard<std::mutex> lk(mutex);
+    closing.swap(queues);
+    workers.swap(threads);
+  }
+  for (auto& cq : closing) cq->Shutdown();
+  for (auto& t : workers) {
+    if (t.joinable()) t.join();
+  }
+}
+
+grpc::CompletionQueue* GrpcEngine::nextQueue() {
+  std::lock_guard<std::mutex> lk(mutex);
+  if (queues.empty()) return nullptr;
+  return queues[next++ % queues.size()].get();
+}
+
+void GrpcEngine::worker(grpc::CompletionQueue* cq) {
+  void* tag;
+  bool ok;
+
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GrpcEngine::worker starting\n");
+  while (cq->Next(&tag, &ok)) {
+    static_cast<Tag*>(tag)->proceed(ok);
+  }
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GrpcEngine::worker ending\n");
+}
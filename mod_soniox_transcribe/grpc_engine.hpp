@@ -0,0 +1,291 @@
+#ifndef __SONIOX_GRPC_ENGINE_HPP__
+#define __SONIOX_GRPC_ENGINE_HPP__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <functional>
+
+#include <grpc++/grpc++.h>
+#include <google/protobuf/arena.h>
+
+/* a response arena is replaced once it holds this much memory */
+#define GRPC_RESPONSE_ARENA_MAX_BYTES (256 * 1024)
+/* number of written requests kept for reuse by acquire() */
+#define GRPC_MAX_RECYCLED_REQUESTS (16)
+
+namespace soniox_speech {
+
+/*
+ * A small fixed pool of threads, each servicing its own completion queue.
+ * Streams are spread over the queues round-robin, so all sessions share these
+ * threads rather than each blocking a thread of its own in a synchronous Read().
+ */
+class GrpcEngine {
+public:
+  struct Tag {
+    virtual ~Tag() {}
+    virtual void proceed(bool ok) = 0;
+  };
+
+  static void initialize(unsigned int nThreads);
+  static void deinitialize();
+
+  // returns nullptr once the engine has been deinitialized
+  static grpc::CompletionQueue* nextQueue();
+
+private:
+  static void worker(grpc::CompletionQueue* cq);
+
+  static std::mutex mutex;
+  static std::vector<std::unique_ptr<grpc::CompletionQueue> > queues;
+  static std::vector<std::thread> threads;
+  static std::atomic<unsigned int> next;
+};
+
+/*
+ * A bidirectional streaming call driven by the engine.  write() only queues the
+ * request and never blocks the caller; a single write is kept in flight and the
+ * next one is issued from the engine thread as each completes.  When more than
+ * maxQueued requests are waiting the oldest is dropped.  Responses and the final
+ * status are delivered on an engine thread.
+ *
+ * Requests that have been written are recycled: a caller that fills the request
+ * returned by acquire() and moves it into write() reuses the buffers of an earlier
+ * request rather than allocating for every frame.  Responses are parsed into a
+ * single message allocated on an arena, which is replaced once it grows too large.
+ */
+template <typename Request, typename Response>
+class AsyncStream {
+public:
+  typedef std::unique_ptr<grpc::ClientAsyncReaderWriter<Request, Response> > rpc_t;
+  typedef std::function<rpc_t(grpc::ClientContext*, grpc::CompletionQueue*)> prepare_t;
+  typedef std::function<void(Response&)> responseHandler_t;
+  typedef std::function<void(const grpc::Status&)> finishHandler_t;
+
+  AsyncStream(size_t maxQueued) : m_maxQueued(maxQueued), m_pending(0), m_dropped(0),
+    m_startIssued(false), m_started(false), m_writeInFlight(false), m_writeFailed(false),
+    m_writesDoneRequested(false), m_writesDoneSent(false), m_finishIssued(false), m_finished(false),
+    m_startTag(this, &AsyncStream::onStart), m_readTag(this, &AsyncStream::onRead),
+    m_writeTag(this, &AsyncStream::onWrite), m_finishTag(this, &AsyncStream::onFinish) {
+    resetArena();
+  }
+
+  grpc::ClientContext& context() { return m_context; }
+
+  // starts the call; the initial request is written ahead of anything queued by write().
+  // returns false, leaving the stream finished without a call, if the engine is not running
+  bool start(prepare_t prepare, const Request& initial, responseHandler_t onResponse, finishHandler_t onFinish) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    grpc::CompletionQueue* cq = GrpcEngine::nextQueue();
+    if (!cq) {
+      m_finishIssued = true;
+      m_finished = true;
+      return false;
+    }
+    m_onResponse = onResponse;
+    m_onFinish = onFinish;
+    m_queue.push_front(initial);
+    m_rpc = prepare(&m_context, cq);
+    m_startIssued = true;
+    m_pending++;
+    m_rpc->StartCall(&m_startTag);
+    return true;
+  }
+
+  // returns a previously written request, with its buffers still allocated, for the caller to fill
+  Request acquire() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (m_free.empty()) return Request();
+    Request request = std::move(m_free.back());
+    m_free.pop_back();
+    return request;
+  }
+
+  bool write(Request request) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (m_writesDoneRequested || m_writeFailed || m_finishIssued) return false;
+    if (m_queue.size() >= m_maxQueued) {
+      // keep the initial request if the call has not started yet
+      auto it = m_started || m_queue.size() < 2 ? m_queue.begin() : m_queue.begin() + 1;
+      recycle(*it);
+      m_queue.erase(it);
+      m_dropped++;
+    }
+    m_queue.push_back(std::move(request));
+    if (m_started && !m_writeInFlight) writeNext();
+    return true;
+  }
+
+  void writesDone() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (m_writesDoneRequested) return;
+    m_writesDoneRequested = true;
+    if (m_started && !m_writeInFlight) writeNext();
+  }
+
+  // waits for the final status; if it does not arrive within timeoutMs the call is cancelled
+  bool waitForFinish(unsigned int timeoutMs) {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    if (!m_startIssued) return true;
+    auto done = [this] { return m_finished && 0 == m_pending; };
+    if (m_cv.wait_for(lk, std::chrono::milliseconds(timeoutMs), done)) return true;
+    m_context.TryCancel();
+    m_cv.wait(lk, done);
+    return false;
+  }
+
+  bool isStarted() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_startIssued;
+  }
+
+  size_t getQueued() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_queue.size();
+  }
+
+  unsigned int getDropped() const { return m_dropped; }
+
+private:
+  struct OpTag : public GrpcEngine::Tag {
+    typedef void (AsyncStream::*fn_t)(bool);
+    OpTag(AsyncStream* stream, fn_t fn) : m_stream(stream), m_fn(fn) {}
+    void proceed(bool ok) { (m_stream->*m_fn)(ok); }
+    AsyncStream* m_stream;
+    fn_t m_fn;
+  };
+
+  // called with the mutex held
+  void recycle(Request& request) {
+    if (m_free.size() < GRPC_MAX_RECYCLED_REQUESTS) m_free.push_back(std::move(request));
+  }
+
+  // called when no read is outstanding
+  void resetArena() {
+    google::protobuf::ArenaOptions options;
+    options.start_block_size = 4096;
+    options.max_block_size = 65536;
+    m_arena.reset(new google::protobuf::Arena(options));
+    m_response = google::protobuf::Arena::CreateMessage<Response>(m_arena.get());
+  }
+
+  // called with the mutex held
+  void writeNext() {
+    if (m_writeFailed || m_finishIssued) return;
+    if (!m_queue.empty()) {
+      m_current = std::move(m_queue.front());
+      m_queue.pop_front();
+      m_writeInFlight = true;
+      m_pending++;
+      m_rpc->Write(m_current, &m_writeTag);
+    }
+    else if (m_writesDoneRequested && !m_writesDoneSent) {
+      m_writesDoneSent = true;
+      m_writeInFlight = true;
+      m_pending++;
+      m_rpc->WritesDone(&m_writeTag);
+    }
+  }
+
+  // called with the mutex held
+  void finishCall() {
+    if (m_finishIssued) return;
+    m_finishIssued = true;
+    m_queue.clear();
+    m_pending++;
+    m_rpc->Finish(&m_status, &m_finishTag);
+  }
+
+  // called with the mutex held, as the last thing done by a completion
+  void complete() {
+    if (0 == --m_pending && m_finished) m_cv.notify_all();
+  }
+
+  void onStart(bool ok) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (ok) {
+      m_started = true;
+      m_pending++;
+      m_rpc->Read(m_response, &m_readTag);
+      writeNext();
+    }
+    else finishCall();
+    complete();
+  }
+
+  void onRead(bool ok) {
+    if (ok && m_onResponse) m_onResponse(*m_response);
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (ok) {
+      if (m_arena->SpaceUsed() > GRPC_RESPONSE_ARENA_MAX_BYTES) resetArena();
+      m_pending++;
+      m_rpc->Read(m_response, &m_readTag);
+    }
+    else finishCall();
+    complete();
+  }
+
+  void onWrite(bool ok) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_writeInFlight = false;
+    if (!m_writesDoneSent) recycle(m_current);
+    if (ok) writeNext();
+    else {
+      // the stream is broken; the pending read will fail and collect the status
+      m_writeFailed = true;
+      m_queue.clear();
+    }
+    complete();
+  }
+
+  // a Finish always completes with ok set; the outcome of the call is in m_status
+  void onFinish(bool) {
+    if (m_onFinish) m_onFinish(m_status);
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_finished = true;
+    complete();
+  }
+
+  grpc::ClientContext m_context;
+  rpc_t m_rpc;
+  responseHandler_t m_onResponse;
+  finishHandler_t m_onFinish;
+
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<Request> m_queue;
+  std::vector<Request> m_free;
+  Request m_current;
+  std::unique_ptr<google::protobuf::Arena> m_arena;
+  Response* m_response;
+  grpc::Status m_status;
+  size_t m_maxQueued;
+  unsigned int m_pending;
+  std::atomic<unsigned int> m_dropped;
+
+  bool m_startIssued;
+  bool m_started;
+  bool m_writeInFlight;
+  bool m_writeFailed;
+  bool m_writesDoneRequested;
+  bool m_writesDoneSent;
+  bool m_finishIssued;
+  bool m_finished;
+
+  OpTag m_startTag;
+  OpTag m_readTag;
+  OpTag m_writeTag;
+  OpTag m_finishTag;
+};
+
+} // namespace soniox_speech
+#endif
@@ -12,10 +12,29 @@ namespace soniox_asr = soniox::speech_service;
 
 #include "mod_soniox_transcribe.h"
 #include "simple_buffer.h"
+#include "channel_registry.hpp"
+#include "grpc_engine.hpp"
+#include "config_cache.hpp"
 
 #define CHUNKSIZE (320)
 
 namespace {
+  static const char *requestedGrpcSubchannels = std::getenv("MOD_TRANSCRIBE_GRPC_SUBCHANNELS");
+  static unsigned int nGrpcSubchannels = std::max(1, requestedGrpcSubchannels ? ::atoi(requestedGrpcSubchannels) : 2);
+  static const char *requestedGrpcMaxStreams = std::getenv("MOD_TRANSCRIBE_GRPC_MAX_STREAMS_PER_CHANNEL");
+  static unsigned int nGrpcMaxStreamsPerChannel = std::max(1, requestedGrpcMaxStreams ? ::atoi(requestedGrpcMaxStreams) : 100);
+  static const char *requestedGrpcKeepaliveMs = std::getenv("MOD_TRANSCRIBE_GRPC_KEEPALIVE_MS");
+  static unsigned int nGrpcKeepaliveMs = std::max(0, requestedGrpcKeepaliveMs ? ::atoi(requestedGrpcKeepaliveMs) : 30000);
+  static const char *requestedGrpcThreads = std::getenv("MOD_TRANSCRIBE_GRPC_THREADS");
+  static unsigned int nGrpcThreads = std::max(1, requestedGrpcThreads ? ::atoi(requestedGrpcThreads) : 2);
+  static const char *requestedGrpcMaxQueuedFrames = std::getenv("MOD_TRANSCRIBE_GRPC_MAX_QUEUED_FRAMES");
+  static unsigned int nGrpcMaxQueuedFrames = std::max(1, requestedGrpcMaxQueuedFrames ? ::atoi(requestedGrpcMaxQueuedFrames) : 250);
+  static const char *requestedTeardownTimeoutMs = std::getenv("MOD_TRANSCRIBE_TEARDOWN_TIMEOUT_MS");
+  static unsigned int nTeardownTimeoutMs = std::max(100, requestedTeardownTimeoutMs ? ::atoi(requestedTeardownTimeoutMs) : 5000);
+  static const char *requestedConfigCacheSize = std::getenv("MOD_TRANSCRIBE_CONFIG_CACHE_SIZE");
+  static unsigned int nConfigCacheSize = std::max(0, requestedConfigCacheSize ? ::atoi(requestedConfigCacheSize) : 100);
+  static soniox_speech::ConfigCache<soniox_asr::TranscriptionConfig> hintsCache(nConfigCacheSize);
+
   int case_insensitive_match(std::string s1, std::string s2) {
    std::transform(s1.begin(), s1.end(), s1.begin(), ::tolower);
    std::transform(s2.begin(), s2.end(), s2.begin(), ::tolower);
@@ -25,16 +44,20 @@ namespace {
   }
 }
 
+static void grpc_on_response(struct cap_cb *cb, soniox_asr::TranscribeStreamResponse& response);
+static void grpc_on_finish(struct cap_cb *cb, const grpc::Status& status);
+
 class GStreamer {
 public:
 	GStreamer(
-    switch_core_session_t *session, uint32_t channels, char* lang, int interim) : 
+    switch_core_session_t *session, struct cap_cb *cb, uint32_t channels, char* lang, int interim) : 
       m_session(session), 
-      m_writesDone(false), 
+      m_cb(cb),
       m_connected(false), 
       m_language(lang),
       m_interim(interim),
-      m_audioBuffer(CHUNKSIZE, 15) {
+      m_audioBuffer(CHUNKSIZE, 15),
+      m_stream(nGrpcMaxQueuedFrames) {
   
     const char* var;
     char sessionId[256];
@@ -50,8 +73,9 @@ public:
     switch_channel_t *channel = switch_core_session_get_channel(m_session);
 
     std::shared_ptr<grpc::Channel> grpcChannel ;
-    auto channelCreds = grpc::SslCredentials(grpc::SslCredentialsOptions());
-    grpcChannel = grpc::CreateChannel("api.soniox.com:443", channelCreds);
+    grpcChannel = soniox_speech::ChannelRegistry::getChannel("api.soniox.com:443", "ssl", [] {
+      return grpc::SslCredentials(grpc::SslCredentialsOptions());
+    });
 
     if (!grpcChannel) {
       switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "GStreamer %p failed creating grpc channel\n", this);	
@@ -93,49 +117,54 @@ public:
     /* hints */
     const char* hints = switch_channel_get_variable(channel, "SONIOX_HINTS");
     if (hints) {
-      float boost = -1;
-      auto* speech_context = config->mutable_speech_context();
-
-      // hints are either a simple comma-separated list of phrases, or a json array of objects
-      // containing a phrase and a boost value
-      auto *jHint = cJSON_Parse((char *) hints);
-      if (jHint) {
-        int i = 0;
-        cJSON *jPhrase = NULL;
-        cJSON_ArrayForEach(jPhrase, jHint) {
-          cJSON *jItem = cJSON_GetObjectItem(jPhrase, "phrase");
-          if (jItem) {
-            auto* speech_context_entry = speech_context->add_entries();
-            auto *phrase = cJSON_GetStringValue(jItem);
-            speech_context_entry->add_phrases(phrase);
-            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "hint: %s\n", phrase);
-            if (cJSON_GetObjectItem(jPhrase, "boost")) {
-              float boost = (float) cJSON_GetObjectItem(jPhrase, "boost")->valuedouble;
-              speech_context_entry->set_boost(boost);
-              switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "boost value: %f\n", boost);
+      const char* boost_str = switch_channel_get_variable(channel, "SONIOX_HINTS_BOOST");
+      std::string content = std::string(hints) + "|" + (boost_str ? boost_str : "");
+      bool hit = hintsCache.merge(content, config, [&](soniox_asr::TranscriptionConfig* config) {
+        float boost = -1;
+        auto* speech_context = config->mutable_speech_context();
+
+        // hints are either a simple comma-separated list of phrases, or a json array of objects
+        // containing a phrase and a boost value
+        auto *jHint = cJSON_Parse((char *) hints);
+        if (jHint) {
+          int i = 0;
+          cJSON *jPhrase = NULL;
+          cJSON_ArrayForEach(jPhrase, jHint) {
+            cJSON *jItem = cJSON_GetObjectItem(jPhrase, "phrase");
+            if (jItem) {
+              auto* speech_context_entry = speech_context->add_entries();
+              auto *phrase = cJSON_GetStringValue(jItem);
+              speech_context_entry->add_phrases(phrase);
+              switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "hint: %s\n", phrase);
+              if (cJSON_GetObjectItem(jPhrase, "boost")) {
+                float boost = (float) cJSON_GetObjectItem(jPhrase, "boost")->valuedouble;
+                speech_context_entry->set_boost(boost);
+                switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "boost value: %f\n", boost);
+              }
+              i++;
             }
-            i++;
           }
+          cJSON_Delete(jHint);
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "added %d hints\n", i);
         }
-        cJSON_Delete(jHint);
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "added %d hints\n", i);
-      }
-      else {
-        // single set of hints 
-        char *phrases[500] = { 0 };
-        int argc = switch_separate_string((char *) hints, ',', phrases, 500);
-        auto* speech_context_entry = speech_context->add_entries();
-        for (int i = 0; i < argc; i++) {
-          speech_context_entry->add_phrases(phrases[i]);
-        }
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "added %d hints\n", argc);
-        const char* boost_str = switch_channel_get_variable(channel, "SONIOX_HINTS_BOOST");
-        if (boost_str) {
-          float boost = (float) atof(boost_str);
-          speech_context_entry->set_boost(boost);
-          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "boost value: %f\n", boost);
+        else {
+          // single set of hints 
+          char *phrases[500] = { 0 };
+          int argc = switch_separate_string((char *) hints, ',', phrases, 500);
+          auto* speech_context_entry = speech_context->add_entries();
+          for (int i = 0; i < argc; i++) {
+            speech_context_entry->add_phrases(phrases[i]);
+          }
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "added %d hints\n", argc);
+          const char* boost_str = switch_channel_get_variable(channel, "SONIOX_HINTS_BOOST");
+          if (boost_str) {
+            float boost = (float) atof(boost_str);
+            speech_context_entry->set_boost(boost);
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "boost value: %f\n", boost);
+          }
         }
-      }
+      });
+      switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(m_session), SWITCH_LOG_DEBUG, "hints %s\n", hit ? "found in cache" : "built");
     }
 
     var = switch_channel_get_variable(channel, "SONIOX_STORAGE_ID");
@@ -190,15 +219,18 @@ public:
 
     createInitMessage();
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p creating streamer\n", this);	
-  	m_streamer = m_stub->TranscribeStream(&m_context);
+    struct cap_cb *cb = m_cb;
+    bool started = m_stream.start([this](grpc::ClientContext* context, grpc::CompletionQueue* cq) {
+        return m_stub->PrepareAsyncTranscribeStream(context, cq);
+      },
+      m_request,  // the first request contains the config only
+      [cb](soniox_asr::TranscribeStreamResponse& response) { grpc_on_response(cb, response); },
+      [cb](const grpc::Status& status) { grpc_on_finish(cb, status); });
+    if (!started) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "GStreamer %p could not start a stream, the grpc engine is not running\n", this);
+      return;
+    }
     m_connected = true;
-
-    // read thread is waiting on this
-    m_promise.set_value();
-
-  	// Write the first request, containing the config only.
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "GStreamer %p sending initial message\n", this);	
-  	m_streamer->Write(m_request);
     m_request.clear_config();
 
     // send any buffered audio
@@ -222,149 +254,124 @@ public:
       }
       return true;
     }
-    m_request.clear_audio();
-    m_request.set_audio(data, datalen);
-    bool ok = m_streamer->Write(m_request);
-    return ok;
+    auto request = m_stream.acquire();
+    request.set_audio(data, datalen);
+    return m_stream.write(std::move(request));
   }
 
-	uint32_t nextMessageSize(void) {
-		uint32_t size = 0;
-		m_streamer->NextMessageSize(&size);
-		return size;
-	}
-
-	bool read(soniox_asr::TranscribeStreamResponse* response) {
-		return m_streamer->Read(response);
-	}
-
-	grpc::Status finish() {
-		return m_streamer->Finish();
-	}
-
 	void writesDone() {
-    // grpc crashes if we call this twice on a stream
-    if (!m_connected) {
-      cancelConnect();
-    }
-    else if (!m_writesDone) {
-      m_streamer->WritesDone();
-      m_writesDone = true;
-    }
+    m_stream.writesDone();
 	}
 
-  bool waitForConnect() {
-    std::shared_future<void> sf(m_promise.get_future());
-    sf.wait();
-    return m_connected;
+  bool waitForFinish() {
+    bool ok = m_stream.waitForFinish(nTeardownTimeoutMs);
+    if (m_stream.getDropped() > 0) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "GStreamer %p dropped %u audio frames the network could not keep up with\n",
+        this, m_stream.getDropped());
+    }
+    return ok;
   }
 
-  void cancelConnect() {
-    assert(!m_connected);
-    m_promise.set_value();
-  } 
-
   bool isConnected() {
     return m_connected;
   }
 
 private:
 	switch_core_session_t* m_session;
-  grpc::ClientContext m_context;
+  struct cap_cb *m_cb;
 	std::shared_ptr<grpc::Channel> m_channel;
 	std::unique_ptr<soniox_asr::SpeechService::Stub> m_stub;
   soniox_asr::TranscribeStreamRequest m_request;
-	std::unique_ptr< grpc::ClientReaderWriterInterface<soniox_asr::TranscribeStreamRequest, soniox_asr::TranscribeStreamResponse> > m_streamer;
-  bool m_writesDone;
   bool m_connected;
   bool m_interim;
   std::string m_language;
-  std::promise<void> m_promise;
   SimpleBuffer m_audioBuffer;
+  soniox_speech::AsyncStream<soniox_asr::TranscribeStreamRequest, soniox_asr::TranscribeStreamResponse> m_stream;
   char m_sessionId[256];
 };
 
-static void *SWITCH_THREAD_FUNC grpc_read_thread(switch_thread_t *thread, void *obj) {
-  static int count;
-	struct cap_cb *cb = (struct cap_cb *) obj;
-	GStreamer* streamer = (GStreamer *) cb->streamer;
-
-  bool connected = streamer->waitForConnect();
-  if (!connected) {
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "soniox transcribe grpc read thread exiting since we didnt connect\n") ;
-    return nullptr;
+static void grpc_on_response(struct cap_cb *cb, soniox_asr::TranscribeStreamResponse& response) {
+  static std::atomic<int> count;
+  if (!response.has_result()) return;
+  count++;
+  switch_core_session_t* session = switch_core_session_locate(cb->sessionId);
+  if (!session) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "grpc_on_response: session %s is gone!\n", cb->sessionId) ;
+    return;
   }
 
-  // Read responses.
-  soniox_asr::TranscribeStreamResponse response;
-  while (streamer->read(&response)) {  // Returns false when no more to read.
-    if (!response.has_result()) continue;
-    count++;
-    switch_core_session_t* session = switch_core_session_locate(cb->sessionId);
-    if (!session) {
-      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "grpc_read_thread: session %s is gone!\n", cb->sessionId) ;
-      return nullptr;
-    }
+  const auto& result = response.result();
+  int nWords = result.words_size();
+  if (0 == nWords) {
+    switch_core_session_rwunlock(session);
+    return;
+  }
 
-    const auto& result = response.result();
-    int nWords = result.words_size();
-    if (0 == nWords) {
-      switch_core_session_rwunlock(session);
-      continue;
-    }
+  auto final_proc_time_ms = result.final_proc_time_ms();
+  auto total_proc_time_ms = result.total_proc_time_ms();
+  auto channel = result.channel();
+
+  cJSON * jResult = cJSON_CreateObject();
+  cJSON * jWords = cJSON_CreateArray();
+  cJSON * jFinalProcTime = cJSON_CreateNumber(final_proc_time_ms);
+  cJSON * jTotalProcTime = cJSON_CreateNumber(total_proc_time_ms);
+  cJSON * jChannel = cJSON_CreateNumber(channel);
+  cJSON_AddItemToObject(jResult, "words", jWords);
+  cJSON_AddItemToObject(jResult, "channel", jChannel);
+  cJSON_AddItemToObject(jResult, "final_proc_time", jFinalProcTime);
+  cJSON_AddItemToObject(jResult, "total_proc_time", jTotalProcTime);
+
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "%d: received response with %d words\n", count.load(), nWords) ;
+
+  for (int i = 0; i < nWords; ++i) {
+    auto& word = result.words(i);
+    auto& text = word.text();
+    auto& orig_text = word.orig_text();
+    auto start_ms = word.start_ms();
+    auto duration_ms = word.duration_ms();
+    auto is_final = word.is_final();
+    auto confidence = word.confidence();
+
+    cJSON * jWord = cJSON_CreateObject();
+    cJSON_AddStringToObject(jWord, "text", text.c_str());
+    cJSON_AddStringToObject(jWord, "orig_text", text.c_str());
+    cJSON_AddNumberToObject(jWord, "start_ms", start_ms);
+    cJSON_AddNumberToObject(jWord, "duration_ms", duration_ms);
+    cJSON_AddBoolToObject(jWord, "is_final", is_final);
+    cJSON_AddNumberToObject(jWord, "confidence", confidence);
+
+    cJSON_AddItemToArray(jWords, jWord);
+  }
+  char* json = cJSON_PrintUnformatted(jResult);
+  cb->responseHandler(session, (const char *) json, cb->bugname, NULL);
+  free(json);
 
-    auto final_proc_time_ms = result.final_proc_time_ms();
-    auto total_proc_time_ms = result.total_proc_time_ms();
-    auto channel = result.channel();
-
-    cJSON * jResult = cJSON_CreateObject();
-    cJSON * jWords = cJSON_CreateArray();
-    cJSON * jFinalProcTime = cJSON_CreateNumber(final_proc_time_ms);
-    cJSON * jTotalProcTime = cJSON_CreateNumber(total_proc_time_ms);
-    cJSON * jChannel = cJSON_CreateNumber(channel);
-    cJSON_AddItemToObject(jResult, "words", jWords);
-    cJSON_AddItemToObject(jResult, "channel", jChannel);
-    cJSON_AddItemToObject(jResult, "final_proc_time", jFinalProcTime);
-    cJSON_AddItemToObject(jResult, "total_proc_time", jTotalProcTime);
-
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "%d: received response with %d words\n", count, nWords) ;
-
-    for (int i = 0; i < nWords; ++i) {
-      auto& word = result.words(i);
-      auto& text = word.text();
-      auto& orig_text = word.orig_text();
-      auto start_ms = word.start_ms();
-      auto duration_ms = word.duration_ms();
-      auto is_final = word.is_final();
-      auto confidence = word.confidence();
-
-      cJSON * jWord = cJSON_CreateObject();
-      cJSON_AddStringToObject(jWord, "text", text.c_str());
-      cJSON_AddStringToObject(jWord, "orig_text", text.c_str());
-      cJSON_AddNumberToObject(jWord, "start_ms", start_ms);
-      cJSON_AddNumberToObject(jWord, "duration_ms", duration_ms);
-      cJSON_AddBoolToObject(jWord, "is_final", is_final);
-      cJSON_AddNumberToObject(jWord, "confidence", confidence);
-
-      cJSON_AddItemToArray(jWords, jWord);
-    }
-    char* json = cJSON_PrintUnformatted(jResult);
-    cb->responseHandler(session, (const char *) json, cb->bugname, NULL);
-    free(json);
+  cJSON_Delete(jResult);
 
-    cJSON_Delete(jResult);
+  switch_core_session_rwunlock(session);
+}
 
-    switch_core_session_rwunlock(session);
-  }
-  return nullptr;
+static void grpc_on_finish(struct cap_cb *cb, const grpc::Status& status) {
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "grpc_on_finish: %s status %s (%d)\n", cb->sessionId,
+    status.error_message().c_str(), status.error_code()) ;
 }
 extern "C" {
 
     switch_status_t soniox_speech_init() {
+      soniox_speech::ChannelRegistry::initialize(nGrpcSubchannels, nGrpcMaxStreamsPerChannel, nGrpcKeepaliveMs);
+      soniox_speech::GrpcEngine::initialize(nGrpcThreads);
       return SWITCH_STATUS_SUCCESS;
     }
 
     switch_status_t soniox_speech_cleanup() {
+      soniox_speech::GrpcEngine::deinitialize();
+      soniox_speech::ChannelRegistry::deinitialize();
+
+      soniox_speech::ConfigCache<soniox_asr::TranscriptionConfig>::Stats stats;
+      hintsCache.getStats(stats);
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "hints cache: %u entries, %llu hits, %llu misses, %llu evictions\n",
+        (unsigned int) stats.entries, (unsigned long long) stats.hits, (unsigned long long) stats.misses, (unsigned long long) stats.evictions);
+      hintsCache.clear();
       return SWITCH_STATUS_SUCCESS;
     }
     switch_status_t soniox_speech_session_init(switch_core_session_t *session, responseHandler_t responseHandler, 
@@ -428,7 +435,7 @@ extern "C" {
       GStreamer *streamer = NULL;
       try {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "soniox_speech_session_init:  allocating streamer\n");
-        streamer = new GStreamer(session, channels, lang, interim);
+        streamer = new GStreamer(session, cb, channels, lang, interim);
         cb->streamer = streamer;
       } catch (std::exception& e) {
         switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "%s: Error initializing gstreamer: %s.\n", 
@@ -441,14 +448,6 @@ extern "C" {
         streamer->connect();
       }
 
-      // create the read thread
-      switch_threadattr_t *thd_attr = NULL;
-      switch_memory_pool_t *pool = switch_core_session_get_pool(session);
-
-      switch_threadattr_create(&thd_attr, pool);
-      switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
-      switch_thread_create(&cb->thread, thd_attr, grpc_read_thread, cb, pool);
-
       *ppUserData = cb;
       return SWITCH_STATUS_SUCCESS;
     }
@@ -474,10 +473,9 @@ extern "C" {
         if (streamer) {
           streamer->writesDone();
 
-          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "soniox_speech_session_cleanup: GStreamer (%p) waiting for read thread to complete\n", (void*)streamer);
-          switch_status_t st;
-          switch_thread_join(&st, cb->thread);
-          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "soniox_speech_session_cleanup:  GStreamer (%p) read thread completed\n", (void*)streamer);
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "soniox_speech_session_cleanup: GStreamer (%p) waiting for stream to finish\n", (void*)streamer);
+          streamer->waitForFinish();
+          switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "soniox_speech_session_cleanup:  GStreamer (%p) stream finished\n", (void*)streamer);
 
           delete streamer;
           cb->streamer = NULL;